@@ -0,0 +1,214 @@
+#include "avo_archive.h"
+#include <iostream>
+#include <algorithm>
+
+// Контрольные точки не ставятся чаще, чем раз в столько кадров
+static const uint32_t MIN_CHECKPOINT_SPACING = 16;
+
+static size_t stateMemory(const std::vector<uint8_t>& frame, const AVOStreamContext& context) {
+    return frame.capacity() + context.background.capacity() +
+           context.stableCount.capacity() + context.lastFrame.capacity();
+}
+
+AVOArchive::AVOArchive(size_t memoryBudget, size_t cachedFrames)
+    : memoryBudget(memoryBudget), cachedFrames(cachedFrames), checkpointSpacing(0),
+      maxCheckpoints(0), cursorValid(false) {
+}
+
+bool AVOArchive::open(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    keyFrames.clear();
+    checkpoints.clear();
+    cache.clear();
+    cacheIndex.clear();
+    cursorValid = false;
+
+    // Данные кадров не копируются: декодер читает их из отображения файла
+    if (!archive.open(filename)) {
+        return false;
+    }
+
+    const std::vector<AVORecordInfo>& records = archive.getRecords();
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].frameType != AVO_FRAME_DIFF) {
+            keyFrames.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    planCheckpoints();
+    return true;
+}
+
+uint32_t AVOArchive::getDelayMs(uint32_t index) const {
+    return index < archive.getFrameCount() ? archive.getRecords()[index].delayMs : 0;
+}
+
+// Шаг контрольных точек выбирается так, чтобы вместе с кэшем уложиться в
+// memoryBudget; ключевые кадры служат точками бесплатно. Сами точки
+// появляются при декодировании (addCheckpoint)
+void AVOArchive::planCheckpoints() {
+    checkpointSpacing = 0;
+    maxCheckpoints = 0;
+
+    const AVOHeader& header = archive.getHeader();
+    const std::vector<AVORecordInfo>& records = archive.getRecords();
+    uint32_t flags = archive.getFlags();
+    AVOPixelFormat format = AVOCodec::getPixelFormat(flags);
+    size_t frameSize = AVOCodec::getFrameSize(header.width, header.height, format);
+    size_t rgbSize = static_cast<size_t>(header.width) * header.height * 3;
+
+    // Кадр плюс модель фона (фон, счетчики, последний кадр)
+    size_t stateSize = frameSize * ((flags & AVO_FLAG_BACKGROUND) ? 4 : 1);
+    size_t reserved = cachedFrames * rgbSize + 2 * stateSize;   // кэш, курсор, рабочий кадр
+    if (stateSize == 0 || records.empty() || memoryBudget <= reserved) {
+        return;
+    }
+
+    size_t count = (memoryBudget - reserved) / stateSize;
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t spacing = static_cast<uint32_t>(
+        std::max<size_t>(MIN_CHECKPOINT_SPACING, (records.size() + count - 1) / count));
+
+    // Нужны ли точки вообще: все группы кадров короче шага
+    bool needed = false;
+    for (size_t k = 0; k < keyFrames.size() && !needed; k++) {
+        size_t end = k + 1 < keyFrames.size() ? keyFrames[k + 1] : records.size();
+        needed = end - keyFrames[k] > spacing;
+    }
+    if (needed) {
+        checkpointSpacing = spacing;
+        maxCheckpoints = count;
+    }
+}
+
+// Точки стоят через checkpointSpacing кадров от ключевого кадра группы, поэтому
+// их не больше, чем кадров / шаг, в каком бы порядке ни шло декодирование
+void AVOArchive::addCheckpoint(const DecoderState& state) {
+    if (checkpointSpacing == 0 || checkpoints.size() >= maxCheckpoints) {
+        return;
+    }
+
+    auto key = std::upper_bound(keyFrames.begin(), keyFrames.end(), state.index);
+    if (key == keyFrames.begin()) {
+        return;
+    }
+    uint32_t distance = state.index - *(key - 1);
+    if (distance == 0 || distance % checkpointSpacing != 0) {
+        return;
+    }
+    checkpoints.emplace(state.index, state);
+}
+
+// Ближайшая к index точка старта: ключевой кадр, контрольная точка или курсор
+bool AVOArchive::startFrom(uint32_t index, DecoderState& state) {
+    auto key = std::upper_bound(keyFrames.begin(), keyFrames.end(), index);
+    if (key == keyFrames.begin()) {
+        return false;
+    }
+    uint32_t keyIndex = *(key - 1);
+
+    auto checkpoint = checkpoints.upper_bound(index);
+    bool useCheckpoint = checkpoint != checkpoints.begin() &&
+                         std::prev(checkpoint)->first > keyIndex;
+    uint32_t bestIndex = useCheckpoint ? std::prev(checkpoint)->first : keyIndex;
+
+    // Курсор забирается целиком (кадр и модель фона не копируются); getFrame
+    // вернет в него новое состояние
+    if (cursorValid && cursor.index <= index && cursor.index >= bestIndex) {
+        state = std::move(cursor);
+        cursorValid = false;
+        return true;
+    }
+
+    if (useCheckpoint) {
+        state = std::prev(checkpoint)->second;
+        return true;
+    }
+
+    state.index = keyIndex;
+    state.context = AVOStreamContext();
+    return archive.decodeRecord(keyIndex, std::vector<uint8_t>(), &state.context, state.frame);
+}
+
+bool AVOArchive::decodeNext(DecoderState& state) {
+    uint32_t next = state.index + 1;
+
+    std::vector<uint8_t> frame;
+    if (!archive.decodeRecord(next, state.frame, &state.context, frame)) {
+        std::cerr << "Cannot decode frame " << next << std::endl;
+        return false;
+    }
+
+    state.frame.swap(frame);
+    state.index = next;
+    return true;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> AVOArchive::getFrame(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (index >= archive.getFrameCount()) {
+        return nullptr;
+    }
+
+    auto cached = cacheIndex.find(index);
+    if (cached != cacheIndex.end()) {
+        cache.splice(cache.begin(), cache, cached->second);
+        return cached->second->second;
+    }
+
+    DecoderState state;
+    if (!startFrom(index, state)) {
+        std::cerr << "Cannot decode frame " << index << std::endl;
+        return nullptr;
+    }
+    while (state.index < index) {
+        if (!decodeNext(state)) {
+            return nullptr;
+        }
+        addCheckpoint(state);
+    }
+
+    const AVOHeader& header = archive.getHeader();
+    auto rgb = std::make_shared<std::vector<uint8_t>>();
+    if (AVOCodec::getPixelFormat(archive.getFlags()) == AVO_PIXEL_YUV420) {
+        AVOCodec::yuv420ToRGB(state.frame, header.width, header.height, *rgb);
+    } else {
+        *rgb = state.frame;
+    }
+
+    // Последнее состояние - продолжение для следующего кадра при воспроизведении
+    cursor = std::move(state);
+    cursorValid = true;
+
+    if (cachedFrames > 0) {
+        cache.emplace_front(index, rgb);
+        cacheIndex[index] = cache.begin();
+        while (cache.size() > cachedFrames) {
+            cacheIndex.erase(cache.back().first);
+            cache.pop_back();
+        }
+    }
+
+    return rgb;
+}
+
+size_t AVOArchive::getMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t total = 0;
+    for (const auto& checkpoint : checkpoints) {
+        total += stateMemory(checkpoint.second.frame, checkpoint.second.context);
+    }
+    if (cursorValid) {
+        total += stateMemory(cursor.frame, cursor.context);
+    }
+    for (const CacheEntry& entry : cache) {
+        total += entry.second->capacity();
+    }
+    return total;
+}
@@ -0,0 +1,77 @@
+#ifndef AVO_ARCHIVE_H
+#define AVO_ARCHIVE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "avo_codec.h"
+#include "avo_mapped.h"
+
+// Архив .avo без распаковки всех кадров: сжатые данные записей читаются
+// из отображения файла (AVOMappedArchive), в памяти - редкие контрольные
+// точки (восстановленный кадр и модель фона) и LRU-кэш последних
+// запрошенных кадров. Любой кадр восстанавливается
+// декодированием от ближайшего ключевого кадра, контрольной точки или
+// последнего декодированного кадра (последовательное воспроизведение).
+// open() ничего не декодирует: контрольные точки ставятся по пути, когда
+// getFrame проходит через их место, так что первый кадр доступен сразу, а
+// повторные переходы в уже пройденную часть архива дешевы
+class AVOArchive {
+public:
+    // memoryBudget - память на контрольные точки и кэш (без сжатых данных),
+    // cachedFrames - сколько кадров RGB держать в кэше
+    explicit AVOArchive(size_t memoryBudget = 64 * 1024 * 1024, size_t cachedFrames = 8);
+
+    bool open(const std::string& filename);
+
+    uint32_t getFrameCount() const { return archive.getFrameCount(); }
+    const AVOHeader& getHeader() const { return archive.getHeader(); }
+    uint32_t getFlags() const { return archive.getFlags(); }
+    uint32_t getDelayMs(uint32_t index) const;
+
+    // Кадр в RGB; nullptr при ошибке. Потокобезопасно
+    std::shared_ptr<const std::vector<uint8_t>> getFrame(uint32_t index);
+
+    // Занятая память: контрольные точки и кэш (отображение файла
+    // принадлежит страничному кэшу ОС и не учитывается)
+    size_t getMemoryUsage() const;
+
+private:
+    // Состояние декодера после кадра index (кадр в формате хранения)
+    struct DecoderState {
+        uint32_t index;
+        std::vector<uint8_t> frame;
+        AVOStreamContext context;
+    };
+
+    bool startFrom(uint32_t index, DecoderState& state);
+    bool decodeNext(DecoderState& state);
+    void planCheckpoints();
+    void addCheckpoint(const DecoderState& state);
+
+    size_t memoryBudget;
+    size_t cachedFrames;
+    uint32_t checkpointSpacing;     // 0 - контрольные точки не нужны
+    size_t maxCheckpoints;
+
+    AVOMappedArchive archive;
+    std::vector<uint32_t> keyFrames;                 // номера ключевых кадров по возрастанию
+    std::map<uint32_t, DecoderState> checkpoints;
+    DecoderState cursor;
+    bool cursorValid;
+
+    // LRU: в начале списка - последний запрошенный кадр
+    typedef std::pair<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> CacheEntry;
+    std::list<CacheEntry> cache;
+    std::unordered_map<uint32_t, std::list<CacheEntry>::iterator> cacheIndex;
+
+    mutable std::mutex mutex;
+};
+
+#endif // AVO_ARCHIVE_H
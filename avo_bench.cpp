@@ -0,0 +1,444 @@
+// Микробенчмарк кодека на наборах из репозитория (1test, 2test):
+// первый кадр - X.avo, изменения - X_frames/frame_N.avop.
+// Для каждого этапа и разрешения выводит МБ/с (по исходным кадрам RGB),
+// кадры/с, байт на кадр (результат этапа) и выделений памяти на кадр;
+// результаты дублируются в JSON для сравнения между версиями.
+//
+// Использование: avo_bench [--data DIR] [--repeat N] [--scales 0.5,1,2] [--json FILE]
+
+#include "avo_codec.h"
+#include "avo_mapped.h"
+#include "avo_instrument.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <dirent.h>
+
+// ================= ПОДСЧЕТ ВЫДЕЛЕНИЙ ПАМЯТИ =================
+
+static std::atomic<uint64_t> allocationCount{0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+// ================= НАБОРЫ КАДРОВ =================
+
+struct Sequence {
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    std::vector<std::vector<uint8_t>> frames;     // RGB24
+};
+
+static bool readFile(const std::string& filename, std::vector<uint8_t>& data) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(data.data()), data.size()));
+}
+
+// Номера кадров frame_N.avop в каталоге по возрастанию
+static std::vector<uint32_t> listFrames(const std::string& directory) {
+    std::vector<uint32_t> numbers;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        return numbers;
+    }
+    while (dirent* entry = readdir(dir)) {
+        unsigned number;
+        char tail[8] = {0};
+        if (sscanf(entry->d_name, "frame_%u.%7s", &number, tail) == 2 && strcmp(tail, "avop") == 0) {
+            numbers.push_back(number);
+        }
+    }
+    closedir(dir);
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+// Записи .avop бывают двух видов: текущие (задержка и размер в сетевом
+// порядке) и ранние, как в 1test_frames (см. AVOCodec::isLegacyFrameDiffRecord)
+static std::vector<uint8_t> normalizeRecord(const std::vector<uint8_t>& record) {
+    std::vector<uint8_t> converted;
+    if (!AVOCodec::upgradeLegacyFrameDiffRecord(record.data(), record.size(), 33, converted)) {
+        return record;
+    }
+    return converted;
+}
+
+static bool loadSequence(const std::string& dataDir, const std::string& name, Sequence& sequence) {
+    AVOHeader header;
+    std::vector<uint8_t> frame;
+    if (!AVOCodec::decodeFirstFrame(dataDir + "/" + name + ".avo", frame, header)) {
+        return false;
+    }
+
+    sequence.name = name;
+    sequence.width = header.width;
+    sequence.height = header.height;
+    sequence.frames.clear();
+    sequence.frames.push_back(frame);
+
+    std::string directory = dataDir + "/" + name + "_frames";
+    std::vector<uint8_t> record;
+    for (uint32_t number : listFrames(directory)) {
+        if (!readFile(directory + "/frame_" + std::to_string(number) + ".avop", record)) {
+            std::cerr << "Cannot read frame " << number << " of " << name << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> next;
+        uint32_t delayMs;
+        std::vector<uint8_t> normalized = normalizeRecord(record);
+        if (!AVOCodec::decodeFrameDiffRecord(normalized.data(), normalized.size(),
+                                             sequence.frames.back(), next,
+                                             header.width, header.height, delayMs)) {
+            std::cerr << "Cannot decode frame " << number << " of " << name << std::endl;
+            return false;
+        }
+        sequence.frames.push_back(std::move(next));
+    }
+    return sequence.frames.size() > 1;
+}
+
+// Ближайший сосед: тот же материал в другом разрешении
+static Sequence scaleSequence(const Sequence& source, double scale) {
+    Sequence scaled;
+    scaled.name = source.name;
+    scaled.width = std::max<uint32_t>(16, static_cast<uint32_t>(source.width * scale)) & ~1u;
+    scaled.height = std::max<uint32_t>(16, static_cast<uint32_t>(source.height * scale)) & ~1u;
+
+    for (const std::vector<uint8_t>& frame : source.frames) {
+        std::vector<uint8_t> out(static_cast<size_t>(scaled.width) * scaled.height * 3);
+        for (uint32_t y = 0; y < scaled.height; y++) {
+            uint32_t sy = static_cast<uint32_t>(static_cast<uint64_t>(y) * source.height / scaled.height);
+            for (uint32_t x = 0; x < scaled.width; x++) {
+                uint32_t sx = static_cast<uint32_t>(static_cast<uint64_t>(x) * source.width / scaled.width);
+                memcpy(&out[(static_cast<size_t>(y) * scaled.width + x) * 3],
+                       &frame[(static_cast<size_t>(sy) * source.width + sx) * 3], 3);
+            }
+        }
+        scaled.frames.push_back(std::move(out));
+    }
+    return scaled;
+}
+
+// ================= ИЗМЕРЕНИЕ =================
+
+struct StageResult {
+    std::string corpus;
+    std::string stage;
+    uint32_t width;
+    uint32_t height;
+    size_t frames;
+    double seconds;          // лучший из повторов
+    uint64_t outputBytes;    // результат этапа за проход
+    uint64_t allocations;    // за проход
+};
+
+// body(i) обрабатывает кадр i и возвращает размер результата в байтах
+template <typename Body>
+static StageResult runStage(const std::string& stage, const Sequence& sequence,
+                            size_t first, int repeat, Body&& body) {
+    StageResult result;
+    result.corpus = sequence.name;
+    result.stage = stage;
+    result.width = sequence.width;
+    result.height = sequence.height;
+    result.frames = sequence.frames.size() - first;
+    result.seconds = 0;
+    result.outputBytes = 0;
+    result.allocations = 0;
+
+    for (int pass = 0; pass < repeat; pass++) {
+        uint64_t bytes = 0;
+        uint64_t allocationsBefore = allocationCount.load();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = first; i < sequence.frames.size(); i++) {
+            bytes += body(i);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t allocations = allocationCount.load() - allocationsBefore;
+
+        if (pass == 0 || seconds < result.seconds) {
+            result.seconds = seconds;
+        }
+        result.outputBytes = bytes;
+        result.allocations = allocations;
+    }
+    return result;
+}
+
+// Этап, который обрабатывает весь набор одним вызовом (архив); отчет - на кадр
+template <typename Body>
+static StageResult runWholeStage(const std::string& stage, const Sequence& sequence,
+                                 int repeat, Body&& body) {
+    StageResult result = runStage(stage, sequence, sequence.frames.size() - 1, repeat,
+                                  [&](size_t) { return body(); });
+    result.frames = sequence.frames.size();
+    return result;
+}
+
+static void benchmarkSequence(const Sequence& sequence, int repeat, std::vector<StageResult>& results) {
+    const uint32_t width = sequence.width;
+    const uint32_t height = sequence.height;
+    const std::vector<std::vector<uint8_t>>& frames = sequence.frames;
+    const size_t frameCount = frames.size();
+
+    // Входные данные каждого этапа готовятся заранее, чтобы мерить этапы по отдельности
+    std::vector<std::vector<PixelChange>> changes(frameCount);
+    std::vector<std::vector<uint8_t>> rle(frameCount);
+    std::vector<std::vector<uint8_t>> records(frameCount);
+    std::vector<std::vector<uint8_t>> payloads(frameCount);
+    std::vector<std::vector<uint8_t>> intra(frameCount);
+    AVOEncoderOptions options;
+    options.flags = AVO_FLAG_ENTROPY | AVO_FLAG_MOTION;
+    for (size_t i = 1; i < frameCount; i++) {
+        AVOCodec::compareFrames(frames[i - 1], frames[i], width, height, changes[i]);
+        rle[i] = AVOCodec::compressRLE(changes[i]);
+        records[i] = AVOCodec::encodeFrameDiffRecord(frames[i - 1], frames[i], width, height, 33);
+        std::vector<uint8_t> reconstructed;
+        payloads[i] = AVOCodec::encodeDiffPayload(frames[i - 1], frames[i], width, height,
+                                                  options, reconstructed);
+    }
+    for (size_t i = 0; i < frameCount; i++) {
+        intra[i] = AVOCodec::encodeIntraFrame(frames[i], width, height);
+    }
+
+    std::vector<PixelChange> changesOut;
+    std::vector<uint8_t> frameOut;
+    std::vector<uint8_t> diffBuffer(AVOCodec::getMaxFrameDiffSize(width, height));
+    std::vector<uint8_t> frameBuffer(frames[0].size());
+    changesOut.reserve(frames[0].size() / 3);
+    frameOut.reserve(frames[0].size());
+
+    results.push_back(runStage("compareFrames", sequence, 1, repeat, [&](size_t i) {
+        AVOCodec::compareFrames(frames[i - 1], frames[i], width, height, changesOut);
+        return changesOut.size() * 8;
+    }));
+    results.push_back(runStage("compressRLE", sequence, 1, repeat, [&](size_t i) {
+        return AVOCodec::compressRLE(changes[i]).size();
+    }));
+    results.push_back(runStage("decompressRLE", sequence, 1, repeat, [&](size_t i) {
+        return AVOCodec::decompressRLE(rle[i]).size() * sizeof(PixelChange);
+    }));
+    results.push_back(runStage("applyChanges", sequence, 1, repeat, [&](size_t i) {
+        AVOCodec::applyChanges(frames[i - 1], changes[i], frameOut, width, height);
+        return frameOut.size();
+    }));
+    results.push_back(runStage("encodeFrameDiff(buffer)", sequence, 1, repeat, [&](size_t i) {
+        size_t size = 0;
+        AVOCodec::encodeFrameDiff(frames[i - 1].data(), frames[i].data(), width, height, 33,
+                                  diffBuffer.data(), diffBuffer.size(), size);
+        return size;
+    }));
+    results.push_back(runStage("decodeFrameDiff(buffer)", sequence, 1, repeat, [&](size_t i) {
+        uint32_t delayMs;
+        AVOCodec::decodeFrameDiff(records[i].data(), records[i].size(), frames[i - 1].data(),
+                                  frameBuffer.data(), width, height, delayMs);
+        return frameBuffer.size();
+    }));
+    results.push_back(runStage("encodeDiffPayload(entropy+motion)", sequence, 1, repeat, [&](size_t i) {
+        return AVOCodec::encodeDiffPayload(frames[i - 1], frames[i], width, height,
+                                           options, frameOut).size();
+    }));
+    results.push_back(runStage("decodeDiffPayload(entropy+motion)", sequence, 1, repeat, [&](size_t i) {
+        AVOCodec::decodeDiffPayload(payloads[i], frames[i - 1], width, height, options.flags, frameOut);
+        return frameOut.size();
+    }));
+    results.push_back(runStage("encodeIntraFrame", sequence, 0, repeat, [&](size_t i) {
+        return AVOCodec::encodeIntraFrame(frames[i], width, height).size();
+    }));
+    results.push_back(runStage("decodeIntraFrame", sequence, 0, repeat, [&](size_t i) {
+        AVOCodec::decodeIntraFrame(intra[i], width, height, frameOut);
+        return frameOut.size();
+    }));
+
+    // Архив целиком: кодирование в файл и оба декодера
+    std::vector<AVOFrame> archiveFrames(frameCount);
+    for (size_t i = 0; i < frameCount; i++) {
+        archiveFrames[i].data = frames[i];
+        archiveFrames[i].delayMs = 33;
+        archiveFrames[i].isFullFrame = i == 0;
+    }
+    std::string archiveFile = "avo_bench_" + sequence.name + "_" + std::to_string(width) + ".avo";
+    AVOEncoderOptions archiveOptions;
+    archiveOptions.flags = AVO_FLAG_ENTROPY | AVO_FLAG_MOTION | AVO_FLAG_BACKGROUND;
+
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    std::ostringstream silent;
+    std::cout.rdbuf(silent.rdbuf());     // encodeVideoArchive печатает статистику
+    StageResult encodeArchive = runWholeStage("encodeVideoArchive", sequence, repeat, [&]() {
+        AVOCodec::encodeVideoArchive(archiveFrames, width, height, 30, archiveFile, archiveOptions);
+        std::ifstream file(archiveFile, std::ios::binary | std::ios::ate);
+        return static_cast<size_t>(file.tellg());
+    });
+    std::cout.rdbuf(coutBuffer);
+    results.push_back(encodeArchive);
+
+    results.push_back(runWholeStage("decodeVideoArchive", sequence, repeat, [&]() {
+        std::vector<AVOFrame> decoded;
+        AVOHeader header;
+        AVOCodec::decodeVideoArchive(archiveFile, decoded, header);
+        return decoded.size() * frames[0].size();
+    }));
+    results.push_back(runWholeStage("AVOMappedArchive::decodeAll", sequence, repeat, [&]() {
+        AVOMappedArchive archive;
+        size_t bytes = 0;
+        if (archive.open(archiveFile)) {
+            archive.decodeAll([&](uint32_t, const AVOFrame& frame) {
+                bytes += frame.data.size();
+                return true;
+            });
+        }
+        return bytes;
+    }));
+
+    std::remove(archiveFile.c_str());
+}
+
+// ================= ВЫВОД =================
+
+static double megabytesPerSecond(const StageResult& r) {
+    double rawBytes = static_cast<double>(r.frames) * r.width * r.height * 3;
+    return r.seconds > 0 ? rawBytes / r.seconds / (1024.0 * 1024.0) : 0;
+}
+
+static double framesPerSecond(const StageResult& r) {
+    return r.seconds > 0 ? r.frames / r.seconds : 0;
+}
+
+static void printTable(const std::vector<StageResult>& results) {
+    std::cout << std::left << std::setw(8) << "corpus" << std::setw(11) << "size"
+              << std::setw(36) << "stage" << std::right
+              << std::setw(10) << "MB/s" << std::setw(10) << "fps"
+              << std::setw(12) << "bytes/fr" << std::setw(10) << "allocs/fr" << std::endl;
+    for (const StageResult& r : results) {
+        std::ostringstream size;
+        size << r.width << "x" << r.height;
+        std::cout << std::left << std::setw(8) << r.corpus << std::setw(11) << size.str()
+                  << std::setw(36) << r.stage << std::right << std::fixed
+                  << std::setw(10) << std::setprecision(1) << megabytesPerSecond(r)
+                  << std::setw(10) << std::setprecision(1) << framesPerSecond(r)
+                  << std::setw(12) << std::setprecision(0)
+                  << static_cast<double>(r.outputBytes) / r.frames
+                  << std::setw(10) << std::setprecision(2)
+                  << static_cast<double>(r.allocations) / r.frames << std::endl;
+    }
+}
+
+static bool writeJson(const std::string& filename, const std::vector<StageResult>& results, int repeat) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Cannot create file: " << filename << std::endl;
+        return false;
+    }
+
+    out << std::fixed << "{\n  \"benchmark\": \"avo_bench\",\n  \"version\": 1,\n"
+        << "  \"repeat\": " << repeat << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StageResult& r = results[i];
+        out << "    {\"corpus\": \"" << r.corpus << "\", \"stage\": \"" << r.stage << "\""
+            << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"frames\": " << r.frames
+            << std::setprecision(3) << ", \"ms\": " << r.seconds * 1000.0
+            << ", \"mbPerSec\": " << megabytesPerSecond(r)
+            << ", \"framesPerSec\": " << framesPerSecond(r)
+            << std::setprecision(1) << ", \"bytesPerFrame\": " << static_cast<double>(r.outputBytes) / r.frames
+            << std::setprecision(3) << ", \"allocationsPerFrame\": "
+            << static_cast<double>(r.allocations) / r.frames << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char** argv) {
+    std::string dataDir = ".";
+    std::string jsonFile = "avo_bench.json";
+    std::vector<double> scales = {0.5, 1.0};
+    int repeat = 3;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--data" && i + 1 < argc) {
+            dataDir = argv[++i];
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (arg == "--scales" && i + 1 < argc) {
+            scales.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                double scale = atof(item.c_str());
+                if (scale > 0) {
+                    scales.push_back(scale);
+                }
+            }
+        } else {
+            std::cout << "Usage: avo_bench [--data DIR] [--repeat N] [--scales 0.5,1,2] [--json FILE]"
+                      << std::endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<StageResult> results;
+    for (const char* name : {"1test", "2test"}) {
+        Sequence sequence;
+        if (!loadSequence(dataDir, name, sequence)) {
+            std::cerr << "Skipping corpus " << name << " (not found in " << dataDir << ")" << std::endl;
+            continue;
+        }
+        for (double scale : scales) {
+            if (scale == 1.0) {
+                benchmarkSequence(sequence, repeat, results);
+            } else {
+                benchmarkSequence(scaleSequence(sequence, scale), repeat, results);
+            }
+        }
+    }
+
+    if (results.empty()) {
+        std::cerr << "No corpora found" << std::endl;
+        return 1;
+    }
+
+    printTable(results);
+    if (!writeJson(jsonFile, results, repeat)) {
+        return 1;
+    }
+    std::cout << "\nJSON: " << jsonFile << std::endl;
+    if (AVOInstrument::compiledIn) {
+        std::cout << std::endl;
+        AVOInstrument::report(std::cout);
+    }
+    return 0;
+}
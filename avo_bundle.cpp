@@ -0,0 +1,354 @@
+#include "avo_bundle.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <filesystem>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <windows.h>
+    #pragma comment(lib, "ws2_32.lib")
+#else
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+static const uint8_t BUNDLE_SIGNATURE[4] = {'A', 'V', 'P', 'B'};
+static const uint32_t BUNDLE_VERSION = 1;
+static const size_t BUNDLE_HEADER_SIZE = 8;
+static const size_t BUNDLE_ENTRY_SIZE = 16;
+static const size_t BUNDLE_TRAILER_SIZE = 16;
+
+static void putU32(uint8_t* out, uint32_t value) {
+    uint32_t netValue = htonl(value);
+    memcpy(out, &netValue, 4);
+}
+
+static uint32_t getU32(const uint8_t* data) {
+    uint32_t netValue;
+    memcpy(&netValue, data, 4);
+    return ntohl(netValue);
+}
+
+static void putU64(uint8_t* out, uint64_t value) {
+    putU32(out, static_cast<uint32_t>(value >> 32));
+    putU32(out + 4, static_cast<uint32_t>(value));
+}
+
+static uint64_t getU64(const uint8_t* data) {
+    return (static_cast<uint64_t>(getU32(data)) << 32) | getU32(data + 4);
+}
+
+// ================= ЗАПИСЬ =================
+
+AVOBundleWriter::AVOBundleWriter() : position(0) {
+}
+
+// Без close() оглавление не пишется: незавершенный пакет не откроется
+AVOBundleWriter::~AVOBundleWriter() {
+}
+
+bool AVOBundleWriter::open(const std::string& filename) {
+    entries.clear();
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Cannot create bundle: " << filename << std::endl;
+        return false;
+    }
+
+    uint8_t header[BUNDLE_HEADER_SIZE];
+    memcpy(header, BUNDLE_SIGNATURE, 4);
+    putU32(header + 4, BUNDLE_VERSION);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    position = sizeof(header);
+    return static_cast<bool>(file);
+}
+
+bool AVOBundleWriter::append(uint32_t frameNumber, const std::vector<uint8_t>& record) {
+    if (!file.is_open()) {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(record.data()), record.size());
+    if (!file) {
+        std::cerr << "Cannot write bundle record " << frameNumber << std::endl;
+        return false;
+    }
+
+    entries.push_back(AVOBundleEntry{frameNumber, position, static_cast<uint32_t>(record.size())});
+    position += record.size();
+    return true;
+}
+
+bool AVOBundleWriter::appendFrameDiff(uint32_t frameNumber,
+                                      const std::vector<uint8_t>& prevFrame,
+                                      const std::vector<uint8_t>& currFrame,
+                                      uint32_t width, uint32_t height,
+                                      uint32_t delayMs) {
+    if (prevFrame.size() != currFrame.size() || prevFrame.empty()) {
+        std::cerr << "Frame sizes don't match!" << std::endl;
+        return false;
+    }
+    return append(frameNumber, AVOCodec::encodeFrameDiffRecord(prevFrame, currFrame,
+                                                               width, height, delayMs));
+}
+
+bool AVOBundleWriter::close() {
+    if (!file.is_open()) {
+        return false;
+    }
+
+    // Оглавление и хвост одним блоком
+    std::vector<uint8_t> index(entries.size() * BUNDLE_ENTRY_SIZE + BUNDLE_TRAILER_SIZE);
+    uint8_t* out = index.data();
+    for (const AVOBundleEntry& entry : entries) {
+        putU32(out, entry.frameNumber);
+        putU64(out + 4, entry.offset);
+        putU32(out + 12, entry.size);
+        out += BUNDLE_ENTRY_SIZE;
+    }
+    putU64(out, position);
+    putU32(out + 8, static_cast<uint32_t>(entries.size()));
+    memcpy(out + 12, BUNDLE_SIGNATURE, 4);
+
+    file.write(reinterpret_cast<const char*>(index.data()), index.size());
+    bool ok = static_cast<bool>(file);
+    file.close();
+    entries.clear();
+    return ok;
+}
+
+// ================= ЧТЕНИЕ =================
+
+AVOBundleReader::AVOBundleReader()
+#ifdef _WIN32
+    : handle(INVALID_HANDLE_VALUE) {
+#else
+    : fd(-1) {
+#endif
+}
+
+AVOBundleReader::~AVOBundleReader() {
+    close();
+}
+
+void AVOBundleReader::close() {
+#ifdef _WIN32
+    if (handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+    entries.clear();
+}
+
+bool AVOBundleReader::readAt(uint64_t offset, uint8_t* data, size_t size) const {
+#ifdef _WIN32
+    // ReadFile со смещением в OVERLAPPED не сдвигает общую позицию файла
+    while (size > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD done = 0;
+        if (!ReadFile(handle, data, chunk, &done, &overlapped) || done == 0) {
+            return false;
+        }
+        data += done;
+        offset += done;
+        size -= done;
+    }
+#else
+    while (size > 0) {
+        ssize_t done = pread(fd, data, size, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return false;
+        }
+        data += done;
+        offset += static_cast<uint64_t>(done);
+        size -= static_cast<size_t>(done);
+    }
+#endif
+    return true;
+}
+
+bool AVOBundleReader::open(const std::string& filename) {
+    close();
+
+    uint64_t fileSize;
+#ifdef _WIN32
+    handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &size)) {
+        std::cerr << "Cannot open bundle: " << filename << std::endl;
+        close();
+        return false;
+    }
+    fileSize = static_cast<uint64_t>(size.QuadPart);
+#else
+    fd = ::open(filename.c_str(), O_RDONLY);
+    off_t end = fd >= 0 ? lseek(fd, 0, SEEK_END) : -1;
+    if (end < 0) {
+        std::cerr << "Cannot open bundle: " << filename << std::endl;
+        close();
+        return false;
+    }
+    fileSize = static_cast<uint64_t>(end);
+#endif
+
+    uint8_t header[BUNDLE_HEADER_SIZE];
+    uint8_t trailer[BUNDLE_TRAILER_SIZE];
+    if (fileSize < BUNDLE_HEADER_SIZE + BUNDLE_TRAILER_SIZE ||
+        !readAt(0, header, sizeof(header)) ||
+        !readAt(fileSize - BUNDLE_TRAILER_SIZE, trailer, sizeof(trailer)) ||
+        memcmp(header, BUNDLE_SIGNATURE, 4) != 0 || getU32(header + 4) != BUNDLE_VERSION ||
+        memcmp(trailer + 12, BUNDLE_SIGNATURE, 4) != 0) {
+        std::cerr << "Invalid bundle (no index): " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    uint64_t indexOffset = getU64(trailer);
+    uint32_t count = getU32(trailer + 8);
+    uint64_t indexEnd = fileSize - BUNDLE_TRAILER_SIZE;
+    if (indexOffset < BUNDLE_HEADER_SIZE || indexOffset > indexEnd ||
+        (indexEnd - indexOffset) != static_cast<uint64_t>(count) * BUNDLE_ENTRY_SIZE) {
+        std::cerr << "Corrupted bundle index: " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    std::vector<uint8_t> index(static_cast<size_t>(count) * BUNDLE_ENTRY_SIZE);
+    if (!readAt(indexOffset, index.data(), index.size())) {
+        std::cerr << "Cannot read bundle index: " << filename << std::endl;
+        close();
+        return false;
+    }
+
+    entries.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* in = index.data() + static_cast<size_t>(i) * BUNDLE_ENTRY_SIZE;
+        AVOBundleEntry& entry = entries[i];
+        entry.frameNumber = getU32(in);
+        entry.offset = getU64(in + 4);
+        entry.size = getU32(in + 12);
+        if (entry.offset < BUNDLE_HEADER_SIZE || entry.offset + entry.size > indexOffset) {
+            std::cerr << "Corrupted bundle entry " << i << ": " << filename << std::endl;
+            close();
+            return false;
+        }
+    }
+
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const AVOBundleEntry& a, const AVOBundleEntry& b) {
+                         return a.frameNumber < b.frameNumber;
+                     });
+    return true;
+}
+
+const AVOBundleEntry* AVOBundleReader::findEntry(uint32_t frameNumber) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), frameNumber,
+                               [](const AVOBundleEntry& entry, uint32_t number) {
+                                   return entry.frameNumber < number;
+                               });
+    if (it == entries.end() || it->frameNumber != frameNumber) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+bool AVOBundleReader::readRecord(uint32_t frameNumber, std::vector<uint8_t>& record) const {
+    const AVOBundleEntry* entry = findEntry(frameNumber);
+    if (!entry) {
+        std::cerr << "Frame " << frameNumber << " is not in bundle" << std::endl;
+        return false;
+    }
+
+    record.resize(entry->size);
+    if (!readAt(entry->offset, record.data(), record.size())) {
+        std::cerr << "Cannot read frame " << frameNumber << " from bundle" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool AVOBundleReader::decodeFrameDiff(uint32_t frameNumber,
+                                      const std::vector<uint8_t>& prevFrame,
+                                      std::vector<uint8_t>& currFrame,
+                                      uint32_t width, uint32_t height,
+                                      uint32_t& delayMs) const {
+    std::vector<uint8_t> record;
+    return readRecord(frameNumber, record) &&
+           AVOCodec::decodeFrameDiffRecord(record.data(), record.size(), prevFrame, currFrame,
+                                           width, height, delayMs);
+}
+
+bool AVOBundleReader::convertDirectory(const std::string& directory, const std::string& bundleFile,
+                                       uint32_t legacyDelayMs) {
+    namespace fs = std::filesystem;
+
+    // Файлы frame_N.avop, по возрастанию N
+    std::vector<std::pair<uint32_t, fs::path>> frames;
+    std::error_code error;
+    for (const fs::directory_entry& item : fs::directory_iterator(directory, error)) {
+        std::string name = item.path().filename().string();
+        const std::string prefix = "frame_";
+        const std::string suffix = ".avop";
+        if (name.size() <= prefix.size() + suffix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+        std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (number.find_first_not_of("0123456789") != std::string::npos || number.size() > 9) {
+            continue;
+        }
+        frames.emplace_back(static_cast<uint32_t>(std::stoul(number)), item.path());
+    }
+    if (error) {
+        std::cerr << "Cannot read directory: " << directory << std::endl;
+        return false;
+    }
+    std::sort(frames.begin(), frames.end());
+
+    AVOBundleWriter writer;
+    if (!writer.open(bundleFile)) {
+        return false;
+    }
+
+    std::vector<uint8_t> record;
+    std::vector<uint8_t> upgraded;
+    for (const auto& frame : frames) {
+        std::ifstream input(frame.second, std::ios::binary | std::ios::ate);
+        if (!input.is_open()) {
+            std::cerr << "Cannot open file: " << frame.second.string() << std::endl;
+            return false;
+        }
+        record.resize(static_cast<size_t>(input.tellg()));
+        input.seekg(0);
+        if (!input.read(reinterpret_cast<char*>(record.data()), record.size())) {
+            std::cerr << "Cannot read file: " << frame.second.string() << std::endl;
+            return false;
+        }
+        if (AVOCodec::upgradeLegacyFrameDiffRecord(record.data(), record.size(), legacyDelayMs, upgraded)) {
+            record.swap(upgraded);
+        }
+        if (!writer.append(frame.first, record)) {
+            std::cerr << "Cannot convert file: " << frame.second.string() << std::endl;
+            return false;
+        }
+    }
+
+    return writer.close();
+}
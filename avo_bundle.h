@@ -0,0 +1,92 @@
+#ifndef AVO_BUNDLE_H
+#define AVO_BUNDLE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <fstream>
+
+#include "avo_codec.h"
+
+// Пакет .avopb: записи .avop (задержка, размер, данные RLE) подряд в одном
+// файле вместо отдельного файла на каждый кадр, оглавление - в конце.
+//
+// Формат (целые в сетевом порядке байт):
+//   "AVPB" (4 байта), версия (4 байта)
+//   записи .avop без изменений
+//   оглавление: на каждую запись номер кадра (4), смещение (8), размер (4)
+//   хвост: смещение оглавления (8), число записей (4), "AVPB" (4)
+struct AVOBundleEntry {
+    uint32_t frameNumber;
+    uint64_t offset;
+    uint32_t size;
+};
+
+class AVOBundleWriter {
+public:
+    AVOBundleWriter();
+    ~AVOBundleWriter();
+
+    bool open(const std::string& filename);
+
+    // Запись .avop как есть (содержимое файла frame_N.avop)
+    bool append(uint32_t frameNumber, const std::vector<uint8_t>& record);
+
+    // Изменения между кадрами, как AVOCodec::encodeFrameDiff
+    bool appendFrameDiff(uint32_t frameNumber,
+                         const std::vector<uint8_t>& prevFrame,
+                         const std::vector<uint8_t>& currFrame,
+                         uint32_t width, uint32_t height,
+                         uint32_t delayMs);
+
+    // Дописывает оглавление; без close() пакет не читается
+    bool close();
+
+private:
+    std::ofstream file;
+    uint64_t position;
+    std::vector<AVOBundleEntry> entries;
+};
+
+class AVOBundleReader {
+public:
+    AVOBundleReader();
+    ~AVOBundleReader();
+
+    AVOBundleReader(const AVOBundleReader&) = delete;
+    AVOBundleReader& operator=(const AVOBundleReader&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    const std::vector<AVOBundleEntry>& getEntries() const { return entries; }
+
+    // Запись кадра frameNumber одним позиционным чтением (pread);
+    // потокобезопасно
+    bool readRecord(uint32_t frameNumber, std::vector<uint8_t>& record) const;
+
+    bool decodeFrameDiff(uint32_t frameNumber,
+                         const std::vector<uint8_t>& prevFrame,
+                         std::vector<uint8_t>& currFrame,
+                         uint32_t width, uint32_t height,
+                         uint32_t& delayMs) const;
+
+    // Перепаковка каталога frame_N.avop (например, 1test_frames/) в пакет;
+    // записи идут по возрастанию N. Записи старого формата (без задержки)
+    // переводятся в текущий с задержкой legacyDelayMs
+    static bool convertDirectory(const std::string& directory, const std::string& bundleFile,
+                                 uint32_t legacyDelayMs = 33);
+
+private:
+    bool readAt(uint64_t offset, uint8_t* data, size_t size) const;
+    const AVOBundleEntry* findEntry(uint32_t frameNumber) const;
+
+#ifdef _WIN32
+    void* handle;
+#else
+    int fd;
+#endif
+    std::vector<AVOBundleEntry> entries;    // по возрастанию номера кадра
+};
+
+#endif // AVO_BUNDLE_H
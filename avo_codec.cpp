@@ -1,4 +1,6 @@
 #include "avo_codec.h"
+#include "avo_entropy.h"
+#include "avo_instrument.h"
 #include <fstream>
 #include <iostream>
 #include <cstring>
@@ -9,7 +11,11 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <atomic>
 #include <chrono>
+#include <map>
+#include <deque>
+#include <iterator>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -19,6 +25,10 @@
     #include <netinet/in.h>
 #endif
 
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 // Вспомогательная функция для получения размера файла
 static long long getFileSize(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
@@ -26,6 +36,43 @@ static long long getFileSize(const std::string& filename) {
     return static_cast<long long>(file.tellg());
 }
 
+// Целые в файлах и пакетах хранятся в сетевом порядке байт
+static void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+    uint32_t netValue = htonl(value);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&netValue);
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+static bool readU32(const uint8_t* data, size_t size, size_t& pos, uint32_t& value) {
+    if (pos + 4 > size) {
+        return false;
+    }
+    uint32_t netValue;
+    memcpy(&netValue, &data[pos], 4);
+    value = ntohl(netValue);
+    pos += 4;
+    return true;
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+    uint32_t netValue = htonl(value);
+    memcpy(out, &netValue, 4);
+}
+
+// Заголовок записи .avop: задержка и размер данных
+static const size_t FRAME_DIFF_HEADER_SIZE = 8;
+
+// Серия RLE: offset (4 байта), count (1 байт), RGB (3 байта)
+static const size_t RLE_RUN_SIZE = 8;
+
+static inline void putRLERun(uint8_t* out, const PixelChange& change) {
+    putU32(out, change.offset);
+    out[4] = change.count;
+    out[5] = change.r;
+    out[6] = change.g;
+    out[7] = change.b;
+}
+
 bool AVOCodec::encodeFirstFrame(const std::vector<uint8_t>& frameData, 
                                uint32_t width, uint32_t height, 
                                uint32_t fps, const std::string& filename) {
@@ -35,15 +82,19 @@ bool AVOCodec::encodeFirstFrame(const std::vector<uint8_t>& frameData,
         return false;
     }
     
+    // Первый кадр сохраняется сжатым, если это дает выигрыш
+    std::vector<uint8_t> payload;
+    encodeKeyFrame(frameData, width, height, payload);
+    
     AVOHeader header;
     header.width = width;
     header.height = height;
     header.fps = fps;
     header.totalFrames = 1;
-    header.firstFrameSize = static_cast<uint32_t>(frameData.size());
+    header.firstFrameSize = static_cast<uint32_t>(payload.size());
     
     file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    file.write(reinterpret_cast<const char*>(frameData.data()), frameData.size());
+    file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
     
     file.close();
     return true;
@@ -65,11 +116,13 @@ bool AVOCodec::decodeFirstFrame(const std::string& filename,
         return false;
     }
     
-    frameData.resize(header.firstFrameSize);
-    file.read(reinterpret_cast<char*>(frameData.data()), header.firstFrameSize);
+    std::vector<uint8_t> payload(header.firstFrameSize);
+    file.read(reinterpret_cast<char*>(payload.data()), header.firstFrameSize);
     
     file.close();
-    return true;
+    
+    // Размер, отличный от width*height*3, означает сжатый кадр
+    return decodeKeyFrame(payload, header.width, header.height, frameData);
 }
 
 // Старая версия без задержки
@@ -106,10 +159,7 @@ bool AVOCodec::encodeFrameDiff(const std::vector<uint8_t>& prevFrame,
         return false;
     }
     
-    std::vector<PixelChange> changes;
-    compareFrames(prevFrame, currFrame, width, height, changes);
-    
-    std::vector<uint8_t> compressed = compressRLE(changes);
+    std::vector<uint8_t> record = encodeFrameDiffRecord(prevFrame, currFrame, width, height, delayMs);
     
     std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) {
@@ -117,19 +167,7 @@ bool AVOCodec::encodeFrameDiff(const std::vector<uint8_t>& prevFrame,
         return false;
     }
     
-    // Сохраняем задержку (4 байта)
-    uint32_t netDelayMs = htonl(delayMs);
-    file.write(reinterpret_cast<const char*>(&netDelayMs), sizeof(netDelayMs));
-    
-    // Сохраняем размер данных (4 байта)
-    uint32_t dataSize = static_cast<uint32_t>(compressed.size());
-    uint32_t netDataSize = htonl(dataSize);
-    file.write(reinterpret_cast<const char*>(&netDataSize), sizeof(netDataSize));
-    
-    // Сохраняем данные
-    if (!compressed.empty()) {
-        file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
-    }
+    file.write(reinterpret_cast<const char*>(record.data()), record.size());
     
     file.close();
     return true;
@@ -147,61 +185,156 @@ bool AVOCodec::decodeFrameDiff(const std::string& filename,
         return false;
     }
     
-    // Читаем задержку
-    uint32_t netDelayMs;
-    file.read(reinterpret_cast<char*>(&netDelayMs), sizeof(netDelayMs));
-    delayMs = ntohl(netDelayMs);
+    std::vector<uint8_t> record((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+    file.close();
     
-    // Читаем размер данных
-    uint32_t netDataSize;
-    file.read(reinterpret_cast<char*>(&netDataSize), sizeof(netDataSize));
-    uint32_t dataSize = ntohl(netDataSize);
+    return decodeFrameDiffRecord(record.data(), record.size(), prevFrame, currFrame,
+                                 width, height, delayMs);
+}
+
+// Запись .avop: задержка (4 байта), размер данных (4 байта), данные RLE
+std::vector<uint8_t> AVOCodec::encodeFrameDiffRecord(const std::vector<uint8_t>& prevFrame,
+                                                     const std::vector<uint8_t>& currFrame,
+                                                     uint32_t width, uint32_t height,
+                                                     uint32_t delayMs) {
+    std::vector<PixelChange> changes;
+    compareFrames(prevFrame, currFrame, width, height, changes);
     
-    if (dataSize == 0) {
-        currFrame = prevFrame;
-        file.close();
-        return true;
-    }
+    std::vector<uint8_t> compressed = compressRLE(changes);
     
-    std::vector<uint8_t> compressed(dataSize);
-    file.read(reinterpret_cast<char*>(compressed.data()), dataSize);
+    std::vector<uint8_t> record;
+    record.reserve(FRAME_DIFF_HEADER_SIZE + compressed.size());
+    appendU32(record, delayMs);
+    appendU32(record, static_cast<uint32_t>(compressed.size()));
+    record.insert(record.end(), compressed.begin(), compressed.end());
+    return record;
+}
+
+bool AVOCodec::decodeFrameDiffRecord(const uint8_t* data, size_t size,
+                                     const std::vector<uint8_t>& prevFrame,
+                                     std::vector<uint8_t>& currFrame,
+                                     uint32_t width, uint32_t height,
+                                     uint32_t& delayMs) {
+    if (prevFrame.size() != static_cast<size_t>(width) * height * 3) {
+        std::cerr << "Frame sizes don't match!" << std::endl;
+        return false;
+    }
     
-    file.close();
+    currFrame.resize(prevFrame.size());
+    return decodeFrameDiff(data, size, prevFrame.data(), currFrame.data(), width, height, delayMs);
+}
+
+// Текущая запись: размер данных (сетевой порядок) сразу после задержки и
+// ровно до конца записи. Старая: первые 4 байта - размер в порядке хоста
+bool AVOCodec::isLegacyFrameDiffRecord(const uint8_t* data, size_t size) {
+    size_t pos = 4;
+    uint32_t dataSize;
+    if (size >= FRAME_DIFF_HEADER_SIZE && readU32(data, size, pos, dataSize) &&
+        dataSize == size - FRAME_DIFF_HEADER_SIZE) {
+        return false;
+    }
     
-    std::vector<PixelChange> changes = decompressRLE(compressed);
-    currFrame = prevFrame;
-    applyChanges(currFrame, changes, currFrame, width, height);
+    uint32_t hostSize;
+    if (size < 4) {
+        return false;
+    }
+    memcpy(&hostSize, data, 4);
+    return hostSize == size - 4;
+}
+
+bool AVOCodec::upgradeLegacyFrameDiffRecord(const uint8_t* data, size_t size, uint32_t delayMs,
+                                            std::vector<uint8_t>& record) {
+    if (!isLegacyFrameDiffRecord(data, size)) {
+        return false;
+    }
     
+    record.clear();
+    record.reserve(size + 4);
+    appendU32(record, delayMs);
+    appendU32(record, static_cast<uint32_t>(size - 4));
+    record.insert(record.end(), data + 4, data + size);
     return true;
 }
 
+// Порог изменения (чтобы игнорировать незначительные изменения шума)
+static const int CHANGE_THRESHOLD = 10;
+
+static inline bool tripletChanged(const uint8_t* a, const uint8_t* b) {
+    return abs((int)a[0] - (int)b[0]) > CHANGE_THRESHOLD ||
+           abs((int)a[1] - (int)b[1]) > CHANGE_THRESHOLD ||
+           abs((int)a[2] - (int)b[2]) > CHANGE_THRESHOLD;
+}
+
+// То же с порогом на каждый байт (карта из buildThresholdMap)
+static inline bool tripletChanged(const uint8_t* a, const uint8_t* b, const uint8_t* threshold) {
+    return abs((int)a[0] - (int)b[0]) > threshold[0] ||
+           abs((int)a[1] - (int)b[1]) > threshold[1] ||
+           abs((int)a[2] - (int)b[2]) > threshold[2];
+}
+
+#if defined(__SSE2__)
+// Есть ли среди 16 троек (48 байт) изменившиеся: |a - b| с насыщением
+// минус порог дает ненулевой байт только там, где порог превышен
+static inline bool chunkChanged(const uint8_t* a, const uint8_t* b, const uint8_t* threshold) {
+    const __m128i uniform = _mm_set1_epi8(CHANGE_THRESHOLD);
+    __m128i over = _mm_setzero_si128();
+    for (int i = 0; i < 48; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i limit = threshold
+            ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(threshold + i))
+            : uniform;
+        over = _mm_or_si128(over, _mm_subs_epu8(diff, limit));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(over, _mm_setzero_si128())) != 0xFFFF;
+}
+#endif
+
 void AVOCodec::compareFrames(const std::vector<uint8_t>& frame1,
                             const std::vector<uint8_t>& frame2,
                             uint32_t width, uint32_t height,
                             std::vector<PixelChange>& changes) {
-    changes.clear();
-    
-    if (frame1.size() != frame2.size() || frame1.empty()) {
-        return;
-    }
-    
-    uint32_t totalPixels = width * height;
+    static const std::vector<uint8_t> noThresholds;
+    compareFrames(frame1, frame2, width, height, noThresholds, changes);
+}
+
+// Обход изменившихся серий троек байт: emit(change) для каждой серии.
+// Общая основа compareFrames и буферного encodeFrameDiff
+template <typename Emit>
+static void scanChanges(const uint8_t* frame1, const uint8_t* frame2, uint32_t totalPixels,
+                        const uint8_t* threshold, Emit&& emit) {
+    AVO_PROBE_SCOPE(AVO_PROBE_COMPARE);
+    AVO_PROBE_ADD(AVO_PROBE_COMPARE, PIXELS, totalPixels);
     uint32_t pixelIndex = 0;
     
-    // Порог изменения (чтобы игнорировать незначительные изменения шума)
-    const uint8_t threshold = 10;
+    auto changedAt = [&](size_t idx) {
+        return threshold ? tripletChanged(&frame1[idx], &frame2[idx], threshold + idx)
+                         : tripletChanged(&frame1[idx], &frame2[idx]);
+    };
     
     while (pixelIndex < totalPixels) {
+#if defined(__SSE2__)
+        // Неизменившиеся участки по 16 троек пропускаются целиком
+        if ((pixelIndex & 15) == 0) {
+            while (pixelIndex + 16 <= totalPixels &&
+                   !chunkChanged(&frame1[pixelIndex * 3], &frame2[pixelIndex * 3],
+                                 threshold ? threshold + pixelIndex * 3 : nullptr)) {
+                pixelIndex += 16;
+            }
+            if (pixelIndex >= totalPixels) {
+                break;
+            }
+            AVO_PROBE_ADD(AVO_PROBE_COMPARE, SLOW_PATHS, 1);
+        }
+#else
+        AVO_PROBE_ADD(AVO_PROBE_COMPARE, SLOW_PATHS, 1);
+#endif
         size_t idx = pixelIndex * 3;
         
         // Проверяем, изменился ли пиксель с учетом порога
-        bool changed = false;
-        
-        if (abs((int)frame1[idx] - (int)frame2[idx]) > threshold ||
-            abs((int)frame1[idx + 1] - (int)frame2[idx + 1]) > threshold ||
-            abs((int)frame1[idx + 2] - (int)frame2[idx + 2]) > threshold) {
-            changed = true;
-        }
+        bool changed = changedAt(idx);
         
         if (changed) {
             PixelChange change;
@@ -217,14 +350,7 @@ void AVOCodec::compareFrames(const std::vector<uint8_t>& frame1,
                 size_t nextIdx = (pixelIndex + change.count) * 3;
                 
                 // Проверяем, изменился ли следующий пиксель
-                bool nextChanged = false;
-                if (abs((int)frame1[nextIdx] - (int)frame2[nextIdx]) > threshold ||
-                    abs((int)frame1[nextIdx + 1] - (int)frame2[nextIdx + 1]) > threshold ||
-                    abs((int)frame1[nextIdx + 2] - (int)frame2[nextIdx + 2]) > threshold) {
-                    nextChanged = true;
-                }
-                
-                if (!nextChanged) {
+                if (!changedAt(nextIdx)) {
                     break;
                 }
                 
@@ -238,7 +364,8 @@ void AVOCodec::compareFrames(const std::vector<uint8_t>& frame1,
                 }
             }
             
-            changes.push_back(change);
+            AVO_PROBE_ADD(AVO_PROBE_COMPARE, RUNS, 1);
+            emit(change);
             pixelIndex += change.count;
         } else {
             pixelIndex++;
@@ -246,38 +373,344 @@ void AVOCodec::compareFrames(const std::vector<uint8_t>& frame1,
     }
 }
 
-std::vector<uint8_t> AVOCodec::compressRLE(const std::vector<PixelChange>& changes) {
-    std::vector<uint8_t> result;
+void AVOCodec::compareFrames(const std::vector<uint8_t>& frame1,
+                            const std::vector<uint8_t>& frame2,
+                            uint32_t width, uint32_t height,
+                            const std::vector<uint8_t>& thresholds,
+                            std::vector<PixelChange>& changes) {
+    changes.clear();
     
-    for (const auto& change : changes) {
-        // Записываем offset (4 байта) в сетевом порядке байт
-        uint32_t netOffset = htonl(change.offset);
-        result.insert(result.end(), 
-                     reinterpret_cast<const uint8_t*>(&netOffset), 
-                     reinterpret_cast<const uint8_t*>(&netOffset) + 4);
+    if (frame1.size() != frame2.size() || frame1.empty()) {
+        return;
+    }
+    
+    // Карта порогов строится под кадр width x height (RGB24 или YUV420): карта
+    // другого размера или кадр не этих размеров - общий порог
+    bool frameMatches = frame1.size() == getFrameSize(width, height, AVO_PIXEL_RGB24) ||
+                        frame1.size() == getFrameSize(width, height, AVO_PIXEL_YUV420);
+    const uint8_t* threshold = frameMatches && thresholds.size() == frame1.size()
+                               ? thresholds.data() : nullptr;
+    
+    // Число троек байт: для RGB24 равно width * height, для YUV420 - меньше
+    uint32_t totalPixels = static_cast<uint32_t>(frame1.size() / 3);
+    scanChanges(frame1.data(), frame2.data(), totalPixels, threshold,
+                [&](const PixelChange& change) { changes.push_back(change); });
+}
+
+// ================= БУФЕРНЫЙ API =================
+// Те же записи .avop и заголовок .avo, что и у файловых функций, но в буфере
+// вызывающего без промежуточных векторов. Если буфера не хватает, функция
+// возвращает false, а size - нужный размер.
+
+size_t AVOCodec::getMaxFrameDiffSize(uint32_t width, uint32_t height) {
+    return FRAME_DIFF_HEADER_SIZE + static_cast<size_t>(width) * height * RLE_RUN_SIZE;
+}
+
+bool AVOCodec::encodeFrameDiff(const uint8_t* prevFrame, const uint8_t* currFrame,
+                               uint32_t width, uint32_t height, uint32_t delayMs,
+                               uint8_t* out, size_t capacity, size_t& size) {
+    // Серии пишутся сразу при обходе, пока помещаются; размер считается всегда
+    size = FRAME_DIFF_HEADER_SIZE;
+    scanChanges(prevFrame, currFrame, width * height, nullptr,
+                [&](const PixelChange& change) {
+                    if (size + RLE_RUN_SIZE <= capacity) {
+                        putRLERun(out + size, change);
+                    }
+                    size += RLE_RUN_SIZE;
+                });
+    
+    if (size > capacity) {
+        return false;
+    }
+    
+    putU32(out, delayMs);
+    putU32(out + 4, static_cast<uint32_t>(size - FRAME_DIFF_HEADER_SIZE));
+    return true;
+}
+
+bool AVOCodec::decodeFrameDiff(const uint8_t* data, size_t size,
+                               const uint8_t* prevFrame, uint8_t* currFrame,
+                               uint32_t width, uint32_t height,
+                               uint32_t& delayMs) {
+    if (isLegacyFrameDiffRecord(data, size)) {
+        std::cerr << "Legacy frame difference record (no delay field), convert it first" << std::endl;
+        return false;
+    }
+    
+    size_t pos = 0;
+    uint32_t dataSize;
+    if (!readU32(data, size, pos, delayMs) || !readU32(data, size, pos, dataSize) ||
+        dataSize > size - pos) {
+        std::cerr << "Corrupted frame difference record" << std::endl;
+        return false;
+    }
+    
+    // currFrame может совпадать с prevFrame - тогда кадр обновляется на месте
+    uint32_t totalPixels = width * height;
+    if (currFrame != prevFrame) {
+        memcpy(currFrame, prevFrame, static_cast<size_t>(totalPixels) * 3);
+    }
+    
+    const uint8_t* run = data + pos;
+    const uint8_t* end = run + dataSize - dataSize % RLE_RUN_SIZE;
+    for (; run < end; run += RLE_RUN_SIZE) {
+        uint32_t offset;
+        size_t runPos = 0;
+        readU32(run, RLE_RUN_SIZE, runPos, offset);
+        if (offset >= totalPixels) {
+            continue;
+        }
+        
+        uint32_t count = std::min<uint32_t>(run[4], totalPixels - offset);
+        uint8_t* pixel = currFrame + static_cast<size_t>(offset) * 3;
+        for (uint32_t i = 0; i < count; i++, pixel += 3) {
+            pixel[0] = run[5];
+            pixel[1] = run[6];
+            pixel[2] = run[7];
+        }
+    }
+    
+    return true;
+}
+
+size_t AVOCodec::getMaxFirstFrameSize(uint32_t width, uint32_t height) {
+    // Сжатый ключевой кадр никогда не больше исходного
+    return sizeof(AVOHeader) + static_cast<size_t>(width) * height * 3;
+}
+
+bool AVOCodec::encodeFirstFrame(const uint8_t* frameData,
+                                uint32_t width, uint32_t height, uint32_t fps,
+                                uint8_t* out, size_t capacity, size_t& size) {
+    size_t frameSize = static_cast<size_t>(width) * height * 3;
+    std::vector<uint8_t> intra = encodeIntraFrame(frameData, frameSize, width, height);
+    bool compressed = !intra.empty() && intra.size() < frameSize;
+    const uint8_t* payload = compressed ? intra.data() : frameData;
+    size_t payloadSize = compressed ? intra.size() : frameSize;
+    
+    size = sizeof(AVOHeader) + payloadSize;
+    if (size > capacity) {
+        return false;
+    }
+    
+    AVOHeader header;
+    header.width = width;
+    header.height = height;
+    header.fps = fps;
+    header.totalFrames = 1;
+    header.firstFrameSize = static_cast<uint32_t>(payloadSize);
+    
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), payload, payloadSize);
+    return true;
+}
+
+bool AVOCodec::decodeFirstFrame(const uint8_t* data, size_t size, AVOHeader& header,
+                                uint8_t* frameData, size_t capacity) {
+    if (size < sizeof(header)) {
+        std::cerr << "Invalid AVO file header" << std::endl;
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    
+    size_t frameSize = static_cast<size_t>(header.width) * header.height * 3;
+    if (header.firstFrameSize == 0 || frameSize == 0 ||
+        header.firstFrameSize > size - sizeof(header)) {
+        std::cerr << "Invalid AVO file header" << std::endl;
+        return false;
+    }
+    if (frameSize > capacity) {
+        return false;
+    }
+    
+    const uint8_t* payload = data + sizeof(header);
+    if (header.firstFrameSize == frameSize) {
+        memcpy(frameData, payload, frameSize);
+        return true;
+    }
+    
+    std::vector<uint8_t> frame;
+    if (!decodeIntraFrame(payload, header.firstFrameSize, header.width, header.height, frame)) {
+        return false;
+    }
+    memcpy(frameData, frame.data(), frameSize);
+    return true;
+}
+
+// ================= МАСКИ КАДРА =================
+
+static void fillRegions(std::vector<uint8_t>& classes, uint32_t width, uint32_t height,
+                        const std::vector<AVORegion>& regions, uint8_t value) {
+    for (const AVORegion& region : regions) {
+        if (region.x >= width || region.y >= height) {
+            continue;
+        }
+        uint32_t x1 = region.x + std::min(region.width, width - region.x);
+        uint32_t y1 = region.y + std::min(region.height, height - region.y);
+        for (uint32_t y = region.y; y < y1; y++) {
+            std::fill(classes.begin() + y * width + region.x,
+                      classes.begin() + y * width + x1, value);
+        }
+    }
+}
+
+void AVOCodec::buildThresholdMap(const AVOFrameMask& mask,
+                                 uint32_t width, uint32_t height,
+                                 AVOPixelFormat format,
+                                 std::vector<uint8_t>& thresholds) {
+    thresholds.clear();
+    if (mask.empty() || width == 0 || height == 0) {
+        return;
+    }
+    
+    // Класс каждого пикселя: карта, затем приоритетные и исключенные области
+    std::vector<uint8_t> classes;
+    if (mask.bitmap.size() == static_cast<size_t>(width) * height) {
+        classes = mask.bitmap;
+    } else {
+        classes.assign(static_cast<size_t>(width) * height, AVO_MASK_NORMAL);
+    }
+    fillRegions(classes, width, height, mask.priority, AVO_MASK_PRIORITY);
+    fillRegions(classes, width, height, mask.excluded, AVO_MASK_EXCLUDE);
+    
+    uint8_t byClass[3];
+    byClass[AVO_MASK_NORMAL] = CHANGE_THRESHOLD;
+    byClass[AVO_MASK_EXCLUDE] = 255;
+    byClass[AVO_MASK_PRIORITY] = mask.priorityThreshold;
+    auto classThreshold = [&](uint8_t value) {
+        return value <= AVO_MASK_PRIORITY ? byClass[value] : byClass[AVO_MASK_NORMAL];
+    };
+    
+    thresholds.resize(getFrameSize(width, height, format), CHANGE_THRESHOLD);
+    
+    if (format != AVO_PIXEL_YUV420) {
+        for (size_t i = 0; i < classes.size(); i++) {
+            uint8_t t = classThreshold(classes[i]);
+            thresholds[i * 3] = t;
+            thresholds[i * 3 + 1] = t;
+            thresholds[i * 3 + 2] = t;
+        }
+        return;
+    }
+    
+    for (size_t i = 0; i < classes.size(); i++) {
+        thresholds[i] = classThreshold(classes[i]);
+    }
+    
+    // Цветность покрывает блок 2x2: приоритет, если он есть в блоке,
+    // исключение - только если исключен весь блок
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    size_t uOffset = static_cast<size_t>(width) * height;
+    
+    for (uint32_t cy = 0; cy < chromaHeight; cy++) {
+        for (uint32_t cx = 0; cx < chromaWidth; cx++) {
+            bool priority = false;
+            bool excluded = true;
+            for (uint32_t y = cy * 2; y < std::min(height, cy * 2 + 2); y++) {
+                for (uint32_t x = cx * 2; x < std::min(width, cx * 2 + 2); x++) {
+                    uint8_t value = classes[y * width + x];
+                    priority = priority || value == AVO_MASK_PRIORITY;
+                    excluded = excluded && value == AVO_MASK_EXCLUDE;
+                }
+            }
+            uint8_t t = priority ? byClass[AVO_MASK_PRIORITY]
+                      : excluded ? byClass[AVO_MASK_EXCLUDE] : byClass[AVO_MASK_NORMAL];
+            size_t idx = uOffset + cy * chromaWidth + cx;
+            thresholds[idx] = t;
+            thresholds[idx + chromaSize] = t;
+        }
+    }
+}
+
+// ================= ПОДАВЛЕНИЕ ШУМА =================
+// Для каждого байта хранится устойчивое значение. Пока байт "стоит", он
+// не меняется, если отклонение не больше порога входа; при большем
+// отклонении байт начинает "двигаться" и следует за кадром, пока отклонения
+// больше порога выхода. Шум около порога compareFrames больше не мерцает
+
+void AVOCodec::suppressTemporalNoise(std::vector<uint8_t>& frame, AVODenoiseState& state,
+                                     uint8_t enterThreshold, uint8_t leaveThreshold) {
+    if (state.stable.size() != frame.size()) {
+        state.stable = frame;
+        state.moving.assign(frame.size(), 0);
+        return;
+    }
+    
+    uint8_t* cur = frame.data();
+    uint8_t* stable = state.stable.data();
+    uint8_t* moving = state.moving.data();
+    size_t size = frame.size();
+    size_t i = 0;
+    
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i enter = _mm_set1_epi8(static_cast<char>(enterThreshold));
+    const __m128i leave = _mm_set1_epi8(static_cast<char>(leaveThreshold));
+    for (; i + 16 <= size; i += 16) {
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i));
+        __m128i vs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stable + i));
+        __m128i vm = _mm_loadu_si128(reinterpret_cast<const __m128i*>(moving + i));
         
-        // Записываем count (1 байт)
-        result.push_back(change.count);
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(vc, vs), _mm_subs_epu8(vs, vc));
+        __m128i overEnter = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(diff, enter), zero),
+                                          _mm_set1_epi8(-1));
+        __m128i overLeave = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(diff, leave), zero),
+                                          _mm_set1_epi8(-1));
         
-        // Записываем RGB (3 байта)
-        result.push_back(change.r);
-        result.push_back(change.g);
-        result.push_back(change.b);
+        // Движущийся байт держится порогом выхода, стоящий - порогом входа
+        __m128i follow = _mm_or_si128(_mm_and_si128(vm, overLeave),
+                                      _mm_andnot_si128(vm, overEnter));
+        vs = _mm_or_si128(_mm_and_si128(follow, vc), _mm_andnot_si128(follow, vs));
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(stable + i), vs);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(moving + i), follow);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cur + i), vs);
+    }
+#endif
+    
+    for (; i < size; i++) {
+        int diff = abs((int)cur[i] - (int)stable[i]);
+        bool follow = moving[i] ? diff > leaveThreshold : diff > enterThreshold;
+        if (follow) {
+            stable[i] = cur[i];
+        }
+        moving[i] = follow ? 0xFF : 0;
+        cur[i] = stable[i];
+    }
+}
+
+std::vector<uint8_t> AVOCodec::compressRLE(const std::vector<PixelChange>& changes) {
+    AVO_PROBE_SCOPE(AVO_PROBE_COMPRESS);
+    AVO_PROBE_ADD(AVO_PROBE_COMPRESS, RUNS, changes.size());
+    AVO_PROBE_ADD(AVO_PROBE_COMPRESS, BYTES, changes.size() * RLE_RUN_SIZE);
+    std::vector<uint8_t> result(changes.size() * RLE_RUN_SIZE);
+    
+    // offset (4 байта, сетевой порядок), count (1 байт), RGB (3 байта)
+    uint8_t* out = result.data();
+    for (const auto& change : changes) {
+        putRLERun(out, change);
+        out += RLE_RUN_SIZE;
     }
     
     return result;
 }
 
 std::vector<PixelChange> AVOCodec::decompressRLE(const std::vector<uint8_t>& data) {
+    return decompressRLE(data.data(), data.size());
+}
+
+std::vector<PixelChange> AVOCodec::decompressRLE(const uint8_t* data, size_t size) {
     std::vector<PixelChange> changes;
     
-    if (data.empty()) {
+    if (size == 0) {
         return changes;
     }
     
+    changes.reserve(size / 8);
     size_t i = 0;
     
-    while (i + 8 <= data.size()) { // 4 байта offset + 1 байт count + 3 байта RGB = 8 байт
+    while (i + 8 <= size) { // 4 байта offset + 1 байт count + 3 байта RGB = 8 байт
         PixelChange change;
         
         // Читаем offset
@@ -300,23 +733,206 @@ std::vector<PixelChange> AVOCodec::decompressRLE(const std::vector<uint8_t>& dat
     return changes;
 }
 
+// ================= ЭНТРОПИЙНОЕ СЖАТИЕ ИЗМЕНЕНИЙ =================
+// Формат (AVO_FLAG_ENTROPY): число серий (4 байта), затем 5 потоков, каждый -
+// размер (4 байта) и блок AVOEntropy:
+//   0 - промежутки между сериями (zigzag varint: offset - конец предыдущей серии)
+//   1 - длины серий
+//   2..4 - разности G, R-G, B-G с предыдущей серией
+// Таблицы Хаффмана строятся для каждого кадра заново.
+
+static const size_t CHANGE_STREAMS = 5;
+
+std::vector<uint8_t> AVOCodec::compressChanges(const std::vector<PixelChange>& changes,
+                                               uint32_t flags) {
+    if (!(flags & AVO_FLAG_ENTROPY)) {
+        return compressRLE(changes);
+    }
+    
+    std::vector<uint8_t> result;
+    if (changes.empty()) {
+        return result;
+    }
+    
+    size_t count = changes.size();
+    std::vector<uint8_t> streams[CHANGE_STREAMS];
+    streams[0].resize(count * 5);
+    for (size_t s = 1; s < CHANGE_STREAMS; s++) {
+        streams[s].resize(count);
+    }
+    
+    uint8_t* gaps = streams[0].data();
+    uint8_t* counts = streams[1].data();
+    uint8_t* dg = streams[2].data();
+    uint8_t* dr = streams[3].data();
+    uint8_t* db = streams[4].data();
+    
+    uint32_t runEnd = 0;
+    int prevG = 0, prevR = 0, prevB = 0;
+    size_t gapSize = 0;
+    
+    for (size_t i = 0; i < count; i++) {
+        const PixelChange& change = changes[i];
+        
+        // Промежуток со знаком (zigzag): серии от compareFrames идут по
+        // возрастанию, но произвольный порядок тоже кодируется корректно
+        int64_t delta = static_cast<int64_t>(change.offset) - runEnd;
+        uint64_t gap = delta >= 0 ? static_cast<uint64_t>(delta) << 1
+                                  : (static_cast<uint64_t>(-delta) << 1) - 1;
+        while (gap >= 0x80) {
+            gaps[gapSize++] = static_cast<uint8_t>(gap | 0x80);
+            gap >>= 7;
+        }
+        gaps[gapSize++] = static_cast<uint8_t>(gap);
+        runEnd = change.offset + change.count;
+        
+        counts[i] = change.count;
+        
+        int g = change.g;
+        int r = change.r - change.g;
+        int b = change.b - change.g;
+        dg[i] = static_cast<uint8_t>(g - prevG);
+        dr[i] = static_cast<uint8_t>(r - prevR);
+        db[i] = static_cast<uint8_t>(b - prevB);
+        prevG = g;
+        prevR = r;
+        prevB = b;
+    }
+    streams[0].resize(gapSize);
+    
+    appendU32(result, static_cast<uint32_t>(count));
+    for (size_t s = 0; s < CHANGE_STREAMS; s++) {
+        std::vector<uint8_t> block = AVOEntropy::compress(streams[s]);
+        appendU32(result, static_cast<uint32_t>(block.size()));
+        result.insert(result.end(), block.begin(), block.end());
+    }
+    
+    return result;
+}
+
+bool AVOCodec::decompressChanges(const std::vector<uint8_t>& data, uint32_t flags,
+                                 size_t maxChanges, std::vector<PixelChange>& changes) {
+    return decompressChanges(data.data(), data.size(), flags, maxChanges, changes);
+}
+
+bool AVOCodec::decompressChanges(const uint8_t* data, size_t size, uint32_t flags,
+                                 size_t maxChanges, std::vector<PixelChange>& changes) {
+    if (!(flags & AVO_FLAG_ENTROPY)) {
+        changes = decompressRLE(data, size);
+        return true;
+    }
+    
+    changes.clear();
+    
+    // Пустые данные (или маркер "нет изменений") - изменений нет
+    if (size < 4) {
+        return true;
+    }
+    
+    size_t pos = 0;
+    uint32_t count;
+    readU32(data, size, pos, count);
+    if (count > maxChanges) {
+        std::cerr << "Corrupted entropy-coded changes" << std::endl;
+        return false;
+    }
+    
+    std::vector<uint8_t> streams[CHANGE_STREAMS];
+    for (size_t s = 0; s < CHANGE_STREAMS; s++) {
+        // Промежуток - varint до 5 байт, остальные потоки - байт на серию
+        size_t maxStreamSize = s == 0 ? static_cast<size_t>(count) * 5 : count;
+        uint32_t blockSize;
+        if (!readU32(data, size, pos, blockSize) || blockSize > size - pos ||
+            !AVOEntropy::decompress(data + pos, blockSize, streams[s], maxStreamSize)) {
+            std::cerr << "Corrupted entropy-coded changes" << std::endl;
+            return false;
+        }
+        pos += blockSize;
+        
+        if (s > 0 && streams[s].size() != count) {
+            std::cerr << "Corrupted entropy-coded changes" << std::endl;
+            return false;
+        }
+    }
+    
+    changes.resize(count);
+    
+    const uint8_t* gaps = streams[0].data();
+    const uint8_t* gapsEnd = gaps + streams[0].size();
+    const uint8_t* counts = streams[1].data();
+    const uint8_t* dg = streams[2].data();
+    const uint8_t* dr = streams[3].data();
+    const uint8_t* db = streams[4].data();
+    
+    uint32_t runEnd = 0;
+    uint8_t g = 0, r = 0, b = 0;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t gap = 0;
+        int shift = 0;
+        while (true) {
+            if (gaps == gapsEnd || shift > 35) {
+                std::cerr << "Corrupted entropy-coded changes" << std::endl;
+                changes.clear();
+                return false;
+            }
+            uint8_t byte = *gaps++;
+            gap |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+        }
+        
+        // Разности накапливаются по модулю 256 (G, R-G, B-G)
+        g = static_cast<uint8_t>(g + dg[i]);
+        r = static_cast<uint8_t>(r + dr[i]);
+        b = static_cast<uint8_t>(b + db[i]);
+        
+        PixelChange& change = changes[i];
+        int64_t delta = (gap & 1) ? -static_cast<int64_t>((gap + 1) >> 1)
+                                  : static_cast<int64_t>(gap >> 1);
+        change.offset = static_cast<uint32_t>(runEnd + delta);
+        change.count = counts[i];
+        change.g = g;
+        change.r = static_cast<uint8_t>(r + g);
+        change.b = static_cast<uint8_t>(b + g);
+        runEnd = change.offset + change.count;
+    }
+    
+    return true;
+}
+
 void AVOCodec::applyChanges(const std::vector<uint8_t>& baseFrame,
                            const std::vector<PixelChange>& changes,
                            std::vector<uint8_t>& resultFrame,
                            uint32_t width, uint32_t height) {
+    AVO_PROBE_SCOPE(AVO_PROBE_APPLY);
     resultFrame = baseFrame;
     
     if (resultFrame.empty() || width == 0 || height == 0) {
         return;
     }
     
-    uint32_t totalPixels = width * height;
+    uint32_t totalPixels = static_cast<uint32_t>(resultFrame.size() / 3);
+#ifdef AVO_INSTRUMENT
+    uint32_t lastRunEnd = 0;
+#endif
     
     for (const auto& change : changes) {
         // Проверяем, не выходит ли offset за границы
         if (change.offset >= totalPixels) {
             continue;
         }
+#ifdef AVO_INSTRUMENT
+        // Серия дальше 4 КБ от предыдущей (или позади нее) - вероятный промах кэша
+        AVO_PROBE_ADD(AVO_PROBE_APPLY, RUNS, 1);
+        AVO_PROBE_ADD(AVO_PROBE_APPLY, PIXELS, std::min<uint32_t>(change.count, totalPixels - change.offset));
+        if (change.offset < lastRunEnd || (change.offset - lastRunEnd) * 3 > 4096) {
+            AVO_PROBE_ADD(AVO_PROBE_APPLY, SLOW_PATHS, 1);
+        }
+        lastRunEnd = change.offset + change.count;
+#endif
         
         // Применяем изменение для каждого пикселя в count
         for (uint8_t i = 0; i < change.count; i++) {
@@ -340,13 +956,1363 @@ void AVOCodec::applyChanges(const std::vector<uint8_t>& baseFrame,
     }
 }
 
-std::vector<uint8_t> AVOCodec::createBlackFrame(uint32_t width, uint32_t height) {
-    return std::vector<uint8_t>(width * height * 3, 0);
-}
+// ================= КОМПЕНСАЦИЯ ДВИЖЕНИЯ =================
+// С флагом AVO_FLAG_MOTION данные изменений начинаются с блока операций
+// копирования: число операций (4 байта), затем для каждой - приращение
+// индекса блока 16x16 в порядке развертки (varint) и вектор dx, dy
+// (по 1 байту со знаком). Блок берется из опорного кадра со сдвигом,
+// остаточные изменения (compressChanges) считаются уже от результата.
+// Для YUV420 векторы ищутся по яркости, цветность копируется со сдвигом /2.
 
-float AVOCodec::getDiffPercentage(const std::vector<uint8_t>& prevFrame,
-                                 const std::vector<uint8_t>& currFrame,
-                                 uint32_t width, uint32_t height) {
+static const uint32_t MOTION_BLOCK = 16;
+static const int MOTION_RANGE = 32;          // поиск глобального сдвига, пикселей
+static const int MOTION_MAX_VECTOR = 64;     // предел вектора блока
+static const int MOTION_REFINE_STEPS = 8;
+
+struct MotionVector {
+    int dx;
+    int dy;
+};
+
+struct BlockCopy {
+    uint32_t block;
+    int dx;
+    int dy;
+};
+
+// Плоскость, по которой ищется движение: RGB целиком или Y для YUV420
+struct MotionPlane {
+    const uint8_t* data;
+    size_t stride;
+    uint32_t bytesPerPixel;
+};
+
+static MotionPlane getMotionPlane(const std::vector<uint8_t>& frame, uint32_t width,
+                                  AVOPixelFormat format) {
+    MotionPlane plane;
+    plane.data = frame.data();
+    plane.bytesPerPixel = (format == AVO_PIXEL_YUV420) ? 1 : 3;
+    plane.stride = static_cast<size_t>(width) * plane.bytesPerPixel;
+    return plane;
+}
+
+// SAD блока 16 строк по rowBytes байт (кратно 16); прерывается при превышении limit
+static uint32_t blockSAD(const uint8_t* a, const uint8_t* b, size_t stride,
+                         uint32_t rowBytes, uint32_t limit) {
+    uint32_t sad = 0;
+    for (uint32_t y = 0; y < MOTION_BLOCK; y++) {
+        const uint8_t* rowA = a + y * stride;
+        const uint8_t* rowB = b + y * stride;
+#if defined(__SSE2__)
+        __m128i acc = _mm_setzero_si128();
+        for (uint32_t x = 0; x < rowBytes; x += 16) {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowA + x));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowB + x));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+        }
+        sad += static_cast<uint32_t>(_mm_cvtsi128_si32(acc) +
+                                     _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#else
+        for (uint32_t x = 0; x < rowBytes; x++) {
+            sad += static_cast<uint32_t>(std::abs(rowA[x] - rowB[x]));
+        }
+#endif
+        if (sad >= limit) {
+            return sad;
+        }
+    }
+    return sad;
+}
+
+// Проекции (суммы по столбцам и строкам) первого байта каждого пикселя
+static void computeProjections(const MotionPlane& plane, uint32_t width, uint32_t height,
+                               std::vector<int32_t>& columns, std::vector<int32_t>& rows) {
+    columns.assign(width, 0);
+    rows.assign(height, 0);
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* row = plane.data + y * plane.stride;
+        int32_t rowSum = 0;
+        for (uint32_t x = 0; x < width; x++) {
+            int32_t value = row[x * plane.bytesPerPixel];
+            columns[x] += value;
+            rowSum += value;
+        }
+        rows[y] = rowSum;
+    }
+}
+
+// Сдвиг s, при котором curr[i] ~ ref[i + s]
+static int bestProjectionShift(const std::vector<int32_t>& curr, const std::vector<int32_t>& ref) {
+    int size = static_cast<int>(curr.size());
+    int range = std::min(MOTION_RANGE, size / 4);
+    int bestShift = 0;
+    double bestCost = -1.0;
+    
+    for (int s = -range; s <= range; s++) {
+        int from = std::max(0, -s);
+        int to = std::min(size, size - s);
+        int64_t cost = 0;
+        for (int i = from; i < to; i++) {
+            cost += std::abs(curr[i] - ref[i + s]);
+        }
+        double normalized = static_cast<double>(cost) / (to - from);
+        if (bestCost < 0 || normalized < bestCost) {
+            bestCost = normalized;
+            bestShift = s;
+        }
+    }
+    return bestShift;
+}
+
+static void findBlockCopies(const std::vector<uint8_t>& reference, const std::vector<uint8_t>& frame,
+                            uint32_t width, uint32_t height, AVOPixelFormat format,
+                            const std::vector<uint8_t>& taken,
+                            std::vector<BlockCopy>& copies) {
+    copies.clear();
+    
+    uint32_t blocksX = width / MOTION_BLOCK;
+    uint32_t blocksY = height / MOTION_BLOCK;
+    if (blocksX == 0 || blocksY == 0) {
+        return;
+    }
+    
+    MotionPlane refPlane = getMotionPlane(reference, width, format);
+    MotionPlane curPlane = getMotionPlane(frame, width, format);
+    uint32_t rowBytes = MOTION_BLOCK * refPlane.bytesPerPixel;
+    
+    // Глобальный сдвиг (панорама, прокрутка) по проекциям кадра - первый кандидат
+    std::vector<int32_t> refColumns, refRows, curColumns, curRows;
+    computeProjections(refPlane, width, height, refColumns, refRows);
+    computeProjections(curPlane, width, height, curColumns, curRows);
+    MotionVector global = {bestProjectionShift(curColumns, refColumns),
+                           bestProjectionShift(curRows, refRows)};
+    
+    // Блок с малой средней разницей оставляем остатку (меньше 2 на байт)
+    const uint32_t skipSAD = MOTION_BLOCK * rowBytes * 2;
+    
+    std::vector<MotionVector> vectors(static_cast<size_t>(blocksX) * blocksY, MotionVector{0, 0});
+    
+    for (uint32_t by = 0; by < blocksY; by++) {
+        for (uint32_t bx = 0; bx < blocksX; bx++) {
+            // Блок уже восстановлен другим способом (из фона)
+            if (!taken.empty() && taken[by * blocksX + bx]) {
+                continue;
+            }
+            
+            int x = static_cast<int>(bx * MOTION_BLOCK);
+            int y = static_cast<int>(by * MOTION_BLOCK);
+            const uint8_t* cur = curPlane.data + y * curPlane.stride + x * curPlane.bytesPerPixel;
+            
+            auto cost = [&](const MotionVector& v, uint32_t limit) -> uint32_t {
+                int sx = x + v.dx;
+                int sy = y + v.dy;
+                if (std::abs(v.dx) > MOTION_MAX_VECTOR || std::abs(v.dy) > MOTION_MAX_VECTOR ||
+                    sx < 0 || sy < 0 ||
+                    sx + static_cast<int>(MOTION_BLOCK) > static_cast<int>(width) ||
+                    sy + static_cast<int>(MOTION_BLOCK) > static_cast<int>(height)) {
+                    return UINT32_MAX;
+                }
+                const uint8_t* ref = refPlane.data + sy * refPlane.stride + sx * refPlane.bytesPerPixel;
+                return blockSAD(cur, ref, refPlane.stride, rowBytes, limit);
+            };
+            
+            uint32_t zeroCost = cost(MotionVector{0, 0}, UINT32_MAX);
+            if (zeroCost < skipSAD) {
+                continue;
+            }
+            
+            // Кандидаты: глобальный сдвиг и векторы соседей слева и сверху
+            MotionVector best = {0, 0};
+            uint32_t bestCost = zeroCost;
+            MotionVector candidates[3] = {global, {0, 0}, {0, 0}};
+            int candidateCount = 1;
+            if (bx > 0) {
+                candidates[candidateCount++] = vectors[by * blocksX + bx - 1];
+            }
+            if (by > 0) {
+                candidates[candidateCount++] = vectors[(by - 1) * blocksX + bx];
+            }
+            
+            for (int i = 0; i < candidateCount; i++) {
+                uint32_t c = cost(candidates[i], bestCost);
+                if (c < bestCost) {
+                    bestCost = c;
+                    best = candidates[i];
+                }
+            }
+            
+            // Уточнение малым ромбом вокруг лучшего кандидата
+            static const MotionVector steps[4] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+            for (int iteration = 0; iteration < MOTION_REFINE_STEPS && bestCost > 0; iteration++) {
+                MotionVector center = best;
+                for (const MotionVector& step : steps) {
+                    MotionVector v = {center.dx + step.dx, center.dy + step.dy};
+                    uint32_t c = cost(v, bestCost);
+                    if (c < bestCost) {
+                        bestCost = c;
+                        best = v;
+                    }
+                }
+                if (best.dx == center.dx && best.dy == center.dy) {
+                    break;
+                }
+            }
+            
+            // Копирование выгодно, только если заметно уменьшает разницу
+            if ((best.dx != 0 || best.dy != 0) && bestCost * 2 < zeroCost) {
+                vectors[by * blocksX + bx] = best;
+                copies.push_back(BlockCopy{by * blocksX + bx, best.dx, best.dy});
+            }
+        }
+    }
+}
+
+// Копирование блоков из source в frame со сдвигом (source - опорный кадр или фон)
+static bool applyBlockCopies(const std::vector<uint8_t>& reference, std::vector<uint8_t>& frame,
+                             uint32_t width, uint32_t height, AVOPixelFormat format,
+                             const std::vector<BlockCopy>& copies) {
+    uint32_t blocksX = width / MOTION_BLOCK;
+    uint32_t blocksY = height / MOTION_BLOCK;
+    MotionPlane plane = getMotionPlane(reference, width, format);
+    uint32_t rowBytes = MOTION_BLOCK * plane.bytesPerPixel;
+    
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    size_t chromaOffset = static_cast<size_t>(width) * height;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    
+    for (const BlockCopy& copy : copies) {
+        if (copy.block >= blocksX * blocksY) {
+            return false;
+        }
+        int x = static_cast<int>((copy.block % blocksX) * MOTION_BLOCK);
+        int y = static_cast<int>((copy.block / blocksX) * MOTION_BLOCK);
+        int sx = x + copy.dx;
+        int sy = y + copy.dy;
+        if (sx < 0 || sy < 0 || sx + static_cast<int>(MOTION_BLOCK) > static_cast<int>(width) ||
+            sy + static_cast<int>(MOTION_BLOCK) > static_cast<int>(height)) {
+            return false;
+        }
+        
+        for (uint32_t row = 0; row < MOTION_BLOCK; row++) {
+            memcpy(frame.data() + (y + row) * plane.stride + x * plane.bytesPerPixel,
+                   reference.data() + (sy + row) * plane.stride + sx * plane.bytesPerPixel,
+                   rowBytes);
+        }
+        
+        if (format == AVO_PIXEL_YUV420) {
+            // Цветность: блок 8x8, сдвиг округляется вниз и ограничивается плоскостью
+            int half = static_cast<int>(MOTION_BLOCK / 2);
+            int cx = x / 2;
+            int cy = y / 2;
+            int csx = std::min(std::max(cx + (copy.dx >> 1), 0), static_cast<int>(chromaWidth) - half);
+            int csy = std::min(std::max(cy + (copy.dy >> 1), 0), static_cast<int>(chromaHeight) - half);
+            for (size_t p = 0; p < 2; p++) {
+                size_t base = chromaOffset + p * chromaSize;
+                for (int row = 0; row < half; row++) {
+                    memcpy(frame.data() + base + (cy + row) * chromaWidth + cx,
+                           reference.data() + base + (csy + row) * chromaWidth + csx,
+                           half);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// ================= ДОЛГОВРЕМЕННЫЙ ФОН =================
+// С флагом AVO_FLAG_BACKGROUND кодер и декодер ведут одинаковую модель фона
+// (AVOStreamContext) по восстановленным кадрам: байт, не менявшийся
+// BACKGROUND_STABLE_FRAMES кадров подряд, переносится в фон. На ключевом
+// кадре модель сбрасывается. Данные изменений начинаются с блока
+// восстановления фона: число блоков 16x16 (4 байта) и приращения их
+// индексов (varint); такие блоки берутся из фона без сдвига.
+
+static const uint8_t BACKGROUND_STABLE_FRAMES = 30;
+
+void AVOCodec::updateStreamContext(AVOStreamContext& context,
+                                   const std::vector<uint8_t>& frame,
+                                   bool isKeyFrame) {
+    if (isKeyFrame || context.lastFrame.size() != frame.size()) {
+        context.background = frame;
+        context.lastFrame = frame;
+        context.stableCount.assign(frame.size(), 0);
+        return;
+    }
+    
+    const uint8_t* cur = frame.data();
+    uint8_t* last = context.lastFrame.data();
+    uint8_t* count = context.stableCount.data();
+    uint8_t* background = context.background.data();
+    size_t size = frame.size();
+    size_t i = 0;
+    
+#if defined(__SSE2__)
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i stable = _mm_set1_epi8(static_cast<char>(BACKGROUND_STABLE_FRAMES));
+    for (; i + 16 <= size; i += 16) {
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i));
+        __m128i vl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(last + i));
+        __m128i vn = _mm_loadu_si128(reinterpret_cast<const __m128i*>(count + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + i));
+        
+        // Счетчик растет (с насыщением), пока байт не меняется, иначе сбрасывается
+        __m128i same = _mm_cmpeq_epi8(vc, vl);
+        vn = _mm_and_si128(_mm_adds_epu8(vn, one), same);
+        
+        // Устоявшиеся байты (счетчик >= порога) переходят в фон
+        __m128i adopt = _mm_cmpeq_epi8(_mm_max_epu8(vn, stable), vn);
+        vb = _mm_or_si128(_mm_and_si128(adopt, vc), _mm_andnot_si128(adopt, vb));
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(count + i), vn);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(background + i), vb);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(last + i), vc);
+    }
+#endif
+    
+    for (; i < size; i++) {
+        if (cur[i] == last[i]) {
+            if (count[i] < 255) {
+                count[i]++;
+            }
+        } else {
+            count[i] = 0;
+        }
+        if (count[i] >= BACKGROUND_STABLE_FRAMES) {
+            background[i] = cur[i];
+        }
+        last[i] = cur[i];
+    }
+}
+
+// Блоки, которые ближе к фону, чем к опорному кадру
+static void findBackgroundBlocks(const std::vector<uint8_t>& reference,
+                                 const std::vector<uint8_t>& background,
+                                 const std::vector<uint8_t>& frame,
+                                 uint32_t width, uint32_t height, AVOPixelFormat format,
+                                 std::vector<BlockCopy>& blocks) {
+    blocks.clear();
+    
+    uint32_t blocksX = width / MOTION_BLOCK;
+    uint32_t blocksY = height / MOTION_BLOCK;
+    MotionPlane refPlane = getMotionPlane(reference, width, format);
+    MotionPlane bgPlane = getMotionPlane(background, width, format);
+    MotionPlane curPlane = getMotionPlane(frame, width, format);
+    uint32_t rowBytes = MOTION_BLOCK * refPlane.bytesPerPixel;
+    const uint32_t skipSAD = MOTION_BLOCK * rowBytes * 2;
+    
+    for (uint32_t by = 0; by < blocksY; by++) {
+        for (uint32_t bx = 0; bx < blocksX; bx++) {
+            size_t offset = by * MOTION_BLOCK * refPlane.stride + bx * rowBytes;
+            uint32_t refCost = blockSAD(curPlane.data + offset, refPlane.data + offset,
+                                        refPlane.stride, rowBytes, UINT32_MAX);
+            if (refCost < skipSAD) {
+                continue;
+            }
+            
+            uint32_t bgCost = blockSAD(curPlane.data + offset, bgPlane.data + offset,
+                                       refPlane.stride, rowBytes, refCost / 2);
+            if (bgCost * 2 < refCost) {
+                blocks.push_back(BlockCopy{by * blocksX + bx, 0, 0});
+            }
+        }
+    }
+}
+
+static void appendBlockIndices(std::vector<uint8_t>& out, const std::vector<BlockCopy>& blocks,
+                               bool withVectors) {
+    appendU32(out, static_cast<uint32_t>(blocks.size()));
+    uint32_t prevBlock = 0;
+    for (const BlockCopy& block : blocks) {
+        uint32_t delta = block.block - prevBlock;
+        while (delta >= 0x80) {
+            out.push_back(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(delta));
+        if (withVectors) {
+            out.push_back(static_cast<uint8_t>(static_cast<int8_t>(block.dx)));
+            out.push_back(static_cast<uint8_t>(static_cast<int8_t>(block.dy)));
+        }
+        prevBlock = block.block;
+    }
+}
+
+static bool readBlockIndices(const uint8_t* data, size_t size, size_t& pos,
+                             bool withVectors, std::vector<BlockCopy>& blocks) {
+    uint32_t count;
+    if (!readU32(data, size, pos, count) || count > size - pos) {
+        return false;
+    }
+    
+    blocks.resize(count);
+    uint32_t block = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (true) {
+            if (pos >= size || shift > 28) {
+                return false;
+            }
+            uint8_t byte = data[pos++];
+            delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+            shift += 7;
+        }
+        block += delta;
+        blocks[i].block = block;
+        blocks[i].dx = 0;
+        blocks[i].dy = 0;
+        if (withVectors) {
+            if (pos + 2 > size) {
+                return false;
+            }
+            blocks[i].dx = static_cast<int8_t>(data[pos]);
+            blocks[i].dy = static_cast<int8_t>(data[pos + 1]);
+            pos += 2;
+        }
+    }
+    return true;
+}
+
+std::vector<uint8_t> AVOCodec::encodeDiffPayload(const std::vector<uint8_t>& reference,
+                                                 const std::vector<uint8_t>& frame,
+                                                 uint32_t width, uint32_t height,
+                                                 const AVOEncoderOptions& options,
+                                                 std::vector<uint8_t>& reconstructed,
+                                                 const AVOStreamContext* context) {
+    AVOPixelFormat format = getPixelFormat(options.flags);
+    bool sameSize = reference.size() == frame.size();
+    std::vector<uint8_t> result;
+    auto compareStart = std::chrono::steady_clock::now();
+    
+    // Предсказание: опорный кадр, блоки из фона и сдвинутые блоки
+    reconstructed = reference;
+    std::vector<BlockCopy> backgroundBlocks;
+    std::vector<BlockCopy> copies;
+    
+    if ((options.flags & AVO_FLAG_BACKGROUND) && sameSize && context &&
+        context->background.size() == frame.size()) {
+        findBackgroundBlocks(reference, context->background, frame, width, height, format,
+                             backgroundBlocks);
+        applyBlockCopies(context->background, reconstructed, width, height, format,
+                         backgroundBlocks);
+    }
+    
+    if ((options.flags & AVO_FLAG_MOTION) && sameSize) {
+        std::vector<uint8_t> taken;
+        if (!backgroundBlocks.empty()) {
+            taken.assign((width / MOTION_BLOCK) * (height / MOTION_BLOCK), 0);
+            for (const BlockCopy& block : backgroundBlocks) {
+                taken[block.block] = 1;
+            }
+        }
+        findBlockCopies(reference, frame, width, height, format, taken, copies);
+        applyBlockCopies(reference, reconstructed, width, height, format, copies);
+    }
+    
+    std::vector<PixelChange> changes;
+    if (options.thresholds) {
+        compareFrames(reconstructed, frame, width, height, *options.thresholds, changes);
+    } else {
+        compareFrames(reconstructed, frame, width, height, changes);
+    }
+    
+    auto compressStart = std::chrono::steady_clock::now();
+    if (options.timing) {
+        options.timing->compareUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            compressStart - compareStart).count();
+        options.timing->compressUs = 0;
+    }
+    
+    if (changes.empty() && copies.empty() && backgroundBlocks.empty()) {
+        // Нет изменений - пустые данные
+        return result;
+    }
+    
+    if (options.flags & AVO_FLAG_BACKGROUND) {
+        appendBlockIndices(result, backgroundBlocks, false);
+    }
+    if (options.flags & AVO_FLAG_MOTION) {
+        appendBlockIndices(result, copies, true);
+    }
+    
+    std::vector<uint8_t> packed = compressChanges(changes, options.flags);
+    result.insert(result.end(), packed.begin(), packed.end());
+    
+    applyChanges(reconstructed, changes, reconstructed, width, height);
+    if (options.timing) {
+        options.timing->compressUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - compressStart).count();
+    }
+    return result;
+}
+
+bool AVOCodec::decodeDiffPayload(const std::vector<uint8_t>& payload,
+                                 const std::vector<uint8_t>& reference,
+                                 uint32_t width, uint32_t height,
+                                 uint32_t flags,
+                                 std::vector<uint8_t>& frame,
+                                 const AVOStreamContext* context) {
+    return decodeDiffPayload(payload.data(), payload.size(), reference, width, height,
+                             flags, frame, context);
+}
+
+bool AVOCodec::decodeDiffPayload(const uint8_t* payload, size_t size,
+                                 const std::vector<uint8_t>& reference,
+                                 uint32_t width, uint32_t height,
+                                 uint32_t flags,
+                                 std::vector<uint8_t>& frame,
+                                 const AVOStreamContext* context) {
+    // Пустые данные или маркер "нет изменений" - кадр не изменился
+    if (size == 0 || (size == 1 && payload[0] == 0)) {
+        frame = reference;
+        return true;
+    }
+    
+    AVOPixelFormat format = getPixelFormat(flags);
+    std::vector<uint8_t> predicted = reference;
+    size_t pos = 0;
+    
+    if (flags & AVO_FLAG_BACKGROUND) {
+        std::vector<BlockCopy> backgroundBlocks;
+        if (!readBlockIndices(payload, size, pos, false, backgroundBlocks)) {
+            std::cerr << "Corrupted background data" << std::endl;
+            return false;
+        }
+        if (!backgroundBlocks.empty()) {
+            if (!context || context->background.size() != reference.size() ||
+                !applyBlockCopies(context->background, predicted, width, height, format,
+                                  backgroundBlocks)) {
+                std::cerr << "Background reference is not available" << std::endl;
+                return false;
+            }
+        }
+    }
+    
+    if (flags & AVO_FLAG_MOTION) {
+        std::vector<BlockCopy> copies;
+        if (!readBlockIndices(payload, size, pos, true, copies)) {
+            std::cerr << "Corrupted motion data" << std::endl;
+            return false;
+        }
+        if (!applyBlockCopies(reference, predicted, width, height, format, copies)) {
+            std::cerr << "Invalid motion vector" << std::endl;
+            return false;
+        }
+    }
+    
+    std::vector<PixelChange> changes;
+    // Серии идут по тройкам байт опорного кадра и не пересекаются
+    size_t maxChanges = (reference.size() + 2) / 3;
+    if (!decompressChanges(payload + pos, size - pos, flags, maxChanges, changes)) {
+        return false;
+    }
+    
+    applyChanges(predicted, changes, frame, width, height);
+    return true;
+}
+
+// ================= ВНУТРИКАДРОВОЕ СЖАТИЕ =================
+// Формат: сигнатура "AVOI" (4 байта), версия (1 байт), затем 3 плоскости
+// (G, R-G, B-G), каждая: режим (1 байт), размер блока (4 байта), блок AVOEntropy.
+// Плоскость до энтропийного кодирования - построчно байт фильтра и остатки.
+
+static const uint8_t INTRA_SIGNATURE[4] = {'A', 'V', 'O', 'I'};
+static const uint8_t INTRA_VERSION = 1;
+static const size_t INTRA_HEADER_SIZE = 5;
+
+enum IntraFilter : uint8_t {
+    FILTER_NONE = 0,
+    FILTER_LEFT = 1,
+    FILTER_UP = 2,
+    FILTER_PAETH = 3
+};
+
+enum IntraPlaneMode : uint8_t {
+    PLANE_PLAIN = 0,     // остатки без RLE
+    PLANE_ZERO_RLE = 1   // серии нулевых остатков: 0, длина-1
+};
+
+// Предсказатель Paeth (как в PNG)
+static inline int paethPredict(int a, int b, int c) {
+    int pa = abs(b - c);         // |p - a|, где p = a + b - c
+    int pb = abs(a - c);         // |p - b|
+    int pc = abs(a + b - 2 * c); // |p - c|
+    int bc = (pb <= pc) ? b : c;
+    return (pa <= pb && pa <= pc) ? a : bc;
+}
+
+// Остатки всех трех предсказателей для одной строки и суммы их модулей
+static void filterRow(const uint8_t* row, const uint8_t* prev, uint32_t width,
+                      uint8_t* left, uint8_t* up, uint8_t* paeth,
+                      uint32_t sums[3]) {
+    left[0] = row[0];
+    up[0] = static_cast<uint8_t>(row[0] - prev[0]);
+    paeth[0] = up[0];
+    
+    uint32_t x = 1;
+    
+#if defined(__SSE2__)
+    // 16 пикселей за итерацию; Paeth считается в 16-битных лайнах.
+    // Сумма |int8| через psadbw: |(r ^ 0x80) - 0x80| = |r|
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+    __m128i accLeft = zero, accUp = zero, accPaeth = zero;
+    
+    for (; x + 16 <= width; x += 16) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        __m128i a8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+        __m128i b8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x));
+        __m128i c8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev + x - 1));
+        
+        __m128i pred[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i a = half ? _mm_unpackhi_epi8(a8, zero) : _mm_unpacklo_epi8(a8, zero);
+            __m128i b = half ? _mm_unpackhi_epi8(b8, zero) : _mm_unpacklo_epi8(b8, zero);
+            __m128i c = half ? _mm_unpackhi_epi8(c8, zero) : _mm_unpacklo_epi8(c8, zero);
+            
+            __m128i bc = _mm_sub_epi16(b, c);
+            __m128i ac = _mm_sub_epi16(a, c);
+            __m128i abc = _mm_add_epi16(bc, ac);
+            __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+            __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+            __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+            
+            __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+            __m128i useC = _mm_cmpgt_epi16(pb, pc);
+            __m128i predBC = _mm_or_si128(_mm_and_si128(useC, c), _mm_andnot_si128(useC, b));
+            pred[half] = _mm_or_si128(_mm_and_si128(notA, predBC), _mm_andnot_si128(notA, a));
+        }
+        
+        __m128i rLeft = _mm_sub_epi8(cur, a8);
+        __m128i rUp = _mm_sub_epi8(cur, b8);
+        __m128i rPaeth = _mm_sub_epi8(cur, _mm_packus_epi16(pred[0], pred[1]));
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(left + x), rLeft);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(up + x), rUp);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(paeth + x), rPaeth);
+        
+        accLeft = _mm_add_epi64(accLeft, _mm_sad_epu8(_mm_xor_si128(rLeft, bias), bias));
+        accUp = _mm_add_epi64(accUp, _mm_sad_epu8(_mm_xor_si128(rUp, bias), bias));
+        accPaeth = _mm_add_epi64(accPaeth, _mm_sad_epu8(_mm_xor_si128(rPaeth, bias), bias));
+    }
+    
+    sums[0] = static_cast<uint32_t>(_mm_cvtsi128_si32(accLeft) +
+                                    _mm_cvtsi128_si32(_mm_srli_si128(accLeft, 8)));
+    sums[1] = static_cast<uint32_t>(_mm_cvtsi128_si32(accUp) +
+                                    _mm_cvtsi128_si32(_mm_srli_si128(accUp, 8)));
+    sums[2] = static_cast<uint32_t>(_mm_cvtsi128_si32(accPaeth) +
+                                    _mm_cvtsi128_si32(_mm_srli_si128(accPaeth, 8)));
+#else
+    sums[0] = sums[1] = sums[2] = 0;
+#endif
+    
+    for (; x < width; x++) {
+        int a = row[x - 1];
+        int b = prev[x];
+        int c = prev[x - 1];
+        left[x] = static_cast<uint8_t>(row[x] - a);
+        up[x] = static_cast<uint8_t>(row[x] - b);
+        paeth[x] = static_cast<uint8_t>(row[x] - paethPredict(a, b, c));
+        sums[0] += abs(static_cast<int8_t>(left[x]));
+        sums[1] += abs(static_cast<int8_t>(up[x]));
+        sums[2] += abs(static_cast<int8_t>(paeth[x]));
+    }
+    
+    sums[0] += abs(static_cast<int8_t>(left[0]));
+    sums[1] += abs(static_cast<int8_t>(up[0]));
+    sums[2] += abs(static_cast<int8_t>(paeth[0]));
+}
+
+// Построчная фильтрация плоскости: для каждой строки выбирается
+// предсказатель с минимальной суммой модулей остатков
+static void filterPlane(const uint8_t* plane, uint32_t width, uint32_t height,
+                        std::vector<uint8_t>& out) {
+    out.resize(static_cast<size_t>(height) * (width + 1));
+    if (width == 0) {
+        return;
+    }
+    
+    std::vector<uint8_t> zeroRow(width, 0);
+    std::vector<uint8_t> buffers(static_cast<size_t>(width) * 3);
+    uint8_t* left = buffers.data();
+    uint8_t* up = left + width;
+    uint8_t* paeth = up + width;
+    
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* row = plane + static_cast<size_t>(y) * width;
+        const uint8_t* prev = (y > 0) ? row - width : zeroRow.data();
+        
+        uint32_t sums[3];
+        filterRow(row, prev, width, left, up, paeth, sums);
+        uint32_t sumLeft = sums[0], sumUp = sums[1], sumPaeth = sums[2];
+        
+        uint8_t filter = FILTER_LEFT;
+        const uint8_t* best = left;
+        if (sumUp < sumLeft && sumUp <= sumPaeth) {
+            filter = FILTER_UP;
+            best = up;
+        } else if (sumPaeth < sumLeft) {
+            filter = FILTER_PAETH;
+            best = paeth;
+        }
+        
+        uint8_t* dst = out.data() + static_cast<size_t>(y) * (width + 1);
+        dst[0] = filter;
+        memcpy(dst + 1, best, width);
+    }
+}
+
+static bool unfilterPlane(const std::vector<uint8_t>& filtered, uint32_t width, uint32_t height,
+                          uint8_t* plane) {
+    if (filtered.size() != static_cast<size_t>(height) * (width + 1)) {
+        return false;
+    }
+    
+    std::vector<uint8_t> zeroRow(width, 0);
+    
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* src = filtered.data() + static_cast<size_t>(y) * (width + 1);
+        uint8_t* row = plane + static_cast<size_t>(y) * width;
+        const uint8_t* prev = (y > 0) ? row - width : zeroRow.data();
+        const uint8_t* residual = src + 1;
+        
+        switch (src[0]) {
+            case FILTER_NONE:
+                memcpy(row, residual, width);
+                break;
+            case FILTER_LEFT: {
+                uint8_t a = 0;
+                for (uint32_t x = 0; x < width; x++) {
+                    a = static_cast<uint8_t>(residual[x] + a);
+                    row[x] = a;
+                }
+                break;
+            }
+            case FILTER_UP:
+                for (uint32_t x = 0; x < width; x++) {
+                    row[x] = static_cast<uint8_t>(residual[x] + prev[x]);
+                }
+                break;
+            case FILTER_PAETH: {
+                if (width == 0) break;
+                int a = static_cast<uint8_t>(residual[0] + prev[0]);
+                row[0] = static_cast<uint8_t>(a);
+                for (uint32_t x = 1; x < width; x++) {
+                    a = static_cast<uint8_t>(residual[x] + paethPredict(a, prev[x], prev[x - 1]));
+                    row[x] = static_cast<uint8_t>(a);
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    
+    return true;
+}
+
+static void packZeroRuns(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+    // Худший случай - одиночные нули: 2 байта на входной байт
+    out.resize(in.size() * 2);
+    
+    const uint8_t* src = in.data();
+    const uint8_t* end = src + in.size();
+    uint8_t* dst = out.data();
+    
+    while (src < end) {
+        if (*src != 0) {
+            *dst++ = *src++;
+            continue;
+        }
+        const uint8_t* runEnd = src + 1;
+        const uint8_t* runLimit = std::min(end, src + 256);
+        // Длинные серии нулей проверяем по 8 байт
+        uint64_t word;
+        while (runEnd + 8 <= runLimit && (memcpy(&word, runEnd, 8), word == 0)) {
+            runEnd += 8;
+        }
+        while (runEnd < runLimit && *runEnd == 0) {
+            runEnd++;
+        }
+        *dst++ = 0;
+        *dst++ = static_cast<uint8_t>(runEnd - src - 1);
+        src = runEnd;
+    }
+    
+    out.resize(dst - out.data());
+}
+
+static bool unpackZeroRuns(const std::vector<uint8_t>& in, size_t expectedSize,
+                           std::vector<uint8_t>& out) {
+    out.resize(expectedSize);
+    
+    const uint8_t* src = in.data();
+    const uint8_t* srcEnd = src + in.size();
+    uint8_t* dst = out.data();
+    uint8_t* dstEnd = dst + expectedSize;
+    
+    while (src < srcEnd) {
+        if (*src != 0) {
+            if (dst >= dstEnd) return false;
+            *dst++ = *src++;
+            continue;
+        }
+        if (src + 1 >= srcEnd) return false;
+        size_t run = static_cast<size_t>(src[1]) + 1;
+        if (run > static_cast<size_t>(dstEnd - dst)) return false;
+        memset(dst, 0, run);
+        dst += run;
+        src += 2;
+    }
+    
+    return dst == dstEnd;
+}
+
+// Кодирование одной плоскости: фильтр -> RLE нулей (если выгодно) -> энтропия
+static void encodeIntraPlane(const uint8_t* plane, uint32_t width, uint32_t height,
+                             std::vector<uint8_t>& out) {
+    std::vector<uint8_t> filtered;
+    filterPlane(plane, width, height, filtered);
+    
+    std::vector<uint8_t> packed;
+    packZeroRuns(filtered, packed);
+    
+    // RLE выгоден только при длинных сериях нулей (плоские области)
+    uint8_t mode = PLANE_PLAIN;
+    const std::vector<uint8_t>* source = &filtered;
+    if (packed.size() * 5 < filtered.size() * 4) {
+        mode = PLANE_ZERO_RLE;
+        source = &packed;
+    }
+    
+    std::vector<uint8_t> block = AVOEntropy::compress(*source);
+    
+    out.push_back(mode);
+    uint32_t netBlockSize = htonl(static_cast<uint32_t>(block.size()));
+    out.insert(out.end(),
+               reinterpret_cast<const uint8_t*>(&netBlockSize),
+               reinterpret_cast<const uint8_t*>(&netBlockSize) + 4);
+    out.insert(out.end(), block.begin(), block.end());
+}
+
+static bool decodeIntraPlane(const uint8_t* data, size_t size, size_t& pos,
+                             uint32_t width, uint32_t height, uint8_t* plane) {
+    if (pos + 5 > size) {
+        return false;
+    }
+    
+    uint8_t mode = data[pos];
+    uint32_t netBlockSize;
+    memcpy(&netBlockSize, &data[pos + 1], 4);
+    uint32_t blockSize = ntohl(netBlockSize);
+    pos += 5;
+    
+    if (blockSize > size - pos) {
+        return false;
+    }
+    
+    // Упакованная плоскость не длиннее отфильтрованной (иначе пишется как есть)
+    size_t filteredSize = static_cast<size_t>(height) * (width + 1);
+    std::vector<uint8_t> decoded;
+    if (!AVOEntropy::decompress(data + pos, blockSize, decoded, filteredSize)) {
+        return false;
+    }
+    pos += blockSize;
+    
+    if (mode == PLANE_ZERO_RLE) {
+        std::vector<uint8_t> filtered;
+        if (!unpackZeroRuns(decoded, filteredSize, filtered)) {
+            return false;
+        }
+        return unfilterPlane(filtered, width, height, plane);
+    }
+    
+    if (mode != PLANE_PLAIN) {
+        return false;
+    }
+    return unfilterPlane(decoded, width, height, plane);
+}
+
+std::vector<uint8_t> AVOCodec::encodeIntraFrame(const std::vector<uint8_t>& frameData,
+                                                uint32_t width, uint32_t height,
+                                                AVOPixelFormat format) {
+    return encodeIntraFrame(frameData.data(), frameData.size(), width, height, format);
+}
+
+std::vector<uint8_t> AVOCodec::encodeIntraFrame(const uint8_t* frameData, size_t size,
+                                                uint32_t width, uint32_t height,
+                                                AVOPixelFormat format) {
+    std::vector<uint8_t> result;
+    
+    size_t totalPixels = static_cast<size_t>(width) * height;
+    if (size != getFrameSize(width, height, format) || totalPixels == 0) {
+        return result;
+    }
+    
+    if (format == AVO_PIXEL_YUV420) {
+        // Плоскости уже разделены: Y, затем U и V вдвое меньшего размера
+        uint32_t chromaWidth = (width + 1) / 2;
+        uint32_t chromaHeight = (height + 1) / 2;
+        const uint8_t* planeY = frameData;
+        const uint8_t* planeU = planeY + totalPixels;
+        const uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+        
+        result.reserve(size / 2);
+        result.insert(result.end(), INTRA_SIGNATURE, INTRA_SIGNATURE + 4);
+        result.push_back(INTRA_VERSION);
+        
+        encodeIntraPlane(planeY, width, height, result);
+        encodeIntraPlane(planeU, chromaWidth, chromaHeight, result);
+        encodeIntraPlane(planeV, chromaWidth, chromaHeight, result);
+        return result;
+    }
+    
+    // Разделение на плоскости с цветовой декорреляцией: G, R-G, B-G
+    std::vector<uint8_t> planes(totalPixels * 3);
+    uint8_t* planeG = planes.data();
+    uint8_t* planeR = planeG + totalPixels;
+    uint8_t* planeB = planeR + totalPixels;
+    
+    for (size_t i = 0; i < totalPixels; i++) {
+        uint8_t r = frameData[i * 3];
+        uint8_t g = frameData[i * 3 + 1];
+        uint8_t b = frameData[i * 3 + 2];
+        planeG[i] = g;
+        planeR[i] = static_cast<uint8_t>(r - g);
+        planeB[i] = static_cast<uint8_t>(b - g);
+    }
+    
+    result.reserve(size / 3);
+    result.insert(result.end(), INTRA_SIGNATURE, INTRA_SIGNATURE + 4);
+    result.push_back(INTRA_VERSION);
+    
+    encodeIntraPlane(planeG, width, height, result);
+    encodeIntraPlane(planeR, width, height, result);
+    encodeIntraPlane(planeB, width, height, result);
+    
+    return result;
+}
+
+bool AVOCodec::isIntraFrame(const std::vector<uint8_t>& data) {
+    return isIntraFrame(data.data(), data.size());
+}
+
+bool AVOCodec::isIntraFrame(const uint8_t* data, size_t size) {
+    return size >= INTRA_HEADER_SIZE &&
+           memcmp(data, INTRA_SIGNATURE, 4) == 0 &&
+           data[4] == INTRA_VERSION;
+}
+
+bool AVOCodec::decodeIntraFrame(const std::vector<uint8_t>& data,
+                                uint32_t width, uint32_t height,
+                                std::vector<uint8_t>& frameData,
+                                AVOPixelFormat format) {
+    return decodeIntraFrame(data.data(), data.size(), width, height, frameData, format);
+}
+
+bool AVOCodec::decodeIntraFrame(const uint8_t* data, size_t size,
+                                uint32_t width, uint32_t height,
+                                std::vector<uint8_t>& frameData,
+                                AVOPixelFormat format) {
+    if (!isIntraFrame(data, size)) {
+        std::cerr << "Invalid intra frame signature" << std::endl;
+        return false;
+    }
+    
+    size_t totalPixels = static_cast<size_t>(width) * height;
+    
+    if (format == AVO_PIXEL_YUV420) {
+        uint32_t chromaWidth = (width + 1) / 2;
+        uint32_t chromaHeight = (height + 1) / 2;
+        std::vector<uint8_t> yuv(getFrameSize(width, height, format), 0);
+        uint8_t* planeY = yuv.data();
+        uint8_t* planeU = planeY + totalPixels;
+        uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+        
+        size_t pos = INTRA_HEADER_SIZE;
+        if (!decodeIntraPlane(data, size, pos, width, height, planeY) ||
+            !decodeIntraPlane(data, size, pos, chromaWidth, chromaHeight, planeU) ||
+            !decodeIntraPlane(data, size, pos, chromaWidth, chromaHeight, planeV)) {
+            std::cerr << "Corrupted intra frame data" << std::endl;
+            return false;
+        }
+        
+        frameData.swap(yuv);
+        return true;
+    }
+    
+    std::vector<uint8_t> planes(totalPixels * 3);
+    uint8_t* planeG = planes.data();
+    uint8_t* planeR = planeG + totalPixels;
+    uint8_t* planeB = planeR + totalPixels;
+    
+    size_t pos = INTRA_HEADER_SIZE;
+    if (!decodeIntraPlane(data, size, pos, width, height, planeG) ||
+        !decodeIntraPlane(data, size, pos, width, height, planeR) ||
+        !decodeIntraPlane(data, size, pos, width, height, planeB)) {
+        std::cerr << "Corrupted intra frame data" << std::endl;
+        return false;
+    }
+    
+    frameData.resize(totalPixels * 3);
+    for (size_t i = 0; i < totalPixels; i++) {
+        uint8_t g = planeG[i];
+        frameData[i * 3] = static_cast<uint8_t>(planeR[i] + g);
+        frameData[i * 3 + 1] = g;
+        frameData[i * 3 + 2] = static_cast<uint8_t>(planeB[i] + g);
+    }
+    
+    return true;
+}
+
+uint8_t AVOCodec::encodeKeyFrame(const std::vector<uint8_t>& frameData,
+                                 uint32_t width, uint32_t height,
+                                 std::vector<uint8_t>& payload,
+                                 AVOPixelFormat format) {
+    payload = encodeIntraFrame(frameData, width, height, format);
+    
+    // Сжатый кадр всегда меньше исходного - по размеру их можно различить
+    if (payload.empty() || payload.size() >= frameData.size()) {
+        payload = frameData;
+        return AVO_FRAME_FULL;
+    }
+    
+    return AVO_FRAME_INTRA;
+}
+
+bool AVOCodec::decodeKeyFrame(const std::vector<uint8_t>& payload,
+                              uint32_t width, uint32_t height,
+                              std::vector<uint8_t>& frameData,
+                              AVOPixelFormat format) {
+    if (payload.size() == getFrameSize(width, height, format)) {
+        frameData = payload;
+        return true;
+    }
+    
+    return decodeIntraFrame(payload, width, height, frameData, format);
+}
+
+// ================= ФОРМАТ ПИКСЕЛЕЙ YUV 4:2:0 =================
+// Планарный буфер: Y (width*height), U и V ((width+1)/2 * (height+1)/2),
+// дополненный нулями до кратного 3 размера - так сравнение и применение
+// изменений работают с ним как с тройками байт без отдельного кода.
+// Преобразование - BT.601 полного диапазона в целых числах:
+//   Y = (77R + 150G + 29B + 128) >> 8
+//   U = ((128B - 43R - 85G + 127) >> 8) + 128
+//   V = ((128R - 107G - 21B + 127) >> 8) + 128
+// Цветность считается по среднему блока 2x2.
+
+static inline uint8_t clampByte(int value) {
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline uint8_t rgbToY(int r, int g, int b) {
+    return static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+static inline uint8_t rgbToU(int r, int g, int b) {
+    return static_cast<uint8_t>(((128 * b - 43 * r - 85 * g + 127) >> 8) + 128);
+}
+
+static inline uint8_t rgbToV(int r, int g, int b) {
+    return static_cast<uint8_t>(((128 * r - 107 * g - 21 * b + 127) >> 8) + 128);
+}
+
+static inline void yuvToRGB(int y, int u, int v, uint8_t* rgb) {
+    int d = u - 128;
+    int e = v - 128;
+    rgb[0] = clampByte(y + ((90 * e + 32) >> 6));
+    rgb[1] = clampByte(y - ((22 * d + 46 * e + 32) >> 6));
+    rgb[2] = clampByte(y + ((113 * d + 32) >> 6));
+}
+
+// Пара строк (y0, y1) начиная со столбца xStart (четный)
+static void rgbToYUVRowsScalar(const uint8_t* rgb, uint32_t width, uint32_t height,
+                               uint32_t y0, uint32_t xStart,
+                               uint8_t* planeY, uint8_t* planeU, uint8_t* planeV) {
+    uint32_t y1 = std::min(y0 + 1, height - 1);
+    uint32_t chromaWidth = (width + 1) / 2;
+    const uint8_t* row0 = rgb + static_cast<size_t>(y0) * width * 3;
+    const uint8_t* row1 = rgb + static_cast<size_t>(y1) * width * 3;
+    
+    for (uint32_t x = xStart; x < width; x++) {
+        planeY[static_cast<size_t>(y0) * width + x] = rgbToY(row0[x * 3], row0[x * 3 + 1], row0[x * 3 + 2]);
+        planeY[static_cast<size_t>(y1) * width + x] = rgbToY(row1[x * 3], row1[x * 3 + 1], row1[x * 3 + 2]);
+    }
+    
+    for (uint32_t x0 = xStart; x0 < width; x0 += 2) {
+        uint32_t x1 = std::min(x0 + 1, width - 1);
+        int sum[3];
+        for (int c = 0; c < 3; c++) {
+            sum[c] = (row0[x0 * 3 + c] + row0[x1 * 3 + c] +
+                      row1[x0 * 3 + c] + row1[x1 * 3 + c] + 2) >> 2;
+        }
+        size_t chromaIndex = static_cast<size_t>(y0 / 2) * chromaWidth + x0 / 2;
+        planeU[chromaIndex] = rgbToU(sum[0], sum[1], sum[2]);
+        planeV[chromaIndex] = rgbToV(sum[0], sum[1], sum[2]);
+    }
+}
+
+#if defined(__SSE2__)
+// Один шаг перестановки 96 байт (6 регистров): out[2i] = in[i], out[2i+1] = in[48+i].
+// Пять шагов переводят RGBRGB... (32 пикселя) в R R G G B B
+static inline void interleaveStep(__m128i* v) {
+    __m128i t0 = _mm_unpacklo_epi8(v[0], v[3]);
+    __m128i t1 = _mm_unpackhi_epi8(v[0], v[3]);
+    __m128i t2 = _mm_unpacklo_epi8(v[1], v[4]);
+    __m128i t3 = _mm_unpackhi_epi8(v[1], v[4]);
+    __m128i t4 = _mm_unpacklo_epi8(v[2], v[5]);
+    __m128i t5 = _mm_unpackhi_epi8(v[2], v[5]);
+    v[0] = t0; v[1] = t1; v[2] = t2; v[3] = t3; v[4] = t4; v[5] = t5;
+}
+
+// Обратный шаг: out[i] = in[2i], out[48+i] = in[2i+1].
+// Пять шагов переводят R R G G B B обратно в RGBRGB...
+static inline void deinterleaveStep(__m128i* v) {
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    __m128i t0 = _mm_packus_epi16(_mm_and_si128(v[0], mask), _mm_and_si128(v[1], mask));
+    __m128i t1 = _mm_packus_epi16(_mm_and_si128(v[2], mask), _mm_and_si128(v[3], mask));
+    __m128i t2 = _mm_packus_epi16(_mm_and_si128(v[4], mask), _mm_and_si128(v[5], mask));
+    __m128i t3 = _mm_packus_epi16(_mm_srli_epi16(v[0], 8), _mm_srli_epi16(v[1], 8));
+    __m128i t4 = _mm_packus_epi16(_mm_srli_epi16(v[2], 8), _mm_srli_epi16(v[3], 8));
+    __m128i t5 = _mm_packus_epi16(_mm_srli_epi16(v[4], 8), _mm_srli_epi16(v[5], 8));
+    v[0] = t0; v[1] = t1; v[2] = t2; v[3] = t3; v[4] = t4; v[5] = t5;
+}
+
+// 32 пикселя RGB -> регистры R0 R1 G0 G1 B0 B1 (по 16 пикселей)
+static inline void loadPlanarRGB(const uint8_t* rgb, __m128i* v) {
+    for (int i = 0; i < 6; i++) {
+        v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 16));
+    }
+    for (int i = 0; i < 5; i++) {
+        interleaveStep(v);
+    }
+}
+
+// Y для 8 пикселей в 16-битных лайнах
+static inline __m128i lumaEpi16(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+    return _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+}
+
+// Сумма соседних пар 16-битных лайнов двух регистров -> 8 лайнов
+static inline __m128i pairSumEpi16(__m128i lo, __m128i hi) {
+    const __m128i mask = _mm_set1_epi32(0xFFFF);
+    __m128i sumLo = _mm_add_epi32(_mm_and_si128(lo, mask), _mm_srli_epi32(lo, 16));
+    __m128i sumHi = _mm_add_epi32(_mm_and_si128(hi, mask), _mm_srli_epi32(hi, 16));
+    return _mm_packs_epi32(sumLo, sumHi);
+}
+
+// Среднее блоков 2x2 для 16 пикселей канала двух строк -> 8 значений
+static inline __m128i chromaAverage(__m128i row0, __m128i row1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+    return _mm_srli_epi16(_mm_add_epi16(pairSumEpi16(lo, hi), _mm_set1_epi16(2)), 2);
+}
+
+static inline __m128i chromaEpi16(__m128i a, int ca, __m128i b, int cb, __m128i c, int cc) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_set1_epi16(static_cast<short>(ca))),
+                                _mm_set1_epi16(127));
+    sum = _mm_sub_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(static_cast<short>(cb))));
+    sum = _mm_sub_epi16(sum, _mm_mullo_epi16(c, _mm_set1_epi16(static_cast<short>(cc))));
+    return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+#endif
+
+void AVOCodec::rgbToYUV420(const std::vector<uint8_t>& rgbData,
+                           uint32_t width, uint32_t height,
+                           std::vector<uint8_t>& yuvData) {
+    yuvData.assign(getFrameSize(width, height, AVO_PIXEL_YUV420), 0);
+    if (width == 0 || height == 0 || rgbData.size() < static_cast<size_t>(width) * height * 3) {
+        return;
+    }
+    
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    uint8_t* planeY = yuvData.data();
+    uint8_t* planeU = planeY + static_cast<size_t>(width) * height;
+    uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+    const uint8_t* rgb = rgbData.data();
+    
+    for (uint32_t y = 0; y < height; y += 2) {
+        uint32_t x = 0;
+#if defined(__SSE2__)
+        if (y + 1 < height) {
+            const uint8_t* row0 = rgb + static_cast<size_t>(y) * width * 3;
+            const uint8_t* row1 = row0 + static_cast<size_t>(width) * 3;
+            uint8_t* outY0 = planeY + static_cast<size_t>(y) * width;
+            uint8_t* outY1 = outY0 + width;
+            uint8_t* outU = planeU + static_cast<size_t>(y / 2) * chromaWidth;
+            uint8_t* outV = planeV + static_cast<size_t>(y / 2) * chromaWidth;
+            const __m128i zero = _mm_setzero_si128();
+            
+            for (; x + 32 <= width; x += 32) {
+                __m128i p0[6], p1[6];
+                loadPlanarRGB(row0 + x * 3, p0);
+                loadPlanarRGB(row1 + x * 3, p1);
+                
+                // Яркость: 4 группы по 16 пикселей
+                for (int half = 0; half < 2; half++) {
+                    __m128i y0lo = lumaEpi16(_mm_unpacklo_epi8(p0[half], zero),
+                                             _mm_unpacklo_epi8(p0[2 + half], zero),
+                                             _mm_unpacklo_epi8(p0[4 + half], zero));
+                    __m128i y0hi = lumaEpi16(_mm_unpackhi_epi8(p0[half], zero),
+                                             _mm_unpackhi_epi8(p0[2 + half], zero),
+                                             _mm_unpackhi_epi8(p0[4 + half], zero));
+                    __m128i y1lo = lumaEpi16(_mm_unpacklo_epi8(p1[half], zero),
+                                             _mm_unpacklo_epi8(p1[2 + half], zero),
+                                             _mm_unpacklo_epi8(p1[4 + half], zero));
+                    __m128i y1hi = lumaEpi16(_mm_unpackhi_epi8(p1[half], zero),
+                                             _mm_unpackhi_epi8(p1[2 + half], zero),
+                                             _mm_unpackhi_epi8(p1[4 + half], zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(outY0 + x + half * 16),
+                                     _mm_packus_epi16(y0lo, y0hi));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(outY1 + x + half * 16),
+                                     _mm_packus_epi16(y1lo, y1hi));
+                }
+                
+                // Цветность: 16 значений из блоков 2x2
+                __m128i r0 = chromaAverage(p0[0], p1[0]);
+                __m128i r1 = chromaAverage(p0[1], p1[1]);
+                __m128i g0 = chromaAverage(p0[2], p1[2]);
+                __m128i g1 = chromaAverage(p0[3], p1[3]);
+                __m128i b0 = chromaAverage(p0[4], p1[4]);
+                __m128i b1 = chromaAverage(p0[5], p1[5]);
+                
+                __m128i u = _mm_packus_epi16(chromaEpi16(b0, 128, r0, 43, g0, 85),
+                                             chromaEpi16(b1, 128, r1, 43, g1, 85));
+                __m128i v = _mm_packus_epi16(chromaEpi16(r0, 128, g0, 107, b0, 21),
+                                             chromaEpi16(r1, 128, g1, 107, b1, 21));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(outU + x / 2), u);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(outV + x / 2), v);
+            }
+        }
+#endif
+        rgbToYUVRowsScalar(rgb, width, height, y, x, planeY, planeU, planeV);
+    }
+}
+
+void AVOCodec::yuv420ToRGB(const std::vector<uint8_t>& yuvData,
+                           uint32_t width, uint32_t height,
+                           std::vector<uint8_t>& rgbData) {
+    rgbData.resize(static_cast<size_t>(width) * height * 3);
+    if (width == 0 || height == 0 ||
+        yuvData.size() < getFrameSize(width, height, AVO_PIXEL_YUV420)) {
+        std::fill(rgbData.begin(), rgbData.end(), 0);
+        return;
+    }
+    
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    const uint8_t* planeY = yuvData.data();
+    const uint8_t* planeU = planeY + static_cast<size_t>(width) * height;
+    const uint8_t* planeV = planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+    
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* rowY = planeY + static_cast<size_t>(y) * width;
+        const uint8_t* rowU = planeU + static_cast<size_t>(y / 2) * chromaWidth;
+        const uint8_t* rowV = planeV + static_cast<size_t>(y / 2) * chromaWidth;
+        uint8_t* out = rgbData.data() + static_cast<size_t>(y) * width * 3;
+        uint32_t x = 0;
+        
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bias = _mm_set1_epi16(128);
+        const __m128i round = _mm_set1_epi16(32);
+        
+        for (; x + 32 <= width; x += 32) {
+            __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowU + x / 2));
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowV + x / 2));
+            __m128i planar[6];
+            
+            for (int half = 0; half < 2; half++) {
+                __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowY + x + half * 16));
+                // Каждое значение цветности - на два соседних пикселя
+                __m128i uu = half == 0 ? _mm_unpacklo_epi8(u, u) : _mm_unpackhi_epi8(u, u);
+                __m128i vv = half == 0 ? _mm_unpacklo_epi8(v, v) : _mm_unpackhi_epi8(v, v);
+                __m128i rgb[3][2];
+                
+                for (int part = 0; part < 2; part++) {
+                    __m128i y16 = part == 0 ? _mm_unpacklo_epi8(luma, zero) : _mm_unpackhi_epi8(luma, zero);
+                    __m128i d = _mm_sub_epi16(part == 0 ? _mm_unpacklo_epi8(uu, zero)
+                                                        : _mm_unpackhi_epi8(uu, zero), bias);
+                    __m128i e = _mm_sub_epi16(part == 0 ? _mm_unpacklo_epi8(vv, zero)
+                                                        : _mm_unpackhi_epi8(vv, zero), bias);
+                    
+                    __m128i cr = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(e, _mm_set1_epi16(90)), round), 6);
+                    __m128i cg = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(
+                        _mm_mullo_epi16(d, _mm_set1_epi16(22)),
+                        _mm_mullo_epi16(e, _mm_set1_epi16(46))), round), 6);
+                    __m128i cb = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(d, _mm_set1_epi16(113)), round), 6);
+                    
+                    rgb[0][part] = _mm_add_epi16(y16, cr);
+                    rgb[1][part] = _mm_sub_epi16(y16, cg);
+                    rgb[2][part] = _mm_add_epi16(y16, cb);
+                }
+                
+                for (int c = 0; c < 3; c++) {
+                    planar[c * 2 + half] = _mm_packus_epi16(rgb[c][0], rgb[c][1]);
+                }
+            }
+            
+            for (int i = 0; i < 5; i++) {
+                deinterleaveStep(planar);
+            }
+            for (int i = 0; i < 6; i++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 3 + i * 16), planar[i]);
+            }
+        }
+#endif
+        
+        for (; x < width; x++) {
+            yuvToRGB(rowY[x], rowU[x / 2], rowV[x / 2], out + x * 3);
+        }
+    }
+}
+
+size_t AVOCodec::getFrameSize(uint32_t width, uint32_t height, AVOPixelFormat format) {
+    size_t totalPixels = static_cast<size_t>(width) * height;
+    if (format != AVO_PIXEL_YUV420) {
+        return totalPixels * 3;
+    }
+    
+    size_t chromaSize = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    size_t size = totalPixels + chromaSize * 2;
+    return (size + 2) / 3 * 3;
+}
+
+AVOPixelFormat AVOCodec::getPixelFormat(uint32_t flags) {
+    return (flags & AVO_FLAG_YUV420) ? AVO_PIXEL_YUV420 : AVO_PIXEL_RGB24;
+}
+
+std::vector<uint8_t> AVOCodec::createBlackFrame(uint32_t width, uint32_t height,
+                                                AVOPixelFormat format) {
+    if (format != AVO_PIXEL_YUV420) {
+        return createBlackFrame(width, height);
+    }
+    
+    // Черный в YUV: Y = 0, U = V = 128 (дополнение в конце - нули)
+    std::vector<uint8_t> frame(getFrameSize(width, height, format), 0);
+    size_t lumaSize = static_cast<size_t>(width) * height;
+    size_t chromaSize = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    std::fill(frame.begin() + lumaSize, frame.begin() + lumaSize + chromaSize * 2, 128);
+    return frame;
+}
+
+std::vector<uint8_t> AVOCodec::createBlackFrame(uint32_t width, uint32_t height) {
+    return std::vector<uint8_t>(width * height * 3, 0);
+}
+
+float AVOCodec::getDiffPercentage(const std::vector<uint8_t>& prevFrame,
+                                 const std::vector<uint8_t>& currFrame,
+                                 uint32_t width, uint32_t height) {
     if (prevFrame.size() != currFrame.size() || prevFrame.empty()) {
         return 100.0f;
     }
@@ -366,14 +2332,127 @@ float AVOCodec::getDiffPercentage(const std::vector<uint8_t>& prevFrame,
     return (changedPixels * 100.0f) / totalPixels;
 }
 
+// Разреженная сетка: каждый SAMPLE_GRID-й пиксель каждой SAMPLE_GRID-й строки.
+// Сдвиг сетки меняется с phase, поэтому объект от SAMPLE_GRID x SAMPLE_GRID
+// пикселей замечается сразу, а любое стойкое изменение - за SAMPLE_GRID^2 кадров
+static const uint32_t SAMPLE_GRID = 8;
+
+static bool samplePlaneChanged(const uint8_t* prev, const uint8_t* curr, size_t stride,
+                               uint32_t width, uint32_t height, uint32_t bytesPerPixel,
+                               uint32_t grid, uint32_t offsetX, uint32_t offsetY) {
+    for (uint32_t y = offsetY; y < height; y += grid) {
+        const uint8_t* prevRow = prev + y * stride;
+        const uint8_t* currRow = curr + y * stride;
+        for (uint32_t x = offsetX; x < width; x += grid) {
+            size_t idx = x * bytesPerPixel;
+            for (uint32_t c = 0; c < bytesPerPixel; c++) {
+                if (abs((int)prevRow[idx + c] - (int)currRow[idx + c]) > CHANGE_THRESHOLD) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool AVOCodec::hasSampledChanges(const std::vector<uint8_t>& prevFrame,
+                                 const std::vector<uint8_t>& currFrame,
+                                 uint32_t width, uint32_t height,
+                                 AVOPixelFormat format, uint32_t phase) {
+    if (prevFrame.size() != currFrame.size() ||
+        prevFrame.size() < getFrameSize(width, height, format)) {
+        return true;
+    }
+    
+    uint32_t offsetX = phase % SAMPLE_GRID;
+    uint32_t offsetY = (phase / SAMPLE_GRID) % SAMPLE_GRID;
+    
+    if (format != AVO_PIXEL_YUV420) {
+        return samplePlaneChanged(prevFrame.data(), currFrame.data(), width * 3,
+                                  width, height, 3, SAMPLE_GRID, offsetX, offsetY);
+    }
+    
+    // YUV420: яркость по той же сетке, цветность - по сетке вдвое реже
+    if (samplePlaneChanged(prevFrame.data(), currFrame.data(), width,
+                           width, height, 1, SAMPLE_GRID, offsetX, offsetY)) {
+        return true;
+    }
+    
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+    size_t uOffset = static_cast<size_t>(width) * height;
+    uint32_t chromaGrid = SAMPLE_GRID / 2;
+    
+    for (size_t plane = uOffset; plane < uOffset + 2 * chromaSize; plane += chromaSize) {
+        if (samplePlaneChanged(prevFrame.data() + plane, currFrame.data() + plane, chromaWidth,
+                               chromaWidth, chromaHeight, 1, chromaGrid,
+                               offsetX % chromaGrid, offsetY % chromaGrid)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Оценка по выборке: проверяется каждая DIFF_SAMPLE_STEP-я тройка и ее левый
+// сосед - этого достаточно, чтобы оценить число серий compareFrames
+static const uint32_t DIFF_SAMPLE_STEP = 17;
+static const size_t RLE_BYTES_PER_RUN = 8;      // compressRLE: смещение, RGB, счетчик
+static const size_t ENTROPY_BYTES_PER_RUN = 3;  // в среднем после кода Хаффмана
+
+size_t AVOCodec::estimateDiffSize(const std::vector<uint8_t>& prevFrame,
+                                  const std::vector<uint8_t>& currFrame,
+                                  uint32_t flags) {
+    if (prevFrame.size() != currFrame.size() || prevFrame.empty()) {
+        return SIZE_MAX;
+    }
+    
+    size_t totalPixels = currFrame.size() / 3;
+    size_t runStarts = 0;
+    size_t changedSamples = 0;
+    
+    for (size_t i = 1; i < totalPixels; i += DIFF_SAMPLE_STEP) {
+        const uint8_t* prev = &prevFrame[i * 3];
+        const uint8_t* curr = &currFrame[i * 3];
+        if (!tripletChanged(prev, curr)) {
+            continue;
+        }
+        changedSamples++;
+        
+        // Серия продолжается только изменившимся пикселем того же цвета
+        bool continuesRun = tripletChanged(prev - 3, curr - 3) &&
+                            curr[0] == curr[-3] && curr[1] == curr[-2] && curr[2] == curr[-1];
+        if (!continuesRun) {
+            runStarts++;
+        }
+    }
+    
+    // Серии длиннее 255 пикселей разбиваются
+    size_t runs = (runStarts + changedSamples / 255) * DIFF_SAMPLE_STEP;
+    size_t bytesPerRun = (flags & AVO_FLAG_ENTROPY) ? ENTROPY_BYTES_PER_RUN : RLE_BYTES_PER_RUN;
+    return runs * bytesPerRun;
+}
+
+// Заголовок сетевого пакета - 32 байта (все в сетевом порядке байт):
+// сигнатура с версией, frameId, packetId, totalPackets, width, height,
+// dataSize, flags. После данных может идти время захвата (8 байт: старшие
+// и младшие 4). Пакеты без сигнатуры (24-байтный заголовок первых версий)
+// и других версий отвергаются: сервер и клиент должны быть одной версии
+static const uint32_t NETWORK_MAGIC = 0x41564E01;      // "AVN" и версия 1
+static const size_t NETWORK_HEADER_SIZE = 32;
+static const size_t NETWORK_TIMESTAMP_SIZE = 8;
+
 std::vector<uint8_t> AVOCodec::createNetworkPacket(const std::vector<uint8_t>& data,
                                                   uint32_t frameId,
                                                   uint32_t packetId,
                                                   uint32_t totalPackets,
                                                   uint32_t width,
-                                                  uint32_t height) {
+                                                  uint32_t height,
+                                                  uint32_t flags,
+                                                  uint64_t captureTimeUs) {
     std::vector<uint8_t> packet;
-    packet.resize(24 + data.size()); // 24 байта заголовка
+    packet.resize(NETWORK_HEADER_SIZE + data.size() +
+                  (captureTimeUs != 0 ? NETWORK_TIMESTAMP_SIZE : 0));
     
     // Заголовок (все в сетевом порядке байт)
     uint32_t netFrameId = htonl(frameId);
@@ -382,17 +2461,25 @@ std::vector<uint8_t> AVOCodec::createNetworkPacket(const std::vector<uint8_t>& d
     uint32_t netWidth = htonl(width);
     uint32_t netHeight = htonl(height);
     uint32_t netDataSize = htonl(static_cast<uint32_t>(data.size()));
+    uint32_t netFlags = htonl(flags);
     
-    memcpy(packet.data(), &netFrameId, 4);
-    memcpy(packet.data() + 4, &netPacketId, 4);
-    memcpy(packet.data() + 8, &netTotalPackets, 4);
-    memcpy(packet.data() + 12, &netWidth, 4);
-    memcpy(packet.data() + 16, &netHeight, 4);
-    memcpy(packet.data() + 20, &netDataSize, 4);
+    putU32(packet.data(), NETWORK_MAGIC);
+    memcpy(packet.data() + 4, &netFrameId, 4);
+    memcpy(packet.data() + 8, &netPacketId, 4);
+    memcpy(packet.data() + 12, &netTotalPackets, 4);
+    memcpy(packet.data() + 16, &netWidth, 4);
+    memcpy(packet.data() + 20, &netHeight, 4);
+    memcpy(packet.data() + 24, &netDataSize, 4);
+    memcpy(packet.data() + 28, &netFlags, 4);
     
     // Данные
     if (!data.empty()) {
-        memcpy(packet.data() + 24, data.data(), data.size());
+        memcpy(packet.data() + NETWORK_HEADER_SIZE, data.data(), data.size());
+    }
+    if (captureTimeUs != 0) {
+        uint8_t* timestamp = packet.data() + NETWORK_HEADER_SIZE + data.size();
+        putU32(timestamp, static_cast<uint32_t>(captureTimeUs >> 32));
+        putU32(timestamp + 4, static_cast<uint32_t>(captureTimeUs));
     }
     
     return packet;
@@ -405,19 +2492,60 @@ bool AVOCodec::parseNetworkPacket(const std::vector<uint8_t>& packet,
                                  uint32_t& totalPackets,
                                  uint32_t& width,
                                  uint32_t& height) {
-    if (packet.size() < 24) {
+    uint32_t flags;
+    return parseNetworkPacket(packet, data, frameId, packetId, totalPackets,
+                              width, height, flags);
+}
+
+bool AVOCodec::parseNetworkPacket(const std::vector<uint8_t>& packet,
+                                 std::vector<uint8_t>& data,
+                                 uint32_t& frameId,
+                                 uint32_t& packetId,
+                                 uint32_t& totalPackets,
+                                 uint32_t& width,
+                                 uint32_t& height,
+                                 uint32_t& flags) {
+    uint64_t captureTimeUs;
+    return parseNetworkPacket(packet, data, frameId, packetId, totalPackets,
+                              width, height, flags, captureTimeUs);
+}
+
+bool AVOCodec::parseNetworkPacket(const std::vector<uint8_t>& packet,
+                                 std::vector<uint8_t>& data,
+                                 uint32_t& frameId,
+                                 uint32_t& packetId,
+                                 uint32_t& totalPackets,
+                                 uint32_t& width,
+                                 uint32_t& height,
+                                 uint32_t& flags,
+                                 uint64_t& captureTimeUs) {
+    captureTimeUs = 0;
+    if (packet.size() < NETWORK_HEADER_SIZE) {
+        return false;
+    }
+    
+    size_t magicPos = 0;
+    uint32_t magic;
+    readU32(packet.data(), packet.size(), magicPos, magic);
+    if (magic != NETWORK_MAGIC) {
+        static std::atomic<bool> reported{false};
+        if (!reported.exchange(true)) {
+            std::cerr << "Network packet of another protocol version (signature 0x" << std::hex
+                      << magic << std::dec << "), ignoring" << std::endl;
+        }
         return false;
     }
     
     // Читаем заголовок
-    memcpy(&frameId, packet.data(), 4);
-    memcpy(&packetId, packet.data() + 4, 4);
-    memcpy(&totalPackets, packet.data() + 8, 4);
-    memcpy(&width, packet.data() + 12, 4);
-    memcpy(&height, packet.data() + 16, 4);
+    memcpy(&frameId, packet.data() + 4, 4);
+    memcpy(&packetId, packet.data() + 8, 4);
+    memcpy(&totalPackets, packet.data() + 12, 4);
+    memcpy(&width, packet.data() + 16, 4);
+    memcpy(&height, packet.data() + 20, 4);
     
     uint32_t dataSize;
-    memcpy(&dataSize, packet.data() + 20, 4);
+    memcpy(&dataSize, packet.data() + 24, 4);
+    memcpy(&flags, packet.data() + 28, 4);
     
     // Конвертируем из сетевого порядка байт
     frameId = ntohl(frameId);
@@ -426,23 +2554,171 @@ bool AVOCodec::parseNetworkPacket(const std::vector<uint8_t>& packet,
     width = ntohl(width);
     height = ntohl(height);
     dataSize = ntohl(dataSize);
+    flags = ntohl(flags);
     
     // Проверяем размер данных
-    if (packet.size() < 24 + dataSize) {
+    if (packet.size() - NETWORK_HEADER_SIZE < dataSize) {
         return false;
     }
     
     // Копируем данные
     data.resize(dataSize);
-    memcpy(data.data(), packet.data() + 24, dataSize);
+    memcpy(data.data(), packet.data() + NETWORK_HEADER_SIZE, dataSize);
+    
+    if (packet.size() - NETWORK_HEADER_SIZE - dataSize >= NETWORK_TIMESTAMP_SIZE) {
+        size_t pos = NETWORK_HEADER_SIZE + dataSize;
+        uint32_t high = 0, low = 0;
+        readU32(packet.data(), packet.size(), pos, high);
+        readU32(packet.data(), packet.size(), pos, low);
+        captureTimeUs = (static_cast<uint64_t>(high) << 32) | low;
+    }
     
     return true;
 }
 
-// Исправленная функция для создания архива с реальными задержками
+// Расширенный заголовок архива: сигнатура "AVO2" и флаги (4 байта, сетевой
+// порядок) перед AVOHeader. Архивы без флагов пишутся в старом формате.
+// Старый формат начинается с ширины кадра, поэтому сигнатуру не спутать.
+static const uint8_t ARCHIVE_SIGNATURE[4] = {'A', 'V', 'O', '2'};
+
+static void writeArchiveHeader(std::ofstream& file, const AVOHeader& header, uint32_t flags) {
+    if (flags != 0) {
+        uint32_t netFlags = htonl(flags);
+        file.write(reinterpret_cast<const char*>(ARCHIVE_SIGNATURE), sizeof(ARCHIVE_SIGNATURE));
+        file.write(reinterpret_cast<const char*>(&netFlags), sizeof(netFlags));
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+static bool readArchiveHeader(std::ifstream& file, AVOHeader& header, uint32_t& flags) {
+    flags = 0;
+    
+    uint8_t signature[4];
+    if (!file.read(reinterpret_cast<char*>(signature), sizeof(signature))) {
+        return false;
+    }
+    
+    if (memcmp(signature, ARCHIVE_SIGNATURE, sizeof(signature)) == 0) {
+        uint32_t netFlags;
+        file.read(reinterpret_cast<char*>(&netFlags), sizeof(netFlags));
+        flags = ntohl(netFlags);
+    } else {
+        file.seekg(0);
+    }
+    
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return static_cast<bool>(file);
+}
+
 bool AVOCodec::encodeVideoArchive(const std::vector<AVOFrame>& frames,
                                  uint32_t width, uint32_t height, 
                                  uint32_t fps, const std::string& filename) {
+    return encodeVideoArchive(frames, width, height, fps, filename, AVOEncoderOptions());
+}
+
+// Исправленная функция для создания архива с реальными задержками
+// Ключевой кадр пробуется, когда оценка изменений больше 1/SCENE_CHANGE_RATIO
+// исходного кадра (типичное внутрикадровое сжатие - 6-10 раз)
+static const size_t SCENE_CHANGE_RATIO = 16;
+
+// Архив кодируется отрезками от ключевого кадра до следующего: внутри отрезка
+// кадры зависят друг от друга, сами отрезки - нет. Кадры входа восстанавливает
+// основной поток (каждый зависит от предыдущего), отрезки с готовыми кадрами
+// (RGB) раздаются потокам и записываются по порядку; результат не зависит
+// от числа потоков
+struct ArchiveRecord {
+    uint8_t frameType;
+    std::vector<uint8_t> payload;
+};
+
+// Кодер одного отрезка: перевод в формат хранения, подавление шума,
+// сравнение с предыдущим кадром, выбор ключевого кадра и упаковка
+class ArchiveSegmentEncoder {
+public:
+    ArchiveSegmentEncoder(uint32_t width, uint32_t height, const AVOEncoderOptions& options)
+        : width(width), height(height), options(options),
+          format(AVOCodec::getPixelFormat(options.flags)),
+          useBackground((options.flags & AVO_FLAG_BACKGROUND) != 0) {}
+    
+    void encodeFrame(const std::vector<uint8_t>& frame, ArchiveRecord& record) {
+        toStoredFormat(frame, currCoded);
+        
+        // Первый кадр отрезка - ключевой (сжатый внутрикадрово, если выгодно)
+        if (first) {
+            record.frameType = AVOCodec::encodeKeyFrame(currCoded, width, height,
+                                                        record.payload, format);
+            first = false;
+        } else {
+            // Смена сцены: если по оценке изменения дороже сжатого ключевого кадра,
+            // кодируем оба варианта и сохраняем меньший
+            bool tryKeyFrame = AVOCodec::estimateDiffSize(prevCoded, currCoded, options.flags) >
+                               currCoded.size() / SCENE_CHANGE_RATIO;
+            if (tryKeyFrame) {
+                record.frameType = AVOCodec::encodeKeyFrame(currCoded, width, height,
+                                                            record.payload, format);
+            }
+            
+            // Находим разницу с восстановленным предыдущим кадром (как у декодера)
+            std::vector<uint8_t> diff = AVOCodec::encodeDiffPayload(prevCoded, currCoded,
+                                                                    width, height, options,
+                                                                    reconstructed, &context);
+            if (!tryKeyFrame || diff.size() < record.payload.size()) {
+                record.payload.swap(diff);
+                currCoded.swap(reconstructed);
+                record.frameType = AVO_FRAME_DIFF;
+            }
+        }
+        
+        // Модель фона ведется так же, как ее поведет декодер
+        if (useBackground) {
+            AVOCodec::updateStreamContext(context, currCoded, record.frameType != AVO_FRAME_DIFF);
+        }
+        prevCoded.swap(currCoded);
+    }
+    
+private:
+    // Кадры на входе - RGB; в архиве они хранятся в формате из флагов.
+    // Подавление шума применяется к кадрам в формате хранения, до сравнения
+    void toStoredFormat(const std::vector<uint8_t>& rgb, std::vector<uint8_t>& out) {
+        if (format == AVO_PIXEL_YUV420) {
+            AVOCodec::rgbToYUV420(rgb, width, height, out);
+        } else {
+            out = rgb;
+        }
+        if (options.denoiseEnter > 0) {
+            AVOCodec::suppressTemporalNoise(out, denoiseState, options.denoiseEnter,
+                                            options.denoiseLeave);
+        }
+    }
+    
+    uint32_t width;
+    uint32_t height;
+    const AVOEncoderOptions& options;
+    AVOPixelFormat format;
+    bool useBackground;
+    bool first = true;
+    AVODenoiseState denoiseState;
+    AVOStreamContext context;
+    std::vector<uint8_t> prevCoded;
+    std::vector<uint8_t> currCoded;
+    std::vector<uint8_t> reconstructed;
+};
+
+// Отрезок в работе: кадры от основного потока и записи от рабочего
+struct ArchiveSegment {
+    std::deque<std::vector<uint8_t>> input;     // восстановленные кадры (RGB)
+    bool inputDone = false;
+    std::vector<ArchiveRecord> records;
+    bool encoded = false;
+};
+
+// Сколько восстановленных кадров одного отрезка ждут рабочего потока
+static const size_t MAX_PENDING_SEGMENT_FRAMES = 16;
+
+bool AVOCodec::encodeVideoArchive(const std::vector<AVOFrame>& frames,
+                                 uint32_t width, uint32_t height, 
+                                 uint32_t fps, const std::string& filename,
+                                 const AVOEncoderOptions& options) {
     if (frames.empty()) {
         std::cerr << "No frames to encode!" << std::endl;
         return false;
@@ -454,73 +2730,221 @@ bool AVOCodec::encodeVideoArchive(const std::vector<AVOFrame>& frames,
         return false;
     }
     
-    // Заголовок архива
-    AVOHeader header;
-    header.width = width;
-    header.height = height;
-    header.fps = 0; // НЕ используем FPS, так как у нас реальные задержки
-    header.totalFrames = static_cast<uint32_t>(frames.size());
-    header.firstFrameSize = static_cast<uint32_t>(frames[0].data.size());
-    
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    
-    // Сохраняем первый кадр (полный)
-    AVOFrame firstFrame = frames[0];
+    const AVOFrame& firstFrame = frames[0];
     if (!firstFrame.isFullFrame) {
         std::cerr << "First frame must be full frame!" << std::endl;
         file.close();
         return false;
     }
     
-    // Сохраняем задержку первого кадра
-    uint32_t netFirstDelay = htonl(firstFrame.delayMs);
-    file.write(reinterpret_cast<const char*>(&netFirstDelay), sizeof(netFirstDelay));
+    // Маска переводится в пороги один раз на весь архив
+    AVOEncoderOptions coderOptions = options;
+    if (!coderOptions.thresholds && !options.mask.empty()) {
+        auto thresholds = std::make_shared<std::vector<uint8_t>>();
+        buildThresholdMap(options.mask, width, height, getPixelFormat(options.flags), *thresholds);
+        coderOptions.thresholds = thresholds;
+    }
+    // Отрезки кодируются в нескольких потоках сразу, а время одного кадра
+    // для архива ничего не значит
+    coderOptions.timing = nullptr;
+    
+    // Границы отрезков: полные кадры входа и принудительные ключевые кадры
+    std::vector<size_t> segmentStarts;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (i == 0 || frames[i].isFullFrame ||
+            (options.keyFrameInterval > 0 && i - segmentStarts.back() >= options.keyFrameInterval)) {
+            segmentStarts.push_back(i);
+        }
+    }
     
-    // Сохраняем первый кадр
-    file.write(reinterpret_cast<const char*>(firstFrame.data.data()), firstFrame.data.size());
+    size_t threadCount = options.threads > 0 ? options.threads : std::thread::hardware_concurrency();
+    threadCount = std::max<size_t>(1, std::min(threadCount, segmentStarts.size()));
+    
+    // Запись кадра по порядку; первый кадр архива пишется с заголовком
+    auto writeRecord = [&](size_t frameIndex, const ArchiveRecord& record) {
+        if (frameIndex == 0) {
+            // Заголовок архива
+            AVOHeader header;
+            header.width = width;
+            header.height = height;
+            header.fps = 0; // НЕ используем FPS, так как у нас реальные задержки
+            header.totalFrames = static_cast<uint32_t>(frames.size());
+            header.firstFrameSize = static_cast<uint32_t>(record.payload.size());
+            
+            writeArchiveHeader(file, header, options.flags);
+            
+            // Сохраняем задержку первого кадра
+            uint32_t netFirstDelay = htonl(firstFrame.delayMs);
+            file.write(reinterpret_cast<const char*>(&netFirstDelay), sizeof(netFirstDelay));
+            
+            // Сохраняем первый кадр
+            file.write(reinterpret_cast<const char*>(record.payload.data()), record.payload.size());
+            return;
+        }
+        
+        // Сохраняем тип кадра (1 байт): AVO_FRAME_DIFF / AVO_FRAME_FULL / AVO_FRAME_INTRA
+        file.write(reinterpret_cast<const char*>(&record.frameType), sizeof(record.frameType));
+        
+        // Сохраняем реальную задержку (4 байта)
+        uint32_t netDelay = htonl(frames[frameIndex].delayMs);
+        file.write(reinterpret_cast<const char*>(&netDelay), sizeof(netDelay));
+        
+        // Сохраняем размер сжатых данных (4 байта)
+        uint32_t netDataSize = htonl(static_cast<uint32_t>(record.payload.size()));
+        file.write(reinterpret_cast<const char*>(&netDataSize), sizeof(netDataSize));
+        
+        // Сохраняем сжатые данные
+        if (!record.payload.empty()) {
+            file.write(reinterpret_cast<const char*>(record.payload.data()), record.payload.size());
+        }
+    };
+    
+    std::mutex segmentMutex;
+    std::condition_variable segmentCondVar;
+    std::map<size_t, ArchiveSegment> segments;
+    size_t startedSegments = 0;
+    size_t nextToEncode = 0;
+    size_t nextToWrite = 0;
+    bool producerDone = false;
+    
+    // Рабочий берет отрезки по порядку и кодирует кадры по мере того,
+    // как основной поток их восстанавливает
+    auto encodeWorker = [&]() {
+        while (true) {
+            std::unique_lock<std::mutex> lock(segmentMutex);
+            segmentCondVar.wait(lock, [&] { return nextToEncode < startedSegments || producerDone; });
+            if (nextToEncode >= startedSegments) {
+                return;
+            }
+            ArchiveSegment& segment = segments[nextToEncode++];
+            
+            ArchiveSegmentEncoder encoder(width, height, coderOptions);
+            std::vector<ArchiveRecord> records;
+            std::vector<uint8_t> frame;
+            while (true) {
+                segmentCondVar.wait(lock, [&] { return !segment.input.empty() || segment.inputDone; });
+                if (segment.input.empty()) {
+                    break;
+                }
+                frame.swap(segment.input.front());
+                segment.input.pop_front();
+                segmentCondVar.notify_all();
+                lock.unlock();
+                
+                ArchiveRecord record;
+                encoder.encodeFrame(frame, record);
+                records.push_back(std::move(record));
+                
+                lock.lock();
+            }
+            
+            segment.records = std::move(records);
+            segment.encoded = true;
+            segmentCondVar.notify_all();
+        }
+    };
     
-    // Сохраняем остальные кадры как изменения
-    std::vector<uint8_t> prevFrame = firstFrame.data;
+    std::vector<std::thread> workers;
+    if (threadCount > 1) {
+        for (size_t t = 0; t < threadCount; t++) {
+            workers.emplace_back(encodeWorker);
+        }
+    }
     
-    for (size_t i = 1; i < frames.size(); i++) {
+    // Пока основной поток ждет места в очереди, он пишет готовые отрезки
+    auto writeReady = [&](std::unique_lock<std::mutex>& lock) {
+        while (segments.count(nextToWrite) && segments[nextToWrite].encoded) {
+            std::vector<ArchiveRecord> records = std::move(segments[nextToWrite].records);
+            segments.erase(nextToWrite);
+            lock.unlock();
+            for (size_t r = 0; r < records.size(); r++) {
+                writeRecord(segmentStarts[nextToWrite] + r, records[r]);
+            }
+            lock.lock();
+            nextToWrite++;
+        }
+    };
+    
+    // Восстановление кадров входа идет последовательно и только здесь;
+    // в работе не больше двух отрезков на поток и не больше
+    // MAX_PENDING_SEGMENT_FRAMES ждущих кадров в каждом
+    const size_t maxInFlight = threadCount * 2;
+    std::vector<uint8_t> inputFrame;
+    std::vector<uint8_t> nextFrame;
+    std::unique_ptr<ArchiveSegmentEncoder> serialEncoder;
+    size_t nextSegment = 0;
+    
+    for (size_t i = 0; i < frames.size(); i++) {
         const AVOFrame& frame = frames[i];
-        
-        // Получаем текущий кадр
-        std::vector<uint8_t> currFrame;
         if (frame.isFullFrame) {
-            currFrame = frame.data;
+            inputFrame = frame.data;
         } else {
             std::vector<PixelChange> changes = decompressRLE(frame.data);
-            applyChanges(prevFrame, changes, currFrame, width, height);
+            applyChanges(inputFrame, changes, nextFrame, width, height);
+            inputFrame.swap(nextFrame);
         }
         
-        // Находим разницу между кадрами
-        std::vector<PixelChange> changes;
-        compareFrames(prevFrame, currFrame, width, height, changes);
-        
-        // Сжимаем изменения
-        std::vector<uint8_t> compressed = compressRLE(changes);
-        
-        // Сохраняем тип кадра (1 байт): 0 = изменения, 1 = полный кадр
-        uint8_t frameType = frame.isFullFrame ? 1 : 0;
-        file.write(reinterpret_cast<const char*>(&frameType), sizeof(frameType));
+        bool segmentStart = nextSegment < segmentStarts.size() && segmentStarts[nextSegment] == i;
+        if (segmentStart) {
+            nextSegment++;
+        }
         
-        // Сохраняем реальную задержку (4 байта)
-        uint32_t netDelay = htonl(frame.delayMs);
-        file.write(reinterpret_cast<const char*>(&netDelay), sizeof(netDelay));
+        if (threadCount == 1) {
+            // Без потоков - кодируем и пишем сразу
+            if (segmentStart) {
+                serialEncoder.reset(new ArchiveSegmentEncoder(width, height, coderOptions));
+            }
+            ArchiveRecord record;
+            serialEncoder->encodeFrame(inputFrame, record);
+            writeRecord(i, record);
+            continue;
+        }
         
-        // Сохраняем размер сжатых данных (4 байта)
-        uint32_t dataSize = static_cast<uint32_t>(compressed.size());
-        uint32_t netDataSize = htonl(dataSize);
-        file.write(reinterpret_cast<const char*>(&netDataSize), sizeof(netDataSize));
+        std::unique_lock<std::mutex> lock(segmentMutex);
+        if (segmentStart) {
+            if (startedSegments > 0) {
+                segments[startedSegments - 1].inputDone = true;
+                segmentCondVar.notify_all();
+            }
+            while (true) {
+                writeReady(lock);
+                if (startedSegments - nextToWrite < maxInFlight) {
+                    break;
+                }
+                segmentCondVar.wait(lock);
+            }
+            segments[startedSegments++];
+        } else {
+            while (true) {
+                writeReady(lock);
+                if (segments[startedSegments - 1].input.size() < MAX_PENDING_SEGMENT_FRAMES) {
+                    break;
+                }
+                segmentCondVar.wait(lock);
+            }
+        }
+        segments[startedSegments - 1].input.push_back(inputFrame);
+        segmentCondVar.notify_all();
+    }
+    
+    if (threadCount > 1) {
+        std::unique_lock<std::mutex> lock(segmentMutex);
+        segments[startedSegments - 1].inputDone = true;
+        producerDone = true;
+        segmentCondVar.notify_all();
         
-        // Сохраняем сжатые данные
-        if (!compressed.empty()) {
-            file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+        while (true) {
+            writeReady(lock);
+            if (nextToWrite == segmentStarts.size()) {
+                break;
+            }
+            segmentCondVar.wait(lock);
         }
+        lock.unlock();
         
-        // Обновляем предыдущий кадр для следующей итерации
-        prevFrame = currFrame;
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
     }
     
     file.close();
@@ -540,90 +2964,441 @@ bool AVOCodec::encodeVideoArchive(const std::vector<AVOFrame>& frames,
     return true;
 }
 
-// Исправленная функция для чтения архива с реальными задержками
 bool AVOCodec::decodeVideoArchive(const std::string& filename,
                                  std::vector<AVOFrame>& frames,
                                  AVOHeader& header) {
+    uint32_t flags;
+    return decodeVideoArchive(filename, frames, header, flags);
+}
+
+// Исправленная функция для чтения архива с реальными задержками:
+// записи берутся из оглавления (readArchiveIndex проверяет их границы
+// по размеру файла) и декодируются по одной
+bool AVOCodec::decodeVideoArchive(const std::string& filename,
+                                 std::vector<AVOFrame>& frames,
+                                 AVOHeader& header,
+                                 uint32_t& flags) {
+    std::vector<AVORecordInfo> records;
+    if (!readArchiveIndex(filename, header, flags, records)) {
+        return false;
+    }
+    
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         std::cerr << "Cannot open archive: " << filename << std::endl;
         return false;
     }
     
-    // Читаем заголовок
-    file.read(reinterpret_cast<char*>(&header), sizeof(header));
-    
     frames.clear();
-    frames.reserve(header.totalFrames);
+    frames.reserve(records.size());
+    
+    // Кадры декодируются в формате архива, наружу отдаются в RGB
+    AVOPixelFormat format = getPixelFormat(flags);
+    
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> prevFrame;
+    std::vector<uint8_t> currFrame;
+    AVOStreamContext context;
+    
+    for (size_t i = 0; i < records.size(); i++) {
+        const AVORecordInfo& record = records[i];
+        payload.resize(record.size);
+        file.seekg(static_cast<std::streamoff>(record.offset));
+        if (!file.read(reinterpret_cast<char*>(payload.data()), record.size) ||
+            !decodeArchiveRecord(record.frameType, payload, prevFrame,
+                                 header.width, header.height, flags, &context, currFrame)) {
+            std::cerr << "Cannot decode frame " << i << " of archive: " << filename << std::endl;
+            return false;
+        }
+        
+        AVOFrame frame;
+        frame.delayMs = record.delayMs;
+        frame.isFullFrame = true; // После декодирования это полный кадр
+        if (format == AVO_PIXEL_YUV420) {
+            yuv420ToRGB(currFrame, header.width, header.height, frame.data);
+        } else {
+            frame.data = currFrame;
+        }
+        frames.push_back(std::move(frame));
+        
+        prevFrame.swap(currFrame);
+    }
+    
+    return true;
+}
+
+// ================= ОГЛАВЛЕНИЕ И ПАРАЛЛЕЛЬНОЕ ДЕКОДИРОВАНИЕ =================
+
+bool AVOCodec::decodeArchiveRecord(uint8_t frameType, const std::vector<uint8_t>& payload,
+                                   const std::vector<uint8_t>& prevFrame,
+                                   uint32_t width, uint32_t height, uint32_t flags,
+                                   AVOStreamContext* context, std::vector<uint8_t>& frame) {
+    return decodeArchiveRecord(frameType, payload.data(), payload.size(), prevFrame,
+                               width, height, flags, context, frame);
+}
+
+bool AVOCodec::decodeArchiveRecord(uint8_t frameType, const uint8_t* payload, size_t size,
+                                   const std::vector<uint8_t>& prevFrame,
+                                   uint32_t width, uint32_t height, uint32_t flags,
+                                   AVOStreamContext* context, std::vector<uint8_t>& frame) {
+    AVOPixelFormat format = getPixelFormat(flags);
+    bool isKeyFrame = frameType != AVO_FRAME_DIFF;
+    
+    if (!isKeyFrame) {
+        if (!decodeDiffPayload(payload, size, prevFrame, width, height, flags, frame, context)) {
+            return false;
+        }
+    } else if (frameType == AVO_FRAME_INTRA) {
+        if (!decodeIntraFrame(payload, size, width, height, frame, format)) {
+            return false;
+        }
+    } else if (size == getFrameSize(width, height, format)) {
+        frame.assign(payload, payload + size);
+    } else {
+        return false;
+    }
+    
+    // Модель фона обновляется так же, как у кодера
+    if (context && (flags & AVO_FLAG_BACKGROUND)) {
+        updateStreamContext(*context, frame, isKeyFrame);
+    }
+    return true;
+}
+
+// Заголовок записи: тип (1), задержка (4), размер (4)
+static const uint64_t RECORD_HEADER_SIZE = 9;
+
+static AVORecordInfo firstArchiveRecord(const AVOHeader& header, uint32_t flags,
+                                        uint32_t netDelay, uint64_t offset) {
+    AVORecordInfo first;
+    first.offset = offset;
+    first.size = header.firstFrameSize;
+    first.delayMs = ntohl(netDelay);
+    first.frameType = header.firstFrameSize ==
+                      AVOCodec::getFrameSize(header.width, header.height,
+                                             AVOCodec::getPixelFormat(flags))
+                      ? AVO_FRAME_FULL : AVO_FRAME_INTRA;
+    return first;
+}
+
+static bool parseRecordHeader(const uint8_t* recordHeader, uint64_t pos, uint64_t fileSize,
+                              AVORecordInfo& record) {
+    uint32_t netValue;
+    record.frameType = recordHeader[0];
+    memcpy(&netValue, recordHeader + 1, sizeof(netValue));
+    record.delayMs = ntohl(netValue);
+    memcpy(&netValue, recordHeader + 5, sizeof(netValue));
+    record.size = ntohl(netValue);
+    record.offset = pos + RECORD_HEADER_SIZE;
+    return record.frameType <= AVO_FRAME_INTRA && record.offset + record.size <= fileSize;
+}
+
+// Файл первого кадра (encodeFirstFrame, например 1test.avo) - тот же
+// заголовок с одним кадром, но без задержки перед данными; задержка
+// берется из частоты
+static bool isFirstFrameFile(const AVOHeader& header, uint32_t flags,
+                             uint64_t headerEnd, uint64_t fileSize) {
+    return flags == 0 && header.totalFrames == 1 &&
+           headerEnd + header.firstFrameSize == fileSize;
+}
+
+static uint32_t firstFrameFileDelay(const AVOHeader& header) {
+    return htonl(header.fps > 0 ? 1000 / header.fps : 33);
+}
+
+// Каждый кадр после первого занимает хотя бы заголовок записи, поэтому
+// число кадров из заголовка архива проверяется по размеру файла до того,
+// как под него резервируется оглавление
+static bool archiveFrameCountFits(const AVOHeader& header, uint64_t dataEnd, uint64_t fileSize) {
+    if (header.totalFrames == 0 || dataEnd > fileSize) {
+        return false;
+    }
+    return header.totalFrames - 1 <= (fileSize - dataEnd) / RECORD_HEADER_SIZE;
+}
+
+bool AVOCodec::readArchiveIndex(const std::string& filename, AVOHeader& header,
+                                uint32_t& flags, std::vector<AVORecordInfo>& records) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cerr << "Cannot open archive: " << filename << std::endl;
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    
+    if (!readArchiveHeader(file, header, flags)) {
+        std::cerr << "Invalid archive header: " << filename << std::endl;
+        return false;
+    }
     
-    // Читаем первый кадр (полный)
-    AVOFrame firstFrame;
+    records.clear();
     
-    // Читаем задержку первого кадра
-    uint32_t netFirstDelay;
-    file.read(reinterpret_cast<char*>(&netFirstDelay), sizeof(netFirstDelay));
-    firstFrame.delayMs = ntohl(netFirstDelay);
-    firstFrame.isFullFrame = true;
+    uint64_t headerEnd = static_cast<uint64_t>(file.tellg());
+    if (isFirstFrameFile(header, flags, headerEnd, fileSize)) {
+        records.push_back(firstArchiveRecord(header, flags, firstFrameFileDelay(header), headerEnd));
+        return true;
+    }
     
-    // Читаем первый кадр
-    firstFrame.data.resize(header.firstFrameSize);
-    file.read(reinterpret_cast<char*>(firstFrame.data.data()), header.firstFrameSize);
+    // Первый кадр: задержка и данные ключевого кадра без байта типа
+    uint32_t netDelay;
+    if (!file.read(reinterpret_cast<char*>(&netDelay), sizeof(netDelay))) {
+        return false;
+    }
     
-    frames.push_back(firstFrame);
+    AVORecordInfo first = firstArchiveRecord(header, flags, netDelay,
+                                             static_cast<uint64_t>(file.tellg()));
+    uint64_t pos = first.offset + first.size;
+    if (!archiveFrameCountFits(header, pos, fileSize)) {
+        std::cerr << "Archive header does not match file size: " << filename << std::endl;
+        return false;
+    }
     
-    // Читаем остальные кадры
-    std::vector<uint8_t> prevFrame = firstFrame.data;
+    records.reserve(header.totalFrames);
+    records.push_back(first);
     
     for (uint32_t i = 1; i < header.totalFrames; i++) {
-        AVOFrame frame;
-        frame.isFullFrame = true; // После декодирования это будет полный кадр
-        
-        // Читаем тип кадра
-        uint8_t frameType;
-        file.read(reinterpret_cast<char*>(&frameType), sizeof(frameType));
-        bool wasDiffFrame = (frameType == 0);
-        
-        // Читаем реальную задержку
-        uint32_t netDelay;
-        file.read(reinterpret_cast<char*>(&netDelay), sizeof(netDelay));
-        frame.delayMs = ntohl(netDelay);
-        
-        // Читаем размер данных
-        uint32_t netDataSize;
-        file.read(reinterpret_cast<char*>(&netDataSize), sizeof(netDataSize));
-        uint32_t dataSize = ntohl(netDataSize);
-        
-        if (dataSize > 0) {
-            // Читаем сжатые данные
-            std::vector<uint8_t> compressedData(dataSize);
-            file.read(reinterpret_cast<char*>(compressedData.data()), dataSize);
+        uint8_t recordHeader[RECORD_HEADER_SIZE];
+        if (pos + RECORD_HEADER_SIZE > fileSize ||
+            !file.seekg(static_cast<std::streamoff>(pos)) ||
+            !file.read(reinterpret_cast<char*>(recordHeader), sizeof(recordHeader))) {
+            std::cerr << "Archive is truncated at frame " << i << ": " << filename << std::endl;
+            return false;
+        }
+        
+        AVORecordInfo record;
+        if (!parseRecordHeader(recordHeader, pos, fileSize, record)) {
+            std::cerr << "Corrupted record " << i << " in archive: " << filename << std::endl;
+            return false;
+        }
+        
+        records.push_back(record);
+        pos = record.offset + record.size;
+    }
+    
+    return true;
+}
+
+bool AVOCodec::parseArchiveIndex(const uint8_t* data, size_t size, AVOHeader& header,
+                                 uint32_t& flags, std::vector<AVORecordInfo>& records) {
+    flags = 0;
+    size_t pos = 0;
+    if (size >= sizeof(ARCHIVE_SIGNATURE) + 4 &&
+        memcmp(data, ARCHIVE_SIGNATURE, sizeof(ARCHIVE_SIGNATURE)) == 0) {
+        uint32_t netFlags;
+        memcpy(&netFlags, data + sizeof(ARCHIVE_SIGNATURE), sizeof(netFlags));
+        flags = ntohl(netFlags);
+        pos = sizeof(ARCHIVE_SIGNATURE) + 4;
+    }
+    
+    uint32_t netDelay;
+    if (size - pos < sizeof(header)) {
+        std::cerr << "Invalid archive header" << std::endl;
+        return false;
+    }
+    memcpy(&header, data + pos, sizeof(header));
+    pos += sizeof(header);
+    
+    records.clear();
+    
+    if (isFirstFrameFile(header, flags, pos, size)) {
+        records.push_back(firstArchiveRecord(header, flags, firstFrameFileDelay(header), pos));
+        return true;
+    }
+    
+    if (size - pos < sizeof(netDelay)) {
+        std::cerr << "Invalid archive header" << std::endl;
+        return false;
+    }
+    memcpy(&netDelay, data + pos, sizeof(netDelay));
+    pos += sizeof(netDelay);
+    
+    AVORecordInfo first = firstArchiveRecord(header, flags, netDelay, pos);
+    uint64_t recordPos = first.offset + first.size;
+    if (!archiveFrameCountFits(header, recordPos, size)) {
+        std::cerr << "Archive header does not match archive size" << std::endl;
+        return false;
+    }
+    
+    records.reserve(header.totalFrames);
+    records.push_back(first);
+    for (uint32_t i = 1; i < header.totalFrames; i++) {
+        AVORecordInfo record;
+        if (recordPos + RECORD_HEADER_SIZE > size) {
+            std::cerr << "Archive is truncated at frame " << i << std::endl;
+            return false;
+        }
+        if (!parseRecordHeader(data + recordPos, recordPos, size, record)) {
+            std::cerr << "Corrupted record " << i << " in archive" << std::endl;
+            return false;
+        }
+        
+        records.push_back(record);
+        recordPos = record.offset + record.size;
+    }
+    
+    return true;
+}
+
+// Сколько декодированных кадров одной группы ждут передачи в sink
+static const size_t MAX_BUFFERED_GROUP_FRAMES = 16;
+
+bool AVOCodec::decodeVideoArchiveParallel(const std::string& filename,
+                                          const AVOFrameSink& sink,
+                                          AVOHeader& header,
+                                          uint32_t threads) {
+    uint32_t flags;
+    std::vector<AVORecordInfo> records;
+    if (!readArchiveIndex(filename, header, flags, records)) {
+        return false;
+    }
+    
+    // Группы кадров: от каждого ключевого кадра до следующего
+    std::vector<size_t> groupStarts;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].frameType != AVO_FRAME_DIFF) {
+            groupStarts.push_back(i);
+        }
+    }
+    
+    size_t threadCount = threads > 0 ? threads : std::thread::hardware_concurrency();
+    threadCount = std::max<size_t>(1, std::min(threadCount, groupStarts.size()));
+    
+    AVOPixelFormat format = getPixelFormat(flags);
+    uint32_t width = header.width;
+    uint32_t height = header.height;
+    
+    // Кадры группы копятся в очереди, пока вызывающий поток их не заберет;
+    // группа nextToDeliver отдается в sink по мере декодирования, поэтому
+    // архив из одной группы не держится в памяти целиком
+    struct DecodedGroup {
+        std::deque<AVOFrame> frames;
+        bool done = false;
+    };
+    
+    std::mutex groupMutex;
+    std::condition_variable groupCondVar;
+    std::map<size_t, DecodedGroup> decodedGroups;
+    size_t nextGroup = 0;
+    size_t nextToDeliver = 0;
+    bool failed = false;
+    bool stopped = false;
+    
+    // Каждый поток читает архив своим потоком ввода и декодирует группу
+    // по порядку; вперед берется не больше threadCount групп, и в каждой
+    // ждет не больше MAX_BUFFERED_GROUP_FRAMES кадров
+    auto decodeWorker = [&]() {
+        std::ifstream file(filename, std::ios::binary);
+        
+        while (true) {
+            size_t group;
+            {
+                std::unique_lock<std::mutex> lock(groupMutex);
+                groupCondVar.wait(lock, [&] {
+                    return failed || stopped || nextGroup >= groupStarts.size() ||
+                           nextGroup < nextToDeliver + threadCount;
+                });
+                if (failed || stopped || nextGroup >= groupStarts.size()) {
+                    return;
+                }
+                group = nextGroup++;
+                decodedGroups[group];
+            }
             
-            if (wasDiffFrame) {
-                // Декомпрессируем изменения
-                std::vector<PixelChange> changes = decompressRLE(compressedData);
-                
-                // Применяем изменения к предыдущему кадру
-                std::vector<uint8_t> currFrame;
-                applyChanges(prevFrame, changes, currFrame, header.width, header.height);
+            size_t begin = groupStarts[group];
+            size_t end = group + 1 < groupStarts.size() ? groupStarts[group + 1] : records.size();
+            
+            std::vector<uint8_t> payload;
+            std::vector<uint8_t> prevFrame;
+            std::vector<uint8_t> currFrame;
+            AVOStreamContext context;
+            bool ok = file.is_open();
+            
+            for (size_t i = begin; ok && i < end; i++) {
+                const AVORecordInfo& record = records[i];
+                payload.resize(record.size);
+                file.seekg(static_cast<std::streamoff>(record.offset));
+                ok = static_cast<bool>(file.read(reinterpret_cast<char*>(payload.data()), record.size)) &&
+                     decodeArchiveRecord(record.frameType, payload, prevFrame, width, height,
+                                         flags, &context, currFrame);
+                if (!ok) {
+                    std::cerr << "Cannot decode frame " << i << std::endl;
+                    break;
+                }
                 
-                // Обновляем данные кадра
-                frame.data = currFrame;
+                AVOFrame frame;
+                frame.delayMs = record.delayMs;
+                frame.isFullFrame = true;
+                if (format == AVO_PIXEL_YUV420) {
+                    yuv420ToRGB(currFrame, width, height, frame.data);
+                } else {
+                    frame.data = currFrame;
+                }
+                prevFrame.swap(currFrame);
                 
-                // Обновляем предыдущий кадр для следующей итерации
-                prevFrame = currFrame;
-            } else {
-                // Это был полный кадр
-                frame.data = compressedData;
-                prevFrame = compressedData;
+                std::unique_lock<std::mutex> lock(groupMutex);
+                std::deque<AVOFrame>& queue = decodedGroups[group].frames;
+                groupCondVar.wait(lock, [&] {
+                    return failed || stopped || queue.size() < MAX_BUFFERED_GROUP_FRAMES;
+                });
+                if (failed || stopped) {
+                    return;
+                }
+                queue.push_back(std::move(frame));
+                groupCondVar.notify_all();
             }
-        } else {
-            // Нет изменений - используем предыдущий кадр
-            frame.data = prevFrame;
+            
+            {
+                std::lock_guard<std::mutex> lock(groupMutex);
+                if (!ok) {
+                    failed = true;
+                } else {
+                    decodedGroups[group].done = true;
+                }
+            }
+            groupCondVar.notify_all();
         }
-        
-        frames.push_back(frame);
+    };
+    
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threadCount; t++) {
+        workers.emplace_back(decodeWorker);
     }
     
-    file.close();
-    return true;
-}
\ No newline at end of file
+    // Кадры отдаются в sink по порядку из вызывающего потока
+    {
+        std::unique_lock<std::mutex> lock(groupMutex);
+        uint32_t frameIndex = 0;
+        while (!failed && !stopped && nextToDeliver < groupStarts.size()) {
+            auto it = decodedGroups.find(nextToDeliver);
+            if (it == decodedGroups.end() || (it->second.frames.empty() && !it->second.done)) {
+                groupCondVar.wait(lock);
+                continue;
+            }
+            if (it->second.frames.empty()) {
+                decodedGroups.erase(it);
+                nextToDeliver++;
+                groupCondVar.notify_all();
+                continue;
+            }
+            
+            AVOFrame frame = std::move(it->second.frames.front());
+            it->second.frames.pop_front();
+            groupCondVar.notify_all();
+            lock.unlock();
+            
+            bool proceed = sink(frameIndex++, frame);
+            
+            lock.lock();
+            if (!proceed) {
+                stopped = true;
+                groupCondVar.notify_all();
+            }
+        }
+    }
+    
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    
+    return !failed;
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <functional>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -20,6 +22,96 @@ struct AVOHeader {
     uint32_t firstFrameSize;
 };
 
+// Типы кадров в архиве (байт frameType перед каждой записью)
+enum AVOFrameType : uint8_t {
+    AVO_FRAME_DIFF = 0,   // изменения относительно предыдущего кадра (RLE)
+    AVO_FRAME_FULL = 1,   // полный кадр без сжатия (RGB)
+    AVO_FRAME_INTRA = 2   // полный кадр с внутрикадровым сжатием
+};
+
+// Флаги потока/архива (хранятся в расширенном заголовке архива и в сетевом пакете)
+enum AVOStreamFlags : uint32_t {
+    AVO_FLAG_ENTROPY = 1u << 0,  // изменения (AVO_FRAME_DIFF) сжаты энтропийно
+    AVO_FLAG_YUV420 = 1u << 1,   // кадры хранятся в планарном YUV 4:2:0
+    AVO_FLAG_MOTION = 1u << 2,   // изменения начинаются с копирования сдвинутых блоков
+    AVO_FLAG_BACKGROUND = 1u << 3 // блоки могут восстанавливаться из долговременного фона
+};
+
+// Формат пикселей буфера кадра
+enum AVOPixelFormat : uint8_t {
+    AVO_PIXEL_RGB24 = 0,    // упакованный RGB, 3 байта на пиксель
+    AVO_PIXEL_YUV420 = 1    // планарный Y, U, V (12 бит на пиксель)
+};
+
+// Значения попиксельной маски кадра
+enum AVOMaskValue : uint8_t {
+    AVO_MASK_NORMAL = 0,     // обычный порог изменения
+    AVO_MASK_EXCLUDE = 1,    // изменения не передаются (часы, мигающие индикаторы)
+    AVO_MASK_PRIORITY = 2    // область интереса с пониженным порогом
+};
+
+struct AVORegion {
+    uint32_t x, y;
+    uint32_t width, height;
+};
+
+// Маска потока: прямоугольники и/или карта на каждый пиксель
+// (width * height значений AVOMaskValue). Прямоугольники накладываются
+// поверх карты, исключение сильнее приоритета
+struct AVOFrameMask {
+    std::vector<AVORegion> excluded;
+    std::vector<AVORegion> priority;
+    std::vector<uint8_t> bitmap;
+    uint8_t priorityThreshold = 3;
+    
+    bool empty() const { return excluded.empty() && priority.empty() && bitmap.empty(); }
+};
+
+// Время этапов кодирования разницы, мкс
+struct AVOEncodeTiming {
+    uint64_t compareUs = 0;      // предсказание (фон, движение) и сравнение
+    uint64_t compressUs = 0;     // упаковка изменений
+};
+
+// Параметры кодирования архива/потока
+struct AVOEncoderOptions {
+    uint32_t flags = 0;          // комбинация AVOStreamFlags
+    AVOFrameMask mask;           // области исключения и интереса
+    // Порог на каждый байт кадра (buildThresholdMap из mask). Кодеры архива
+    // и сети строят его сами один раз на поток; пусто - общий порог
+    std::shared_ptr<const std::vector<uint8_t>> thresholds;
+    // Временное подавление шума перед сравнением (только на стороне кодера):
+    // байт начинает меняться при отклонении больше denoiseEnter и успокаивается,
+    // когда отклонение не больше denoiseLeave. 0 - подавление выключено
+    uint8_t denoiseEnter = 0;
+    uint8_t denoiseLeave = 4;
+    // Принудительный ключевой кадр каждые keyFrameInterval кадров (0 - только
+    // полные кадры входа). Отрезки между ключевыми кадрами кодируются параллельно,
+    // поэтому потокам архива нужен keyFrameInterval > 0 (или полные кадры во
+    // входе): иначе отрезок один и кадры кодирует один поток, пока основной
+    // восстанавливает следующие
+    uint32_t keyFrameInterval = 0;
+    uint32_t threads = 0;        // потоки кодирования архива (0 - по числу ядер)
+    // Время этапов encodeDiffPayload (заполняется, если задано; кодер архива
+    // его не заполняет)
+    AVOEncodeTiming* timing = nullptr;
+};
+
+// Состояние подавления шума кодера: устойчивое значение и признак
+// "меняется" (0x00/0xFF) для каждого байта кадра
+struct AVODenoiseState {
+    std::vector<uint8_t> stable;
+    std::vector<uint8_t> moving;
+};
+
+// Состояние потока, которое кодер и декодер ведут одинаково по
+// восстановленным кадрам (см. updateStreamContext)
+struct AVOStreamContext {
+    std::vector<uint8_t> background;    // долговременный фон
+    std::vector<uint8_t> stableCount;   // сколько кадров подряд байт не менялся
+    std::vector<uint8_t> lastFrame;     // последний восстановленный кадр
+};
+
 struct PixelChange {
     uint32_t offset;     // Позиция в кадре
     uint8_t r, g, b;     // Новые значения RGB
@@ -32,6 +124,17 @@ struct AVOFrame {
     bool isFullFrame;           // true = полный кадр, false = изменения
 };
 
+// Запись архива: где лежат данные кадра
+struct AVORecordInfo {
+    uint64_t offset;        // смещение данных кадра от начала файла
+    uint32_t size;          // размер данных
+    uint32_t delayMs;
+    uint8_t frameType;      // AVOFrameType (первый кадр - AVO_FRAME_FULL или AVO_FRAME_INTRA)
+};
+
+// Получатель декодированных кадров: номер кадра и кадр
+using AVOFrameSink = std::function<bool(uint32_t frameIndex, const AVOFrame& frame)>;
+
 class AVOCodec {
 public:
     // Кодирование/декодирование .avo файлов
@@ -67,35 +170,214 @@ public:
                                uint32_t width, uint32_t height,
                                uint32_t& delayMs);
     
+    // Содержимое .avop в памяти (для файлов кадров и пакетов .avopb)
+    static std::vector<uint8_t> encodeFrameDiffRecord(const std::vector<uint8_t>& prevFrame,
+                                                      const std::vector<uint8_t>& currFrame,
+                                                      uint32_t width, uint32_t height,
+                                                      uint32_t delayMs);
+    
+    static bool decodeFrameDiffRecord(const uint8_t* data, size_t size,
+                                      const std::vector<uint8_t>& prevFrame,
+                                      std::vector<uint8_t>& currFrame,
+                                      uint32_t width, uint32_t height,
+                                      uint32_t& delayMs);
+    
+    // Запись .avop старого формата (например, 1test_frames/): размер данных в
+    // порядке байт хоста и без задержки. Декодер такие записи отвергает,
+    // upgradeLegacyFrameDiffRecord переводит их в текущий формат с delayMs
+    static bool isLegacyFrameDiffRecord(const uint8_t* data, size_t size);
+    static bool upgradeLegacyFrameDiffRecord(const uint8_t* data, size_t size, uint32_t delayMs,
+                                             std::vector<uint8_t>& record);
+    
+    // Буферный API (без файлов и промежуточных векторов): данные пишутся
+    // в буфер вызывающего out емкостью capacity, size - записанный размер.
+    // Если буфера не хватает, возвращается false и size - нужный размер;
+    // getMax*Size дают верхнюю границу для выделения буфера заранее.
+    // Кадры - RGB24 размером width * height * 3
+    static size_t getMaxFrameDiffSize(uint32_t width, uint32_t height);
+    static bool encodeFrameDiff(const uint8_t* prevFrame, const uint8_t* currFrame,
+                                uint32_t width, uint32_t height, uint32_t delayMs,
+                                uint8_t* out, size_t capacity, size_t& size);
+    
+    // currFrame может совпадать с prevFrame (обновление на месте)
+    static bool decodeFrameDiff(const uint8_t* data, size_t size,
+                                const uint8_t* prevFrame, uint8_t* currFrame,
+                                uint32_t width, uint32_t height,
+                                uint32_t& delayMs);
+    
+    static size_t getMaxFirstFrameSize(uint32_t width, uint32_t height);
+    static bool encodeFirstFrame(const uint8_t* frameData,
+                                 uint32_t width, uint32_t height, uint32_t fps,
+                                 uint8_t* out, size_t capacity, size_t& size);
+    
+    // capacity - размер frameData, нужен width * height * 3 из заголовка
+    static bool decodeFirstFrame(const uint8_t* data, size_t size, AVOHeader& header,
+                                 uint8_t* frameData, size_t capacity);
+    
     // Вспомогательные функции
     static std::vector<uint8_t> compressRLE(const std::vector<PixelChange>& changes);
     static std::vector<PixelChange> decompressRLE(const std::vector<uint8_t>& data);
+    static std::vector<PixelChange> decompressRLE(const uint8_t* data, size_t size);
+    
+    // Упаковка изменений с учетом флагов потока: без AVO_FLAG_ENTROPY это
+    // обычный compressRLE, с ним - раздельные потоки (смещения, счетчики,
+    // разности цветов) с кодом Хаффмана. Пустые данные = нет изменений
+    static std::vector<uint8_t> compressChanges(const std::vector<PixelChange>& changes,
+                                                uint32_t flags);
+    // maxChanges - граница числа серий (не больше пикселей кадра): данные
+    // из сети не должны заставлять выделять память сверх кадра
+    static bool decompressChanges(const std::vector<uint8_t>& data, uint32_t flags,
+                                  size_t maxChanges, std::vector<PixelChange>& changes);
+    static bool decompressChanges(const uint8_t* data, size_t size, uint32_t flags,
+                                  size_t maxChanges, std::vector<PixelChange>& changes);
+    
+    // Изменения кадра относительно опорного с учетом флагов потока
+    // (фон, компенсация движения, энтропийное сжатие). reconstructed - кадр,
+    // который получит декодер; его следует использовать как следующий опорный.
+    // context нужен только с AVO_FLAG_BACKGROUND
+    static std::vector<uint8_t> encodeDiffPayload(const std::vector<uint8_t>& reference,
+                                                  const std::vector<uint8_t>& frame,
+                                                  uint32_t width, uint32_t height,
+                                                  const AVOEncoderOptions& options,
+                                                  std::vector<uint8_t>& reconstructed,
+                                                  const AVOStreamContext* context = nullptr);
+    
+    static bool decodeDiffPayload(const std::vector<uint8_t>& payload,
+                                  const std::vector<uint8_t>& reference,
+                                  uint32_t width, uint32_t height,
+                                  uint32_t flags,
+                                  std::vector<uint8_t>& frame,
+                                  const AVOStreamContext* context = nullptr);
+    
+    // То же для данных вне вектора (например, отображенного в память архива)
+    static bool decodeDiffPayload(const uint8_t* payload, size_t size,
+                                  const std::vector<uint8_t>& reference,
+                                  uint32_t width, uint32_t height,
+                                  uint32_t flags,
+                                  std::vector<uint8_t>& frame,
+                                  const AVOStreamContext* context = nullptr);
+    
+    // Обновление модели фона после каждого кадра (в том числе без изменений);
+    // ключевой кадр сбрасывает модель
+    static void updateStreamContext(AVOStreamContext& context,
+                                    const std::vector<uint8_t>& frame,
+                                    bool isKeyFrame);
+    
+    // Сравнение и применение изменений работают с буфером как с тройками байт:
+    // для RGB24 это пиксели, для YUV420 - тройки байт планарного буфера
+    static void compareFrames(const std::vector<uint8_t>& frame1,
+                             const std::vector<uint8_t>& frame2,
+                             uint32_t width, uint32_t height,
+                             std::vector<PixelChange>& changes);
     
+    // Сравнение с порогом на каждый байт кадра (см. buildThresholdMap)
     static void compareFrames(const std::vector<uint8_t>& frame1,
                              const std::vector<uint8_t>& frame2,
                              uint32_t width, uint32_t height,
+                             const std::vector<uint8_t>& thresholds,
                              std::vector<PixelChange>& changes);
     
+    // Гистерезис по времени: frame заменяется устойчивыми значениями. Шум с
+    // амплитудой до enterThreshold не доходит до сравнения, а настоящее
+    // движение проходит без задержки и размытия
+    static void suppressTemporalNoise(std::vector<uint8_t>& frame, AVODenoiseState& state,
+                                      uint8_t enterThreshold, uint8_t leaveThreshold);
+    
+    // Карта порогов для буфера кадра в формате format: исключенные байты
+    // получают 255 (изменение невозможно), приоритетные - mask.priorityThreshold
+    static void buildThresholdMap(const AVOFrameMask& mask,
+                                  uint32_t width, uint32_t height,
+                                  AVOPixelFormat format,
+                                  std::vector<uint8_t>& thresholds);
+    
     static void applyChanges(const std::vector<uint8_t>& baseFrame,
                             const std::vector<PixelChange>& changes,
                             std::vector<uint8_t>& resultFrame,
                             uint32_t width, uint32_t height);
     
+    // Внутрикадровое сжатие полных кадров (без потерь):
+    // предсказание (left/up/paeth) по плоскостям G, R-G, B-G,
+    // RLE нулевых остатков и энтропийное кодирование
+    // (для YUV420 - по плоскостям Y, U, V без цветового преобразования)
+    static std::vector<uint8_t> encodeIntraFrame(const std::vector<uint8_t>& frameData,
+                                                 uint32_t width, uint32_t height,
+                                                 AVOPixelFormat format = AVO_PIXEL_RGB24);
+    static std::vector<uint8_t> encodeIntraFrame(const uint8_t* frameData, size_t size,
+                                                 uint32_t width, uint32_t height,
+                                                 AVOPixelFormat format = AVO_PIXEL_RGB24);
+    
+    static bool decodeIntraFrame(const std::vector<uint8_t>& data,
+                                 uint32_t width, uint32_t height,
+                                 std::vector<uint8_t>& frameData,
+                                 AVOPixelFormat format = AVO_PIXEL_RGB24);
+    
+    static bool decodeIntraFrame(const uint8_t* data, size_t size,
+                                 uint32_t width, uint32_t height,
+                                 std::vector<uint8_t>& frameData,
+                                 AVOPixelFormat format = AVO_PIXEL_RGB24);
+    
+    static bool isIntraFrame(const std::vector<uint8_t>& data);
+    static bool isIntraFrame(const uint8_t* data, size_t size);
+    
+    // Ключевой кадр: сжатый (AVO_FRAME_INTRA) или исходный (AVO_FRAME_FULL),
+    // если сжатие не дало выигрыша. Возвращает тип кадра
+    static uint8_t encodeKeyFrame(const std::vector<uint8_t>& frameData,
+                                  uint32_t width, uint32_t height,
+                                  std::vector<uint8_t>& payload,
+                                  AVOPixelFormat format = AVO_PIXEL_RGB24);
+    
+    static bool decodeKeyFrame(const std::vector<uint8_t>& payload,
+                               uint32_t width, uint32_t height,
+                               std::vector<uint8_t>& frameData,
+                               AVOPixelFormat format = AVO_PIXEL_RGB24);
+    
+    // Формат пикселей: размер буфера кадра и преобразование RGB <-> YUV 4:2:0
+    // (SSE2, если доступно)
+    static size_t getFrameSize(uint32_t width, uint32_t height, AVOPixelFormat format);
+    static AVOPixelFormat getPixelFormat(uint32_t flags);
+    
+    static void rgbToYUV420(const std::vector<uint8_t>& rgbData,
+                            uint32_t width, uint32_t height,
+                            std::vector<uint8_t>& yuvData);
+    
+    static void yuv420ToRGB(const std::vector<uint8_t>& yuvData,
+                            uint32_t width, uint32_t height,
+                            std::vector<uint8_t>& rgbData);
+    
     // Создание черного кадра
     static std::vector<uint8_t> createBlackFrame(uint32_t width, uint32_t height);
+    static std::vector<uint8_t> createBlackFrame(uint32_t width, uint32_t height,
+                                                 AVOPixelFormat format);
     
     // Анализ изменений
     static float getDiffPercentage(const std::vector<uint8_t>& prevFrame,
                                  const std::vector<uint8_t>& currFrame,
                                  uint32_t width, uint32_t height);
     
+    // Быстрая оценка размера изменений (байт) по выборке пикселей, без
+    // compareFrames. Не учитывает компенсацию движения и фон, поэтому скорее
+    // завышена; используется для выбора между изменениями и ключевым кадром
+    static size_t estimateDiffSize(const std::vector<uint8_t>& prevFrame,
+                                   const std::vector<uint8_t>& currFrame,
+                                   uint32_t flags);
+    
+    // Быстрая проверка по разреженной сетке пикселей (1/64 кадра) с порогом
+    // compareFrames. false - кадр можно считать неизменившимся без полного
+    // сравнения. phase (например, номер кадра) сдвигает сетку от кадра к кадру
+    static bool hasSampledChanges(const std::vector<uint8_t>& prevFrame,
+                                  const std::vector<uint8_t>& currFrame,
+                                  uint32_t width, uint32_t height,
+                                  AVOPixelFormat format, uint32_t phase);
+    
     // Новые функции для сетевой передачи
     static std::vector<uint8_t> createNetworkPacket(const std::vector<uint8_t>& data,
                                                    uint32_t frameId,
                                                    uint32_t packetId,
                                                    uint32_t totalPackets,
                                                    uint32_t width,
-                                                   uint32_t height);
+                                                   uint32_t height,
+                                                   uint32_t flags = 0,
+                                                   uint64_t captureTimeUs = 0);
     
     static bool parseNetworkPacket(const std::vector<uint8_t>& packet,
                                   std::vector<uint8_t>& data,
@@ -105,14 +387,82 @@ public:
                                   uint32_t& width,
                                   uint32_t& height);
     
+    static bool parseNetworkPacket(const std::vector<uint8_t>& packet,
+                                  std::vector<uint8_t>& data,
+                                  uint32_t& frameId,
+                                  uint32_t& packetId,
+                                  uint32_t& totalPackets,
+                                  uint32_t& width,
+                                  uint32_t& height,
+                                  uint32_t& flags);
+    
+    // captureTimeUs - время захвата кадра у сервера (мкс system_clock),
+    // 0 если сервер его не передал
+    static bool parseNetworkPacket(const std::vector<uint8_t>& packet,
+                                  std::vector<uint8_t>& data,
+                                  uint32_t& frameId,
+                                  uint32_t& packetId,
+                                  uint32_t& totalPackets,
+                                  uint32_t& width,
+                                  uint32_t& height,
+                                  uint32_t& flags,
+                                  uint64_t& captureTimeUs);
+    
     // Функции для архива
     static bool encodeVideoArchive(const std::vector<AVOFrame>& frames,
                                   uint32_t width, uint32_t height, 
                                   uint32_t fps, const std::string& filename);
     
+    static bool encodeVideoArchive(const std::vector<AVOFrame>& frames,
+                                  uint32_t width, uint32_t height, 
+                                  uint32_t fps, const std::string& filename,
+                                  const AVOEncoderOptions& options);
+    
     static bool decodeVideoArchive(const std::string& filename,
                                   std::vector<AVOFrame>& frames,
                                   AVOHeader& header);
+    
+    static bool decodeVideoArchive(const std::string& filename,
+                                  std::vector<AVOFrame>& frames,
+                                  AVOHeader& header,
+                                  uint32_t& flags);
+    
+    // Оглавление архива: положение каждой записи, без чтения данных кадров.
+    // Файл первого кадра (encodeFirstFrame) читается как архив из одного кадра
+    static bool readArchiveIndex(const std::string& filename,
+                                 AVOHeader& header,
+                                 uint32_t& flags,
+                                 std::vector<AVORecordInfo>& records);
+    
+    // Оглавление архива, целиком находящегося в памяти (data, size) -
+    // та же проверка цепочки записей без чтения файла
+    static bool parseArchiveIndex(const uint8_t* data, size_t size,
+                                  AVOHeader& header,
+                                  uint32_t& flags,
+                                  std::vector<AVORecordInfo>& records);
+    
+    // Декодирование одной записи архива в формате хранения (prevFrame -> frame);
+    // context - модель фона декодера, нужна только с AVO_FLAG_BACKGROUND
+    static bool decodeArchiveRecord(uint8_t frameType, const std::vector<uint8_t>& payload,
+                                    const std::vector<uint8_t>& prevFrame,
+                                    uint32_t width, uint32_t height, uint32_t flags,
+                                    AVOStreamContext* context, std::vector<uint8_t>& frame);
+    static bool decodeArchiveRecord(uint8_t frameType, const uint8_t* payload, size_t size,
+                                    const std::vector<uint8_t>& prevFrame,
+                                    uint32_t width, uint32_t height, uint32_t flags,
+                                    AVOStreamContext* context, std::vector<uint8_t>& frame);
+    
+    // Параллельное декодирование: группы кадров от ключевого до следующего
+    // декодируются на threads потоках (0 - по числу ядер), кадры (RGB)
+    // передаются в sink строго по порядку из вызывающего потока по мере
+    // декодирования; в памяти - не больше 16 ждущих кадров на группу.
+    // Группы параллелятся только между собой: архив с одним ключевым кадром
+    // (keyFrameInterval = 0, старые архивы) декодируется одним потоком.
+    // sink возвращает false, чтобы остановить декодирование
+    static bool decodeVideoArchiveParallel(const std::string& filename,
+                                           const AVOFrameSink& sink,
+                                           AVOHeader& header,
+                                           uint32_t threads = 0);
 };
 
 #endif // AVO_CODEC_H
\ No newline at end of file
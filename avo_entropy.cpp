@@ -0,0 +1,466 @@
+#include "avo_entropy.h"
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <winsock2.h>
+#else
+    #include <arpa/inet.h>
+#endif
+
+namespace {
+
+const int MAX_CODE_LEN = 11;                   // максимальная длина кода (бит)
+const uint32_t TABLE_SIZE = 1u << MAX_CODE_LEN; // размер таблицы декодирования
+const size_t BLOCK_HEADER_SIZE = 5;            // режим + исходный размер
+const size_t LENGTHS_SIZE = 128;               // 256 длин по 4 бита
+const size_t STREAM_SIZES_SIZE = 12;           // размеры потоков 0-2
+
+enum BlockMode : uint8_t {
+    MODE_STORED = 0,
+    MODE_SINGLE = 1,
+    MODE_HUFFMAN = 2
+};
+
+inline uint64_t loadLE64(const uint8_t* p) {
+    // Компилятор сводит это к одной загрузке на little-endian платформах
+    return static_cast<uint64_t>(p[0]) |
+           (static_cast<uint64_t>(p[1]) << 8) |
+           (static_cast<uint64_t>(p[2]) << 16) |
+           (static_cast<uint64_t>(p[3]) << 24) |
+           (static_cast<uint64_t>(p[4]) << 32) |
+           (static_cast<uint64_t>(p[5]) << 40) |
+           (static_cast<uint64_t>(p[6]) << 48) |
+           (static_cast<uint64_t>(p[7]) << 56);
+}
+
+inline void putU32(std::vector<uint8_t>& out, uint32_t value) {
+    uint32_t netValue = htonl(value);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&netValue);
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+inline uint32_t getU32(const uint8_t* p) {
+    uint32_t netValue;
+    memcpy(&netValue, p, 4);
+    return ntohl(netValue);
+}
+
+inline uint32_t reverseBits(uint32_t code, int len) {
+    uint32_t result = 0;
+    for (int i = 0; i < len; i++) {
+        result = (result << 1) | (code & 1);
+        code >>= 1;
+    }
+    return result;
+}
+
+// Длины кодов Хаффмана с ограничением MAX_CODE_LEN: при превышении
+// частоты сжимаются вдвое и дерево строится заново.
+void buildCodeLengths(const uint32_t freq[256], uint8_t lengths[256]) {
+    std::vector<uint32_t> scaled(freq, freq + 256);
+
+    while (true) {
+        // Узлы 0-255 - листья, далее внутренние узлы
+        std::vector<uint64_t> weight;
+        std::vector<int> parent;
+        std::vector<int> heap;
+        weight.reserve(512);
+        parent.reserve(512);
+
+        for (int s = 0; s < 256; s++) {
+            weight.push_back(scaled[s]);
+            parent.push_back(-1);
+            if (scaled[s] > 0) {
+                heap.push_back(s);
+            }
+        }
+
+        auto greater = [&weight](int a, int b) {
+            if (weight[a] != weight[b]) return weight[a] > weight[b];
+            return a > b;
+        };
+        std::make_heap(heap.begin(), heap.end(), greater);
+
+        while (heap.size() > 1) {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            int a = heap.back();
+            heap.pop_back();
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            int b = heap.back();
+            heap.pop_back();
+
+            int node = static_cast<int>(weight.size());
+            weight.push_back(weight[a] + weight[b]);
+            parent.push_back(-1);
+            parent[a] = node;
+            parent[b] = node;
+
+            heap.push_back(node);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+
+        int maxLen = 0;
+        for (int s = 0; s < 256; s++) {
+            int len = 0;
+            if (scaled[s] > 0) {
+                for (int n = s; parent[n] >= 0; n = parent[n]) {
+                    len++;
+                }
+            }
+            lengths[s] = static_cast<uint8_t>(len);
+            maxLen = std::max(maxLen, len);
+        }
+
+        if (maxLen <= MAX_CODE_LEN) {
+            return;
+        }
+
+        for (int s = 0; s < 256; s++) {
+            if (scaled[s] > 0) {
+                scaled[s] = (scaled[s] + 1) / 2;
+            }
+        }
+    }
+}
+
+// Канонические коды (уже развернутые для записи младшим битом вперед)
+bool buildCanonicalCodes(const uint8_t lengths[256], uint16_t codes[256]) {
+    int symbols[256];
+    int count = 0;
+    uint32_t kraft = 0;
+
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s] > MAX_CODE_LEN) {
+            return false;
+        }
+        if (lengths[s] > 0) {
+            symbols[count++] = s;
+            kraft += TABLE_SIZE >> lengths[s];
+        }
+    }
+
+    // Код Хаффмана всегда полный - иначе данные повреждены
+    if (kraft != TABLE_SIZE) {
+        return false;
+    }
+
+    std::sort(symbols, symbols + count, [lengths](int a, int b) {
+        if (lengths[a] != lengths[b]) return lengths[a] < lengths[b];
+        return a < b;
+    });
+
+    uint32_t code = 0;
+    int prevLen = 0;
+    for (int i = 0; i < count; i++) {
+        int s = symbols[i];
+        code <<= (lengths[s] - prevLen);
+        codes[s] = static_cast<uint16_t>(reverseBits(code, lengths[s]));
+        code++;
+        prevLen = lengths[s];
+    }
+
+    return true;
+}
+
+struct BitWriter {
+    uint8_t* out;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    explicit BitWriter(uint8_t* target) : out(target) {}
+
+    inline void put(uint32_t code, int len) {
+        acc |= static_cast<uint64_t>(code) << bits;
+        bits += len;
+        if (bits >= 32) {
+            out[0] = static_cast<uint8_t>(acc);
+            out[1] = static_cast<uint8_t>(acc >> 8);
+            out[2] = static_cast<uint8_t>(acc >> 16);
+            out[3] = static_cast<uint8_t>(acc >> 24);
+            out += 4;
+            acc >>= 32;
+            bits -= 32;
+        }
+    }
+
+    uint8_t* flush() {
+        while (bits > 0) {
+            *out++ = static_cast<uint8_t>(acc);
+            acc >>= 8;
+            bits -= 8;
+        }
+        bits = 0;
+        acc = 0;
+        return out;
+    }
+};
+
+struct BitReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    BitReader(const uint8_t* begin, const uint8_t* finish) : p(begin), end(finish) {}
+
+    // Дополняет буфер минимум до 56 бит (если данные не закончились)
+    inline void refill() {
+        if (end - p >= 8) {
+            acc |= loadLE64(p) << bits;
+            int bytes = (63 - bits) >> 3;
+            p += bytes;
+            bits += bytes * 8;
+        } else {
+            while (bits <= 56 && p < end) {
+                acc |= static_cast<uint64_t>(*p++) << bits;
+                bits += 8;
+            }
+        }
+    }
+
+    inline uint8_t decode(const uint16_t* table) {
+        uint16_t entry = table[acc & (TABLE_SIZE - 1)];
+        int len = entry & 0x0F;
+        acc >>= len;
+        bits -= len;
+        return static_cast<uint8_t>(entry >> 4);
+    }
+};
+
+} // namespace
+
+std::vector<uint8_t> AVOEntropy::compress(const std::vector<uint8_t>& data) {
+    return compress(data.data(), data.size());
+}
+
+std::vector<uint8_t> AVOEntropy::compress(const uint8_t* data, size_t size) {
+    std::vector<uint8_t> result;
+
+    uint32_t freq[256] = {0};
+    for (size_t i = 0; i < size; i++) {
+        freq[data[i]]++;
+    }
+
+    int distinct = 0;
+    int lastSymbol = 0;
+    for (int s = 0; s < 256; s++) {
+        if (freq[s] > 0) {
+            distinct++;
+            lastSymbol = s;
+        }
+    }
+
+    if (size > 0 && distinct == 1) {
+        result.push_back(MODE_SINGLE);
+        putU32(result, static_cast<uint32_t>(size));
+        result.push_back(static_cast<uint8_t>(lastSymbol));
+        return result;
+    }
+
+    if (size >= 64) {
+        uint8_t lengths[256];
+        uint16_t codes[256] = {0};
+        buildCodeLengths(freq, lengths);
+
+        if (buildCanonicalCodes(lengths, codes)) {
+            size_t headerSize = BLOCK_HEADER_SIZE + LENGTHS_SIZE + STREAM_SIZES_SIZE;
+            size_t bitCount = 0;
+            for (int s = 0; s < 256; s++) {
+                bitCount += static_cast<size_t>(freq[s]) * lengths[s];
+            }
+
+            // Точный размер известен заранее (+ по 1 байту выравнивания на поток)
+            if (headerSize + bitCount / 8 + 4 < size + BLOCK_HEADER_SIZE) {
+                result.resize(headerSize + bitCount / 8 + 8);
+                result[0] = MODE_HUFFMAN;
+                uint32_t netRawSize = htonl(static_cast<uint32_t>(size));
+                memcpy(result.data() + 1, &netRawSize, 4);
+
+                for (int s = 0; s < 256; s += 2) {
+                    result[BLOCK_HEADER_SIZE + s / 2] =
+                        static_cast<uint8_t>((lengths[s] << 4) | lengths[s + 1]);
+                }
+
+                // Четыре независимых потока - декодер обрабатывает их чередуя
+                uint8_t* sizesPtr = result.data() + BLOCK_HEADER_SIZE + LENGTHS_SIZE;
+                uint8_t* streamPtr = result.data() + headerSize;
+                size_t segment = (size + 3) / 4;
+                for (int stream = 0; stream < 4; stream++) {
+                    size_t begin = std::min(size, segment * stream);
+                    size_t end = std::min(size, begin + segment);
+
+                    BitWriter writer(streamPtr);
+                    for (size_t i = begin; i < end; i++) {
+                        writer.put(codes[data[i]], lengths[data[i]]);
+                    }
+                    uint8_t* streamEnd = writer.flush();
+
+                    if (stream < 3) {
+                        uint32_t netSize = htonl(static_cast<uint32_t>(streamEnd - streamPtr));
+                        memcpy(sizesPtr + stream * 4, &netSize, 4);
+                    }
+                    streamPtr = streamEnd;
+                }
+
+                result.resize(streamPtr - result.data());
+                return result;
+            }
+        }
+    }
+
+    // Сжатие не дало выигрыша - сохраняем как есть
+    result.reserve(size + BLOCK_HEADER_SIZE);
+    result.push_back(MODE_STORED);
+    putU32(result, static_cast<uint32_t>(size));
+    result.insert(result.end(), data, data + size);
+    return result;
+}
+
+bool AVOEntropy::decompress(const std::vector<uint8_t>& data, std::vector<uint8_t>& out,
+                            size_t maxSize) {
+    return decompress(data.data(), data.size(), out, maxSize);
+}
+
+bool AVOEntropy::decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& out,
+                            size_t maxSize) {
+    if (size < BLOCK_HEADER_SIZE) {
+        return false;
+    }
+
+    uint8_t mode = data[0];
+    uint32_t rawSize = getU32(data + 1);
+    const uint8_t* payload = data + BLOCK_HEADER_SIZE;
+    size_t payloadSize = size - BLOCK_HEADER_SIZE;
+    if (rawSize > maxSize) {
+        return false;
+    }
+
+    if (mode == MODE_STORED) {
+        if (payloadSize != rawSize) {
+            return false;
+        }
+        out.assign(payload, payload + rawSize);
+        return true;
+    }
+
+    if (mode == MODE_SINGLE) {
+        if (payloadSize != 1) {
+            return false;
+        }
+        out.assign(rawSize, payload[0]);
+        return true;
+    }
+
+    if (mode != MODE_HUFFMAN || payloadSize < LENGTHS_SIZE + STREAM_SIZES_SIZE) {
+        return false;
+    }
+
+    uint8_t lengths[256];
+    for (int s = 0; s < 256; s += 2) {
+        lengths[s] = payload[s / 2] >> 4;
+        lengths[s + 1] = payload[s / 2] & 0x0F;
+    }
+
+    uint16_t codes[256] = {0};
+    if (!buildCanonicalCodes(lengths, codes)) {
+        return false;
+    }
+
+    // Таблица: индекс - следующие MAX_CODE_LEN бит, значение - (символ << 4) | длина
+    uint16_t table[TABLE_SIZE];
+    for (int s = 0; s < 256; s++) {
+        int len = lengths[s];
+        if (len == 0) {
+            continue;
+        }
+        uint16_t entry = static_cast<uint16_t>((s << 4) | len);
+        for (uint32_t k = codes[s]; k < TABLE_SIZE; k += (1u << len)) {
+            table[k] = entry;
+        }
+    }
+
+    const uint8_t* streams = payload + LENGTHS_SIZE + STREAM_SIZES_SIZE;
+    size_t streamsSize = payloadSize - LENGTHS_SIZE - STREAM_SIZES_SIZE;
+    size_t streamSizes[4];
+    size_t used = 0;
+    for (int i = 0; i < 3; i++) {
+        streamSizes[i] = getU32(payload + LENGTHS_SIZE + i * 4);
+        used += streamSizes[i];
+    }
+    if (used > streamsSize) {
+        return false;
+    }
+    streamSizes[3] = streamsSize - used;
+    // Код символа не короче бита
+    if (rawSize > streamsSize * 8) {
+        return false;
+    }
+
+    out.resize(rawSize);
+
+    size_t segment = (static_cast<size_t>(rawSize) + 3) / 4;
+    size_t counts[4];
+    size_t offsets[4];
+    const uint8_t* streamBegin[4];
+    const uint8_t* streamPtr = streams;
+
+    for (int i = 0; i < 4; i++) {
+        offsets[i] = std::min<size_t>(rawSize, segment * i);
+        counts[i] = std::min<size_t>(rawSize, offsets[i] + segment) - offsets[i];
+        streamBegin[i] = streamPtr;
+        streamPtr += streamSizes[i];
+    }
+
+    // Локальные копии состояния, чтобы запись в out не мешала держать их в регистрах
+    BitReader r0(streamBegin[0], streamBegin[0] + streamSizes[0]);
+    BitReader r1(streamBegin[1], streamBegin[1] + streamSizes[1]);
+    BitReader r2(streamBegin[2], streamBegin[2] + streamSizes[2]);
+    BitReader r3(streamBegin[3], streamBegin[3] + streamSizes[3]);
+    uint8_t* o0 = out.data() + offsets[0];
+    uint8_t* o1 = out.data() + offsets[1];
+    uint8_t* o2 = out.data() + offsets[2];
+    uint8_t* o3 = out.data() + offsets[3];
+
+    // Основной цикл: 4 символа на поток между пополнениями (4 * 11 <= 56 бит)
+    size_t common = counts[3];
+    size_t i = 0;
+    for (; i + 4 <= common; i += 4) {
+        r0.refill();
+        r1.refill();
+        r2.refill();
+        r3.refill();
+        o0[i] = r0.decode(table);
+        o1[i] = r1.decode(table);
+        o2[i] = r2.decode(table);
+        o3[i] = r3.decode(table);
+        o0[i + 1] = r0.decode(table);
+        o1[i + 1] = r1.decode(table);
+        o2[i + 1] = r2.decode(table);
+        o3[i + 1] = r3.decode(table);
+        o0[i + 2] = r0.decode(table);
+        o1[i + 2] = r1.decode(table);
+        o2[i + 2] = r2.decode(table);
+        o3[i + 2] = r3.decode(table);
+        o0[i + 3] = r0.decode(table);
+        o1[i + 3] = r1.decode(table);
+        o2[i + 3] = r2.decode(table);
+        o3[i + 3] = r3.decode(table);
+    }
+
+    BitReader* readers[4] = {&r0, &r1, &r2, &r3};
+    uint8_t* outs[4] = {o0, o1, o2, o3};
+    for (int stream = 0; stream < 4; stream++) {
+        BitReader& reader = *readers[stream];
+        for (size_t j = i; j < counts[stream]; j++) {
+            reader.refill();
+            outs[stream][j] = reader.decode(table);
+        }
+        // Поток закончился раньше, чем символы - данные повреждены
+        if (reader.bits < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef AVO_ENTROPY_H
+#define AVO_ENTROPY_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Энтропийное кодирование байтовых потоков: канонический код Хаффмана
+// с ограничением длины кода и четырьмя чередующимися битовыми потоками
+// (табличное декодирование без ветвлений на каждый бит).
+//
+// Формат блока:
+//   1 байт  - режим (0 = без сжатия, 1 = один символ, 2 = Хаффман)
+//   4 байта - исходный размер (сетевой порядок байт)
+//   режим 0: исходные данные
+//   режим 1: 1 байт символа
+//   режим 2: 128 байт длин кодов (по 4 бита на символ),
+//            3 x 4 байта размеров потоков 0-2, затем 4 битовых потока
+class AVOEntropy {
+public:
+    static std::vector<uint8_t> compress(const uint8_t* data, size_t size);
+    static std::vector<uint8_t> compress(const std::vector<uint8_t>& data);
+
+    // Исходный размер берется из заголовка блока, поэтому вызывающий задает
+    // наибольший допустимый (maxSize, из размеров кадра): блок с большим
+    // размером отвергается до выделения памяти
+    static bool decompress(const uint8_t* data, size_t size, std::vector<uint8_t>& out,
+                           size_t maxSize);
+    static bool decompress(const std::vector<uint8_t>& data, std::vector<uint8_t>& out,
+                           size_t maxSize);
+};
+
+#endif // AVO_ENTROPY_H
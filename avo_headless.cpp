@@ -0,0 +1,691 @@
+// Сервер и клиент трансляции без окон и OpenCV HighGUI: для узлов без
+// дисплея и прогонов на полной скорости кодека (без imshow/putText/waitKey
+// на каждом кадре). Журнал и статистика идут в stderr.
+//
+// Сервер берет кадры из архива .avo, из сырого RGB24-потока (файл или
+// stdin, например ffmpeg -f rawvideo -pix_fmt rgb24 -) или с камеры
+// (только при сборке с -DAVO_WITH_OPENCV, нужен лишь videoio/imgproc).
+// Без --fps архив идет с задержками из записей, остальные источники - без
+// темпа: следующий кадр подается, когда очередь кодера освободится.
+//
+// Клиент декодирует кадры в одном потоке и пишет их в приемник: null
+// (только декодирование) или raw (RGB24 в файл или stdout, например в
+// ffplay -f rawvideo -pixel_format rgb24 -video_size WxH -).
+//
+// Использование:
+//   avo_headless server [--listen IP:PORT] [--source avo:FILE|raw:FILE|raw:-|camera:N]
+//                       [--size WxH] [--fps N] [--loop] [--threads N]
+//                       [--flags entropy,yuv420] [--stats SEC]
+//                       [--metrics-file FILE] [--metrics-socket PATH] [--trace FILE]
+//   avo_headless client [--connect IP:PORT] [--sink null|raw:FILE|raw:-] [--frames N]
+//                       [--stats SEC] [--metrics-file FILE] [--metrics-socket PATH]
+//                       [--trace FILE]
+
+#include "network_stream.h"
+#include "avo_codec.h"
+#include "avo_mapped.h"
+#include "avo_trace.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#ifdef AVO_WITH_OPENCV
+    #include <opencv2/videoio.hpp>
+    #include <opencv2/imgproc.hpp>
+#endif
+
+static std::atomic<bool> stopRequested{false};
+
+static void onSignal(int) {
+    stopRequested = true;
+}
+
+static bool parseAddress(const std::string& address, std::string& ip, int& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    ip = address.substr(0, colon);
+    port = atoi(address.c_str() + colon + 1);
+    return !ip.empty() && port > 0 && port < 65536;
+}
+
+static uint32_t parseFlags(const std::string& list) {
+    uint32_t flags = 0;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item == "entropy") {
+            flags |= AVO_FLAG_ENTROPY;
+        } else if (item == "yuv420") {
+            flags |= AVO_FLAG_YUV420;
+        } else if (!item.empty() && item != "none") {
+            std::cerr << "Unknown flag: " << item << std::endl;
+        }
+    }
+    return flags;
+}
+
+static std::string formatLatency(const AVOLatencySummary& summary) {
+    std::ostringstream out;
+    out << "p50=" << summary.p50Us / 1000.0 << "ms p99=" << summary.p99Us / 1000.0 << "ms";
+    return out.str();
+}
+
+// Общие ключи сервера и клиента; i указывает на ключ, значение берется следом
+static bool parseCommonOption(int argc, char** argv, int& i, MetricsExportConfig& metrics,
+                              std::string& traceFile, double& statsSeconds) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+        return false;
+    }
+    if (arg == "--metrics-file") {
+        metrics.filePath = argv[++i];
+    } else if (arg == "--metrics-socket") {
+        metrics.socketPath = argv[++i];
+    } else if (arg == "--trace") {
+        traceFile = argv[++i];
+    } else if (arg == "--stats") {
+        statsSeconds = atof(argv[++i]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// ================= ИСТОЧНИКИ КАДРОВ =================
+
+class HeadlessSource {
+public:
+    virtual ~HeadlessSource() {}
+    // Следующий кадр RGB24; delayMs - задержка до следующего (0 - неизвестна).
+    // false - кадры кончились
+    virtual bool next(std::vector<uint8_t>& frame, uint32_t& delayMs) = 0;
+    virtual uint32_t width() const = 0;
+    virtual uint32_t height() const = 0;
+};
+
+// Архив декодируется по одному кадру через отображение в память
+class ArchiveSource : public HeadlessSource {
+public:
+    ArchiveSource(bool loop) : loop(loop), index(0) {}
+
+    bool open(const std::string& filename) {
+        if (!archive.open(filename) || archive.getFrameCount() == 0) {
+            return false;
+        }
+        format = AVOCodec::getPixelFormat(archive.getFlags());
+        return true;
+    }
+
+    bool next(std::vector<uint8_t>& frame, uint32_t& delayMs) override {
+        if (index >= archive.getFrameCount()) {
+            if (!loop) {
+                return false;
+            }
+            index = 0;
+            prevFrame.clear();
+            context = AVOStreamContext();
+        }
+        if (index % 64 == 0) {
+            archive.prefetch(index, 128);
+        }
+        if (!archive.decodeRecord(index, prevFrame, &context, currFrame)) {
+            std::cerr << "Cannot decode frame " << index << std::endl;
+            return false;
+        }
+        if (format == AVO_PIXEL_YUV420) {
+            AVOCodec::yuv420ToRGB(currFrame, width(), height(), frame);
+        } else {
+            frame = currFrame;
+        }
+        delayMs = archive.getRecords()[index].delayMs;
+        prevFrame.swap(currFrame);
+        index++;
+        return true;
+    }
+
+    uint32_t width() const override { return archive.getHeader().width; }
+    uint32_t height() const override { return archive.getHeader().height; }
+
+private:
+    AVOMappedArchive archive;
+    AVOPixelFormat format;
+    bool loop;
+    uint32_t index;
+    std::vector<uint8_t> prevFrame;
+    std::vector<uint8_t> currFrame;
+    AVOStreamContext context;
+};
+
+// Сырые кадры RGB24 подряд, без заголовков
+class RawSource : public HeadlessSource {
+public:
+    RawSource(uint32_t width, uint32_t height) : file(nullptr), frameWidth(width), frameHeight(height) {}
+
+    ~RawSource() override {
+        if (file && file != stdin) {
+            fclose(file);
+        }
+    }
+
+    bool open(const std::string& path) {
+        file = (path == "-") ? stdin : fopen(path.c_str(), "rb");
+        return file != nullptr;
+    }
+
+    bool next(std::vector<uint8_t>& frame, uint32_t& delayMs) override {
+        frame.resize(static_cast<size_t>(frameWidth) * frameHeight * 3);
+        delayMs = 0;
+        return fread(frame.data(), 1, frame.size(), file) == frame.size();
+    }
+
+    uint32_t width() const override { return frameWidth; }
+    uint32_t height() const override { return frameHeight; }
+
+private:
+    FILE* file;
+    uint32_t frameWidth;
+    uint32_t frameHeight;
+};
+
+#ifdef AVO_WITH_OPENCV
+class CameraSource : public HeadlessSource {
+public:
+    CameraSource(uint32_t width, uint32_t height) : frameWidth(width), frameHeight(height) {}
+
+    bool open(int index) {
+        if (!capture.open(index)) {
+            return false;
+        }
+        capture.set(cv::CAP_PROP_FRAME_WIDTH, frameWidth);
+        capture.set(cv::CAP_PROP_FRAME_HEIGHT, frameHeight);
+        return true;
+    }
+
+    bool next(std::vector<uint8_t>& frame, uint32_t& delayMs) override {
+        delayMs = 0;
+        if (!capture.read(captured) || captured.empty()) {
+            return false;
+        }
+        if (captured.cols != static_cast<int>(frameWidth) ||
+            captured.rows != static_cast<int>(frameHeight)) {
+            cv::resize(captured, resized, cv::Size(frameWidth, frameHeight));
+        } else {
+            resized = captured;
+        }
+        // Перестановка каналов сразу в буфер кадра, без промежуточного cv::Mat
+        frame.resize(static_cast<size_t>(frameWidth) * frameHeight * 3);
+        cv::Mat rgb(frameHeight, frameWidth, CV_8UC3, frame.data());
+        cv::cvtColor(resized, rgb, cv::COLOR_BGR2RGB);
+        return true;
+    }
+
+    uint32_t width() const override { return frameWidth; }
+    uint32_t height() const override { return frameHeight; }
+
+private:
+    cv::VideoCapture capture;
+    cv::Mat captured, resized;
+    uint32_t frameWidth;
+    uint32_t frameHeight;
+};
+#endif
+
+// ================= СЕРВЕР =================
+
+static int runServer(int argc, char** argv) {
+    std::string listen = "0.0.0.0:7777";
+    std::string source;
+    uint32_t width = 640, height = 480;
+    double fps = -1;        // -1: задержки архива, без темпа для остальных
+    bool loop = false;
+    int threads = 2;
+    uint32_t flags = AVO_FLAG_ENTROPY;
+    MetricsExportConfig metrics;
+    std::string traceFile;
+    double statsSeconds = 5;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (parseCommonOption(argc, argv, i, metrics, traceFile, statsSeconds)) {
+            continue;
+        } else if (arg == "--listen" && i + 1 < argc) {
+            listen = argv[++i];
+        } else if (arg == "--source" && i + 1 < argc) {
+            source = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width < 2 || height < 2) {
+                std::cerr << "Invalid size: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--fps" && i + 1 < argc) {
+            fps = std::max(0.0, atof(argv[++i]));
+        } else if (arg == "--loop") {
+            loop = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--flags" && i + 1 < argc) {
+            flags = parseFlags(argv[++i]);
+        } else {
+            std::cerr << "Unknown server option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<HeadlessSource> frames;
+    if (source.compare(0, 4, "avo:") == 0) {
+        ArchiveSource* archive = new ArchiveSource(loop);
+        frames.reset(archive);
+        if (!archive->open(source.substr(4))) {
+            std::cerr << "Cannot open archive: " << source.substr(4) << std::endl;
+            return 1;
+        }
+    } else if (source.compare(0, 4, "raw:") == 0) {
+        RawSource* raw = new RawSource(width, height);
+        frames.reset(raw);
+        if (!raw->open(source.substr(4))) {
+            std::cerr << "Cannot open raw input: " << source.substr(4) << std::endl;
+            return 1;
+        }
+        if (fps < 0) {
+            fps = 0;
+        }
+    } else if (source.compare(0, 7, "camera:") == 0) {
+#ifdef AVO_WITH_OPENCV
+        CameraSource* camera = new CameraSource(width, height);
+        frames.reset(camera);
+        if (!camera->open(atoi(source.c_str() + 7))) {
+            std::cerr << "Cannot open camera: " << source.substr(7) << std::endl;
+            return 1;
+        }
+        if (fps < 0) {
+            fps = 0;
+        }
+#else
+        std::cerr << "Camera source requires building with -DAVO_WITH_OPENCV" << std::endl;
+        return 1;
+#endif
+    } else {
+        std::cerr << "Source required: --source avo:FILE | raw:FILE | raw:- | camera:N" << std::endl;
+        return 1;
+    }
+
+    std::string ip;
+    int port;
+    if (!parseAddress(listen, ip, port)) {
+        std::cerr << "Invalid address: " << listen << std::endl;
+        return 1;
+    }
+
+    if (!traceFile.empty()) {
+        AVOTrace::start();
+        AVOTrace::setProcessName("AVO headless server");
+        AVOTrace::setThreadName("source");
+    }
+
+    if (!NetworkStream::initializeNetwork()) {
+        std::cerr << "Network initialization error!" << std::endl;
+        return 1;
+    }
+
+    NetworkStream server;
+    server.setEncoderThreads(threads);
+    server.setStreamFlags(flags);
+    if (!server.startUDPServer(ip, port)) {
+        std::cerr << "Failed to start UDP server on " << listen << std::endl;
+        NetworkStream::cleanupNetwork();
+        return 1;
+    }
+    metrics.instance = "server:" + std::to_string(port);
+    if (metrics.enabled()) {
+        server.startMetricsExport(metrics);
+    }
+
+    std::cerr << "Serving " << frames->width() << "x" << frames->height() << " on " << listen
+              << ", waiting for a client..." << std::endl;
+    while (!stopRequested && !server.hasUDPClient()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    std::vector<uint8_t> frame;
+    auto next = std::chrono::steady_clock::now();
+    auto lastStats = next;
+    uint64_t framesRead = 0;
+    while (!stopRequested) {
+        uint32_t delayMs = 0;
+        bool ok;
+        {
+            AVOTraceScope traceCapture("capture", server.getNextFrameId());
+            ok = frames->next(frame, delayMs);
+        }
+        if (!ok) {
+            break;
+        }
+        framesRead++;
+
+        // Без темпа источник ждет кодер, а не теряет кадры в его очереди
+        if (fps == 0) {
+            while (!stopRequested && server.getPendingFrames() > static_cast<uint32_t>(threads)) {
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        }
+        server.sendUDPFrame(frame, frames->width(), frames->height());
+
+        if (fps > 0) {
+            next += std::chrono::microseconds(static_cast<int64_t>(1e6 / fps));
+            std::this_thread::sleep_until(next);
+        } else if (fps < 0) {
+            next += std::chrono::milliseconds(delayMs > 0 ? delayMs : 33);
+            std::this_thread::sleep_until(next);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (statsSeconds > 0 && now - lastStats >= std::chrono::duration<double>(statsSeconds)) {
+            NetworkStream::ServerStats stats = server.getStats();
+            std::cerr << "[server] read " << framesRead << " encoded " << stats.framesProcessed
+                      << " sent " << std::fixed << std::setprecision(1)
+                      << stats.bytesSent / 1048576.0 << " MB, dropped "
+                      << stats.bufferDropped + stats.sendQueueDropped << ", compare "
+                      << formatLatency(stats.compare) << ", age " << formatLatency(stats.frameAge)
+                      << std::endl;
+            lastStats = now;
+        }
+    }
+
+    // Даем кодеру и отправке досылать очередь
+    for (int waited = 0; waited < 500 && !stopRequested && server.getPendingFrames() > 0; waited++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    NetworkStream::ServerStats stats = server.getStats();
+    std::cerr << "[server] done: read " << framesRead << " encoded " << stats.framesProcessed
+              << ", dropped " << stats.bufferDropped << " (frame queue) + " << stats.sendQueueDropped
+              << " (send queue)" << std::endl;
+
+    server.stopMetricsExport();
+    server.stopUDPServer();
+    NetworkStream::cleanupNetwork();
+    if (!traceFile.empty()) {
+        AVOTrace::stop();
+        AVOTrace::writeChromeTrace(traceFile);
+    }
+    return 0;
+}
+
+// ================= КЛИЕНТ =================
+
+// Очередь декодера и приемник кадров
+struct HeadlessClient {
+    NetworkStream& stream;
+    FILE* sink;             // nullptr - кадры никуда не пишутся
+    uint32_t sinkWidth = 0;
+    uint32_t sinkHeight = 0;
+
+    std::queue<FramePacket> packetQueue;
+    std::mutex queueMutex;
+    std::condition_variable queueCondVar;
+    bool running = true;
+
+    std::vector<uint8_t> currentFrame;
+    std::vector<uint8_t> rgbFrame;
+    std::atomic<uint64_t> framesDecoded{0};
+    std::atomic<uint64_t> decodeErrors{0};
+    std::atomic<uint64_t> queueDropped{0};
+
+    HeadlessClient(NetworkStream& stream, FILE* sink) : stream(stream), sink(sink) {}
+
+    void push(const FramePacket& packet) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (packetQueue.size() >= 50) {
+                while (packetQueue.size() >= 40) {
+                    packetQueue.pop();
+                    queueDropped++;
+                    stream.recordDropped();
+                }
+            }
+            packetQueue.push(packet);
+        }
+        queueCondVar.notify_one();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            running = false;
+        }
+        queueCondVar.notify_all();
+    }
+
+    void decoderLoop() {
+        AVOTrace::setThreadName("decoder");
+        while (true) {
+            FramePacket packet;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondVar.wait(lock, [this]() { return !packetQueue.empty() || !running; });
+                if (packetQueue.empty()) {
+                    break;
+                }
+                packet = std::move(packetQueue.front());
+                packetQueue.pop();
+            }
+            decode(packet);
+        }
+    }
+
+    void decode(const FramePacket& packet) {
+        if (packet.data.empty()) {
+            return;
+        }
+        uint64_t startUs = AVOTrace::now();
+        AVOPixelFormat format = AVOCodec::getPixelFormat(packet.flags);
+        bool noChanges = packet.data.size() == 1 && packet.data[0] == 0;
+        if (!noChanges) {
+            if (packet.isFullFrame) {
+                currentFrame = packet.data;
+            } else {
+                if (currentFrame.size() != AVOCodec::getFrameSize(packet.width, packet.height, format)) {
+                    currentFrame = AVOCodec::createBlackFrame(packet.width, packet.height, format);
+                }
+                std::vector<uint8_t> newFrame;
+                if (!AVOCodec::decodeDiffPayload(packet.data, currentFrame, packet.width,
+                                                 packet.height, packet.flags, newFrame)) {
+                    decodeErrors++;
+                    return;
+                }
+                currentFrame.swap(newFrame);
+            }
+        }
+        uint64_t endUs = AVOTrace::now();
+        AVOTrace::complete("decode", packet.frameId, startUs, endUs);
+        stream.recordDecode(packet, endUs - startUs);
+        framesDecoded++;
+
+        if (sink && currentFrame.size() == AVOCodec::getFrameSize(packet.width, packet.height, format)) {
+            writeFrame(packet.width, packet.height, format);
+        }
+    }
+
+    void writeFrame(uint32_t width, uint32_t height, AVOPixelFormat format) {
+        if (sinkWidth == 0) {
+            sinkWidth = width;
+            sinkHeight = height;
+            std::cerr << "[client] writing " << width << "x" << height << " RGB24 frames" << std::endl;
+        } else if (width != sinkWidth || height != sinkHeight) {
+            // Сырой поток без заголовков не может сменить размер
+            return;
+        }
+        const std::vector<uint8_t>* rgb = &currentFrame;
+        if (format == AVO_PIXEL_YUV420) {
+            AVOCodec::yuv420ToRGB(currentFrame, width, height, rgbFrame);
+            rgb = &rgbFrame;
+        }
+        if (fwrite(rgb->data(), 1, rgb->size(), sink) != rgb->size()) {
+            // Читатель закрыл канал - дальше только декодируем
+            std::cerr << "[client] sink closed" << std::endl;
+            sink = nullptr;
+        }
+    }
+};
+
+static int runClient(int argc, char** argv) {
+    std::string connect = "127.0.0.1:7777";
+    std::string sinkSpec = "null";
+    uint64_t maxFrames = 0;
+    MetricsExportConfig metrics;
+    std::string traceFile;
+    double statsSeconds = 5;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (parseCommonOption(argc, argv, i, metrics, traceFile, statsSeconds)) {
+            continue;
+        } else if (arg == "--connect" && i + 1 < argc) {
+            connect = argv[++i];
+        } else if (arg == "--sink" && i + 1 < argc) {
+            sinkSpec = argv[++i];
+        } else if (arg == "--frames" && i + 1 < argc) {
+            maxFrames = strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Unknown client option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    FILE* sink = nullptr;
+    if (sinkSpec.compare(0, 4, "raw:") == 0) {
+        std::string path = sinkSpec.substr(4);
+        if (path == "-") {
+            // stdout занят кадрами: журнал NetworkStream уходит в stderr
+            sink = stdout;
+            std::cout.rdbuf(std::cerr.rdbuf());
+        } else {
+            sink = fopen(path.c_str(), "wb");
+        }
+        if (!sink) {
+            std::cerr << "Cannot open sink: " << path << std::endl;
+            return 1;
+        }
+    } else if (sinkSpec != "null") {
+        std::cerr << "Sink must be null, raw:FILE or raw:-" << std::endl;
+        return 1;
+    }
+
+    std::string ip;
+    int port;
+    if (!parseAddress(connect, ip, port)) {
+        std::cerr << "Invalid address: " << connect << std::endl;
+        return 1;
+    }
+
+    if (!traceFile.empty()) {
+        AVOTrace::start();
+        AVOTrace::setProcessName("AVO headless client");
+    }
+
+    if (!NetworkStream::initializeNetwork()) {
+        std::cerr << "Network initialization error!" << std::endl;
+        return 1;
+    }
+
+    NetworkStream stream;
+    if (!stream.connectToUDPServer(ip, port)) {
+        std::cerr << "Failed to connect to UDP server " << connect << std::endl;
+        NetworkStream::cleanupNetwork();
+        return 1;
+    }
+    metrics.instance = "client:" + connect;
+    if (metrics.enabled()) {
+        stream.startMetricsExport(metrics);
+    }
+
+    HeadlessClient client(stream, sink);
+    std::thread decoder(&HeadlessClient::decoderLoop, &client);
+    if (!stream.startUDPReceiver(std::function<void(const FramePacket&)>(
+            [&client](const FramePacket& packet) { client.push(packet); }))) {
+        std::cerr << "Failed to start UDP receiver" << std::endl;
+        client.stop();
+        decoder.join();
+        stream.disconnectUDP();
+        NetworkStream::cleanupNetwork();
+        return 1;
+    }
+
+    auto lastStats = std::chrono::steady_clock::now();
+    while (!stopRequested && (maxFrames == 0 || client.framesDecoded < maxFrames)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto now = std::chrono::steady_clock::now();
+        if (statsSeconds > 0 && now - lastStats >= std::chrono::duration<double>(statsSeconds)) {
+            NetworkStream::ClientStats stats = stream.getClientStats();
+            std::cerr << "[client] received " << stats.framesReceived << " decoded "
+                      << client.framesDecoded << ", dropped " << client.queueDropped
+                      << " (queue) + " << stats.reassemblyExpired << " (reassembly), errors "
+                      << client.decodeErrors << ", end-to-end " << formatLatency(stats.endToEnd)
+                      << std::endl;
+            lastStats = now;
+        }
+    }
+
+    stream.stopMetricsExport();
+    stream.disconnectUDP();
+    client.stop();
+    decoder.join();
+    NetworkStream::cleanupNetwork();
+
+    NetworkStream::ClientStats stats = stream.getClientStats();
+    std::cerr << "[client] done: received " << stats.framesReceived << " decoded "
+              << client.framesDecoded << ", errors " << client.decodeErrors
+              << ", end-to-end " << formatLatency(stats.endToEnd) << std::endl;
+
+    if (sink && sink != stdout) {
+        fclose(sink);
+    } else if (sink) {
+        fflush(sink);
+    }
+    if (!traceFile.empty()) {
+        AVOTrace::stop();
+        AVOTrace::writeChromeTrace(traceFile);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode != "server" && mode != "client") {
+        std::cerr << "Usage: avo_headless server [--listen IP:PORT] --source avo:FILE|raw:FILE|raw:-|camera:N\n"
+                  << "                           [--size WxH] [--fps N] [--loop] [--threads N]\n"
+                  << "                           [--flags entropy,yuv420] [--stats SEC]\n"
+                  << "                           [--metrics-file FILE] [--metrics-socket PATH] [--trace FILE]\n"
+                  << "       avo_headless client [--connect IP:PORT] [--sink null|raw:FILE|raw:-]\n"
+                  << "                           [--frames N] [--stats SEC]\n"
+                  << "                           [--metrics-file FILE] [--metrics-socket PATH] [--trace FILE]"
+                  << std::endl;
+        return mode == "--help" ? 0 : 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+#ifdef SIGPIPE
+    // Закрытый канал приемника - ошибка записи, а не завершение процесса
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    return mode == "server" ? runServer(argc, argv) : runClient(argc, argv);
+}
@@ -0,0 +1,121 @@
+#include "avo_histogram.h"
+#include <algorithm>
+#include <cmath>
+
+AVOLatencyHistogram::AVOLatencyHistogram() {
+    reset();
+}
+
+// Номер старшего единичного бита (value > 0)
+static int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+uint32_t AVOLatencyHistogram::bucketIndex(uint64_t valueUs) {
+    if (valueUs > MAX_VALUE_US) {
+        valueUs = MAX_VALUE_US;
+    }
+    if (valueUs < SUB_BUCKETS) {
+        return static_cast<uint32_t>(valueUs);
+    }
+    // Старшие SUB_BUCKET_BITS бит после ведущей единицы - номер корзины в степени
+    int exponent = highestBit(valueUs);
+    uint32_t sub = static_cast<uint32_t>(valueUs >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return static_cast<uint32_t>(exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t AVOLatencyHistogram::bucketUpperBound(uint32_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    int exponent = static_cast<int>(index / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    uint64_t sub = index % SUB_BUCKETS;
+    int shift = exponent - SUB_BUCKET_BITS;
+    uint64_t lower = (SUB_BUCKETS + sub) << shift;
+    return std::min<uint64_t>(MAX_VALUE_US, lower + (1ull << shift) - 1);
+}
+
+void AVOLatencyHistogram::record(uint64_t valueUs) {
+    buckets[bucketIndex(valueUs)].fetch_add(1, std::memory_order_relaxed);
+    totalCount.fetch_add(1, std::memory_order_relaxed);
+    totalUs.fetch_add(valueUs, std::memory_order_relaxed);
+
+    uint64_t current = maxUs.load(std::memory_order_relaxed);
+    while (valueUs > current &&
+           !maxUs.compare_exchange_weak(current, valueUs, std::memory_order_relaxed)) {
+    }
+}
+
+void AVOLatencyHistogram::reset() {
+    for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+    totalCount.store(0, std::memory_order_relaxed);
+    totalUs.store(0, std::memory_order_relaxed);
+    maxUs.store(0, std::memory_order_relaxed);
+}
+
+uint64_t AVOLatencyHistogram::percentile(double percent) const {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+        count += buckets[i].load(std::memory_order_relaxed);
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(percent / 100.0 * count));
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucketUpperBound(i), maxUs.load(std::memory_order_relaxed));
+        }
+    }
+    return maxUs.load(std::memory_order_relaxed);
+}
+
+AVOLatencySummary AVOLatencyHistogram::summarize() const {
+    // Снимок корзин: записи во время обхода попадут в следующую сводку
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        count += counts[i];
+    }
+
+    AVOLatencySummary summary;
+    summary.count = count;
+    summary.maxUs = maxUs.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return summary;
+    }
+    summary.meanUs = static_cast<double>(totalUs.load(std::memory_order_relaxed)) /
+                     std::max<uint64_t>(1, totalCount.load(std::memory_order_relaxed));
+
+    const double percents[4] = {50.0, 90.0, 99.0, 99.9};
+    uint64_t* targets[4] = {&summary.p50Us, &summary.p90Us, &summary.p99Us, &summary.p999Us};
+    uint64_t seen = 0;
+    int next = 0;
+    for (uint32_t i = 0; i < BUCKET_COUNT && next < 4; i++) {
+        seen += counts[i];
+        while (next < 4) {
+            uint64_t rank = static_cast<uint64_t>(std::ceil(percents[next] / 100.0 * count));
+            if (seen < std::max<uint64_t>(1, rank)) {
+                break;
+            }
+            *targets[next] = std::min(bucketUpperBound(i), summary.maxUs);
+            next++;
+        }
+    }
+    return summary;
+}
@@ -0,0 +1,54 @@
+#ifndef AVO_HISTOGRAM_H
+#define AVO_HISTOGRAM_H
+
+#include <cstdint>
+#include <atomic>
+
+// Сводка гистограммы; перцентили - верхняя граница корзины, в микросекундах
+struct AVOLatencySummary {
+    uint64_t count = 0;
+    double meanUs = 0;
+    uint64_t p50Us = 0;
+    uint64_t p90Us = 0;
+    uint64_t p99Us = 0;
+    uint64_t p999Us = 0;
+    uint64_t maxUs = 0;
+};
+
+// Гистограмма задержек в микросекундах с логарифмически-линейными корзинами,
+// как в HdrHistogram: значения до 32 хранятся точно, дальше на каждую степень
+// двойки приходится 32 корзины (относительная ошибка не больше 1/32).
+// Значения больше MAX_VALUE_US (около 71 минуты) попадают в последнюю корзину.
+// Запись - три relaxed-атомарных сложения и редкий CAS максимума, без
+// блокировок, поэтому гистограммы можно держать включенными всегда;
+// сводка проходит по 896 корзинам
+class AVOLatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr uint64_t MAX_VALUE_US = 0xFFFFFFFFull;
+    static constexpr uint32_t BUCKET_COUNT = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    AVOLatencyHistogram();
+
+    AVOLatencyHistogram(const AVOLatencyHistogram&) = delete;
+    AVOLatencyHistogram& operator=(const AVOLatencyHistogram&) = delete;
+
+    void record(uint64_t valueUs);
+    void reset();
+
+    // Значение, не больше которого percent процентов записей
+    uint64_t percentile(double percent) const;
+    AVOLatencySummary summarize() const;
+
+    static uint32_t bucketIndex(uint64_t valueUs);
+    static uint64_t bucketUpperBound(uint32_t index);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> totalCount;
+    std::atomic<uint64_t> totalUs;
+    std::atomic<uint64_t> maxUs;
+};
+
+#endif // AVO_HISTOGRAM_H
@@ -0,0 +1,161 @@
+#include "avo_instrument.h"
+#include <mutex>
+#include <memory>
+#include <iomanip>
+#include <string>
+
+namespace {
+
+// Таблицы завершившихся потоков остаются в реестре, чтобы их счетчики
+// попали в итог
+struct InstrumentRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<AVOInstrument::ThreadTable>> tables;
+    uint32_t nextThread = 1;
+};
+
+InstrumentRegistry& registry() {
+    static InstrumentRegistry instance;
+    return instance;
+}
+
+thread_local std::shared_ptr<AVOInstrument::ThreadTable> localTable;
+
+const AVOInstrument::Field FIELDS[6] = {
+    AVOInstrument::CALLS, AVOInstrument::TIME_NS, AVOInstrument::PIXELS,
+    AVOInstrument::RUNS, AVOInstrument::BYTES, AVOInstrument::SLOW_PATHS
+};
+
+uint64_t* counterField(AVOProbeCounters& counters, AVOInstrument::Field field) {
+    switch (field) {
+        case AVOInstrument::CALLS: return &counters.calls;
+        case AVOInstrument::TIME_NS: return &counters.timeNs;
+        case AVOInstrument::PIXELS: return &counters.pixels;
+        case AVOInstrument::RUNS: return &counters.runs;
+        case AVOInstrument::BYTES: return &counters.bytes;
+        default: return &counters.slowPaths;
+    }
+}
+
+void printRow(std::ostream& out, const std::string& thread, AVOProbe probe,
+              const AVOProbeCounters& counters) {
+    double totalUs = counters.timeNs / 1000.0;
+    out << std::setw(8) << thread << std::setw(10) << AVOInstrument::probeName(probe)
+        << std::setw(10) << counters.calls
+        << std::setw(12) << std::fixed << std::setprecision(0) << totalUs
+        << std::setw(10) << std::setprecision(1)
+        << (counters.calls ? totalUs / counters.calls : 0.0)
+        << std::setw(14) << counters.pixels << std::setw(12) << counters.runs
+        << std::setw(14) << counters.bytes << std::setw(10) << counters.slowPaths << "\n";
+}
+
+} // namespace
+
+AVOInstrument::ThreadTable& AVOInstrument::local() {
+    if (!localTable) {
+        auto table = std::make_shared<ThreadTable>();
+        for (int probe = 0; probe < AVO_PROBE_COUNT; probe++) {
+            for (int field = 0; field < 6; field++) {
+                table->counters[probe][field].store(0, std::memory_order_relaxed);
+            }
+        }
+        InstrumentRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        table->thread = reg.nextThread++;
+        reg.tables.push_back(table);
+        localTable = table;
+    }
+    return *localTable;
+}
+
+std::vector<AVOThreadProbes> AVOInstrument::snapshot() {
+    std::vector<AVOThreadProbes> result;
+    InstrumentRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& table : reg.tables) {
+        AVOThreadProbes thread;
+        thread.thread = table->thread;
+        for (int probe = 0; probe < AVO_PROBE_COUNT; probe++) {
+            for (Field field : FIELDS) {
+                *counterField(thread.probes[probe], field) =
+                    table->counters[probe][field].load(std::memory_order_relaxed);
+            }
+        }
+        result.push_back(thread);
+    }
+    return result;
+}
+
+AVOProbeCounters AVOInstrument::total(const std::vector<AVOThreadProbes>& threads, AVOProbe probe) {
+    AVOProbeCounters sum;
+    for (const auto& thread : threads) {
+        const AVOProbeCounters& counters = thread.probes[probe];
+        sum.calls += counters.calls;
+        sum.timeNs += counters.timeNs;
+        sum.pixels += counters.pixels;
+        sum.runs += counters.runs;
+        sum.bytes += counters.bytes;
+        sum.slowPaths += counters.slowPaths;
+    }
+    return sum;
+}
+
+// Сброс из чужого потока может потерять одновременное приращение - для
+// отчетов между прогонами этого достаточно
+void AVOInstrument::reset() {
+    InstrumentRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto& table : reg.tables) {
+        for (int probe = 0; probe < AVO_PROBE_COUNT; probe++) {
+            for (int field = 0; field < 6; field++) {
+                table->counters[probe][field].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void AVOInstrument::report(std::ostream& out) {
+    if (!compiledIn) {
+        out << "Instrumentation: disabled (build with -DAVO_INSTRUMENT)" << std::endl;
+        return;
+    }
+
+    std::vector<AVOThreadProbes> threads = snapshot();
+    std::ios::fmtflags savedFlags = out.flags();
+    std::streamsize savedPrecision = out.precision();
+
+    out << "Instrumentation (per thread):\n"
+        << std::setw(8) << "thread" << std::setw(10) << "probe" << std::setw(10) << "calls"
+        << std::setw(12) << "total us" << std::setw(10) << "us/call" << std::setw(14) << "pixels"
+        << std::setw(12) << "runs" << std::setw(14) << "bytes" << std::setw(10) << "slow" << "\n";
+    for (const auto& thread : threads) {
+        for (int probe = 0; probe < AVO_PROBE_COUNT; probe++) {
+            if (thread.probes[probe].calls > 0) {
+                printRow(out, std::to_string(thread.thread), static_cast<AVOProbe>(probe),
+                         thread.probes[probe]);
+            }
+        }
+    }
+    for (int probe = 0; probe < AVO_PROBE_COUNT; probe++) {
+        AVOProbeCounters sum = total(threads, static_cast<AVOProbe>(probe));
+        if (sum.calls > 0) {
+            printRow(out, "all", static_cast<AVOProbe>(probe), sum);
+        }
+    }
+    out.flush();
+
+    out.flags(savedFlags);
+    out.precision(savedPrecision);
+}
+
+const char* AVOInstrument::probeName(AVOProbe probe) {
+    switch (probe) {
+        case AVO_PROBE_COMPARE: return "compare";
+        case AVO_PROBE_COMPRESS: return "compress";
+        case AVO_PROBE_APPLY: return "apply";
+        case AVO_PROBE_ENCODE: return "encode";
+        case AVO_PROBE_SEND: return "send";
+        case AVO_PROBE_RECEIVE: return "receive";
+        default: return "unknown";
+    }
+}
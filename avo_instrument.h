@@ -0,0 +1,111 @@
+#ifndef AVO_INSTRUMENT_H
+#define AVO_INSTRUMENT_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// Счетчики и таймеры горячих путей кодека и сетевых потоков. Включаются
+// при сборке: -DAVO_INSTRUMENT (одинаково для всех файлов). Без него
+// макросы AVO_PROBE_* раскрываются в пустые выражения и аргументы не
+// вычисляются, так что обычная сборка не платит ничего.
+//
+// Со включенными пробами каждый поток копит свою таблицу: вызовы, время,
+// пиксели, серии, байты и "медленные" пути (см. описание проб). Запись -
+// relaxed load/store без lock-префикса, таблицу меняет только свой поток;
+// snapshot() и report() можно вызывать из любого потока в любой момент.
+enum AVOProbe {
+    AVO_PROBE_COMPARE = 0,  // поиск изменений: пиксели - просмотренные тройки,
+                            // серии - найденные, медленно - блоки 16 троек с
+                            // попиксельной проверкой (без SSE2 - каждая тройка)
+    AVO_PROBE_COMPRESS,     // compressRLE: серии на входе, байты на выходе
+    AVO_PROBE_APPLY,        // applyChanges: записанные пиксели и серии, медленно -
+                            // серии не рядом с предыдущей (дальше 4 КБ, промах кэша)
+    AVO_PROBE_ENCODE,       // кадр в пуле кодера сервера: пиксели кадра, байты данных,
+                            // медленно - отправка полного кадра вместо изменений
+    AVO_PROBE_SEND,         // кадр в потоке отправки: датаграммы (серии), байты,
+                            // медленно - фрагментация
+    AVO_PROBE_RECEIVE,      // датаграмма в потоке приема: байты, медленно - фрагмент
+    AVO_PROBE_COUNT
+};
+
+struct AVOProbeCounters {
+    uint64_t calls = 0;
+    uint64_t timeNs = 0;
+    uint64_t pixels = 0;
+    uint64_t runs = 0;
+    uint64_t bytes = 0;
+    uint64_t slowPaths = 0;
+};
+
+struct AVOThreadProbes {
+    uint32_t thread;        // порядковый номер потока по первой записи
+    AVOProbeCounters probes[AVO_PROBE_COUNT];
+};
+
+class AVOInstrument {
+public:
+#ifdef AVO_INSTRUMENT
+    static constexpr bool compiledIn = true;
+#else
+    static constexpr bool compiledIn = false;
+#endif
+
+    // Таблица текущего потока (создается при первой записи)
+    struct ThreadTable {
+        uint32_t thread = 0;
+        std::atomic<uint64_t> counters[AVO_PROBE_COUNT][6];
+    };
+    enum Field { CALLS = 0, TIME_NS, PIXELS, RUNS, BYTES, SLOW_PATHS };
+
+    static ThreadTable& local();
+
+    static void add(AVOProbe probe, Field field, uint64_t value) {
+        std::atomic<uint64_t>& counter = local().counters[probe][field];
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Таблицы всех потоков, в том числе завершившихся
+    static std::vector<AVOThreadProbes> snapshot();
+    static AVOProbeCounters total(const std::vector<AVOThreadProbes>& threads, AVOProbe probe);
+    static void reset();
+
+    // Таблица по потокам и итог; без AVO_INSTRUMENT - одна строка об этом
+    static void report(std::ostream& out);
+
+    static const char* probeName(AVOProbe probe);
+};
+
+// Время и число вызовов от конструктора до деструктора
+class AVOProbeScope {
+public:
+    explicit AVOProbeScope(AVOProbe probe)
+        : probe(probe), start(std::chrono::steady_clock::now()) {}
+
+    ~AVOProbeScope() {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        AVOInstrument::add(probe, AVOInstrument::CALLS, 1);
+        AVOInstrument::add(probe, AVOInstrument::TIME_NS, ns);
+    }
+
+    AVOProbeScope(const AVOProbeScope&) = delete;
+    AVOProbeScope& operator=(const AVOProbeScope&) = delete;
+
+private:
+    AVOProbe probe;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef AVO_INSTRUMENT
+    #define AVO_PROBE_SCOPE(probe) AVOProbeScope avoProbeScope_##probe(probe)
+    #define AVO_PROBE_ADD(probe, field, value) \
+        AVOInstrument::add(probe, AVOInstrument::field, static_cast<uint64_t>(value))
+#else
+    #define AVO_PROBE_SCOPE(probe) ((void)0)
+    #define AVO_PROBE_ADD(probe, field, value) ((void)0)
+#endif
+
+#endif // AVO_INSTRUMENT_H
@@ -0,0 +1,194 @@
+#include "avo_mapped.h"
+#include <iostream>
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Окно упреждающего чтения при последовательном декодировании (в кадрах)
+static const uint32_t PREFETCH_FRAMES = 32;
+
+AVOMappedArchive::AVOMappedArchive()
+    : data(nullptr), size(0),
+#ifdef _WIN32
+      fileHandle(nullptr), mappingHandle(nullptr),
+#endif
+      flags(0) {
+    header = AVOHeader();
+}
+
+AVOMappedArchive::~AVOMappedArchive() {
+    close();
+}
+
+bool AVOMappedArchive::open(const std::string& filename) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Cannot open archive: " << filename << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        std::cerr << "Invalid archive: " << filename << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "Cannot map archive: " << filename << std::endl;
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open archive: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << "Invalid archive: " << filename << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);    // отображение остается действительным
+    if (view == MAP_FAILED) {
+        std::cerr << "Cannot map archive: " << filename << std::endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(st.st_size);
+    madvise(view, size, MADV_SEQUENTIAL);
+#endif
+
+    if (!AVOCodec::parseArchiveIndex(data, size, header, flags, records)) {
+        std::cerr << "Invalid archive: " << filename << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void AVOMappedArchive::close() {
+    if (data) {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = nullptr;
+#else
+        munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+    data = nullptr;
+    size = 0;
+    flags = 0;
+    header = AVOHeader();
+    records.clear();
+}
+
+AVOPayloadView AVOMappedArchive::getPayload(uint32_t index) const {
+    if (index >= records.size()) {
+        return AVOPayloadView{nullptr, 0};
+    }
+    const AVORecordInfo& record = records[index];
+    return AVOPayloadView{data + record.offset, record.size};
+}
+
+void AVOMappedArchive::prefetch(uint32_t first, uint32_t count) const {
+#ifndef _WIN32
+    if (first >= records.size() || count == 0) {
+        return;
+    }
+    size_t last = std::min<size_t>(records.size(), static_cast<size_t>(first) + count) - 1;
+
+    // madvise требует адреса, выровненного по странице
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = static_cast<size_t>(records[first].offset) & ~(pageSize - 1);
+    size_t end = static_cast<size_t>(records[last].offset + records[last].size);
+    if (end > begin) {
+        madvise(const_cast<uint8_t*>(data) + begin, end - begin, MADV_WILLNEED);
+    }
+#else
+    (void)first;
+    (void)count;
+#endif
+}
+
+bool AVOMappedArchive::decodeRecord(uint32_t index, const std::vector<uint8_t>& prevFrame,
+                                    AVOStreamContext* context, std::vector<uint8_t>& frame) const {
+    if (index >= records.size()) {
+        return false;
+    }
+    const AVORecordInfo& record = records[index];
+    return AVOCodec::decodeArchiveRecord(record.frameType, data + record.offset, record.size,
+                                         prevFrame, header.width, header.height, flags,
+                                         context, frame);
+}
+
+bool AVOMappedArchive::decodeAll(const AVOFrameSink& sink) const {
+    if (!data) {
+        return false;
+    }
+
+    AVOPixelFormat format = AVOCodec::getPixelFormat(flags);
+    std::vector<uint8_t> prevFrame;
+    std::vector<uint8_t> currFrame;
+    AVOStreamContext context;
+    AVOFrame frame;
+    frame.isFullFrame = true;
+
+    // Окно вперед запрашивается заранее, пока декодируется текущее
+    prefetch(0, PREFETCH_FRAMES * 2);
+
+    for (uint32_t i = 0; i < records.size(); i++) {
+        if (i % PREFETCH_FRAMES == 0 && i > 0) {
+            prefetch(i + PREFETCH_FRAMES, PREFETCH_FRAMES);
+        }
+
+        if (!decodeRecord(i, prevFrame, &context, currFrame)) {
+            std::cerr << "Cannot decode frame " << i << std::endl;
+            return false;
+        }
+
+        frame.delayMs = records[i].delayMs;
+        if (format == AVO_PIXEL_YUV420) {
+            AVOCodec::yuv420ToRGB(currFrame, header.width, header.height, frame.data);
+            if (!sink(i, frame)) {
+                return true;
+            }
+            prevFrame.swap(currFrame);
+            continue;
+        }
+
+        // RGB кадр не копируется: буферы кадра, предыдущего и текущего
+        // меняются местами по кругу
+        frame.data.swap(currFrame);
+        if (!sink(i, frame)) {
+            return true;
+        }
+        prevFrame.swap(frame.data);
+    }
+
+    return true;
+}
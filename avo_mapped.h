@@ -0,0 +1,67 @@
+#ifndef AVO_MAPPED_H
+#define AVO_MAPPED_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "avo_codec.h"
+
+// Данные записи внутри отображения файла (без копирования);
+// действительны, пока архив открыт
+struct AVOPayloadView {
+    const uint8_t* data;
+    size_t size;
+};
+
+// Архив .avo, отображенный в память (mmap / MapViewOfFile). Цепочка записей
+// проверяется один раз при открытии, дальше данные кадров берутся прямо из
+// страничного кэша ОС: декодер читает их без промежуточных буферов.
+// Для последовательного чтения ядру передаются подсказки (MADV_SEQUENTIAL,
+// MADV_WILLNEED для окна впереди текущего кадра)
+class AVOMappedArchive {
+public:
+    AVOMappedArchive();
+    ~AVOMappedArchive();
+
+    AVOMappedArchive(const AVOMappedArchive&) = delete;
+    AVOMappedArchive& operator=(const AVOMappedArchive&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    uint32_t getFrameCount() const { return static_cast<uint32_t>(records.size()); }
+    const AVOHeader& getHeader() const { return header; }
+    uint32_t getFlags() const { return flags; }
+    const std::vector<AVORecordInfo>& getRecords() const { return records; }
+
+    // Данные записи index; {nullptr, 0} для несуществующей записи
+    AVOPayloadView getPayload(uint32_t index) const;
+
+    // Подсказка ОС: записи [first, first + count) скоро понадобятся
+    void prefetch(uint32_t first, uint32_t count) const;
+
+    // Декодирование записи index в формате хранения (prevFrame -> frame),
+    // см. AVOCodec::decodeArchiveRecord
+    bool decodeRecord(uint32_t index, const std::vector<uint8_t>& prevFrame,
+                      AVOStreamContext* context, std::vector<uint8_t>& frame) const;
+
+    // Последовательное декодирование всех кадров (RGB) в sink
+    bool decodeAll(const AVOFrameSink& sink) const;
+
+private:
+    const uint8_t* data;
+    size_t size;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+
+    AVOHeader header;
+    uint32_t flags;
+    std::vector<AVORecordInfo> records;
+};
+
+#endif // AVO_MAPPED_H
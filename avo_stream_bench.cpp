@@ -0,0 +1,802 @@
+// Сквозной бенчмарк UDP-трансляции без камеры и окон: сервер и N клиентов
+// NetworkStream в одном процессе через loopback (каждый клиент - своя пара
+// сервер/клиент на отдельном порту, сервер обслуживает одного клиента).
+// Кадры берутся из архива .avo или синтетического генератора и подаются
+// с заданной частотой и разрешением. Для каждого числа потоков кодера
+// выводятся задержка от захвата до декодирования (перцентили), доставленные
+// кадры/с, байты в сети и потери по этапам; результаты дублируются в JSON.
+// Исходящие пакеты сервера можно пропустить через NetworkImpairment (потери,
+// серии потерь, дубли, перестановка, задержка, узкий канал) - тогда качество
+// (PSNR к исходному кадру) и время восстановления после повреждений
+// воспроизводимы на одной машине при том же --seed.
+//
+// Использование: avo_stream_bench [--avo FILE] [--size 640x480] [--fps 30] [--frames 300]
+//                                 [--clients N] [--threads 1,2,4]
+//                                 [--flags entropy,yuv420] [--port 7800] [--json FILE]
+//                                 [--loss P] [--burst P:LEN] [--dup P] [--reorder P:MS]
+//                                 [--delay MS[:JITTER]] [--rate KBPS] [--seed N] [--good-psnr DB]
+//                                 [--trace FILE]
+//
+// --trace пишет Chrome trace последнего прогона (последнее значение --threads):
+// этапы capture/queue/encode/send/receive/decode по номерам кадров.
+
+#include "network_stream.h"
+#include "avo_codec.h"
+#include "avo_mapped.h"
+#include "avo_trace.h"
+#include "avo_instrument.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ================= ИСТОЧНИК КАДРОВ =================
+
+class FrameSource {
+public:
+    FrameSource(uint32_t width, uint32_t height) : width(width), height(height) {}
+
+    // Кадры архива (RGB), приведенные к размеру width x height
+    bool loadArchive(const std::string& filename, uint32_t maxFrames) {
+        AVOMappedArchive archive;
+        if (!archive.open(filename)) {
+            return false;
+        }
+        const AVOHeader& header = archive.getHeader();
+        archive.decodeAll([&](uint32_t, const AVOFrame& frame) {
+            frames.push_back(scale(frame.data, header.width, header.height));
+            return frames.size() < maxFrames;
+        });
+        return !frames.empty();
+    }
+
+    // Кадр i: из архива по кругу или от генератора (в scratch);
+    // вызывается и из потоков клиентов
+    const std::vector<uint8_t>& frame(uint32_t i, std::vector<uint8_t>& scratch) const {
+        if (!frames.empty()) {
+            return frames[i % frames.size()];
+        }
+        generate(i, scratch);
+        return scratch;
+    }
+
+private:
+    // Ближайший сосед
+    std::vector<uint8_t> scale(const std::vector<uint8_t>& source, uint32_t sourceWidth,
+                               uint32_t sourceHeight) const {
+        if (sourceWidth == width && sourceHeight == height) {
+            return source;
+        }
+        std::vector<uint8_t> out(static_cast<size_t>(width) * height * 3);
+        for (uint32_t y = 0; y < height; y++) {
+            uint32_t sy = static_cast<uint32_t>(static_cast<uint64_t>(y) * sourceHeight / height);
+            for (uint32_t x = 0; x < width; x++) {
+                uint32_t sx = static_cast<uint32_t>(static_cast<uint64_t>(x) * sourceWidth / width);
+                memcpy(&out[(static_cast<size_t>(y) * width + x) * 3],
+                       &source[(static_cast<size_t>(sy) * sourceWidth + sx) * 3], 3);
+            }
+        }
+        return out;
+    }
+
+    // Статичный градиент, движущийся квадрат и мерцающий участок
+    // (как шум матрицы); раз в 150 кадров - смена сцены
+    void generate(uint32_t i, std::vector<uint8_t>& synthetic) const {
+        synthetic.resize(static_cast<size_t>(width) * height * 3);
+        bool inverted = (i / 150) % 2 == 1;
+        uint32_t side = std::max<uint32_t>(8, height / 6);
+        uint32_t squareX = (i * 4) % std::max<uint32_t>(1, width - side);
+        uint32_t squareY = height / 3;
+        uint32_t seed = i * 2654435761u;
+
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* row = &synthetic[static_cast<size_t>(y) * width * 3];
+            for (uint32_t x = 0; x < width; x++) {
+                uint8_t r = static_cast<uint8_t>(x * 255 / width);
+                uint8_t g = static_cast<uint8_t>(y * 255 / height);
+                uint8_t b = 96;
+                if (x >= squareX && x < squareX + side && y >= squareY && y < squareY + side) {
+                    r = 240;
+                    g = 32;
+                    b = 32;
+                } else if (x < width / 8 && y < height / 8) {
+                    seed = seed * 1664525u + 1013904223u;
+                    b = static_cast<uint8_t>(96 + ((seed >> 24) & 0x1F));
+                }
+                if (inverted) {
+                    r = 255 - r;
+                    g = 255 - g;
+                    b = 255 - b;
+                }
+                row[x * 3] = r;
+                row[x * 3 + 1] = g;
+                row[x * 3 + 2] = b;
+            }
+        }
+    }
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<std::vector<uint8_t>> frames;
+};
+
+// PSNR по всем байтам RGB; одинаковые кадры - 99 дБ
+static double computePSNR(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+    if (a.size() != b.size() || a.empty()) {
+        return 0;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int d = static_cast<int>(a[i]) - static_cast<int>(b[i]);
+        sum += static_cast<uint64_t>(d * d);
+    }
+    if (sum == 0) {
+        return 99.0;
+    }
+    double mse = static_cast<double>(sum) / a.size();
+    return std::min(99.0, 10.0 * std::log10(255.0 * 255.0 / mse));
+}
+
+// ================= ПАРА СЕРВЕР/КЛИЕНТ =================
+
+// Клиент как в test_app: поток приема складывает пакеты в очередь
+// (при переполнении старые отбрасываются), декодирует один поток по порядку
+struct BenchClient {
+    NetworkStream stream;
+    std::queue<FramePacket> packetQueue;
+    std::mutex queueMutex;
+    std::condition_variable queueCondVar;
+    std::atomic<bool> running{true};
+    std::thread decoderThread;
+
+    const std::atomic<int64_t>* captureUs = nullptr;    // время захвата по номеру кадра
+    uint32_t frameCount = 0;
+    const FrameSource* source = nullptr;
+    double goodPsnr = 35;
+
+    // Только поток декодера
+    std::vector<double> latenciesMs;
+    std::vector<uint8_t> currentFrame;
+    std::vector<uint8_t> rgbFrame;
+    std::vector<uint8_t> sourceScratch;
+    uint32_t lastFrameId = 0;
+    double psnrSum = 0;
+    uint64_t damagedFrames = 0;
+    int64_t damagedSinceUs = 0;             // 0 - картинка не повреждена
+    uint64_t recoveries = 0;
+    double recoveryMsSum = 0;
+    double recoveryMsMax = 0;
+
+    std::atomic<uint64_t> packetsReceived{0};
+    std::atomic<uint64_t> bytesReceived{0};
+    std::atomic<uint64_t> queueDropped{0};
+    std::atomic<uint64_t> framesDecoded{0};
+    std::atomic<uint64_t> decodeErrors{0};
+    std::atomic<uint64_t> reordered{0};
+    std::atomic<int64_t> lastDecodeUs{0};
+
+    void onPacket(const FramePacket& packet) {
+        packetsReceived++;
+        bytesReceived += packet.data.size();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (packetQueue.size() >= 50) {
+                while (packetQueue.size() >= 40) {
+                    packetQueue.pop();
+                    queueDropped++;
+                }
+            }
+            packetQueue.push(packet);
+        }
+        queueCondVar.notify_one();
+    }
+
+    void decoderLoop() {
+        AVOTrace::setThreadName("decoder");
+        while (true) {
+            FramePacket packet;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondVar.wait(lock, [this]() { return !packetQueue.empty() || !running; });
+                if (packetQueue.empty()) {
+                    break;
+                }
+                packet = std::move(packetQueue.front());
+                packetQueue.pop();
+            }
+            decode(packet);
+        }
+    }
+
+    void decode(const FramePacket& packet) {
+        if (packet.data.empty()) {
+            return;
+        }
+        int64_t decodeStartUs = nowUs();
+        if (framesDecoded > 0 && packet.frameId < lastFrameId) {
+            reordered++;
+        }
+        lastFrameId = packet.frameId;
+
+        AVOPixelFormat format = AVOCodec::getPixelFormat(packet.flags);
+        bool noChanges = packet.data.size() == 1 && packet.data[0] == 0;
+        if (!noChanges) {
+            if (packet.isFullFrame) {
+                currentFrame = packet.data;
+            } else {
+                if (currentFrame.size() != AVOCodec::getFrameSize(packet.width, packet.height, format)) {
+                    currentFrame = AVOCodec::createBlackFrame(packet.width, packet.height, format);
+                }
+                std::vector<uint8_t> newFrame;
+                if (!AVOCodec::decodeDiffPayload(packet.data, currentFrame, packet.width,
+                                                 packet.height, packet.flags, newFrame)) {
+                    decodeErrors++;
+                    return;
+                }
+                currentFrame.swap(newFrame);
+            }
+        }
+
+        int64_t decodedUs = nowUs();
+        AVOTrace::complete("decode", packet.frameId, decodeStartUs, decodedUs);
+        stream.recordDecode(packet, static_cast<uint64_t>(decodedUs - decodeStartUs));
+        if (packet.frameId < frameCount) {
+            int64_t capturedUs = captureUs[packet.frameId].load();
+            if (capturedUs > 0) {
+                latenciesMs.push_back((decodedUs - capturedUs) / 1000.0);
+            }
+        }
+        lastDecodeUs = decodedUs;
+        framesDecoded++;
+        measureQuality(packet, format, decodedUs);
+    }
+
+    // Сравнение с исходным кадром: повреждение длится от первого кадра
+    // ниже goodPsnr до первого кадра не хуже него
+    void measureQuality(const FramePacket& packet, AVOPixelFormat format, int64_t decodedUs) {
+        if (!source || currentFrame.empty()) {
+            return;
+        }
+        const std::vector<uint8_t>* decoded = &currentFrame;
+        if (format == AVO_PIXEL_YUV420) {
+            AVOCodec::yuv420ToRGB(currentFrame, packet.width, packet.height, rgbFrame);
+            decoded = &rgbFrame;
+        }
+        double psnr = computePSNR(*decoded, source->frame(packet.frameId, sourceScratch));
+        psnrSum += psnr;
+
+        if (psnr < goodPsnr) {
+            damagedFrames++;
+            if (damagedSinceUs == 0) {
+                damagedSinceUs = decodedUs;
+            }
+        } else if (damagedSinceUs != 0) {
+            double recoveryMs = (decodedUs - damagedSinceUs) / 1000.0;
+            recoveries++;
+            recoveryMsSum += recoveryMs;
+            recoveryMsMax = std::max(recoveryMsMax, recoveryMs);
+            damagedSinceUs = 0;
+        }
+    }
+};
+
+struct BenchPair {
+    NetworkStream server;
+    BenchClient client;
+    std::unique_ptr<std::atomic<int64_t>[]> captureUs;
+};
+
+// ================= ИЗМЕРЕНИЕ =================
+
+struct BenchOptions {
+    std::string archive;
+    uint32_t width = 640;
+    uint32_t height = 480;
+    double fps = 30;
+    uint32_t frames = 300;
+    int clients = 1;
+    std::vector<int> threads = {1, 2, 4};
+    uint32_t flags = 0;
+    ImpairmentConfig impairment;
+    double goodPsnr = 35;
+    int port = 7800;
+    std::string jsonFile = "avo_stream_bench.json";
+    std::string traceFile;
+};
+
+struct StepResult {
+    int threads;
+    int clients;
+    uint32_t framesCaptured;      // на клиента
+    uint64_t framesDecoded;       // сумма по клиентам
+    double seconds;               // от первого захвата до последнего декодирования
+    double deliveredFps;          // в среднем на клиента
+    double p50, p90, p99, maxMs;  // задержка захват -> декодирование
+    uint64_t bytesSent;           // данные кадров, отправленные серверами
+    uint64_t bytesReceived;
+    uint64_t packetsSent;         // кадров поставлено в очередь отправки
+    uint64_t packetsReceived;     // кадров собрано клиентами
+    uint64_t bufferDropped;       // сервер: очередь кадров и устаревшие кадры
+    uint64_t sendQueueDropped;    // сервер: очередь отправки
+    uint64_t lost;                // сеть и сборка фрагментов
+    uint64_t queueDropped;        // клиент: очередь декодера
+    uint64_t decodeErrors;
+    uint64_t reordered;
+    double encodeMsPerFrame;
+    double meanPsnr;
+    uint64_t damagedFrames;       // PSNR ниже --good-psnr
+    uint64_t recoveries;          // повреждений, после которых картинка восстановилась
+    uint64_t unrecovered;         // повреждений, не исправленных до конца прогона
+    double recoveryMsMean;
+    double recoveryMsMax;
+    ImpairmentStats impairment;   // сумма по серверам
+    std::vector<NetworkStream::ServerStats> serverStats;   // гистограммы этапов по парам
+    std::vector<NetworkStream::ClientStats> clientStats;
+};
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+static bool runStep(const FrameSource& source, const BenchOptions& options, int threads,
+                    int port, StepResult& result) {
+    std::vector<std::unique_ptr<BenchPair>> pairs;
+    bool ok = true;
+
+    for (int i = 0; i < options.clients && ok; i++) {
+        pairs.emplace_back(new BenchPair());
+        BenchPair& pair = *pairs.back();
+        pair.captureUs.reset(new std::atomic<int64_t>[options.frames]);
+        for (uint32_t f = 0; f < options.frames; f++) {
+            pair.captureUs[f] = 0;
+        }
+        pair.client.captureUs = pair.captureUs.get();
+        pair.client.frameCount = options.frames;
+        pair.client.source = &source;
+        pair.client.goodPsnr = options.goodPsnr;
+
+        pair.server.setEncoderThreads(threads);
+        pair.server.setStreamFlags(options.flags);
+        pair.server.setImpairment(options.impairment);
+        if (!pair.server.startUDPServer("127.0.0.1", port + i) ||
+            !pair.client.stream.connectToUDPServer("127.0.0.1", port + i)) {
+            std::cerr << "Cannot set up loopback pair on port " << (port + i) << std::endl;
+            ok = false;
+            break;
+        }
+        BenchClient* client = &pair.client;
+        client->decoderThread = std::thread(&BenchClient::decoderLoop, client);
+        client->stream.startUDPReceiver(std::function<void(const FramePacket&)>(
+            [client](const FramePacket& packet) { client->onPacket(packet); }));
+    }
+
+    // Кадры до подключения клиента сервер не нумерует - ждем всех
+    for (int attempt = 0; attempt < 200 && ok; attempt++) {
+        bool connected = true;
+        for (auto& pair : pairs) {
+            connected = connected && pair->server.hasUDPClient();
+        }
+        if (connected) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    int64_t firstCaptureUs = nowUs();
+    if (ok) {
+        auto period = std::chrono::microseconds(static_cast<int64_t>(1e6 / options.fps));
+        auto next = std::chrono::steady_clock::now();
+        std::vector<uint8_t> scratch;
+        AVOTrace::setThreadName("capture");
+        for (uint32_t i = 0; i < options.frames; i++) {
+            uint32_t traceFrameId = pairs[0]->server.getNextFrameId();
+            const std::vector<uint8_t>* frame;
+            {
+                AVOTraceScope traceCapture("capture", traceFrameId);
+                frame = &source.frame(i, scratch);
+            }
+            for (auto& pair : pairs) {
+                pair->captureUs[i] = nowUs();
+                pair->server.sendUDPFrame(*frame, options.width, options.height);
+            }
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+
+        // Досылаем очереди: ждем, пока клиенты перестанут получать кадры
+        uint64_t lastDecoded = 0;
+        for (int idle = 0, waited = 0; idle < 5 && waited < 100; waited++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            uint64_t decoded = 0;
+            for (auto& pair : pairs) {
+                decoded += pair->client.framesDecoded + pair->client.decodeErrors;
+            }
+            idle = decoded == lastDecoded ? idle + 1 : 0;
+            lastDecoded = decoded;
+        }
+    }
+
+    result = StepResult();
+    result.threads = threads;
+    result.clients = options.clients;
+    result.framesCaptured = options.frames;
+
+    std::vector<double> latencies;
+    double fpsSum = 0;
+    int64_t lastDecodeUs = firstCaptureUs;
+    uint64_t encodingTimeMs = 0;
+    uint64_t framesProcessed = 0;
+    double psnrSum = 0;
+    double recoveryMsSum = 0;
+
+    for (auto& pair : pairs) {
+        NetworkStream::ServerStats stats = pair->server.getStats();
+        ImpairmentStats impairment = pair->server.getImpairmentStats();
+        result.serverStats.push_back(stats);
+        result.clientStats.push_back(pair->client.stream.getClientStats());
+        pair->server.stopUDPServer();
+        pair->client.stream.disconnectUDP();
+        {
+            std::lock_guard<std::mutex> lock(pair->client.queueMutex);
+            pair->client.running = false;
+        }
+        pair->client.queueCondVar.notify_all();
+        if (pair->client.decoderThread.joinable()) {
+            pair->client.decoderThread.join();
+        }
+
+        const BenchClient& client = pair->client;
+        latencies.insert(latencies.end(), client.latenciesMs.begin(), client.latenciesMs.end());
+        int64_t clientLastUs = client.lastDecodeUs.load();
+        if (clientLastUs > firstCaptureUs) {
+            fpsSum += client.framesDecoded / ((clientLastUs - firstCaptureUs) / 1e6);
+            lastDecodeUs = std::max(lastDecodeUs, clientLastUs);
+        }
+
+        result.framesDecoded += client.framesDecoded;
+        result.bytesSent += stats.bytesSent;
+        result.bytesReceived += client.bytesReceived;
+        result.packetsSent += stats.packetsSent;
+        result.packetsReceived += client.packetsReceived;
+        result.bufferDropped += stats.bufferDropped;
+        result.sendQueueDropped += stats.sendQueueDropped;
+        result.lost += stats.packetsSent > client.packetsReceived ?
+                       stats.packetsSent - client.packetsReceived : 0;
+        result.queueDropped += client.queueDropped;
+        result.decodeErrors += client.decodeErrors;
+        result.reordered += client.reordered;
+        encodingTimeMs += stats.encodingTimeMs;
+        framesProcessed += stats.framesProcessed;
+
+        psnrSum += client.psnrSum;
+        result.damagedFrames += client.damagedFrames;
+        result.recoveries += client.recoveries;
+        result.unrecovered += client.damagedSinceUs != 0 ? 1 : 0;
+        recoveryMsSum += client.recoveryMsSum;
+        result.recoveryMsMax = std::max(result.recoveryMsMax, client.recoveryMsMax);
+
+        result.impairment.submitted += impairment.submitted;
+        result.impairment.delivered += impairment.delivered;
+        result.impairment.lost += impairment.lost;
+        result.impairment.burstLost += impairment.burstLost;
+        result.impairment.queueDropped += impairment.queueDropped;
+        result.impairment.duplicated += impairment.duplicated;
+        result.impairment.reordered += impairment.reordered;
+        result.impairment.bytesDelivered += impairment.bytesDelivered;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    result.seconds = (lastDecodeUs - firstCaptureUs) / 1e6;
+    result.deliveredFps = pairs.empty() ? 0 : fpsSum / pairs.size();
+    result.p50 = percentile(latencies, 50);
+    result.p90 = percentile(latencies, 90);
+    result.p99 = percentile(latencies, 99);
+    result.maxMs = latencies.empty() ? 0 : latencies.back();
+    result.encodeMsPerFrame = framesProcessed > 0 ?
+                              static_cast<double>(encodingTimeMs) / framesProcessed : 0;
+    result.meanPsnr = result.framesDecoded > 0 ? psnrSum / result.framesDecoded : 0;
+    result.recoveryMsMean = result.recoveries > 0 ? recoveryMsSum / result.recoveries : 0;
+    return ok;
+}
+
+// ================= ВЫВОД =================
+
+static void printTable(const std::vector<StepResult>& results) {
+    std::cout << std::right << std::setw(7) << "threads" << std::setw(8) << "clients"
+              << std::setw(9) << "decoded" << std::setw(8) << "fps"
+              << std::setw(8) << "p50ms" << std::setw(8) << "p90ms"
+              << std::setw(8) << "p99ms" << std::setw(8) << "maxms"
+              << std::setw(12) << "wire KB" << std::setw(8) << "bufDrop"
+              << std::setw(8) << "sndDrop" << std::setw(6) << "lost"
+              << std::setw(8) << "qDrop" << std::setw(6) << "reord" << std::endl;
+    for (const StepResult& r : results) {
+        std::cout << std::setw(7) << r.threads << std::setw(8) << r.clients
+                  << std::setw(9) << r.framesDecoded << std::fixed << std::setprecision(1)
+                  << std::setw(8) << r.deliveredFps
+                  << std::setw(8) << r.p50 << std::setw(8) << r.p90
+                  << std::setw(8) << r.p99 << std::setw(8) << r.maxMs
+                  << std::setw(12) << r.bytesSent / 1024.0
+                  << std::setw(8) << r.bufferDropped << std::setw(8) << r.sendQueueDropped
+                  << std::setw(6) << r.lost << std::setw(8) << r.queueDropped
+                  << std::setw(6) << r.reordered << std::endl;
+    }
+
+    std::cout << "\n" << std::setw(7) << "threads" << std::setw(8) << "psnr"
+              << std::setw(9) << "damaged" << std::setw(8) << "recov"
+              << std::setw(8) << "unrec" << std::setw(10) << "recovMs"
+              << std::setw(10) << "maxRecMs" << std::setw(8) << "netLost"
+              << std::setw(8) << "burst" << std::setw(8) << "linkDrp"
+              << std::setw(6) << "dup" << std::setw(8) << "delayed" << std::endl;
+    for (const StepResult& r : results) {
+        std::cout << std::setw(7) << r.threads << std::fixed << std::setprecision(1)
+                  << std::setw(8) << r.meanPsnr << std::setw(9) << r.damagedFrames
+                  << std::setw(8) << r.recoveries << std::setw(8) << r.unrecovered
+                  << std::setw(10) << r.recoveryMsMean << std::setw(10) << r.recoveryMsMax
+                  << std::setw(8) << r.impairment.lost << std::setw(8) << r.impairment.burstLost
+                  << std::setw(8) << r.impairment.queueDropped
+                  << std::setw(6) << r.impairment.duplicated
+                  << std::setw(8) << r.impairment.reordered << std::endl;
+    }
+}
+
+static void writeLatency(std::ostream& out, const char* name, const AVOLatencySummary& summary) {
+    out << "\"" << name << "\": {\"count\": " << summary.count
+        << ", \"p50\": " << summary.p50Us << ", \"p99\": " << summary.p99Us
+        << ", \"p999\": " << summary.p999Us << ", \"max\": " << summary.maxUs << "}";
+}
+
+static bool writeJson(const std::string& filename, const BenchOptions& options,
+                      const std::vector<StepResult>& results) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "Cannot create file: " << filename << std::endl;
+        return false;
+    }
+
+    out << std::fixed << std::setprecision(3)
+        << "{\n  \"benchmark\": \"avo_stream_bench\",\n  \"version\": 1,\n"
+        << "  \"source\": \"" << (options.archive.empty() ? "synthetic" : options.archive) << "\",\n"
+        << "  \"width\": " << options.width << ",\n  \"height\": " << options.height << ",\n"
+        << "  \"fps\": " << options.fps << ",\n  \"frames\": " << options.frames << ",\n"
+        << "  \"flags\": " << options.flags << ",\n"
+        << "  \"impairment\": {\"loss\": " << options.impairment.lossRate
+        << ", \"burstStart\": " << options.impairment.burstStartRate
+        << ", \"burstLength\": " << options.impairment.burstLength
+        << ", \"duplicate\": " << options.impairment.duplicateRate
+        << ", \"reorder\": " << options.impairment.reorderRate
+        << ", \"reorderDelayMs\": " << options.impairment.reorderDelayMs
+        << ", \"delayMs\": " << options.impairment.delayMs
+        << ", \"jitterMs\": " << options.impairment.jitterMs
+        << ", \"bandwidthKbps\": " << options.impairment.bandwidthKbps
+        << ", \"seed\": " << options.impairment.seed << "},\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const StepResult& r = results[i];
+        out << "    {\"threads\": " << r.threads << ", \"clients\": " << r.clients
+            << ", \"framesCaptured\": " << r.framesCaptured
+            << ", \"framesDecoded\": " << r.framesDecoded
+            << ", \"seconds\": " << r.seconds
+            << ", \"deliveredFps\": " << r.deliveredFps
+            << ", \"latencyMs\": {\"p50\": " << r.p50 << ", \"p90\": " << r.p90
+            << ", \"p99\": " << r.p99 << ", \"max\": " << r.maxMs << "}"
+            << ", \"bytesSent\": " << r.bytesSent << ", \"bytesReceived\": " << r.bytesReceived
+            << ", \"packetsSent\": " << r.packetsSent << ", \"packetsReceived\": " << r.packetsReceived
+            << ", \"drops\": {\"bufferDropped\": " << r.bufferDropped
+            << ", \"sendQueueDropped\": " << r.sendQueueDropped
+            << ", \"lost\": " << r.lost << ", \"queueDropped\": " << r.queueDropped
+            << ", \"decodeErrors\": " << r.decodeErrors << "}"
+            << ", \"reordered\": " << r.reordered
+            << ", \"encodeMsPerFrame\": " << r.encodeMsPerFrame
+            << ", \"quality\": {\"meanPsnr\": " << r.meanPsnr
+            << ", \"damagedFrames\": " << r.damagedFrames
+            << ", \"recoveries\": " << r.recoveries << ", \"unrecovered\": " << r.unrecovered
+            << ", \"recoveryMsMean\": " << r.recoveryMsMean
+            << ", \"recoveryMsMax\": " << r.recoveryMsMax << "}"
+            << ", \"impairment\": {\"submitted\": " << r.impairment.submitted
+            << ", \"delivered\": " << r.impairment.delivered
+            << ", \"lost\": " << r.impairment.lost << ", \"burstLost\": " << r.impairment.burstLost
+            << ", \"queueDropped\": " << r.impairment.queueDropped
+            << ", \"duplicated\": " << r.impairment.duplicated
+            << ", \"reordered\": " << r.impairment.reordered << "}";
+
+        // Этапы по NetworkStream (мкс): сервер и клиент каждой пары
+        out << ", \"stagesUs\": [";
+        for (size_t p = 0; p < r.serverStats.size(); p++) {
+            out << (p > 0 ? ", " : "") << "{";
+            writeLatency(out, "queueWait", r.serverStats[p].queueWait);
+            out << ", ";
+            writeLatency(out, "compare", r.serverStats[p].compare);
+            out << ", ";
+            writeLatency(out, "compress", r.serverStats[p].compress);
+            out << ", ";
+            writeLatency(out, "send", r.serverStats[p].send);
+            out << ", ";
+            writeLatency(out, "frameAge", r.serverStats[p].frameAge);
+            out << ", ";
+            writeLatency(out, "reassembly", r.clientStats[p].reassembly);
+            out << ", ";
+            writeLatency(out, "decode", r.clientStats[p].decode);
+            out << ", ";
+            writeLatency(out, "endToEnd", r.clientStats[p].endToEnd);
+            out << "}";
+        }
+        out << "]}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+static uint32_t parseFlags(const std::string& list) {
+    uint32_t flags = 0;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item == "entropy") {
+            flags |= AVO_FLAG_ENTROPY;
+        } else if (item == "yuv420") {
+            flags |= AVO_FLAG_YUV420;
+        } else if (!item.empty() && item != "none") {
+            std::cerr << "Unknown flag: " << item << std::endl;
+        }
+    }
+    return flags;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--avo" && i + 1 < argc) {
+            options.archive = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc) {
+            unsigned width, height;
+            if (sscanf(argv[++i], "%ux%u", &width, &height) == 2 && width >= 16 && height >= 16) {
+                options.width = width & ~1u;
+                options.height = height & ~1u;
+            }
+        } else if (arg == "--fps" && i + 1 < argc) {
+            options.fps = std::max(1.0, atof(argv[++i]));
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frames = static_cast<uint32_t>(std::max(1, atoi(argv[++i])));
+        } else if (arg == "--clients" && i + 1 < argc) {
+            options.clients = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                if (atoi(item.c_str()) > 0) {
+                    options.threads.push_back(atoi(item.c_str()));
+                }
+            }
+        } else if (arg == "--flags" && i + 1 < argc) {
+            options.flags = parseFlags(argv[++i]);
+        } else if (arg == "--loss" && i + 1 < argc) {
+            options.impairment.lossRate = atof(argv[++i]);
+        } else if (arg == "--burst" && i + 1 < argc) {
+            double rate = 0, length = 1;
+            sscanf(argv[++i], "%lf:%lf", &rate, &length);
+            options.impairment.burstStartRate = rate;
+            options.impairment.burstLength = length;
+        } else if (arg == "--dup" && i + 1 < argc) {
+            options.impairment.duplicateRate = atof(argv[++i]);
+        } else if (arg == "--reorder" && i + 1 < argc) {
+            double rate = 0;
+            unsigned delayMs = options.impairment.reorderDelayMs;
+            sscanf(argv[++i], "%lf:%u", &rate, &delayMs);
+            options.impairment.reorderRate = rate;
+            options.impairment.reorderDelayMs = delayMs;
+        } else if (arg == "--delay" && i + 1 < argc) {
+            unsigned delayMs = 0, jitterMs = 0;
+            sscanf(argv[++i], "%u:%u", &delayMs, &jitterMs);
+            options.impairment.delayMs = delayMs;
+            options.impairment.jitterMs = jitterMs;
+        } else if (arg == "--rate" && i + 1 < argc) {
+            options.impairment.bandwidthKbps = static_cast<uint32_t>(std::max(0, atoi(argv[++i])));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.impairment.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--good-psnr" && i + 1 < argc) {
+            options.goodPsnr = atof(argv[++i]);
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonFile = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.traceFile = argv[++i];
+        } else {
+            std::cout << "Usage: avo_stream_bench [--avo FILE] [--size 640x480] [--fps 30] [--frames 300]\n"
+                      << "                        [--clients N] [--threads 1,2,4]\n"
+                      << "                        [--flags entropy,yuv420] [--port 7800] [--json FILE]\n"
+                      << "                        [--loss P] [--burst P:LEN] [--dup P] [--reorder P:MS]\n"
+                      << "                        [--delay MS[:JITTER]] [--rate KBPS] [--seed N] [--good-psnr DB]\n"
+                      << "                        [--trace FILE]"
+                      << std::endl;
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (options.threads.empty()) {
+        options.threads.push_back(2);
+    }
+
+    FrameSource source(options.width, options.height);
+    if (!options.archive.empty() && !source.loadArchive(options.archive, options.frames)) {
+        std::cerr << "Cannot load archive: " << options.archive << std::endl;
+        return 1;
+    }
+
+    if (!NetworkStream::initializeNetwork()) {
+        std::cerr << "Network initialization error!" << std::endl;
+        return 1;
+    }
+
+    std::vector<StepResult> results;
+    for (size_t step = 0; step < options.threads.size(); step++) {
+        std::cerr << "Running " << options.threads[step] << " encoder thread(s), "
+                  << options.clients << " client(s)..." << std::endl;
+
+        // Сервер и клиент пишут журнал в cout - на время прогона он отключается
+        std::streambuf* coutBuffer = std::cout.rdbuf();
+        std::ostringstream silent;
+        std::cout.rdbuf(silent.rdbuf());
+        if (!options.traceFile.empty()) {
+            AVOTrace::start();
+        }
+        StepResult result;
+        bool ok = runStep(source, options, options.threads[step],
+                          options.port + static_cast<int>(step) * options.clients, result);
+        std::cout.rdbuf(coutBuffer);
+
+        if (!ok) {
+            NetworkStream::cleanupNetwork();
+            return 1;
+        }
+        results.push_back(result);
+    }
+    NetworkStream::cleanupNetwork();
+    AVOTrace::stop();
+    if (!options.traceFile.empty() && !AVOTrace::writeChromeTrace(options.traceFile)) {
+        return 1;
+    }
+
+    std::cout << "Source: " << (options.archive.empty() ? "synthetic" : options.archive)
+              << ", " << options.width << "x" << options.height << " @ " << options.fps
+              << " fps, " << options.frames << " frames, flags " << options.flags << "\n" << std::endl;
+    printTable(results);
+    if (!writeJson(options.jsonFile, options, results)) {
+        return 1;
+    }
+    std::cout << "\nJSON: " << options.jsonFile << std::endl;
+    if (!options.traceFile.empty()) {
+        std::cout << "Trace: " << options.traceFile << std::endl;
+    }
+    if (AVOInstrument::compiledIn) {
+        std::cout << std::endl;
+        AVOInstrument::report(std::cout);
+    }
+    return 0;
+}
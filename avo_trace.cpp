@@ -0,0 +1,229 @@
+#include "avo_trace.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+    #include <process.h>
+    #define avo_getpid _getpid
+#else
+    #include <unistd.h>
+    #define avo_getpid getpid
+#endif
+
+std::atomic<bool> AVOTrace::enabled{false};
+
+namespace {
+
+struct TraceEvent {
+    const char* stage;
+    uint32_t frameId;
+    uint64_t startUs;
+    uint64_t durationUs;
+};
+
+// Кольцо событий одного потока; память выделяется при первом событии.
+// Мьютекс берет только свой поток и запись файла, поэтому на горячем пути
+// он не оспаривается
+struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;
+    uint64_t written = 0;
+    uint32_t tid = 0;
+    std::string name;
+};
+
+// Буферы завершившихся потоков остаются в реестре до конца программы,
+// чтобы их события попали в файл
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::atomic<size_t> capacity{65536};
+    uint32_t nextTid = 1;
+    std::string processName;
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+thread_local std::shared_ptr<ThreadBuffer> localBuffer;
+
+ThreadBuffer& threadBuffer() {
+    if (!localBuffer) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffer->tid = reg.nextTid++;
+        reg.buffers.push_back(buffer);
+        localBuffer = buffer;
+    }
+    return *localBuffer;
+}
+
+std::string escapeJSON(const std::string& text) {
+    std::string result;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            result += c;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+void AVOTrace::start(size_t eventsPerThread) {
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.capacity = std::max<size_t>(1, eventsPerThread);
+    for (auto& buffer : reg.buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        std::vector<TraceEvent>().swap(buffer->events);
+        buffer->written = 0;
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void AVOTrace::stop() {
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+uint64_t AVOTrace::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void AVOTrace::complete(const char* stage, uint32_t frameId, uint64_t startUs, uint64_t endUs) {
+    if (!isEnabled()) {
+        return;
+    }
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.empty()) {
+        buffer.events.resize(registry().capacity);
+    }
+    TraceEvent& event = buffer.events[buffer.written % buffer.events.size()];
+    event.stage = stage;
+    event.frameId = frameId;
+    event.startUs = startUs;
+    event.durationUs = endUs > startUs ? endUs - startUs : 0;
+    buffer.written++;
+}
+
+void AVOTrace::setThreadName(const std::string& name) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+void AVOTrace::setProcessName(const std::string& name) {
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.processName = name;
+}
+
+bool AVOTrace::writeChromeTrace(const std::string& filename) {
+    struct Collected {
+        TraceEvent event;
+        uint32_t tid;
+    };
+    std::vector<Collected> events;
+    std::vector<std::pair<uint32_t, std::string>> threadNames;
+    std::string processName;
+
+    {
+        TraceRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        processName = reg.processName;
+        for (auto& buffer : reg.buffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            if (!buffer->name.empty()) {
+                threadNames.push_back(std::make_pair(buffer->tid, buffer->name));
+            }
+            size_t capacity = buffer->events.size();
+            uint64_t first = buffer->written > capacity ? buffer->written - capacity : 0;
+            for (uint64_t i = first; i < buffer->written; i++) {
+                events.push_back({buffer->events[i % capacity], buffer->tid});
+            }
+        }
+    }
+
+    std::sort(events.begin(), events.end(), [](const Collected& a, const Collected& b) {
+        return a.event.startUs < b.event.startUs;
+    });
+
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Cannot create trace file: " << filename << std::endl;
+        return false;
+    }
+
+    int pid = static_cast<int>(avo_getpid());
+    bool firstRecord = true;
+    auto separator = [&]() -> std::ostream& {
+        file << (firstRecord ? "\n" : ",\n");
+        firstRecord = false;
+        return file;
+    };
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    if (!processName.empty()) {
+        separator() << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+                    << ",\"tid\":0,\"args\":{\"name\":\"" << escapeJSON(processName) << "\"}}";
+    }
+    for (const auto& thread : threadNames) {
+        separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+                    << ",\"tid\":" << thread.first
+                    << ",\"args\":{\"name\":\"" << escapeJSON(thread.second) << "\"}}";
+    }
+
+    // Этапы кадров
+    std::map<uint32_t, std::vector<size_t>> frames;
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i].event;
+        separator() << "{\"name\":\"" << event.stage << "\",\"cat\":\"avo\",\"ph\":\"X\""
+                    << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs
+                    << ",\"pid\":" << pid << ",\"tid\":" << events[i].tid;
+        if (event.frameId != NO_FRAME) {
+            file << ",\"args\":{\"frame\":" << event.frameId << "}";
+            frames[event.frameId].push_back(i);
+        }
+        file << "}";
+    }
+
+    // Стрелки между этапами одного кадра в порядке начала этапов
+    for (const auto& frame : frames) {
+        const std::vector<size_t>& chain = frame.second;
+        if (chain.size() < 2) {
+            continue;
+        }
+        for (size_t i = 0; i < chain.size(); i++) {
+            const Collected& item = events[chain[i]];
+            const char* phase = i == 0 ? "s" : (i + 1 == chain.size() ? "f" : "t");
+            separator() << "{\"name\":\"frame\",\"cat\":\"avo\",\"ph\":\"" << phase << "\""
+                        << ",\"id\":" << frame.first << ",\"ts\":" << item.event.startUs
+                        << ",\"pid\":" << pid << ",\"tid\":" << item.tid;
+            if (i != 0) {
+                file << ",\"bp\":\"e\"";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    if (!file.good()) {
+        std::cerr << "Error writing trace file: " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
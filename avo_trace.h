@@ -0,0 +1,69 @@
+#ifndef AVO_TRACE_H
+#define AVO_TRACE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+
+// Трассировка конвейера по кадрам в формате Chrome trace (открывается в
+// chrome://tracing и ui.perfetto.dev). Каждый этап кадра - одно событие
+// "X" с началом и длительностью; события пишутся в кольцевой буфер своего
+// потока (старые затираются), файл собирается только в writeChromeTrace.
+// Выключенная трассировка стоит одной relaxed-загрузки на этап.
+//
+// Время - steady_clock в мкс: на одной машине часы общие для процессов,
+// поэтому трассы сервера и клиента можно склеить в одну, например
+//   jq -s '{traceEvents: map(.traceEvents) | add}' server.json client.json > all.json
+// Номер кадра (frameId с провода) записывается в args.frame; этапы одного
+// кадра внутри файла связываются стрелками (flow-события)
+class AVOTrace {
+public:
+    static const uint32_t NO_FRAME = 0xFFFFFFFFu;
+
+    // Включает запись; буферы потоков очищаются
+    static void start(size_t eventsPerThread = 65536);
+    static void stop();
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Текущее время трассы, мкс
+    static uint64_t now();
+
+    // Этап stage кадра frameId от startUs до endUs (время из now()).
+    // stage должен жить до записи файла - обычно строковый литерал
+    static void complete(const char* stage, uint32_t frameId, uint64_t startUs, uint64_t endUs);
+
+    // Подписи в просмотрщике (не обязательны)
+    static void setThreadName(const std::string& name);
+    static void setProcessName(const std::string& name);
+
+    // Записывает накопленные события; можно вызывать во время записи
+    static bool writeChromeTrace(const std::string& filename);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// Этап от конструктора до деструктора
+class AVOTraceScope {
+public:
+    AVOTraceScope(const char* stage, uint32_t frameId)
+        : stage(stage), frameId(frameId),
+          startUs(AVOTrace::isEnabled() ? AVOTrace::now() : 0) {}
+
+    ~AVOTraceScope() {
+        if (startUs != 0) {
+            AVOTrace::complete(stage, frameId, startUs, AVOTrace::now());
+        }
+    }
+
+    AVOTraceScope(const AVOTraceScope&) = delete;
+    AVOTraceScope& operator=(const AVOTraceScope&) = delete;
+
+private:
+    const char* stage;
+    uint32_t frameId;
+    uint64_t startUs;
+};
+
+#endif // AVO_TRACE_H
@@ -0,0 +1,143 @@
+#include "network_impairment.h"
+#include <chrono>
+#include <algorithm>
+
+static int64_t steadyNowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NetworkImpairment::NetworkImpairment(const ImpairmentConfig& config, DeliverFunction deliver)
+    : config(config), deliver(deliver), random(config.seed),
+      inBurst(false), linkFreeUs(0), sequence(0), running(true) {
+    thread = std::thread(&NetworkImpairment::deliveryThread, this);
+}
+
+NetworkImpairment::~NetworkImpairment() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condVar.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+// mt19937 одинаков во всех реализациях, в отличие от распределений std
+double NetworkImpairment::nextRandom() {
+    return random() / 4294967296.0;
+}
+
+void NetworkImpairment::submit(const std::vector<uint8_t>& datagram) {
+    statsSubmitted++;
+    int64_t now = steadyNowUs();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Пять чисел на пакет независимо от настроек и исхода
+    double lossRoll = nextRandom();
+    double burstRoll = nextRandom();
+    double duplicateRoll = nextRandom();
+    double reorderRoll = nextRandom();
+    double jitterRoll = nextRandom();
+
+    // Модель Гилберта: в серии теряется все, выход из серии - в среднем
+    // через burstLength пакетов
+    if (inBurst) {
+        inBurst = burstRoll >= 1.0 / std::max(1.0, config.burstLength);
+    } else {
+        inBurst = burstRoll < config.burstStartRate;
+    }
+    if (inBurst) {
+        statsLost++;
+        statsBurstLost++;
+        return;
+    }
+    if (lossRoll < config.lossRate) {
+        statsLost++;
+        return;
+    }
+
+    // Узкий канал: пакет ждет, пока уйдут предыдущие
+    int64_t sentUs = now;
+    if (config.bandwidthKbps > 0) {
+        int64_t start = std::max(now, linkFreeUs);
+        int64_t backlogBytes = (start - now) * static_cast<int64_t>(config.bandwidthKbps) / 8000;
+        if (static_cast<size_t>(backlogBytes) + datagram.size() > config.queueLimitBytes) {
+            statsQueueDropped++;
+            return;
+        }
+        linkFreeUs = start + static_cast<int64_t>(datagram.size()) * 8000 / config.bandwidthKbps;
+        sentUs = linkFreeUs;
+    }
+
+    int64_t deliverUs = sentUs + static_cast<int64_t>(config.delayMs) * 1000 +
+                        static_cast<int64_t>(jitterRoll * config.jitterMs * 1000);
+    if (reorderRoll < config.reorderRate) {
+        deliverUs += static_cast<int64_t>(config.reorderDelayMs) * 1000;
+        statsReordered++;
+    }
+
+    schedule(datagram, deliverUs);
+    if (duplicateRoll < config.duplicateRate) {
+        schedule(datagram, deliverUs);
+        statsDuplicated++;
+    }
+    condVar.notify_one();
+}
+
+// Вызывается под mutex
+void NetworkImpairment::schedule(std::vector<uint8_t> data, int64_t deliverUs) {
+    Pending item;
+    item.deliverUs = deliverUs;
+    item.sequence = sequence++;
+    item.data = std::move(data);
+    pending.push(std::move(item));
+}
+
+void NetworkImpairment::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!pending.empty()) {
+        pending.pop();
+    }
+    linkFreeUs = 0;
+}
+
+ImpairmentStats NetworkImpairment::getStats() const {
+    ImpairmentStats stats;
+    stats.submitted = statsSubmitted.load();
+    stats.delivered = statsDelivered.load();
+    stats.lost = statsLost.load();
+    stats.burstLost = statsBurstLost.load();
+    stats.queueDropped = statsQueueDropped.load();
+    stats.duplicated = statsDuplicated.load();
+    stats.reordered = statsReordered.load();
+    stats.bytesDelivered = statsBytesDelivered.load();
+    return stats;
+}
+
+void NetworkImpairment::deliveryThread() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (pending.empty()) {
+            condVar.wait(lock);
+            continue;
+        }
+
+        int64_t waitUs = pending.top().deliverUs - steadyNowUs();
+        if (waitUs > 0) {
+            condVar.wait_for(lock, std::chrono::microseconds(waitUs));
+            continue;
+        }
+
+        // Ключи порядка не меняются, поэтому данные можно забрать из top()
+        std::vector<uint8_t> data = std::move(const_cast<Pending&>(pending.top()).data);
+        pending.pop();
+        lock.unlock();
+        deliver(data);
+        statsDelivered++;
+        statsBytesDelivered += data.size();
+        lock.lock();
+    }
+}
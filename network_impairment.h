@@ -0,0 +1,110 @@
+#ifndef NETWORK_IMPAIRMENT_H
+#define NETWORK_IMPAIRMENT_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <queue>
+#include <random>
+#include <condition_variable>
+
+// Плохая сеть на одной машине: потери (одиночные и сериями), дублирование,
+// перестановка, задержка с разбросом и узкий канал. Слой стоит между
+// отправителем и сокетом: датаграммы задерживаются в собственном потоке
+// и передаются дальше в deliver. Все случайные решения берутся из mt19937
+// с заданным seed, на каждый пакет - одинаковое число чисел, поэтому
+// при той же последовательности пакетов решения повторяются
+struct ImpairmentConfig {
+    double lossRate = 0;            // вероятность потери пакета
+    double burstStartRate = 0;      // вероятность начала серии потерь (модель Гилберта)
+    double burstLength = 1;         // средняя длина серии, пакетов
+    double duplicateRate = 0;       // вероятность отправить пакет дважды
+    double reorderRate = 0;         // вероятность придержать пакет, чтобы его обогнали
+    uint32_t reorderDelayMs = 10;
+    uint32_t delayMs = 0;
+    uint32_t jitterMs = 0;          // равномерный разброс [0, jitterMs] к задержке
+    uint32_t bandwidthKbps = 0;     // 0 - без ограничения
+    size_t queueLimitBytes = 1024 * 1024;   // очередь перед узким каналом
+    uint32_t seed = 1;
+
+    bool enabled() const {
+        return lossRate > 0 || burstStartRate > 0 || duplicateRate > 0 || reorderRate > 0 ||
+               delayMs > 0 || jitterMs > 0 || bandwidthKbps > 0;
+    }
+};
+
+struct ImpairmentStats {
+    uint64_t submitted;
+    uint64_t delivered;
+    uint64_t lost;              // случайные потери, включая серии
+    uint64_t burstLost;         // из них в сериях
+    uint64_t queueDropped;      // переполнение очереди узкого канала
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t bytesDelivered;
+};
+
+class NetworkImpairment {
+public:
+    typedef std::function<void(const std::vector<uint8_t>&)> DeliverFunction;
+
+    NetworkImpairment(const ImpairmentConfig& config, DeliverFunction deliver);
+    ~NetworkImpairment();
+
+    NetworkImpairment(const NetworkImpairment&) = delete;
+    NetworkImpairment& operator=(const NetworkImpairment&) = delete;
+
+    // Принимает датаграмму; доставка - позже, из потока слоя
+    void submit(const std::vector<uint8_t>& datagram);
+
+    // Отбрасывает еще не доставленные датаграммы
+    void clear();
+
+    const ImpairmentConfig& getConfig() const { return config; }
+    ImpairmentStats getStats() const;
+
+private:
+    struct Pending {
+        int64_t deliverUs;
+        uint64_t sequence;
+        std::vector<uint8_t> data;
+
+        bool operator>(const Pending& other) const {
+            return deliverUs != other.deliverUs ? deliverUs > other.deliverUs
+                                                : sequence > other.sequence;
+        }
+    };
+
+    double nextRandom();
+    void schedule(std::vector<uint8_t> data, int64_t deliverUs);
+    void deliveryThread();
+
+    ImpairmentConfig config;
+    DeliverFunction deliver;
+
+    std::mt19937 random;
+    bool inBurst;
+    int64_t linkFreeUs;         // когда узкий канал освободится
+    uint64_t sequence;
+
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+    mutable std::mutex mutex;
+    std::condition_variable condVar;
+    bool running;
+    std::thread thread;
+
+    std::atomic<uint64_t> statsSubmitted{0};
+    std::atomic<uint64_t> statsDelivered{0};
+    std::atomic<uint64_t> statsLost{0};
+    std::atomic<uint64_t> statsBurstLost{0};
+    std::atomic<uint64_t> statsQueueDropped{0};
+    std::atomic<uint64_t> statsDuplicated{0};
+    std::atomic<uint64_t> statsReordered{0};
+    std::atomic<uint64_t> statsBytesDelivered{0};
+};
+
+#endif // NETWORK_IMPAIRMENT_H
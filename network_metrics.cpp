@@ -0,0 +1,252 @@
+#include "network_metrics.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+
+#ifndef _WIN32
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/time.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// ================= ТЕКСТ МЕТРИК =================
+
+MetricsWriter::MetricsWriter(const std::string& instance) {
+    if (!instance.empty()) {
+        // Значение метки: экранируются \, " и перевод строки
+        std::string escaped;
+        for (char c : instance) {
+            if (c == '\\' || c == '"') {
+                escaped += '\\';
+                escaped += c;
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += c;
+            }
+        }
+        instanceLabel = "stream=\"" + escaped + "\"";
+    }
+    out.precision(12);
+}
+
+void MetricsWriter::header(const std::string& name, const std::string& help, const char* type) {
+    if (described.insert(name).second) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+    }
+}
+
+std::string MetricsWriter::labelSet(const std::string& labels, const std::string& extra) const {
+    std::string all = instanceLabel;
+    for (const std::string* part : {&labels, &extra}) {
+        if (!part->empty()) {
+            if (!all.empty()) {
+                all += ",";
+            }
+            all += *part;
+        }
+    }
+    return all.empty() ? "" : "{" + all + "}";
+}
+
+void MetricsWriter::counter(const std::string& name, const std::string& help, uint64_t value,
+                            const std::string& labels) {
+    header(name, help, "counter");
+    out << name << labelSet(labels) << " " << value << "\n";
+}
+
+void MetricsWriter::gauge(const std::string& name, const std::string& help, double value,
+                          const std::string& labels) {
+    header(name, help, "gauge");
+    out << name << labelSet(labels) << " " << value << "\n";
+}
+
+void MetricsWriter::summary(const std::string& name, const std::string& help,
+                            const AVOLatencySummary& latency, const std::string& labels) {
+    header(name, help, "summary");
+    const char* quantiles[4] = {"0.5", "0.9", "0.99", "0.999"};
+    const uint64_t values[4] = {latency.p50Us, latency.p90Us, latency.p99Us, latency.p999Us};
+    for (int i = 0; i < 4; i++) {
+        out << name << labelSet(labels, std::string("quantile=\"") + quantiles[i] + "\"") << " "
+            << values[i] / 1e6 << "\n";
+    }
+    out << name << "_sum" << labelSet(labels) << " " << latency.meanUs * latency.count / 1e6 << "\n";
+    out << name << "_count" << labelSet(labels) << " " << latency.count << "\n";
+}
+
+double MetricsRate::update(uint64_t value, uint64_t nowUs) {
+    if (lastUs == 0 || value < lastValue) {
+        // Первый вызов или сброс статистики
+        lastValue = value;
+        lastUs = nowUs;
+        rate = 0;
+        return rate;
+    }
+    if (nowUs - lastUs >= 100000) {
+        rate = (value - lastValue) * 1e6 / (nowUs - lastUs);
+        lastValue = value;
+        lastUs = nowUs;
+    }
+    return rate;
+}
+
+// ================= ЭКСПОРТ =================
+
+MetricsExporter::MetricsExporter(const MetricsExportConfig& config, RenderFunction render)
+    : config(config), render(render), listenSocket(-1), running(true) {
+    if (!config.socketPath.empty()) {
+        openSocket();
+    }
+    thread = std::thread(&MetricsExporter::exportThread, this);
+}
+
+MetricsExporter::~MetricsExporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    condVar.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+#ifndef _WIN32
+    if (listenSocket >= 0) {
+        close(listenSocket);
+        unlink(config.socketPath.c_str());
+    }
+#endif
+}
+
+bool MetricsExporter::openSocket() {
+#ifdef _WIN32
+    std::cerr << "[METRICS] Unix socket export is not supported on Windows" << std::endl;
+    return false;
+#else
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (config.socketPath.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "[METRICS] Socket path too long: " << config.socketPath << std::endl;
+        return false;
+    }
+    strncpy(addr.sun_path, config.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        std::cerr << "[METRICS] Failed to create socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Сокет от прошлого запуска мешает bind
+    unlink(config.socketPath.c_str());
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 8) < 0) {
+        std::cerr << "[METRICS] Failed to listen on " << config.socketPath << ": "
+                  << strerror(errno) << std::endl;
+        close(sock);
+        return false;
+    }
+    listenSocket = sock;
+    return true;
+#endif
+}
+
+bool MetricsExporter::writeFile(const std::string& text) {
+    // Читатель не должен увидеть наполовину записанный файл
+    std::string tempPath = config.filePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << text;
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return std::rename(tempPath.c_str(), config.filePath.c_str()) == 0;
+}
+
+void MetricsExporter::serveClient(int client) {
+#ifndef _WIN32
+    // Запрос читается только чтобы не оборвать клиента; отвечаем на любой
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[1024];
+    recv(client, request, sizeof(request), 0);
+
+    std::string body = render();
+    std::string response = "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                           "\r\n" + body;
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t result = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            break;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    close(client);
+#else
+    (void)client;
+#endif
+}
+
+void MetricsExporter::exportThread() {
+    auto interval = std::chrono::milliseconds(std::max<uint32_t>(config.intervalMs, 10));
+    auto nextWrite = std::chrono::steady_clock::now();
+    bool fileErrorReported = false;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                break;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!config.filePath.empty() && now >= nextWrite) {
+            if (!writeFile(render()) && !fileErrorReported) {
+                std::cerr << "[METRICS] Failed to write " << config.filePath << std::endl;
+                fileErrorReported = true;
+            }
+            nextWrite = now + interval;
+        }
+
+#ifndef _WIN32
+        if (listenSocket >= 0) {
+            // Короткий poll, чтобы остановка не ждала дольше 100 мс
+            struct pollfd fd;
+            fd.fd = listenSocket;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            if (poll(&fd, 1, 100) > 0 && (fd.revents & POLLIN)) {
+                int client = accept(listenSocket, nullptr, nullptr);
+                if (client >= 0) {
+                    serveClient(client);
+                }
+            }
+            continue;
+        }
+#endif
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condVar.wait_until(lock, config.filePath.empty() ? now + interval : nextWrite,
+                           [this]() { return !running; });
+    }
+}
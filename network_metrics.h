@@ -0,0 +1,95 @@
+#ifndef NETWORK_METRICS_H
+#define NETWORK_METRICS_H
+
+#include <string>
+#include <set>
+#include <sstream>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "avo_histogram.h"
+
+// Публикация метрик потока в текстовом формате Prometheus (exposition 0.0.4):
+// файл переписывается раз в intervalMs (подходит для textfile collector
+// node_exporter; запись через временный файл и rename), а Unix-сокет отдает
+// текущий текст каждому подключению в виде ответа HTTP/1.0, например
+//   curl --unix-socket /run/avo/server.sock http://localhost/metrics
+// Можно включить оба способа сразу
+struct MetricsExportConfig {
+    std::string filePath;           // пусто - файл не пишется
+    std::string socketPath;         // пусто - сокета нет (на Windows не поддерживается)
+    uint32_t intervalMs = 1000;
+    std::string instance;           // значение метки stream (пусто - без метки)
+
+    bool enabled() const { return !filePath.empty() || !socketPath.empty(); }
+};
+
+// Текст метрик: HELP и TYPE пишутся один раз на имя. Задержки из
+// AVOLatencySummary выводятся как summary в секундах
+class MetricsWriter {
+public:
+    explicit MetricsWriter(const std::string& instance);
+
+    // labels - дополнительные метки без скобок, например stage="send_queue"
+    void counter(const std::string& name, const std::string& help, uint64_t value,
+                 const std::string& labels = "");
+    void gauge(const std::string& name, const std::string& help, double value,
+               const std::string& labels = "");
+    void summary(const std::string& name, const std::string& help,
+                 const AVOLatencySummary& latency, const std::string& labels = "");
+
+    std::string str() const { return out.str(); }
+
+private:
+    void header(const std::string& name, const std::string& help, const char* type);
+    std::string labelSet(const std::string& labels, const std::string& extra = "") const;
+
+    std::string instanceLabel;
+    std::set<std::string> described;
+    std::ostringstream out;
+};
+
+// Скорость счетчика между соседними вызовами update (в единицах в секунду).
+// Вызовы чаще раза в 100 мс возвращают прошлое значение
+struct MetricsRate {
+    uint64_t lastValue = 0;
+    uint64_t lastUs = 0;
+    double rate = 0;
+
+    double update(uint64_t value, uint64_t nowUs);
+};
+
+class MetricsExporter {
+public:
+    typedef std::function<std::string()> RenderFunction;
+
+    // render вызывается только из потока экспорта
+    MetricsExporter(const MetricsExportConfig& config, RenderFunction render);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    // false - не удалось открыть сокет (файл пишется в любом случае)
+    bool isListening() const { return listenSocket >= 0; }
+
+private:
+    bool openSocket();
+    void exportThread();
+    bool writeFile(const std::string& text);
+    void serveClient(int client);
+
+    MetricsExportConfig config;
+    RenderFunction render;
+    int listenSocket;
+
+    std::mutex mutex;
+    std::condition_variable condVar;
+    bool running;
+    std::thread thread;
+};
+
+#endif // NETWORK_METRICS_H
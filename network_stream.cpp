@@ -28,10 +28,27 @@
     #define INVALID_SOCKET -1
 #endif
 
+// Время захвата кадров передается между машинами - по системным часам
+static uint64_t systemTimeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t steadyTimeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t elapsedUs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
 // Реализация ThreadPool
 NetworkStream::ThreadPool::ThreadPool(size_t numThreads) : stop(false) {
     for (size_t i = 0; i < numThreads; ++i) {
         workers.emplace_back([this] {
+            AVOTrace::setThreadName("encoder");
             while (true) {
                 std::function<void()> task;
                 {
@@ -100,6 +117,7 @@ NetworkStream::NetworkStream()
 }
 
 NetworkStream::~NetworkStream() {
+    stopMetricsExport();
     stopUDPServer();
     disconnectUDP();
     
@@ -132,19 +150,159 @@ NetworkStream::ServerStats NetworkStream::getStats() const {
     stats.framesProcessed = statsFramesProcessed.load();
     stats.bytesSent = statsBytesSent.load();
     stats.packetsSent = statsPacketsSent.load();
-    stats.encodingTimeMs = statsEncodingTimeMs.load();
-    stats.networkTimeMs = statsNetworkTimeMs.load();
+    stats.encodingTimeMs = statsEncodingTimeUs.load() / 1000;
+    stats.networkTimeMs = statsNetworkTimeUs.load() / 1000;
     stats.bufferDropped = statsBufferDropped.load();
+    stats.sendQueueDropped = statsSendQueueDropped.load();
+    {
+        std::lock_guard<std::mutex> lock(frameBufferMutex);
+        stats.frameQueueDepth = static_cast<uint32_t>(frameBufferQueue.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(sendQueueMutex);
+        stats.sendQueueDepth = static_cast<uint32_t>(sendQueue.size());
+    }
+    stats.activeEncoders = static_cast<uint32_t>(std::max(0, activeEncoders.load()));
+    stats.queueWait = queueWaitHistogram.summarize();
+    stats.compare = compareHistogram.summarize();
+    stats.compress = compressHistogram.summarize();
+    stats.send = sendHistogram.summarize();
+    stats.frameAge = frameAgeHistogram.summarize();
     return stats;
 }
 
+uint32_t NetworkStream::getPendingFrames() const {
+    std::lock_guard<std::mutex> lock(frameBufferMutex);
+    return static_cast<uint32_t>(frameBufferQueue.size() + std::max(0, activeEncoders.load()));
+}
+
+NetworkStream::ClientStats NetworkStream::getClientStats() const {
+    ClientStats stats;
+    stats.framesReceived = statsFramesReceived.load();
+    stats.bytesReceived = statsBytesReceived.load();
+    stats.reassemblyExpired = statsReassemblyExpired.load();
+    stats.appDropped = statsAppDropped.load();
+    {
+        std::lock_guard<std::mutex> lock(packetMutex);
+        stats.reassemblyBacklog = static_cast<uint32_t>(fragmentedPackets.size());
+    }
+    stats.reassembly = reassemblyHistogram.summarize();
+    stats.decode = decodeHistogram.summarize();
+    stats.endToEnd = endToEndHistogram.summarize();
+    return stats;
+}
+
+void NetworkStream::recordDecode(const FramePacket& packet, uint64_t decodeUs) {
+    decodeHistogram.record(decodeUs);
+    if (packet.captureTimeUs != 0) {
+        uint64_t now = systemTimeUs();
+        // Часы машин могут расходиться - отрицательная задержка не пишется
+        if (now >= packet.captureTimeUs) {
+            endToEndHistogram.record(now - packet.captureTimeUs);
+        }
+    }
+}
+
+std::string NetworkStream::formatMetrics(const std::string& instance) {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    MetricsWriter metrics(instance);
+    uint64_t now = steadyTimeUs();
+    
+    if (udpServerRunning) {
+        ServerStats stats = getStats();
+        ImpairmentStats impaired = getImpairmentStats();
+        metrics.gauge("avo_server_client_connected", "1 if a client is connected", hasClient ? 1 : 0);
+        metrics.counter("avo_server_frames_total", "Frames encoded and queued for sending",
+                        stats.framesProcessed);
+        metrics.counter("avo_server_packets_total", "Frame packets queued for sending",
+                        stats.packetsSent);
+        metrics.counter("avo_server_bytes_total", "Encoded bytes queued for sending", stats.bytesSent);
+        metrics.gauge("avo_server_fps", "Encoded frames per second since the previous scrape",
+                      serverFpsRate.update(stats.framesProcessed, now));
+        metrics.gauge("avo_server_bitrate_bps", "Encoded bits per second since the previous scrape",
+                      serverBitRate.update(stats.bytesSent, now) * 8);
+        metrics.counter("avo_server_dropped_total", "Frames or packets dropped, by stage",
+                        stats.bufferDropped, "stage=\"frame_buffer\"");
+        metrics.counter("avo_server_dropped_total", "Frames or packets dropped, by stage",
+                        stats.sendQueueDropped, "stage=\"send_queue\"");
+        metrics.counter("avo_server_dropped_total", "Frames or packets dropped, by stage",
+                        impaired.lost + impaired.queueDropped, "stage=\"impairment\"");
+        metrics.gauge("avo_server_queue_depth", "Items waiting in a server queue",
+                      stats.frameQueueDepth, "queue=\"frame_buffer\"");
+        metrics.gauge("avo_server_queue_depth", "Items waiting in a server queue",
+                      stats.sendQueueDepth, "queue=\"send_queue\"");
+        metrics.gauge("avo_server_active_encoders", "Frames being encoded in the encoder pool",
+                      stats.activeEncoders);
+        const char* help = "Server stage latency in seconds";
+        metrics.summary("avo_server_latency_seconds", help, stats.queueWait, "stage=\"queue_wait\"");
+        metrics.summary("avo_server_latency_seconds", help, stats.compare, "stage=\"compare\"");
+        metrics.summary("avo_server_latency_seconds", help, stats.compress, "stage=\"compress\"");
+        metrics.summary("avo_server_latency_seconds", help, stats.send, "stage=\"send\"");
+        metrics.summary("avo_server_latency_seconds", help, stats.frameAge, "stage=\"frame_age\"");
+    }
+    
+    if (udpClientConnected) {
+        ClientStats stats = getClientStats();
+        metrics.counter("avo_client_frames_total", "Frames received and reassembled",
+                        stats.framesReceived);
+        metrics.counter("avo_client_bytes_total", "Frame bytes received", stats.bytesReceived);
+        metrics.gauge("avo_client_fps", "Received frames per second since the previous scrape",
+                      clientFpsRate.update(stats.framesReceived, now));
+        metrics.gauge("avo_client_bitrate_bps", "Received bits per second since the previous scrape",
+                      clientBitRate.update(stats.bytesReceived, now) * 8);
+        metrics.counter("avo_client_dropped_total", "Frames dropped, by stage",
+                        stats.reassemblyExpired, "stage=\"reassembly\"");
+        metrics.counter("avo_client_dropped_total", "Frames dropped, by stage",
+                        stats.appDropped, "stage=\"application\"");
+        metrics.gauge("avo_client_reassembly_backlog", "Frames with fragments still missing",
+                      stats.reassemblyBacklog);
+        const char* help = "Client stage latency in seconds";
+        metrics.summary("avo_client_latency_seconds", help, stats.reassembly, "stage=\"reassembly\"");
+        metrics.summary("avo_client_latency_seconds", help, stats.decode, "stage=\"decode\"");
+        metrics.summary("avo_client_latency_seconds", help, stats.endToEnd, "stage=\"end_to_end\"");
+    }
+    
+    return metrics.str();
+}
+
+bool NetworkStream::startMetricsExport(const MetricsExportConfig& config) {
+    stopMetricsExport();
+    if (!config.enabled()) {
+        return false;
+    }
+    
+    std::string instance = config.instance;
+    metricsExporter.reset(new MetricsExporter(config, [this, instance]() {
+        return formatMetrics(instance);
+    }));
+    return config.socketPath.empty() || metricsExporter->isListening();
+}
+
+void NetworkStream::stopMetricsExport() {
+    metricsExporter.reset();
+}
+
 void NetworkStream::resetStats() {
     statsFramesProcessed = 0;
     statsBytesSent = 0;
     statsPacketsSent = 0;
-    statsEncodingTimeMs = 0;
-    statsNetworkTimeMs = 0;
+    statsEncodingTimeUs = 0;
+    statsNetworkTimeUs = 0;
     statsBufferDropped = 0;
+    statsSendQueueDropped = 0;
+    queueWaitHistogram.reset();
+    compareHistogram.reset();
+    compressHistogram.reset();
+    sendHistogram.reset();
+    frameAgeHistogram.reset();
+    
+    statsFramesReceived = 0;
+    statsBytesReceived = 0;
+    statsReassemblyExpired = 0;
+    statsAppDropped = 0;
+    reassemblyHistogram.reset();
+    decodeHistogram.reset();
+    endToEndHistogram.reset();
 }
 
 void NetworkStream::setEncoderThreads(int count) {
@@ -152,6 +310,77 @@ void NetworkStream::setEncoderThreads(int count) {
     encoderPool = new ThreadPool(count > 0 ? count : 2);
 }
 
+void NetworkStream::setImpairment(const ImpairmentConfig& config) {
+    std::lock_guard<std::mutex> lock(impairmentMutex);
+    impairmentConfig = config;
+    if (udpServerRunning) {
+        impairment.reset();
+        if (config.enabled()) {
+            impairment = std::make_shared<NetworkImpairment>(
+                config, [this](const std::vector<uint8_t>& datagram) {
+                    std::lock_guard<std::mutex> lock(clientAddrMutex);
+                    sendto(udpServerSocket, (const char*)datagram.data(), datagram.size(), 0,
+                           (struct sockaddr*)&udpClientAddr, sizeof(udpClientAddr));
+                });
+        }
+    }
+}
+
+ImpairmentStats NetworkStream::getImpairmentStats() const {
+    std::lock_guard<std::mutex> lock(impairmentMutex);
+    if (!impairment) {
+        return ImpairmentStats();
+    }
+    return impairment->getStats();
+}
+
+// Отправка датаграммы клиенту напрямую или через слой искажений
+int NetworkStream::sendDatagram(const std::vector<uint8_t>& datagram) {
+    std::shared_ptr<NetworkImpairment> layer;
+    {
+        std::lock_guard<std::mutex> lock(impairmentMutex);
+        layer = impairment;
+    }
+    if (layer) {
+        layer->submit(datagram);
+        return static_cast<int>(datagram.size());
+    }
+    return sendto(udpServerSocket, (const char*)datagram.data(), datagram.size(), 0,
+                  (struct sockaddr*)&udpClientAddr, sizeof(udpClientAddr));
+}
+
+void NetworkStream::setFrameMask(const AVOFrameMask& mask) {
+    std::lock_guard<std::mutex> lock(frameMaskMutex);
+    frameMask = mask;
+    maskThresholds.reset();
+}
+
+void NetworkStream::setNoiseSuppression(uint8_t enterThreshold, uint8_t leaveThreshold) {
+    std::lock_guard<std::mutex> lock(denoiseMutex);
+    denoiseEnter = enterThreshold;
+    denoiseLeave = leaveThreshold;
+    denoiseState = AVODenoiseState();
+}
+
+std::shared_ptr<const std::vector<uint8_t>> NetworkStream::getMaskThresholds(
+    uint32_t width, uint32_t height, AVOPixelFormat format) {
+    std::lock_guard<std::mutex> lock(frameMaskMutex);
+    if (frameMask.empty()) {
+        return nullptr;
+    }
+    
+    // Карта строится один раз для размера и формата кадра
+    if (!maskThresholds || maskWidth != width || maskHeight != height || maskFormat != format) {
+        auto thresholds = std::make_shared<std::vector<uint8_t>>();
+        AVOCodec::buildThresholdMap(frameMask, width, height, format, *thresholds);
+        maskThresholds = thresholds;
+        maskWidth = width;
+        maskHeight = height;
+        maskFormat = format;
+    }
+    return maskThresholds;
+}
+
 // ================= UDP СЕРВЕР =================
 bool NetworkStream::startUDPServer(const std::string& ip, int port) {
     udpServerSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -193,6 +422,13 @@ bool NetworkStream::startUDPServer(const std::string& ip, int port) {
     udpServerSenderRunning = true;
     hasClient = false;
     frameBufferRunning = true;
+    nextFrameId = 0;
+    {
+        std::lock_guard<std::mutex> lock(prevFramesMutex);
+        prevFrames.clear();
+    }
+    
+    setImpairment(impairmentConfig);
     
     // Запускаем поток для прослушивания подключений клиентов
     udpServerListenerThreadObj = std::thread(&NetworkStream::udpServerListenerThread, this);
@@ -269,6 +505,7 @@ void NetworkStream::udpServerListenerThread() {
 
 void NetworkStream::frameBufferWorker() {
     std::cout << "[UDP SERVER] Frame buffer worker started" << std::endl;
+    AVOTrace::setThreadName("frame buffer");
     
     while (frameBufferRunning) {
         FrameBuffer frameBuffer;
@@ -295,12 +532,11 @@ void NetworkStream::frameBufferWorker() {
         }
         
         // Проверяем, не устарел ли кадр
-        auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+        uint64_t now = systemTimeUs();
         
-        if (now - frameBuffer.timestamp > 500) { // Кадр старше 500ms
+        if (now > frameBuffer.timestamp + 500000) { // Кадр старше 500ms
             std::cout << "[UDP SERVER] Skipping stale frame (age: " 
-                     << (now - frameBuffer.timestamp) << "ms)" << std::endl;
+                     << (now - frameBuffer.timestamp) / 1000 << "ms)" << std::endl;
             statsBufferDropped++;
             continue;
         }
@@ -313,15 +549,37 @@ void NetworkStream::frameBufferWorker() {
             }
         }
         
+        // Перевод в формат потока и подавление шума - здесь, в порядке кадров:
+        // состояние подавления шума зависит от предыдущего кадра, а пул
+        // кодирует кадры параллельно и в любом порядке
+        auto prepareStart = std::chrono::steady_clock::now();
+        
+        // Долговременный фон и копирование блоков в UDP-потоке не используются:
+        // доставка не гарантирована, ключевых кадров для восстановления нет, а кадры
+        // кодируются параллельно, поэтому опорный кадр и модель фона у клиента
+        // разойдутся, а копии блоков разнесут ошибку по кадру
+        frameBuffer.flags = streamFlags & ~static_cast<uint32_t>(AVO_FLAG_BACKGROUND | AVO_FLAG_MOTION);
+        
+        // Кадр с камеры приходит в RGB; в режиме YUV 4:2:0 сравнение идет по плоскостям
+        if (AVOCodec::getPixelFormat(frameBuffer.flags) == AVO_PIXEL_YUV420) {
+            std::vector<uint8_t> yuvFrame;
+            AVOCodec::rgbToYUV420(frameBuffer.frame, frameBuffer.width, frameBuffer.height, yuvFrame);
+            frameBuffer.frame.swap(yuvFrame);
+        }
+        
+        // Подавление шума до сравнения (состояние одно на поток)
+        if (denoiseEnter > 0) {
+            std::lock_guard<std::mutex> lock(denoiseMutex);
+            AVOCodec::suppressTemporalNoise(frameBuffer.frame, denoiseState, denoiseEnter, denoiseLeave);
+        }
+        statsEncodingTimeUs += elapsedUs(prepareStart);
+        
         // Кодируем и отправляем в отдельном потоке пула
         activeEncoders++;
         encoderPool->enqueue([this, frameBuffer]() {
-            auto encodeStart = std::chrono::high_resolution_clock::now();
+            auto encodeStart = std::chrono::steady_clock::now();
             encodeAndSendFrame(frameBuffer);
-            auto encodeEnd = std::chrono::high_resolution_clock::now();
-            auto encodeTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                encodeEnd - encodeStart);
-            statsEncodingTimeMs += encodeTime.count();
+            statsEncodingTimeUs += elapsedUs(encodeStart);
             activeEncoders--;
         });
     }
@@ -334,33 +592,65 @@ void NetworkStream::encodeAndSendFrame(FrameBuffer frameBuffer) {
         return;
     }
     
-    // Статическое хранение предыдущего кадра для каждого размера
-    static std::map<std::pair<uint32_t, uint32_t>, std::vector<uint8_t>> prevFrames;
-    static std::mutex prevFramesMutex;
+    uint64_t now = systemTimeUs();
+    queueWaitHistogram.record(now > frameBuffer.timestamp ? now - frameBuffer.timestamp : 0);
+    if (frameBuffer.queuedTraceUs != 0) {
+        AVOTrace::complete("queue", frameBuffer.frameId, frameBuffer.queuedTraceUs, AVOTrace::now());
+    }
+    AVOTraceScope traceEncode("encode", frameBuffer.frameId);
+    AVO_PROBE_SCOPE(AVO_PROBE_ENCODE);
+    AVO_PROBE_ADD(AVO_PROBE_ENCODE, PIXELS, static_cast<uint64_t>(frameBuffer.width) * frameBuffer.height);
+    
+    // Кадр уже переведен в формат потока (frameBufferWorker)
+    uint32_t flags = frameBuffer.flags;
+    AVOPixelFormat format = AVOCodec::getPixelFormat(flags);
     
     std::vector<uint8_t> prevFrame;
     auto key = std::make_pair(frameBuffer.width, frameBuffer.height);
     
     {
         std::lock_guard<std::mutex> lock(prevFramesMutex);
-        if (prevFrames.find(key) == prevFrames.end()) {
-            prevFrames[key] = AVOCodec::createBlackFrame(frameBuffer.width, frameBuffer.height);
+        auto it = prevFrames.find(key);
+        if (it == prevFrames.end() || it->second.size() != frameBuffer.frame.size()) {
+            prevFrames[key] = AVOCodec::createBlackFrame(frameBuffer.width, frameBuffer.height, format);
         }
         prevFrame = prevFrames[key];
     }
     
-    // Кодируем разницу
-    std::vector<PixelChange> changes;
-    AVOCodec::compareFrames(prevFrame, frameBuffer.frame, 
-                           frameBuffer.width, frameBuffer.height, changes);
+    // Быстрая проверка по выборке: у статичной камеры полное сравнение не нужно
+    // (опорный кадр не меняется, поэтому мелкие изменения накопятся и будут замечены)
+    std::vector<uint8_t> reconstructed;
+    std::vector<uint8_t> compressed;
+    auto sampleStart = std::chrono::steady_clock::now();
+    bool changed = AVOCodec::hasSampledChanges(prevFrame, frameBuffer.frame, frameBuffer.width,
+                                               frameBuffer.height, format, frameBuffer.frameId);
+    uint64_t sampleUs = elapsedUs(sampleStart);
+    if (changed) {
+        // Кодируем разницу (с компенсацией движения и энтропийным сжатием по флагам)
+        AVOEncodeTiming timing;
+        AVOEncoderOptions options;
+        options.flags = flags;
+        options.thresholds = getMaskThresholds(frameBuffer.width, frameBuffer.height, format);
+        options.timing = &timing;
+        compressed = AVOCodec::encodeDiffPayload(
+            prevFrame, frameBuffer.frame, frameBuffer.width, frameBuffer.height,
+            options, reconstructed);
+        compareHistogram.record(sampleUs + timing.compareUs);
+        compressHistogram.record(timing.compressUs);
+    } else {
+        compareHistogram.record(sampleUs);
+    }
     
-    if (changes.empty()) {
+    if (compressed.empty()) {
         // Нет изменений - отправляем минимальный пакет
         FramePacket packet;
         packet.data = {0}; // Один байт - маркер "нет изменений"
         packet.width = frameBuffer.width;
         packet.height = frameBuffer.height;
         packet.isFullFrame = false;
+        packet.flags = flags;
+        packet.frameId = frameBuffer.frameId;
+        packet.captureTimeUs = frameBuffer.timestamp;
         
         {
             std::lock_guard<std::mutex> lock(sendQueueMutex);
@@ -368,20 +658,27 @@ void NetworkStream::encodeAndSendFrame(FrameBuffer frameBuffer) {
                 sendQueue.push(packet);
                 statsPacketsSent++;
             } else {
-                statsBufferDropped++;
+                statsSendQueueDropped++;
             }
         }
         sendQueueCondVar.notify_one();
         return;
     }
     
-    // Сжимаем изменения
-    std::vector<uint8_t> compressed = AVOCodec::compressRLE(changes);
+    // Смена сцены: изменения не меньше самого кадра - отправляем кадр целиком
+    // (клиент распознает полный кадр по размеру данных)
+    bool sendFullFrame = compressed.size() >= frameBuffer.frame.size();
+    if (sendFullFrame) {
+        compressed = frameBuffer.frame;
+        reconstructed = frameBuffer.frame;
+        AVO_PROBE_ADD(AVO_PROBE_ENCODE, SLOW_PATHS, 1);
+    }
+    AVO_PROBE_ADD(AVO_PROBE_ENCODE, BYTES, compressed.size());
     
-    // Обновляем предыдущий кадр
+    // Обновляем предыдущий кадр - тем, что восстановит клиент
     {
         std::lock_guard<std::mutex> lock(prevFramesMutex);
-        prevFrames[key] = frameBuffer.frame;
+        prevFrames[key] = std::move(reconstructed);
     }
     
     // Отправляем
@@ -389,7 +686,10 @@ void NetworkStream::encodeAndSendFrame(FrameBuffer frameBuffer) {
     packet.data = compressed;
     packet.width = frameBuffer.width;
     packet.height = frameBuffer.height;
-    packet.isFullFrame = false;
+    packet.isFullFrame = sendFullFrame;
+    packet.flags = flags;
+    packet.frameId = frameBuffer.frameId;
+    packet.captureTimeUs = frameBuffer.timestamp;
     
     {
         std::lock_guard<std::mutex> lock(sendQueueMutex);
@@ -401,7 +701,7 @@ void NetworkStream::encodeAndSendFrame(FrameBuffer frameBuffer) {
             // Удаляем самые старые пакеты при переполнении
             while (sendQueue.size() >= 8) {
                 sendQueue.pop();
-                statsBufferDropped++;
+                statsSendQueueDropped++;
             }
             sendQueue.push(packet);
             statsPacketsSent++;
@@ -416,6 +716,7 @@ void NetworkStream::encodeAndSendFrame(FrameBuffer frameBuffer) {
 
 void NetworkStream::udpServerSenderThread() {
     std::cout << "[UDP SERVER] Sender thread started" << std::endl;
+    AVOTrace::setThreadName("sender");
     
     while (udpServerSenderRunning) {
         FramePacket packet;
@@ -451,25 +752,25 @@ void NetworkStream::udpServerSenderThread() {
         
         // Разбиваем данные на части и отправляем
         const size_t MAX_UDP_SIZE = 60000;
-        static uint32_t frameId = 0;
-        frameId++;
+        uint32_t frameId = packet.frameId;
+        uint64_t now = systemTimeUs();
+        frameAgeHistogram.record(now > packet.captureTimeUs ? now - packet.captureTimeUs : 0);
+        AVOTraceScope traceSend("send", frameId);
+        AVO_PROBE_SCOPE(AVO_PROBE_SEND);
+        AVO_PROBE_ADD(AVO_PROBE_SEND, BYTES, packet.data.size());
+        AVO_PROBE_ADD(AVO_PROBE_SEND, RUNS, (packet.data.size() + MAX_UDP_SIZE - 1) / MAX_UDP_SIZE);
         
         if (packet.data.size() <= MAX_UDP_SIZE) {
             // Отправляем одним пакетом
             auto networkPacket = AVOCodec::createNetworkPacket(packet.data, frameId, 0, 1, 
-                                                              packet.width, packet.height);
+                                                              packet.width, packet.height,
+                                                              packet.flags, packet.captureTimeUs);
             
-            socklen_t addrLen = sizeof(udpClientAddr);
-            auto sendStart = std::chrono::high_resolution_clock::now();
-            int sent = sendto(udpServerSocket, 
-                            (const char*)networkPacket.data(), 
-                            networkPacket.size(), 0,
-                            (struct sockaddr*)&udpClientAddr, 
-                            addrLen);
-            auto sendEnd = std::chrono::high_resolution_clock::now();
-            auto sendTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                sendEnd - sendStart);
-            statsNetworkTimeMs += sendTime.count();
+            auto sendStart = std::chrono::steady_clock::now();
+            int sent = sendDatagram(networkPacket);
+            uint64_t sendUs = elapsedUs(sendStart);
+            sendHistogram.record(sendUs);
+            statsNetworkTimeUs += sendUs;
             
             if (sent != static_cast<int>(networkPacket.size())) {
                 std::cerr << "[UDP SERVER] Failed to send packet: " 
@@ -478,6 +779,7 @@ void NetworkStream::udpServerSenderThread() {
             }
         } else {
             // Фрагментация на несколько пакетов
+            AVO_PROBE_ADD(AVO_PROBE_SEND, SLOW_PATHS, 1);
             size_t totalPackets = (packet.data.size() + MAX_UDP_SIZE - 1) / MAX_UDP_SIZE;
             
             for (size_t packetId = 0; packetId < totalPackets; packetId++) {
@@ -489,19 +791,14 @@ void NetworkStream::udpServerSenderThread() {
                 
                 auto networkPacket = AVOCodec::createNetworkPacket(chunk, frameId, 
                                                                   packetId, totalPackets, 
-                                                                  packet.width, packet.height);
+                                                                  packet.width, packet.height,
+                                                                  packet.flags, packet.captureTimeUs);
                 
-                socklen_t addrLen = sizeof(udpClientAddr);
-                auto sendStart = std::chrono::high_resolution_clock::now();
-                int sent = sendto(udpServerSocket, 
-                                (const char*)networkPacket.data(), 
-                                networkPacket.size(), 0,
-                                (struct sockaddr*)&udpClientAddr, 
-                                addrLen);
-                auto sendEnd = std::chrono::high_resolution_clock::now();
-                auto sendTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-                    sendEnd - sendStart);
-                statsNetworkTimeMs += sendTime.count();
+                auto sendStart = std::chrono::steady_clock::now();
+                int sent = sendDatagram(networkPacket);
+                uint64_t sendUs = elapsedUs(sendStart);
+                sendHistogram.record(sendUs);
+                statsNetworkTimeUs += sendUs;
                 
                 if (sent != static_cast<int>(networkPacket.size())) {
                     std::cerr << "[UDP SERVER] Failed to send chunk " 
@@ -547,10 +844,9 @@ bool NetworkStream::sendUDPFrame(const std::vector<uint8_t>& frameData,
     buffer.frame = frameData;
     buffer.width = width;
     buffer.height = height;
-    buffer.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()).count();
-    static std::atomic<uint32_t> frameCounter(0);
-    buffer.frameId = frameCounter++;
+    buffer.timestamp = systemTimeUs();
+    buffer.frameId = nextFrameId++;
+    buffer.queuedTraceUs = AVOTrace::isEnabled() ? AVOTrace::now() : 0;
     
     // Помещаем в очередь буферов
     {
@@ -590,6 +886,12 @@ void NetworkStream::stopUDPServer() {
         frameBufferThread.join();
     }
     
+    // Поток слоя искажений пишет в сокет - останавливается до закрытия
+    {
+        std::lock_guard<std::mutex> lock(impairmentMutex);
+        impairment.reset();
+    }
+    
     if (udpServerSocket != INVALID_SOCKET) {
         close_socket(udpServerSocket);
         udpServerSocket = INVALID_SOCKET;
@@ -679,11 +981,21 @@ bool NetworkStream::connectToUDPServer(const std::string& host, int port) {
 
 bool NetworkStream::startUDPReceiver(std::function<void(const std::vector<uint8_t>&, 
                                                        uint32_t, uint32_t, bool)> frameCallback) {
+    if (!frameCallback) {
+        return startUDPReceiver(std::function<void(const FramePacket&)>());
+    }
+    
+    return startUDPReceiver([frameCallback](const FramePacket& packet) {
+        frameCallback(packet.data, packet.width, packet.height, packet.isFullFrame);
+    });
+}
+
+bool NetworkStream::startUDPReceiver(std::function<void(const FramePacket&)> packetCallback) {
     if (!udpClientConnected || udpClientSocket == INVALID_SOCKET) {
         return false;
     }
     
-    this->frameCallback = frameCallback;
+    this->frameCallback = packetCallback;
     
     udpClientReceiverThreadObj = std::thread(&NetworkStream::udpClientReceiverThread, this);
     
@@ -692,6 +1004,7 @@ bool NetworkStream::startUDPReceiver(std::function<void(const std::vector<uint8_
 
 void NetworkStream::udpClientReceiverThread() {
     std::cout << "[UDP CLIENT] Receiver thread started" << std::endl;
+    AVOTrace::setThreadName("receiver");
     
     const int BUFFER_SIZE = 65507; // Максимальный размер UDP пакета
     std::vector<uint8_t> buffer(BUFFER_SIZE);
@@ -707,30 +1020,54 @@ void NetworkStream::udpClientReceiverThread() {
         
         if (bytesReceived > 0) {
             std::vector<uint8_t> packet(buffer.begin(), buffer.begin() + bytesReceived);
+            uint64_t receivedUs = steadyTimeUs();
+            AVO_PROBE_SCOPE(AVO_PROBE_RECEIVE);
+            AVO_PROBE_ADD(AVO_PROBE_RECEIVE, RUNS, 1);
+            AVO_PROBE_ADD(AVO_PROBE_RECEIVE, BYTES, bytesReceived);
             
             // Парсим пакет
             std::vector<uint8_t> data;
-            uint32_t frameId, packetId, totalPackets, width, height;
+            uint32_t frameId, packetId, totalPackets, width, height, flags;
+            uint64_t captureTimeUs;
             
             if (AVOCodec::parseNetworkPacket(packet, data, frameId, packetId, 
-                                             totalPackets, width, height)) {
+                                             totalPackets, width, height, flags,
+                                             captureTimeUs)) {
                 
                 if (totalPackets == 1) {
                     // Одиночный пакет - сразу обрабатываем
-                    bool isFullFrame = (data.size() == width * height * 3);
+                    statsFramesReceived++;
+                    statsBytesReceived += data.size();
+                    AVOTrace::complete("receive", frameId, receivedUs, AVOTrace::now());
                     if (frameCallback) {
-                        frameCallback(data, width, height, isFullFrame);
+                        FramePacket framePacket;
+                        framePacket.isFullFrame = (data.size() == AVOCodec::getFrameSize(
+                            width, height, AVOCodec::getPixelFormat(flags)));
+                        framePacket.data = std::move(data);
+                        framePacket.width = width;
+                        framePacket.height = height;
+                        framePacket.flags = flags;
+                        framePacket.frameId = frameId;
+                        framePacket.captureTimeUs = captureTimeUs;
+                        framePacket.receiveTimeUs = receivedUs;
+                        frameCallback(framePacket);
                     }
                 } else {
                     // Фрагментированный пакет - собираем
+                    AVO_PROBE_ADD(AVO_PROBE_RECEIVE, SLOW_PATHS, 1);
                     std::lock_guard<std::mutex> lock(packetMutex);
                     uint32_t packetKey = (frameId << 16) | (width & 0xFFFF);
                     
                     auto& fragPacket = fragmentedPackets[packetKey];
+                    if (fragPacket.chunks.empty()) {
+                        fragPacket.firstArrivalUs = receivedUs;
+                        fragPacket.captureTimeUs = captureTimeUs;
+                    }
                     fragPacket.frameId = frameId;
                     fragPacket.width = width;
                     fragPacket.height = height;
                     fragPacket.totalChunks = totalPackets;
+                    fragPacket.flags = flags;
                     fragPacket.lastUpdate = std::chrono::steady_clock::now();
                     
                     if (fragPacket.chunks.size() < totalPackets) {
@@ -739,12 +1076,6 @@ void NetworkStream::udpClientReceiverThread() {
                     
                     if (packetId < totalPackets) {
                         fragPacket.chunks[packetId] = data;
-                        
-                        // Проверяем, является ли это полным кадром
-                        if (packetId == 0) {
-                            uint32_t expectedFullFrameSize = width * height * 3;
-                            fragPacket.isFullFrame = (data.size() == expectedFullFrameSize);
-                        }
                     }
                     
                     // Проверяем, все ли части получены
@@ -764,8 +1095,27 @@ void NetworkStream::udpClientReceiverThread() {
                                               chunk.begin(), chunk.end());
                         }
                         
+                        // Полный кадр распознается по размеру собранных данных
+                        // (любой фрагмент меньше кадра)
+                        fragPacket.isFullFrame = (completeData.size() == AVOCodec::getFrameSize(
+                            width, height, AVOCodec::getPixelFormat(fragPacket.flags)));
+                        
+                        reassemblyHistogram.record(receivedUs - fragPacket.firstArrivalUs);
+                        AVOTrace::complete("receive", frameId, fragPacket.firstArrivalUs, AVOTrace::now());
+                        statsFramesReceived++;
+                        statsBytesReceived += completeData.size();
+                        
                         if (frameCallback) {
-                            frameCallback(completeData, width, height, fragPacket.isFullFrame);
+                            FramePacket framePacket;
+                            framePacket.data = std::move(completeData);
+                            framePacket.width = width;
+                            framePacket.height = height;
+                            framePacket.isFullFrame = fragPacket.isFullFrame;
+                            framePacket.flags = fragPacket.flags;
+                            framePacket.frameId = frameId;
+                            framePacket.captureTimeUs = fragPacket.captureTimeUs;
+                            framePacket.receiveTimeUs = fragPacket.firstArrivalUs;
+                            frameCallback(framePacket);
                         }
                         
                         // Удаляем из map
@@ -786,6 +1136,7 @@ void NetworkStream::udpClientReceiverThread() {
         for (auto it = fragmentedPackets.begin(); it != fragmentedPackets.end(); ) {
             if (std::chrono::duration_cast<std::chrono::seconds>(
                 now - it->second.lastUpdate).count() > 5) {
+                statsReassemblyExpired++;
                 it = fragmentedPackets.erase(it);
             } else {
                 ++it;
@@ -12,6 +12,14 @@
 #include <queue>
 #include <condition_variable>
 #include <future>
+#include <memory>
+
+#include "avo_codec.h"
+#include "network_impairment.h"
+#include "avo_histogram.h"
+#include "avo_trace.h"
+#include "avo_instrument.h"
+#include "network_metrics.h"
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -30,6 +38,10 @@ struct FramePacket {
     uint32_t width;
     uint32_t height;
     bool isFullFrame;
+    uint32_t flags = 0;     // AVOStreamFlags, с которыми закодированы данные
+    uint32_t frameId = 0;   // номер кадра у сервера: по порядку вызовов sendUDPFrame с 0
+    uint64_t captureTimeUs = 0;     // время захвата у сервера, мкс system_clock (0 - неизвестно)
+    uint64_t receiveTimeUs = 0;     // клиент: приход первого фрагмента, мкс steady_clock
 };
 
 class NetworkStream {
@@ -47,10 +59,21 @@ public:
                      uint32_t width, uint32_t height, bool isFullFrame = false);
     void stopUDPServer();
     
+    // Номер, который получит следующий принятый sendUDPFrame кадр (frameId на
+    // проводе); при одном потоке-источнике позволяет пометить в трассе этапы до отправки
+    uint32_t getNextFrameId() const { return nextFrameId; }
+    
+    // Кадры, принятые sendUDPFrame и еще не закодированные (в очереди и в пуле
+    // кодера): источник без темпа может ждать по этому числу, вместо того
+    // чтобы терять кадры при переполнении очереди
+    uint32_t getPendingFrames() const;
+    
     // UDP КЛИЕНТ (прием видео)
     bool connectToUDPServer(const std::string& host, int port);
     bool startUDPReceiver(std::function<void(const std::vector<uint8_t>&, 
                                             uint32_t, uint32_t, bool)> frameCallback);
+    // Вариант с полной информацией о кадре (в том числе флагами потока)
+    bool startUDPReceiver(std::function<void(const FramePacket&)> packetCallback);
     void disconnectUDP();
     
     // Статус
@@ -62,6 +85,19 @@ public:
     void setMaxPacketSize(size_t size) { maxPacketSize = size; }
     size_t getMaxPacketSize() const { return maxPacketSize; }
     
+    // Флаги кодирования потока (AVOStreamFlags), передаются в каждом пакете.
+    // AVO_FLAG_BACKGROUND и AVO_FLAG_MOTION в UDP-потоке не применяются
+    void setStreamFlags(uint32_t flags) { streamFlags = flags; }
+    uint32_t getStreamFlags() const { return streamFlags; }
+    
+    // Маска кадра: исключенные области не передаются, в областях интереса
+    // порог изменения ниже. Пустая маска отключает фильтрацию
+    void setFrameMask(const AVOFrameMask& mask);
+    
+    // Временное подавление шума камеры перед сравнением (0 - выключено),
+    // см. AVOCodec::suppressTemporalNoise
+    void setNoiseSuppression(uint8_t enterThreshold, uint8_t leaveThreshold = 4);
+    
     // Публичные методы для доступа
     int getServerSocket() const { return udpServerSocket; }
     sockaddr_in getClientAddr() const { return udpClientAddr; }
@@ -70,6 +106,11 @@ public:
     // Многопоточная обработка
     void setEncoderThreads(int count);
     
+    // Имитация плохой сети для исходящих пакетов сервера (для испытаний);
+    // конфигурация без искажений отключает слой
+    void setImpairment(const ImpairmentConfig& config);
+    ImpairmentStats getImpairmentStats() const;
+    
     // Статистика
     struct ServerStats {
         uint64_t framesProcessed;
@@ -77,16 +118,57 @@ public:
         uint64_t packetsSent;
         uint64_t encodingTimeMs;
         uint64_t networkTimeMs;
-        uint64_t bufferDropped;
+        uint64_t bufferDropped;      // очередь кадров на кодирование и устаревшие кадры
+        uint64_t sendQueueDropped;   // очередь пакетов на отправку
+        
+        // Текущее состояние
+        uint32_t frameQueueDepth;    // кадры, ждущие кодирования
+        uint32_t sendQueueDepth;     // пакеты, ждущие отправки
+        uint32_t activeEncoders;     // кадры в пуле кодера
+        
+        // Распределения по кадрам (датаграммам для send), мкс
+        AVOLatencySummary queueWait;     // от sendUDPFrame до начала кодирования
+        AVOLatencySummary compare;       // выборочная проверка, предсказание и сравнение
+        AVOLatencySummary compress;      // упаковка изменений
+        AVOLatencySummary send;          // один sendto
+        AVOLatencySummary frameAge;      // от sendUDPFrame до отправки первой датаграммы
+    };
+    
+    struct ClientStats {
+        uint64_t framesReceived;
+        uint64_t bytesReceived;
+        uint64_t reassemblyExpired;      // кадры, не собранные из фрагментов за 5 с
+        uint64_t appDropped;             // по recordDropped
+        uint32_t reassemblyBacklog;      // кадры, собираемые сейчас
+        AVOLatencySummary reassembly;    // от первого до последнего фрагмента кадра
+        AVOLatencySummary decode;        // по recordDecode
+        AVOLatencySummary endToEnd;      // от захвата у сервера до конца декодирования
     };
     
     ServerStats getStats() const;
+    ClientStats getClientStats() const;
     void resetStats();
     
+    // Клиент сообщает о декодированном кадре: время декодирования и (если
+    // сервер передал время захвата) полная задержка. Между машинами полная
+    // задержка верна с точностью синхронизации часов
+    void recordDecode(const FramePacket& packet, uint64_t decodeUs);
+    
+    // Клиент сообщает о кадрах, отброшенных после приема (например, очередью декодера)
+    void recordDropped(uint64_t frames = 1) { statsAppDropped += frames; }
+    
+    // Метрики в формате Prometheus: текущий текст и периодическая публикация
+    // в файл и/или Unix-сокет (см. MetricsExportConfig). Сервер и клиент
+    // выводят свои метрики, пока запущены
+    std::string formatMetrics(const std::string& instance = "");
+    bool startMetricsExport(const MetricsExportConfig& config);
+    void stopMetricsExport();
+    
 private:
     void udpServerListenerThread();
     void udpServerSenderThread();
     void udpClientReceiverThread();
+    int sendDatagram(const std::vector<uint8_t>& datagram);
     
     // Пул потоков для кодирования
     class ThreadPool {
@@ -114,13 +196,22 @@ private:
         std::vector<uint8_t> frame;
         uint32_t width;
         uint32_t height;
-        uint64_t timestamp;
+        uint64_t timestamp;     // время захвата, мкс system_clock
         uint32_t frameId;
+        uint64_t queuedTraceUs; // постановка в очередь, время AVOTrace (0 - без трассировки)
+        uint32_t flags;         // флаги кодирования, под которые подготовлен кадр
     };
     
     // Методы для многопоточной обработки
     void frameBufferWorker();
     void encodeAndSendFrame(FrameBuffer frameBuffer);
+    std::shared_ptr<const std::vector<uint8_t>> getMaskThresholds(uint32_t width, uint32_t height,
+                                                                  AVOPixelFormat format);
+    
+    // Опорные кадры кодера (то, что восстановит клиент), по размеру кадра
+    std::map<std::pair<uint32_t, uint32_t>, std::vector<uint8_t>> prevFrames;
+    std::mutex prevFramesMutex;
+    std::atomic<uint32_t> nextFrameId{0};
     
     // Серверные переменные (UDP)
     int udpServerSocket;
@@ -135,7 +226,7 @@ private:
     
     // Очередь для отправки (сервер)
     std::queue<FramePacket> sendQueue;
-    std::mutex sendQueueMutex;
+    mutable std::mutex sendQueueMutex;
     std::condition_variable sendQueueCondVar;
     
     // Клиентские переменные (UDP)
@@ -144,11 +235,31 @@ private:
     std::atomic<bool> udpClientConnected;
     std::thread udpClientReceiverThreadObj;
     
+    // Слой искажений между сервером и сокетом (создается при запуске сервера)
+    ImpairmentConfig impairmentConfig;
+    std::shared_ptr<NetworkImpairment> impairment;
+    mutable std::mutex impairmentMutex;
+    
     // Общие
     size_t maxPacketSize;
+    std::atomic<uint32_t> streamFlags{0};
+    
+    // Маска кадра и построенная из нее карта порогов (для последнего размера кадра)
+    AVOFrameMask frameMask;
+    std::shared_ptr<const std::vector<uint8_t>> maskThresholds;
+    uint32_t maskWidth = 0;
+    uint32_t maskHeight = 0;
+    AVOPixelFormat maskFormat = AVO_PIXEL_RGB24;
+    std::mutex frameMaskMutex;
+    
+    // Подавление шума (состояние общее для потока)
+    std::atomic<uint8_t> denoiseEnter{0};
+    std::atomic<uint8_t> denoiseLeave{4};
+    AVODenoiseState denoiseState;
+    std::mutex denoiseMutex;
     
     // Callback для клиента
-    std::function<void(const std::vector<uint8_t>&, uint32_t, uint32_t, bool)> frameCallback;
+    std::function<void(const FramePacket&)> frameCallback;
     
     // Для сборки фрагментированных пакетов
     struct FragmentedPacket {
@@ -157,12 +268,15 @@ private:
         uint32_t width;
         uint32_t height;
         uint32_t frameId;
+        uint32_t flags;
         bool isFullFrame;
+        uint64_t captureTimeUs;
+        uint64_t firstArrivalUs;        // steady_clock
         std::chrono::steady_clock::time_point lastUpdate;
     };
     
     std::map<uint32_t, FragmentedPacket> fragmentedPackets;
-    std::mutex packetMutex;
+    mutable std::mutex packetMutex;
     std::mutex clientAddrMutex;
     
     // Многопоточные компоненты
@@ -171,7 +285,7 @@ private:
     
     // Буфер кадров
     std::queue<FrameBuffer> frameBufferQueue;
-    std::mutex frameBufferMutex;
+    mutable std::mutex frameBufferMutex;
     std::condition_variable frameBufferCondVar;
     std::atomic<bool> frameBufferRunning;
     std::thread frameBufferThread;
@@ -180,9 +294,32 @@ private:
     std::atomic<uint64_t> statsFramesProcessed{0};
     std::atomic<uint64_t> statsBytesSent{0};
     std::atomic<uint64_t> statsPacketsSent{0};
-    std::atomic<uint64_t> statsEncodingTimeMs{0};
-    std::atomic<uint64_t> statsNetworkTimeMs{0};
+    std::atomic<uint64_t> statsEncodingTimeUs{0};
+    std::atomic<uint64_t> statsNetworkTimeUs{0};
     std::atomic<uint64_t> statsBufferDropped{0};
+    std::atomic<uint64_t> statsSendQueueDropped{0};
+    AVOLatencyHistogram queueWaitHistogram;
+    AVOLatencyHistogram compareHistogram;
+    AVOLatencyHistogram compressHistogram;
+    AVOLatencyHistogram sendHistogram;
+    AVOLatencyHistogram frameAgeHistogram;
+    
+    // Статистика клиента
+    std::atomic<uint64_t> statsFramesReceived{0};
+    std::atomic<uint64_t> statsBytesReceived{0};
+    AVOLatencyHistogram reassemblyHistogram;
+    AVOLatencyHistogram decodeHistogram;
+    AVOLatencyHistogram endToEndHistogram;
+    std::atomic<uint64_t> statsReassemblyExpired{0};
+    std::atomic<uint64_t> statsAppDropped{0};
+    
+    // Экспорт метрик (скорости считаются между вызовами formatMetrics)
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    std::mutex metricsMutex;
+    MetricsRate serverFpsRate;
+    MetricsRate serverBitRate;
+    MetricsRate clientFpsRate;
+    MetricsRate clientBitRate;
 };
 
 #endif // NETWORK_STREAM_H
\ No newline at end of file
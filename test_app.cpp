@@ -1,5 +1,8 @@
 #include "avo_codec.h"
 #include "network_stream.h"
+#include "avo_archive.h"
+#include "avo_bundle.h"
+#include "avo_trace.h"
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <vector>
@@ -11,9 +14,12 @@
 #include <sstream>
 #include <fstream>
 #include <cstdlib>
+#include <cstdio>
 #include <cstring>
 #include <cstdint>
 #include <algorithm>
+#include <cmath>
+#include <iterator>
 #include <arpa/inet.h>
 #include <condition_variable>
 #include <queue>
@@ -118,56 +124,63 @@ int selectMode() {
     return mode;
 }
 
-std::vector<uint8_t> matToRGBVector(const cv::Mat& frame) {
-    if (frame.empty()) return {};
-    
-    cv::Mat rgbFrame;
-    
-    if (frame.channels() == 1) {
-        cv::cvtColor(frame, rgbFrame, cv::COLOR_GRAY2RGB);
+// Заголовок cv::Mat поверх буфера кадра RGB24 без копирования: буфер должен
+// жить дольше заголовка и не менять размер, пока заголовок используется
+cv::Mat rgbVectorView(std::vector<uint8_t>& rgbData, int width, int height) {
+    return cv::Mat(height, width, CV_8UC3, rgbData.data());
+}
+
+// Преобразование в уже выделенный буфер: cvtColor пишет прямо в память
+// вектора за один проход (векторизованная перестановка каналов OpenCV), при
+// том же размере кадра память не выделяется заново
+void matToRGBVector(const cv::Mat& frame, std::vector<uint8_t>& result) {
+    int code;
+    if (frame.empty() || frame.depth() != CV_8U) {
+        result.clear();
+        return;
+    } else if (frame.channels() == 1) {
+        code = cv::COLOR_GRAY2RGB;
     } else if (frame.channels() == 3) {
-        cv::cvtColor(frame, rgbFrame, cv::COLOR_BGR2RGB);
+        code = cv::COLOR_BGR2RGB;
     } else if (frame.channels() == 4) {
-        cv::cvtColor(frame, rgbFrame, cv::COLOR_BGRA2RGB);
+        code = cv::COLOR_BGRA2RGB;
     } else {
-        return {};
+        result.clear();
+        return;
     }
     
+    result.resize(static_cast<size_t>(frame.rows) * frame.cols * 3);
+    cv::Mat rgbFrame = rgbVectorView(result, frame.cols, frame.rows);
+    cv::cvtColor(frame, rgbFrame, code);
+}
+
+std::vector<uint8_t> matToRGBVector(const cv::Mat& frame) {
     std::vector<uint8_t> result;
-    result.reserve(rgbFrame.rows * rgbFrame.cols * 3);
-    
-    for (int y = 0; y < rgbFrame.rows; y++) {
-        for (int x = 0; x < rgbFrame.cols; x++) {
-            cv::Vec3b pixel = rgbFrame.at<cv::Vec3b>(y, x);
-            result.push_back(pixel[0]); // R
-            result.push_back(pixel[1]); // G
-            result.push_back(pixel[2]); // B
-        }
-    }
-    
+    matToRGBVector(frame, result);
     return result;
 }
 
-cv::Mat rgbVectorToMat(const std::vector<uint8_t>& rgbData, int width, int height) {
-    if (rgbData.empty() || width <= 0 || height <= 0) {
-        return cv::Mat::zeros(height, width, CV_8UC3);
+// Обратное преобразование в result (память переиспользуется при том же
+// размере); кадр короче width * height * 3 дает черный кадр
+void rgbVectorToMat(const std::vector<uint8_t>& rgbData, int width, int height, cv::Mat& result) {
+    if (width <= 0 || height <= 0) {
+        result = cv::Mat();
+        return;
     }
-    
-    cv::Mat result(height, width, CV_8UC3);
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = (y * width + x) * 3;
-            if (idx + 2 < rgbData.size()) {
-                result.at<cv::Vec3b>(y, x) = cv::Vec3b(
-                    rgbData[idx + 2], // B
-                    rgbData[idx + 1], // G
-                    rgbData[idx]      // R
-                );
-            }
-        }
+    if (rgbData.size() < static_cast<size_t>(width) * height * 3) {
+        result.create(height, width, CV_8UC3);
+        result.setTo(cv::Scalar::all(0));
+        return;
     }
     
+    // cvtColor только читает источник
+    cv::Mat rgbFrame(height, width, CV_8UC3, const_cast<uint8_t*>(rgbData.data()));
+    cv::cvtColor(rgbFrame, result, cv::COLOR_RGB2BGR);
+}
+
+cv::Mat rgbVectorToMat(const std::vector<uint8_t>& rgbData, int width, int height) {
+    cv::Mat result;
+    rgbVectorToMat(rgbData, width, height, result);
     return result;
 }
 
@@ -175,6 +188,43 @@ std::vector<uint8_t> createBlackFrame(uint32_t width, uint32_t height) {
     return std::vector<uint8_t>(width * height * 3, 0);
 }
 
+// Строка перцентилей гистограммы задержек
+void printLatency(const std::string& name, const AVOLatencySummary& summary) {
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+              << " n=" << summary.count
+              << " p50=" << summary.p50Us << "us p99=" << summary.p99Us
+              << "us p99.9=" << summary.p999Us << "us max=" << summary.maxUs << "us" << std::endl;
+}
+
+// Публикация метрик Prometheus по переменным окружения AVO_METRICS_FILE,
+// AVO_METRICS_SOCKET и AVO_METRICS_INTERVAL_MS (по умолчанию 1000)
+void startMetricsFromEnv(NetworkStream& stream, const std::string& instance) {
+    MetricsExportConfig config;
+    const char* file = std::getenv("AVO_METRICS_FILE");
+    const char* socketPath = std::getenv("AVO_METRICS_SOCKET");
+    const char* interval = std::getenv("AVO_METRICS_INTERVAL_MS");
+    config.filePath = file ? file : "";
+    config.socketPath = socketPath ? socketPath : "";
+    if (interval && atoi(interval) > 0) {
+        config.intervalMs = static_cast<uint32_t>(atoi(interval));
+    }
+    config.instance = instance;
+    if (!config.enabled()) {
+        return;
+    }
+    
+    if (stream.startMetricsExport(config)) {
+        std::cout << "Metrics export:";
+        if (!config.filePath.empty()) {
+            std::cout << " file " << config.filePath;
+        }
+        if (!config.socketPath.empty()) {
+            std::cout << " socket " << config.socketPath;
+        }
+        std::cout << std::endl;
+    }
+}
+
 std::vector<std::string> getLocalIPs() {
     std::vector<std::string> ips;
     
@@ -199,6 +249,143 @@ std::vector<std::string> getLocalIPs() {
 }
 
 // ================= UDP СЕРВЕР =================
+
+// Этапы сервера в своих потоках, чтобы медленный этап не снижал частоту
+// захвата: поток захвата читает камеру с ее частотой в кадры пула (память
+// выделяется один раз), поток преобразования берет самый свежий кадр,
+// уменьшает, переводит в RGB и передает NetworkStream (sendUDPFrame только
+// ставит кадр в очередь), а окно показывает последний переданный кадр.
+// Из трех кадров пула один пишет захват, один ждет, один преобразуется, так
+// что свободный кадр для захвата есть всегда; непрочитанный кадр вытесняется
+// более свежим
+struct ServerCapture {
+    static const int POOL_SIZE = 3;
+    
+    struct Slot {
+        cv::Mat frame;
+        uint64_t captureStartUs = 0;    // AVOTrace::now(), 0 - трасса выключена
+        uint64_t captureEndUs = 0;
+    };
+    
+    Slot slots[POOL_SIZE];
+    std::vector<int> freeSlots;
+    int readySlot = -1;                 // захваченный и еще не взятый кадр
+    std::mutex slotMutex;
+    std::condition_variable readyCondVar;
+    
+    cv::Mat displayFrame;               // последний переданный кадр
+    uint64_t displaySequence = 0;
+    std::mutex displayMutex;
+    
+    std::atomic<bool> running{true};
+    std::atomic<bool> clientConnected{false};
+    std::atomic<uint64_t> framesCaptured{0};
+    std::atomic<uint64_t> framesSkipped{0};     // вытеснены до преобразования
+    std::atomic<uint64_t> framesConverted{0};
+    std::atomic<uint64_t> captureErrors{0};
+    
+    ServerCapture() {
+        for (int i = POOL_SIZE - 1; i >= 0; i--) {
+            freeSlots.push_back(i);
+        }
+    }
+};
+
+void serverCaptureThread(ServerCapture& capture, cv::VideoCapture& cap) {
+    AVOTrace::setThreadName("capture");
+    
+    while (capture.running) {
+        int slotIndex;
+        {
+            std::lock_guard<std::mutex> lock(capture.slotMutex);
+            slotIndex = capture.freeSlots.back();
+            capture.freeSlots.pop_back();
+        }
+        
+        ServerCapture::Slot& slot = capture.slots[slotIndex];
+        slot.captureStartUs = AVOTrace::isEnabled() ? AVOTrace::now() : 0;
+        bool captured = cap.read(slot.frame) && !slot.frame.empty();
+        slot.captureEndUs = slot.captureStartUs ? AVOTrace::now() : 0;
+        
+        {
+            std::lock_guard<std::mutex> lock(capture.slotMutex);
+            if (!captured) {
+                capture.freeSlots.push_back(slotIndex);
+            } else {
+                if (capture.readySlot >= 0) {
+                    capture.freeSlots.push_back(capture.readySlot);
+                    capture.framesSkipped++;
+                }
+                capture.readySlot = slotIndex;
+            }
+        }
+        
+        if (captured) {
+            capture.framesCaptured++;
+            capture.readyCondVar.notify_one();
+        } else {
+            capture.captureErrors++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+void serverConvertThread(ServerCapture& capture, NetworkStream& server, int width, int height) {
+    AVOTrace::setThreadName("convert");
+    
+    cv::Mat resizedFrame;
+    std::vector<uint8_t> currentFrame;
+    
+    while (true) {
+        int slotIndex;
+        {
+            std::unique_lock<std::mutex> lock(capture.slotMutex);
+            capture.readyCondVar.wait_for(lock, std::chrono::milliseconds(10),
+                [&capture]() { return capture.readySlot >= 0 || !capture.running; });
+            if (!capture.running) {
+                break;
+            }
+            if (capture.readySlot < 0) {
+                continue;
+            }
+            slotIndex = capture.readySlot;
+            capture.readySlot = -1;
+        }
+        
+        // Номер кадра в трассе - тот, что sendUDPFrame передаст клиенту
+        uint32_t traceFrameId = server.getNextFrameId();
+        ServerCapture::Slot& slot = capture.slots[slotIndex];
+        if (slot.captureStartUs) {
+            AVOTrace::complete("capture", traceFrameId, slot.captureStartUs, slot.captureEndUs);
+        }
+        
+        {
+            AVOTraceScope traceResize("resize", traceFrameId);
+            cv::resize(slot.frame, resizedFrame, cv::Size(width, height));
+        }
+        {
+            std::lock_guard<std::mutex> lock(capture.slotMutex);
+            capture.freeSlots.push_back(slotIndex);
+        }
+        
+        {
+            AVOTraceScope traceConvert("matToRGBVector", traceFrameId);
+            matToRGBVector(resizedFrame, currentFrame);
+        }
+        
+        if (capture.clientConnected) {
+            server.sendUDPFrame(currentFrame, width, height);
+        }
+        capture.framesConverted++;
+        
+        {
+            std::lock_guard<std::mutex> lock(capture.displayMutex);
+            resizedFrame.copyTo(capture.displayFrame);
+            capture.displaySequence++;
+        }
+    }
+}
+
 void serverMode() {
     std::cout << "\n=== Server Mode (Streaming) ===\n" << std::endl;
     
@@ -217,6 +404,11 @@ void serverMode() {
     std::cout << "Enter FPS (15-30 recommended): ";
     std::cin >> requestedFps;
     
+    char yuvAnswer = 'n';
+    std::cout << "Use YUV 4:2:0 (half bandwidth, lossy color)? (y/n): ";
+    std::cin >> yuvAnswer;
+    bool useYUV = (yuvAnswer == 'y' || yuvAnswer == 'Y');
+    
     std::cin.ignore();
     
     std::cout << "\nEnter server address (format: IP:PORT)" << std::endl;
@@ -272,7 +464,10 @@ void serverMode() {
     std::cout << "  FPS: " << actualFps << std::endl;
     
     NetworkStream server;
+    AVOTrace::setProcessName("AVO server");
+    AVOTrace::setThreadName("display");
     server.setEncoderThreads(4);
+    server.setStreamFlags(AVO_FLAG_ENTROPY | (useYUV ? static_cast<uint32_t>(AVO_FLAG_YUV420) : 0u));
     
     if (!server.startUDPServer(serverIP, port)) {
         std::cerr << "Failed to start UDP server on " << serverIP << ":" << port << std::endl;
@@ -280,6 +475,7 @@ void serverMode() {
         NetworkStream::cleanupNetwork();
         return;
     }
+    startMetricsFromEnv(server, "server:" + std::to_string(port));
     
     std::cout << "\nUDP Server started! Waiting for client connection..." << std::endl;
     std::cout << "Clients should connect to:" << std::endl;
@@ -293,10 +489,9 @@ void serverMode() {
     
     bool clientConnected = false;
     bool newClientConnected = false;
-    int clientConnectionCheckCounter = 0;
     
-    int frameCount = 0;
-    int fpsCounter = 0;
+    uint64_t fpsConverted = 0;
+    double displayedFps = 0;
     auto lastStatsTime = std::chrono::steady_clock::now();
     auto startTime = lastStatsTime;
     
@@ -307,37 +502,24 @@ void serverMode() {
     
     auto lastStatPrint = std::chrono::steady_clock::now();
     
+    ServerCapture capture;
+    std::thread captureThread(serverCaptureThread, std::ref(capture), std::ref(cap));
+    std::thread convertThread(serverConvertThread, std::ref(capture), std::ref(server), width, height);
+    uint64_t shownSequence = 0;
+    
+    // Окно и клавиатура: кадры показываются по мере готовности, пропущенные
+    // окном кадры все равно отправлены
     while (true) {
-        clientConnectionCheckCounter++;
-        if (clientConnectionCheckCounter >= 5) {
-            bool hasClient = server.hasUDPClient();
-            if (!clientConnected && hasClient) {
-                clientConnected = true;
-                newClientConnected = true;
-                std::cout << "\n✓ Client connected! Sending initial full frame...\n" << std::endl;
-            } else if (clientConnected && !hasClient) {
-                clientConnected = false;
-                std::cout << "\n⚠ Client disconnected. Waiting for new connection...\n" << std::endl;
-            }
-            clientConnectionCheckCounter = 0;
-        }
-        
-        cv::Mat frame;
-        cap >> frame;
-        
-        if (frame.empty()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            continue;
-        }
-        
-        cv::Mat resizedFrame;
-        cv::resize(frame, resizedFrame, cv::Size(width, height));
-        
-        std::vector<uint8_t> currentFrame = matToRGBVector(resizedFrame);
-        
-        if (clientConnected) {
-            server.sendUDPFrame(currentFrame, width, height);
+        bool hasClient = server.hasUDPClient();
+        if (!clientConnected && hasClient) {
+            clientConnected = true;
+            newClientConnected = true;
+            std::cout << "\n✓ Client connected! Sending initial full frame...\n" << std::endl;
+        } else if (clientConnected && !hasClient) {
+            clientConnected = false;
+            std::cout << "\n⚠ Client disconnected. Waiting for new connection...\n" << std::endl;
         }
+        capture.clientConnected = clientConnected;
         
         auto now = std::chrono::steady_clock::now();
         if (std::chrono::duration_cast<std::chrono::seconds>(now - lastStatPrint).count() >= 3) {
@@ -345,48 +527,54 @@ void serverMode() {
             std::cout << "[SERVER STATS] Frames: " << stats.framesProcessed
                      << ", Bytes: " << stats.bytesSent
                      << ", Encoding: " << stats.encodingTimeMs << "ms"
-                     << ", Dropped: " << stats.bufferDropped << std::endl;
+                     << ", Dropped: " << stats.bufferDropped << "/" << stats.sendQueueDropped
+                     << ", Capture skipped: " << capture.framesSkipped << std::endl;
             lastStatPrint = now;
         }
         
-        frameCount++;
-        fpsCounter++;
+        auto elapsedSec = std::chrono::duration_cast<std::chrono::seconds>(now - lastStatsTime).count();
+        if (elapsedSec >= 2) {
+            uint64_t converted = capture.framesConverted;
+            displayedFps = (converted - fpsConverted) / static_cast<double>(elapsedSec);
+            fpsConverted = converted;
+            lastStatsTime = now;
+        }
         
         cv::Mat displayFrame;
-        cv::resize(resizedFrame, displayFrame, cv::Size(640, 480));
-        
-        std::string statusText = clientConnected ? "CLIENT CONNECTED" : "WAITING FOR CLIENT...";
-        cv::Scalar statusColor = clientConnected ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 165, 255);
-        
-        cv::rectangle(displayFrame, cv::Point(5, 5), cv::Point(635, 150), cv::Scalar(0, 0, 0), -1);
-        cv::rectangle(displayFrame, cv::Point(5, 5), cv::Point(635, 150), statusColor, 2);
-        
-        cv::putText(displayFrame, "UDP SERVER: " + address,
-                   cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.7,
-                   cv::Scalar(255, 255, 255), 2);
-        
-        cv::putText(displayFrame, "STATUS: " + statusText,
-                   cv::Point(10, 60), cv::FONT_HERSHEY_SIMPLEX, 0.7,
-                   statusColor, 2);
-        
-        cv::putText(displayFrame, "FRAMES: " + std::to_string(frameCount),
-                   cv::Point(10, 90), cv::FONT_HERSHEY_SIMPLEX, 0.6,
-                   cv::Scalar(255, 255, 255), 1);
-        
-        auto currentTime = std::chrono::steady_clock::now();
-        auto elapsedSec = std::chrono::duration_cast<std::chrono::seconds>(currentTime - lastStatsTime).count();
+        {
+            std::lock_guard<std::mutex> lock(capture.displayMutex);
+            if (capture.displaySequence != shownSequence && !capture.displayFrame.empty()) {
+                cv::resize(capture.displayFrame, displayFrame, cv::Size(640, 480));
+                shownSequence = capture.displaySequence;
+            }
+        }
         
-        if (elapsedSec >= 2) {
-            double fps = fpsCounter / elapsedSec;
-            cv::putText(displayFrame, "FPS: " + std::to_string((int)fps),
+        if (!displayFrame.empty()) {
+            std::string statusText = clientConnected ? "CLIENT CONNECTED" : "WAITING FOR CLIENT...";
+            cv::Scalar statusColor = clientConnected ? cv::Scalar(0, 255, 0) : cv::Scalar(0, 165, 255);
+            
+            cv::rectangle(displayFrame, cv::Point(5, 5), cv::Point(635, 150), cv::Scalar(0, 0, 0), -1);
+            cv::rectangle(displayFrame, cv::Point(5, 5), cv::Point(635, 150), statusColor, 2);
+            
+            cv::putText(displayFrame, "UDP SERVER: " + address,
+                       cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.7,
+                       cv::Scalar(255, 255, 255), 2);
+            
+            cv::putText(displayFrame, "STATUS: " + statusText,
+                       cv::Point(10, 60), cv::FONT_HERSHEY_SIMPLEX, 0.7,
+                       statusColor, 2);
+            
+            cv::putText(displayFrame, "FRAMES: " + std::to_string(capture.framesConverted.load()),
+                       cv::Point(10, 90), cv::FONT_HERSHEY_SIMPLEX, 0.6,
+                       cv::Scalar(255, 255, 255), 1);
+            
+            cv::putText(displayFrame, "FPS: " + std::to_string((int)displayedFps),
                        cv::Point(10, 120), cv::FONT_HERSHEY_SIMPLEX, 0.6,
                        cv::Scalar(255, 255, 255), 1);
-            lastStatsTime = currentTime;
-            fpsCounter = 0;
+            
+            cv::imshow("UDP Server .AVO Stream", displayFrame);
         }
         
-        cv::imshow("UDP Server .AVO Stream", displayFrame);
-        
         int key = cv::waitKey(delayMs);
         if (key == 27) {
             std::cout << "\nStopping server..." << std::endl;
@@ -394,6 +582,12 @@ void serverMode() {
         }
     }
     
+    capture.running = false;
+    capture.readyCondVar.notify_all();
+    convertThread.join();
+    captureThread.join();
+    
+    uint64_t frameCount = capture.framesConverted;
     cap.release();
     cv::destroyAllWindows();
     server.stopUDPServer();
@@ -407,6 +601,9 @@ void serverMode() {
     std::cout << "\n=== Server Summary ===" << std::endl;
     std::cout << "Address: " << address << std::endl;
     std::cout << "Total frames: " << frameCount << std::endl;
+    std::cout << "Captured frames: " << capture.framesCaptured
+              << " (skipped before conversion: " << capture.framesSkipped
+              << ", capture errors: " << capture.captureErrors << ")" << std::endl;
     std::cout << "Total time: " << totalElapsed << " sec" << std::endl;
     if (totalElapsed > 0) {
         std::cout << "Average FPS: " << std::fixed << std::setprecision(1)
@@ -417,6 +614,7 @@ void serverMode() {
     std::cout << "Bytes sent: " << stats.bytesSent << std::endl;
     std::cout << "Packets sent: " << stats.packetsSent << std::endl;
     std::cout << "Frames dropped: " << stats.bufferDropped << std::endl;
+    std::cout << "Packets dropped (send queue): " << stats.sendQueueDropped << std::endl;
     std::cout << "Total encoding time: " << stats.encodingTimeMs << " ms" << std::endl;
     std::cout << "Total network time: " << stats.networkTimeMs << " ms" << std::endl;
     if (stats.framesProcessed > 0) {
@@ -425,12 +623,21 @@ void serverMode() {
         std::cout << "Avg network time: " 
                   << (stats.networkTimeMs / stats.framesProcessed) << " ms/frame" << std::endl;
     }
+    std::cout << "Latency:" << std::endl;
+    printLatency("queue wait", stats.queueWait);
+    printLatency("compare", stats.compare);
+    printLatency("compress", stats.compress);
+    printLatency("send", stats.send);
+    printLatency("frame age", stats.frameAge);
+    if (AVOInstrument::compiledIn) {
+        AVOInstrument::report(std::cout);
+    }
     std::cout << "Streaming finished." << std::endl;
 }
 
 // ================= UDP КЛИЕНТ =================
 struct ClientProcessing {
-    std::queue<std::tuple<std::vector<uint8_t>, uint32_t, uint32_t, bool>> packetQueue;
+    std::queue<FramePacket> packetQueue;
     std::mutex queueMutex;
     std::condition_variable queueCondVar;
     std::atomic<bool> running{true};
@@ -445,6 +652,7 @@ struct ClientProcessing {
     std::vector<uint8_t> currentFrame;
     uint32_t currentWidth{0};
     uint32_t currentHeight{0};
+    AVOPixelFormat currentFormat{AVO_PIXEL_RGB24};
     std::atomic<bool> frameReady{false};
     std::mutex frameMutex;
     std::atomic<uint64_t> framesProcessed{0};
@@ -489,20 +697,24 @@ void clientMode() {
     }
     
     NetworkStream client;
+    AVOTrace::setProcessName("AVO client");
+    AVOTrace::setThreadName("display");
     
     if (!client.connectToUDPServer(serverIP, port)) {
         std::cerr << "Failed to connect to UDP server " << serverIP << ":" << port << std::endl;
         NetworkStream::cleanupNetwork();
         return;
     }
+    startMetricsFromEnv(client, "client:" + serverIP + ":" + std::to_string(port));
     
     ClientProcessing processor;
     const int NUM_PROCESSING_THREADS = 4;
     
     for (int i = 0; i < NUM_PROCESSING_THREADS; i++) {
-        processor.processingThreads.emplace_back([&processor, i]() {
+        processor.processingThreads.emplace_back([&processor, &client, i]() {
+            AVOTrace::setThreadName("client processing");
             while (processor.running) {
-                std::tuple<std::vector<uint8_t>, uint32_t, uint32_t, bool> packet;
+                FramePacket packet;
                 
                 {
                     std::unique_lock<std::mutex> lock(processor.queueMutex);
@@ -523,8 +735,12 @@ void clientMode() {
                 }
                 
                 auto startTime = std::chrono::high_resolution_clock::now();
+                AVOTraceScope traceDecode("decode", packet.frameId);
                 
-                auto& [packetData, width, height, isFullFrame] = packet;
+                const std::vector<uint8_t>& packetData = packet.data;
+                uint32_t width = packet.width;
+                uint32_t height = packet.height;
+                bool isFullFrame = packet.isFullFrame;
                 
                 if (packetData.empty()) {
                     continue;
@@ -533,7 +749,8 @@ void clientMode() {
                 processor.packetsReceived++;
                 
                 try {
-                    uint32_t expectedFullFrameSize = width * height * 3;
+                    AVOPixelFormat format = AVOCodec::getPixelFormat(packet.flags);
+                    size_t expectedFullFrameSize = AVOCodec::getFrameSize(width, height, format);
                     
                     if (packetData.size() == 1 && packetData[0] == 0) {
                         processor.framesDecoded++;
@@ -546,26 +763,29 @@ void clientMode() {
                             processor.currentFrame = packetData;
                             processor.currentWidth = width;
                             processor.currentHeight = height;
+                            processor.currentFormat = format;
                             processor.frameReady = true;
                         }
                         processor.framesDecoded++;
                     } else {
-                        std::vector<PixelChange> changes = AVOCodec::decompressRLE(packetData);
-                        
                         std::lock_guard<std::mutex> lock(processor.frameMutex);
                         
                         if (processor.currentFrame.empty() || 
                             processor.currentFrame.size() != expectedFullFrameSize ||
                             processor.currentWidth != width || 
-                            processor.currentHeight != height) {
-                            processor.currentFrame = AVOCodec::createBlackFrame(width, height);
+                            processor.currentHeight != height ||
+                            processor.currentFormat != format) {
+                            processor.currentFrame = AVOCodec::createBlackFrame(width, height, format);
                             processor.currentWidth = width;
                             processor.currentHeight = height;
+                            processor.currentFormat = format;
                         }
                         
                         std::vector<uint8_t> newFrame;
-                        AVOCodec::applyChanges(processor.currentFrame, changes, 
-                                               newFrame, width, height);
+                        if (!AVOCodec::decodeDiffPayload(packetData, processor.currentFrame,
+                                                         width, height, packet.flags, newFrame)) {
+                            continue;
+                        }
                         processor.currentFrame = newFrame;
                         processor.frameReady = true;
                         processor.framesDecoded++;
@@ -579,6 +799,8 @@ void clientMode() {
                 auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
                     endTime - startTime);
                 processor.processingTimeMs += duration.count();
+                client.recordDecode(packet, std::chrono::duration_cast<std::chrono::microseconds>(
+                    endTime - startTime).count());
             }
         });
     }
@@ -586,12 +808,11 @@ void clientMode() {
     cv::namedWindow("UDP Client .AVO Stream", cv::WINDOW_NORMAL);
     cv::resizeWindow("UDP Client .AVO Stream", 640, 480);
     
-    auto frameCallback = [&processor](const std::vector<uint8_t>& packetData,
-                                     uint32_t width, uint32_t height, bool isFullFrame) {
-        if (packetData.size() == 1 && packetData[0] == 0) {
+    auto frameCallback = [&processor, &client](const FramePacket& packet) {
+        if (packet.data.size() == 1 && packet.data[0] == 0) {
             std::lock_guard<std::mutex> lock(processor.queueMutex);
             if (processor.packetQueue.size() < 50) {
-                processor.packetQueue.emplace(packetData, width, height, isFullFrame);
+                processor.packetQueue.push(packet);
             }
             processor.queueCondVar.notify_one();
             return;
@@ -600,19 +821,20 @@ void clientMode() {
         {
             std::lock_guard<std::mutex> lock(processor.queueMutex);
             if (processor.packetQueue.size() < 50) {
-                processor.packetQueue.emplace(packetData, width, height, isFullFrame);
+                processor.packetQueue.push(packet);
             } else {
                 while (processor.packetQueue.size() >= 40) {
                     processor.packetQueue.pop();
                     processor.queueDropped++;
+                    client.recordDropped();
                 }
-                processor.packetQueue.emplace(packetData, width, height, isFullFrame);
+                processor.packetQueue.push(packet);
             }
         }
         processor.queueCondVar.notify_one();
     };
     
-    if (!client.startUDPReceiver(frameCallback)) {
+    if (!client.startUDPReceiver(std::function<void(const FramePacket&)>(frameCallback))) {
         std::cerr << "Failed to start UDP receiver" << std::endl;
         
         processor.running = false;
@@ -641,6 +863,7 @@ void clientMode() {
     int waitingFrameCount = 0;
     bool wasShowingVideo = false;
     cv::Mat lastGoodFrame = cv::Mat::zeros(480, 640, CV_8UC3);
+    cv::Mat frame;
     
     while (true) {
         auto frameStart = std::chrono::high_resolution_clock::now();
@@ -649,6 +872,7 @@ void clientMode() {
         bool hasFrame = false;
         std::vector<uint8_t> localFrame;
         uint32_t localWidth, localHeight;
+        AVOPixelFormat localFormat = AVO_PIXEL_RGB24;
         
         {
             std::lock_guard<std::mutex> lock(processor.frameMutex);
@@ -657,6 +881,7 @@ void clientMode() {
                 localFrame = processor.currentFrame;
                 localWidth = processor.currentWidth;
                 localHeight = processor.currentHeight;
+                localFormat = processor.currentFormat;
                 processor.frameReady = false;
             }
         }
@@ -665,7 +890,14 @@ void clientMode() {
             wasShowingVideo = true;
             waitingFrameCount = 0;
             
-            cv::Mat frame = rgbVectorToMat(localFrame, localWidth, localHeight);
+            // Кадр в YUV 4:2:0 переводится в RGB только для отображения
+            if (localFormat == AVO_PIXEL_YUV420) {
+                std::vector<uint8_t> rgbFrame;
+                AVOCodec::yuv420ToRGB(localFrame, localWidth, localHeight, rgbFrame);
+                localFrame.swap(rgbFrame);
+            }
+            
+            rgbVectorToMat(localFrame, localWidth, localHeight, frame);
             
             if (frame.empty()) {
                 frame = cv::Mat::zeros(480, 640, CV_8UC3);
@@ -792,9 +1024,139 @@ void clientMode() {
     std::cout << "Average processing time: " 
               << (processor.processingTimeMs / (processor.framesDecoded + 1))
               << " ms/frame" << std::endl;
+    
+    NetworkStream::ClientStats clientStats = client.getClientStats();
+    std::cout << "Latency:" << std::endl;
+    printLatency("reassembly", clientStats.reassembly);
+    printLatency("decode", clientStats.decode);
+    printLatency("end-to-end", clientStats.endToEnd);
+    if (AVOInstrument::compiledIn) {
+        AVOInstrument::report(std::cout);
+    }
     std::cout << "Client stopped." << std::endl;
 }
 
+// Кадры набора из репозитория (1test, 2test): первый кадр из X.avo, затем
+// X_frames/frame_N.avop; записи старого формата читаются с задержкой 33 мс
+bool loadTestSequence(const std::string& name, size_t maxFrames,
+                      std::vector<std::vector<uint8_t>>& frames,
+                      uint32_t& width, uint32_t& height) {
+    AVOHeader header;
+    std::vector<uint8_t> frame;
+    if (getFileSize(name + ".avo") == 0 ||
+        !AVOCodec::decodeFirstFrame(name + ".avo", frame, header)) {
+        return false;
+    }
+    
+    width = header.width;
+    height = header.height;
+    frames.clear();
+    frames.push_back(frame);
+    
+    for (uint32_t number = 2; frames.size() < maxFrames; number++) {
+        std::ifstream file(name + "_frames/frame_" + std::to_string(number) + ".avop",
+                           std::ios::binary);
+        if (!file.is_open()) {
+            break;
+        }
+        std::vector<uint8_t> record((std::istreambuf_iterator<char>(file)),
+                                    std::istreambuf_iterator<char>());
+        std::vector<uint8_t> upgraded;
+        if (AVOCodec::upgradeLegacyFrameDiffRecord(record.data(), record.size(), 33, upgraded)) {
+            record.swap(upgraded);
+        }
+        
+        std::vector<uint8_t> next;
+        uint32_t delayMs;
+        if (!AVOCodec::decodeFrameDiffRecord(record.data(), record.size(), frames.back(), next,
+                                             width, height, delayMs)) {
+            return false;
+        }
+        frames.push_back(std::move(next));
+    }
+    return frames.size() > 1;
+}
+
+// Вход архива, как его собирает режим записи: первый кадр полный, остальные -
+// изменения RLE. expected - кадры, которые из этих изменений восстанавливаются
+std::vector<AVOFrame> makeArchiveInput(const std::vector<std::vector<uint8_t>>& frames,
+                                       uint32_t width, uint32_t height,
+                                       std::vector<std::vector<uint8_t>>& expected) {
+    std::vector<AVOFrame> input(frames.size());
+    expected.assign(1, frames[0]);
+    input[0].data = frames[0];
+    input[0].isFullFrame = true;
+    input[0].delayMs = 33;
+    
+    for (size_t i = 1; i < frames.size(); i++) {
+        std::vector<PixelChange> changes;
+        AVOCodec::compareFrames(expected.back(), frames[i], width, height, changes);
+        input[i].data = AVOCodec::compressRLE(changes);
+        input[i].isFullFrame = false;
+        input[i].delayMs = 33 + static_cast<uint32_t>(i % 3);
+        
+        std::vector<uint8_t> next;
+        AVOCodec::applyChanges(expected.back(), changes, next, width, height);
+        expected.push_back(std::move(next));
+    }
+    return input;
+}
+
+// Кодирование архива (без вывода статистики) и чтение обратно; задержки
+// кадров должны сохраниться
+bool archiveRoundTrip(const std::vector<AVOFrame>& input, uint32_t width, uint32_t height,
+                      const AVOEncoderOptions& options, const std::string& filename,
+                      std::vector<AVOFrame>& decoded) {
+    std::streambuf* coutBuffer = std::cout.rdbuf();
+    std::ostringstream silent;
+    std::cout.rdbuf(silent.rdbuf());
+    bool encoded = AVOCodec::encodeVideoArchive(input, width, height, 30, filename, options);
+    std::cout.rdbuf(coutBuffer);
+    
+    AVOHeader header;
+    if (!encoded || !AVOCodec::decodeVideoArchive(filename, decoded, header) ||
+        decoded.size() != input.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < input.size(); i++) {
+        if (decoded[i].delayMs != input[i].delayMs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Наихудший по кадрам PSNR, дБ (100 - все кадры совпали)
+double minPSNR(const std::vector<std::vector<uint8_t>>& expected, const std::vector<AVOFrame>& decoded) {
+    double worst = 100.0;
+    for (size_t i = 0; i < expected.size() && i < decoded.size(); i++) {
+        if (expected[i].size() != decoded[i].data.size()) {
+            return 0.0;
+        }
+        double squared = 0;
+        for (size_t j = 0; j < expected[i].size(); j++) {
+            double diff = static_cast<double>(expected[i][j]) - decoded[i].data[j];
+            squared += diff * diff;
+        }
+        if (squared > 0) {
+            worst = std::min(worst, 10.0 * std::log10(255.0 * 255.0 * expected[i].size() / squared));
+        }
+    }
+    return worst;
+}
+
+bool sameFrames(const std::vector<AVOFrame>& a, const std::vector<AVOFrame>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].data != b[i].data || a[i].delayMs != b[i].delayMs) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void testCodecMode() {
     std::cout << "\n=== Codec Test ===\n" << std::endl;
     
@@ -840,7 +1202,26 @@ void testCodecMode() {
         std::cout << "   ✗ RLE error!" << std::endl;
     }
     
-    std::cout << "2. Testing black frame creation..." << std::endl;
+    std::cout << "2. Testing buffer API (no files)..." << std::endl;
+    
+    std::vector<uint8_t> diffBuffer(AVOCodec::getMaxFrameDiffSize(width, height));
+    std::vector<uint8_t> restored(testFrame1.size());
+    size_t diffSize = 0;
+    uint32_t restoredDelay = 0;
+    std::vector<uint8_t> expected;
+    AVOCodec::applyChanges(testFrame1, changes, expected, width, height);
+    
+    if (AVOCodec::encodeFrameDiff(testFrame1.data(), testFrame2.data(), width, height, 33,
+                                  diffBuffer.data(), diffBuffer.size(), diffSize) &&
+        AVOCodec::decodeFrameDiff(diffBuffer.data(), diffSize, testFrame1.data(), restored.data(),
+                                  width, height, restoredDelay) &&
+        restored == expected && restoredDelay == 33) {
+        std::cout << "   ✓ Buffer encode/decode works! Record: " << diffSize << " bytes" << std::endl;
+    } else {
+        std::cout << "   ✗ Buffer API error!" << std::endl;
+    }
+    
+    std::cout << "3. Testing black frame creation..." << std::endl;
     std::vector<uint8_t> blackFrame = AVOCodec::createBlackFrame(width, height);
     if (blackFrame.size() == width * height * 3) {
         std::cout << "   ✓ Success! Black frame size: " << blackFrame.size() << " bytes" << std::endl;
@@ -855,6 +1236,429 @@ void testCodecMode() {
     std::cout << "\nSaved test images:" << std::endl;
     std::cout << "  - test_frame1.png (original frame 1)" << std::endl;
     std::cout << "  - test_frame2.png (original frame 2)" << std::endl;
+    
+    // Дальше - круговые проверки на наборах из репозитория
+    std::vector<std::vector<uint8_t>> sequence1;
+    std::vector<std::vector<uint8_t>> sequence2;
+    uint32_t seqWidth = 0, seqHeight = 0, seqWidth2 = 0, seqHeight2 = 0;
+    if (!loadTestSequence("1test", 30, sequence1, seqWidth, seqHeight) ||
+        !loadTestSequence("2test", 30, sequence2, seqWidth2, seqHeight2) ||
+        seqWidth != seqWidth2 || seqHeight != seqHeight2) {
+        std::cout << "\n1test/2test data not found in the current directory, "
+                  << "skipping round-trip tests" << std::endl;
+        return;
+    }
+    std::cout << "\nRound-trip tests on 1test/2test (" << seqWidth << "x" << seqHeight
+              << ", " << sequence1.size() << " + " << sequence2.size() << " frames)" << std::endl;
+    
+    std::vector<std::vector<uint8_t>> expected1;
+    std::vector<AVOFrame> input1 = makeArchiveInput(sequence1, seqWidth, seqHeight, expected1);
+    
+    std::cout << "4. Testing intra-frame key frames..." << std::endl;
+    
+    bool intraOk = true;
+    for (const std::vector<uint8_t>* keyFrame : {&sequence1[0], &sequence2[0]}) {
+        std::vector<uint8_t> intra = AVOCodec::encodeIntraFrame(*keyFrame, seqWidth, seqHeight);
+        std::vector<uint8_t> restoredKey;
+        intraOk = intraOk && intra.size() < keyFrame->size() &&
+                  AVOCodec::decodeIntraFrame(intra, seqWidth, seqHeight, restoredKey) &&
+                  restoredKey == *keyFrame;
+        std::cout << "   Key frame: " << keyFrame->size() << " -> " << intra.size() << " bytes" << std::endl;
+    }
+    
+    // Ключевые кадры архива (первый и каждый 10-й) хранятся без потерь
+    AVOEncoderOptions intraOptions;
+    intraOptions.keyFrameInterval = 10;
+    std::vector<AVOFrame> decoded;
+    AVOHeader archiveHeader;
+    uint32_t archiveFlags;
+    std::vector<AVORecordInfo> records;
+    intraOk = intraOk && archiveRoundTrip(input1, seqWidth, seqHeight, intraOptions, "test_intra.avo", decoded) &&
+              AVOCodec::readArchiveIndex("test_intra.avo", archiveHeader, archiveFlags, records) &&
+              records[0].frameType == AVO_FRAME_INTRA && records[10].frameType == AVO_FRAME_INTRA &&
+              decoded[0].data == expected1[0] && decoded[10].data == expected1[10];
+    
+    if (intraOk) {
+        std::cout << "   ✓ Intra frames are lossless, archive key frames use them" << std::endl;
+    } else {
+        std::cout << "   ✗ Intra frame error!" << std::endl;
+    }
+    
+    std::cout << "5. Testing entropy coding of changes..." << std::endl;
+    
+    std::vector<PixelChange> seqChanges;
+    AVOCodec::compareFrames(sequence1[0], sequence1[1], seqWidth, seqHeight, seqChanges);
+    std::vector<uint8_t> rleChanges = AVOCodec::compressChanges(seqChanges, 0);
+    std::vector<uint8_t> entropyChanges = AVOCodec::compressChanges(seqChanges, AVO_FLAG_ENTROPY);
+    std::vector<PixelChange> entropyDecoded;
+    std::vector<uint8_t> viaRLE, viaEntropy;
+    AVOCodec::applyChanges(sequence1[0], seqChanges, viaRLE, seqWidth, seqHeight);
+    bool entropyOk = entropyChanges.size() < rleChanges.size() &&
+                     AVOCodec::decompressChanges(entropyChanges, AVO_FLAG_ENTROPY,
+                                                 seqWidth * seqHeight, entropyDecoded);
+    if (entropyOk) {
+        AVOCodec::applyChanges(sequence1[0], entropyDecoded, viaEntropy, seqWidth, seqHeight);
+        entropyOk = viaEntropy == viaRLE;
+    }
+    
+    // Энтропийное сжатие без потерь: архив с ним декодируется в те же кадры
+    std::vector<AVOFrame> decodedPlain;
+    std::vector<AVOFrame> decodedEntropy;
+    AVOEncoderOptions entropyOptions;
+    entropyOptions.flags = AVO_FLAG_ENTROPY;
+    entropyOk = entropyOk &&
+                archiveRoundTrip(input1, seqWidth, seqHeight, AVOEncoderOptions(), "test_plain.avo", decodedPlain) &&
+                archiveRoundTrip(input1, seqWidth, seqHeight, entropyOptions, "test_entropy.avo", decodedEntropy) &&
+                sameFrames(decodedPlain, decodedEntropy) &&
+                getFileSize("test_entropy.avo") < getFileSize("test_plain.avo");
+    
+    std::cout << "   Changes: " << rleChanges.size() << " -> " << entropyChanges.size()
+              << " bytes, archive: " << getFileSize("test_plain.avo") << " -> "
+              << getFileSize("test_entropy.avo") << " bytes" << std::endl;
+    if (entropyOk) {
+        std::cout << "   ✓ Entropy coding is lossless and smaller than RLE" << std::endl;
+    } else {
+        std::cout << "   ✗ Entropy coding error!" << std::endl;
+    }
+    
+    std::cout << "6. Testing YUV 4:2:0 frames..." << std::endl;
+    
+    std::vector<uint8_t> yuvFrame;
+    std::vector<AVOFrame> yuvRestored(1);
+    AVOCodec::rgbToYUV420(sequence1[0], seqWidth, seqHeight, yuvFrame);
+    AVOCodec::yuv420ToRGB(yuvFrame, seqWidth, seqHeight, yuvRestored[0].data);
+    double conversionPSNR = minPSNR({sequence1[0]}, yuvRestored);
+    
+    // Архив в YUV: кадры наружу в RGB, данных вдвое меньше, потери - только
+    // от прореживания цвета и порога сравнения
+    std::vector<AVOFrame> decodedYUV;
+    AVOEncoderOptions yuvOptions;
+    yuvOptions.flags = AVO_FLAG_YUV420;
+    bool yuvOk = yuvFrame.size() == AVOCodec::getFrameSize(seqWidth, seqHeight, AVO_PIXEL_YUV420) &&
+                 archiveRoundTrip(input1, seqWidth, seqHeight, yuvOptions, "test_yuv.avo", decodedYUV);
+    double yuvPSNR = yuvOk ? minPSNR(expected1, decodedYUV) : 0.0;
+    yuvOk = yuvOk && conversionPSNR > 30.0 && yuvPSNR > 30.0 &&
+            getFileSize("test_yuv.avo") < getFileSize("test_plain.avo");
+    
+    std::cout << "   Conversion PSNR: " << conversionPSNR << " dB, archive PSNR: " << yuvPSNR
+              << " dB, " << getFileSize("test_plain.avo") << " -> " << getFileSize("test_yuv.avo")
+              << " bytes" << std::endl;
+    if (yuvOk) {
+        std::cout << "   ✓ YUV 4:2:0 archive works!" << std::endl;
+    } else {
+        std::cout << "   ✗ YUV 4:2:0 error!" << std::endl;
+    }
+    
+    std::cout << "7. Testing motion compensation (scrolled frames)..." << std::endl;
+    
+    // Прокрутка первого кадра 2test на 8 строк за кадр (по кругу)
+    std::vector<std::vector<uint8_t>> scrolled;
+    size_t rowBytes = static_cast<size_t>(seqWidth) * 3;
+    for (uint32_t k = 0; k < 10; k++) {
+        std::vector<uint8_t> frame(sequence2[0].size());
+        for (uint32_t y = 0; y < seqHeight; y++) {
+            uint32_t sourceY = (y + k * 8) % seqHeight;
+            memcpy(&frame[y * rowBytes], &sequence2[0][sourceY * rowBytes], rowBytes);
+        }
+        scrolled.push_back(std::move(frame));
+    }
+    std::vector<std::vector<uint8_t>> expectedScroll;
+    std::vector<AVOFrame> inputScroll = makeArchiveInput(scrolled, seqWidth, seqHeight, expectedScroll);
+    
+    std::vector<AVOFrame> decodedScroll;
+    std::vector<AVOFrame> decodedMotion;
+    AVOEncoderOptions motionOptions;
+    motionOptions.flags = AVO_FLAG_MOTION;
+    bool motionOk = archiveRoundTrip(inputScroll, seqWidth, seqHeight, AVOEncoderOptions(),
+                                     "test_scroll.avo", decodedScroll) &&
+                    archiveRoundTrip(inputScroll, seqWidth, seqHeight, motionOptions,
+                                     "test_motion.avo", decodedMotion);
+    double motionPSNR = motionOk ? minPSNR(expectedScroll, decodedMotion) : 0.0;
+    motionOk = motionOk && motionPSNR > 30.0 &&
+               getFileSize("test_motion.avo") * 2 < getFileSize("test_scroll.avo");
+    
+    std::cout << "   Archive: " << getFileSize("test_scroll.avo") << " -> "
+              << getFileSize("test_motion.avo") << " bytes, PSNR: " << motionPSNR << " dB" << std::endl;
+    if (motionOk) {
+        std::cout << "   ✓ Block copies replace scrolled content" << std::endl;
+    } else {
+        std::cout << "   ✗ Motion compensation error!" << std::endl;
+    }
+    
+    std::cout << "8. Testing background reference (uncovered background)..." << std::endl;
+    
+    // Фон - первый кадр 2test, по нему проходит квадрат из 1test и открывает
+    // фон, который был виден в первом кадре
+    std::vector<std::vector<uint8_t>> passing;
+    for (uint32_t k = 0; k < 12; k++) {
+        std::vector<uint8_t> frame = sequence2[0];
+        uint32_t left = 16 + k * 32;
+        for (uint32_t y = 160; y < 320; y++) {
+            memcpy(&frame[y * rowBytes + left * 3], &sequence1[0][y * rowBytes + left * 3], 160 * 3);
+        }
+        passing.push_back(std::move(frame));
+    }
+    std::vector<std::vector<uint8_t>> expectedPassing;
+    std::vector<AVOFrame> inputPassing = makeArchiveInput(passing, seqWidth, seqHeight, expectedPassing);
+    
+    std::vector<AVOFrame> decodedPassing;
+    std::vector<AVOFrame> decodedBackground;
+    AVOEncoderOptions backgroundOptions;
+    backgroundOptions.flags = AVO_FLAG_BACKGROUND;
+    bool backgroundOk = archiveRoundTrip(inputPassing, seqWidth, seqHeight, AVOEncoderOptions(),
+                                         "test_passing.avo", decodedPassing) &&
+                        archiveRoundTrip(inputPassing, seqWidth, seqHeight, backgroundOptions,
+                                         "test_background.avo", decodedBackground);
+    double backgroundPSNR = backgroundOk ? minPSNR(expectedPassing, decodedBackground) : 0.0;
+    backgroundOk = backgroundOk && backgroundPSNR > 30.0 &&
+                   getFileSize("test_background.avo") < getFileSize("test_passing.avo");
+    
+    std::cout << "   Archive: " << getFileSize("test_passing.avo") << " -> "
+              << getFileSize("test_background.avo") << " bytes, PSNR: " << backgroundPSNR << " dB" << std::endl;
+    if (backgroundOk) {
+        std::cout << "   ✓ Uncovered background is copied from the reference" << std::endl;
+    } else {
+        std::cout << "   ✗ Background reference error!" << std::endl;
+    }
+    
+    std::cout << "9. Testing scene change detection..." << std::endl;
+    
+    // 10 кадров 1test, затем 10 кадров 2test - вход только изменениями,
+    // ключевой кадр на смене сцены кодер выбирает сам
+    std::vector<std::vector<uint8_t>> twoScenes(sequence1.begin(), sequence1.begin() + 10);
+    twoScenes.insert(twoScenes.end(), sequence2.begin(), sequence2.begin() + 10);
+    std::vector<std::vector<uint8_t>> expectedScenes;
+    std::vector<AVOFrame> inputScenes = makeArchiveInput(twoScenes, seqWidth, seqHeight, expectedScenes);
+    
+    std::vector<AVOFrame> decodedScenes;
+    bool sceneOk = archiveRoundTrip(inputScenes, seqWidth, seqHeight, AVOEncoderOptions(),
+                                    "test_scenes.avo", decodedScenes) &&
+                   AVOCodec::readArchiveIndex("test_scenes.avo", archiveHeader, archiveFlags, records) &&
+                   records[9].frameType == AVO_FRAME_DIFF &&
+                   records[10].frameType != AVO_FRAME_DIFF &&
+                   records[11].frameType == AVO_FRAME_DIFF &&
+                   decodedScenes[10].data == expectedScenes[10];
+    
+    if (sceneOk) {
+        std::cout << "   ✓ Key frame chosen at the scene change (frame 10, "
+                  << records[10].size << " bytes)" << std::endl;
+    } else {
+        std::cout << "   ✗ Scene change error!" << std::endl;
+    }
+    
+    std::cout << "10. Testing exclusion mask..." << std::endl;
+    
+    // Левая половина кадра исключена: кадры изменений ее не трогают
+    // (ключевые кадры, в том числе на смене сцены, переписывают кадр целиком)
+    AVOEncoderOptions maskOptions;
+    maskOptions.mask.excluded.push_back({0, 0, seqWidth / 2, seqHeight});
+    std::vector<AVOFrame> decodedMasked;
+    bool maskOk = archiveRoundTrip(input1, seqWidth, seqHeight, maskOptions, "test_mask.avo", decodedMasked) &&
+                  AVOCodec::readArchiveIndex("test_mask.avo", archiveHeader, archiveFlags, records) &&
+                  getFileSize("test_mask.avo") < getFileSize("test_plain.avo");
+    
+    size_t changedExcluded = 0;
+    size_t changedAllowed = 0;
+    for (size_t i = 1; maskOk && i < decodedMasked.size(); i++) {
+        if (records[i].frameType != AVO_FRAME_DIFF) {
+            continue;
+        }
+        for (uint32_t y = 0; y < seqHeight; y++) {
+            size_t half = rowBytes / 2;
+            const uint8_t* row = &decodedMasked[i].data[y * rowBytes];
+            const uint8_t* prevRow = &decodedMasked[i - 1].data[y * rowBytes];
+            changedExcluded += memcmp(row, prevRow, half) != 0;
+            changedAllowed += memcmp(row + half, prevRow + half, half) != 0;
+        }
+    }
+    maskOk = maskOk && changedExcluded == 0 && changedAllowed > 0;
+    
+    std::cout << "   Archive: " << getFileSize("test_plain.avo") << " -> " << getFileSize("test_mask.avo")
+              << " bytes, changed rows: " << changedExcluded << " excluded, "
+              << changedAllowed << " allowed" << std::endl;
+    if (maskOk) {
+        std::cout << "   ✓ Diff frames never update the excluded region" << std::endl;
+    } else {
+        std::cout << "   ✗ Mask error!" << std::endl;
+    }
+    
+    std::cout << "11. Testing temporal noise suppression..." << std::endl;
+    
+    // Неподвижный кадр 2test с шумом +-14 (больше порога сравнения)
+    std::vector<std::vector<uint8_t>> noisy;
+    uint32_t noiseSeed = 12345;
+    for (uint32_t k = 0; k < 15; k++) {
+        std::vector<uint8_t> frame = sequence2[0];
+        for (uint8_t& value : frame) {
+            noiseSeed = noiseSeed * 1103515245 + 12345;
+            int noise = static_cast<int>((noiseSeed >> 16) % 29) - 14;
+            value = static_cast<uint8_t>(std::max(0, std::min(255, value + noise)));
+        }
+        noisy.push_back(std::move(frame));
+    }
+    std::vector<std::vector<uint8_t>> expectedNoisy;
+    std::vector<AVOFrame> inputNoisy = makeArchiveInput(noisy, seqWidth, seqHeight, expectedNoisy);
+    std::vector<std::vector<uint8_t>> clean(noisy.size(), sequence2[0]);
+    
+    std::vector<AVOFrame> decodedNoisy;
+    std::vector<AVOFrame> decodedDenoised;
+    AVOEncoderOptions denoiseOptions;
+    denoiseOptions.denoiseEnter = 16;
+    bool denoiseOk = archiveRoundTrip(inputNoisy, seqWidth, seqHeight, AVOEncoderOptions(),
+                                      "test_noisy.avo", decodedNoisy) &&
+                     archiveRoundTrip(inputNoisy, seqWidth, seqHeight, denoiseOptions,
+                                      "test_denoised.avo", decodedDenoised);
+    double noisyPSNR = denoiseOk ? minPSNR(clean, decodedNoisy) : 0.0;
+    double denoisedPSNR = denoiseOk ? minPSNR(clean, decodedDenoised) : 0.0;
+    denoiseOk = denoiseOk && getFileSize("test_denoised.avo") * 2 < getFileSize("test_noisy.avo") &&
+                denoisedPSNR + 1.0 > noisyPSNR;
+    
+    std::cout << "   Archive: " << getFileSize("test_noisy.avo") << " -> " << getFileSize("test_denoised.avo")
+              << " bytes, PSNR to clean frame: " << noisyPSNR << " -> " << denoisedPSNR << " dB" << std::endl;
+    if (denoiseOk) {
+        std::cout << "   ✓ Noise no longer reaches the diff" << std::endl;
+    } else {
+        std::cout << "   ✗ Noise suppression error!" << std::endl;
+    }
+    
+    std::cout << "12. Testing parallel decoding..." << std::endl;
+    
+    // Архив с ключевым кадром каждые 8 кадров - несколько независимых групп
+    std::vector<AVOFrame> decodedGroups;
+    AVOEncoderOptions groupOptions;
+    groupOptions.flags = AVO_FLAG_ENTROPY | AVO_FLAG_BACKGROUND;
+    groupOptions.keyFrameInterval = 8;
+    bool parallelOk = archiveRoundTrip(input1, seqWidth, seqHeight, groupOptions,
+                                       "test_groups.avo", decodedGroups);
+    
+    std::vector<AVOFrame> parallelFrames;
+    bool inOrder = true;
+    parallelOk = parallelOk &&
+                 AVOCodec::decodeVideoArchiveParallel("test_groups.avo", [&](uint32_t index, const AVOFrame& frame) {
+                     inOrder = inOrder && index == parallelFrames.size();
+                     parallelFrames.push_back(frame);
+                     return true;
+                 }, archiveHeader, 4);
+    parallelOk = parallelOk && inOrder && sameFrames(parallelFrames, decodedGroups);
+    
+    // Остановка из sink
+    uint32_t delivered = 0;
+    parallelOk = parallelOk &&
+                 AVOCodec::decodeVideoArchiveParallel("test_groups.avo", [&](uint32_t, const AVOFrame&) {
+                     return ++delivered < 5;
+                 }, archiveHeader, 4) && delivered == 5;
+    
+    if (parallelOk) {
+        std::cout << "   ✓ 4 threads give the same frames in order as serial decoding" << std::endl;
+    } else {
+        std::cout << "   ✗ Parallel decoding error!" << std::endl;
+    }
+    
+    std::cout << "13. Testing random access to archive frames..." << std::endl;
+    
+    // Переходы назад и вперед, затем последовательный проход: кэш на 2 кадра,
+    // остальное - от контрольных точек и ключевых кадров
+    bool randomOk = true;
+    for (const char* archiveFile : {"test_plain.avo", "test_groups.avo"}) {
+        std::vector<AVOFrame> reference;
+        AVOArchive archive(8 * 1024 * 1024, 2);
+        randomOk = randomOk && AVOCodec::decodeVideoArchive(archiveFile, reference, archiveHeader) &&
+                   archive.open(archiveFile) && archive.getFrameCount() == reference.size();
+        
+        for (uint32_t index : {17u, 3u, 29u, 0u, 22u, 22u, 9u, 28u}) {
+            if (!randomOk) {
+                break;
+            }
+            auto frame = archive.getFrame(index);
+            randomOk = frame && *frame == reference[index].data &&
+                       archive.getDelayMs(index) == reference[index].delayMs;
+        }
+        for (uint32_t index = 0; randomOk && index < reference.size(); index++) {
+            auto frame = archive.getFrame(index);
+            randomOk = frame && *frame == reference[index].data;
+        }
+    }
+    
+    if (randomOk) {
+        std::cout << "   ✓ Random and sequential access match full decoding" << std::endl;
+    } else {
+        std::cout << "   ✗ Random access error!" << std::endl;
+    }
+    
+    std::cout << "14. Testing memory-mapped archive reader..." << std::endl;
+    
+    // RGB и YUV архивы, а также файл первого кадра (1test.avo)
+    bool mappedOk = true;
+    for (const char* archiveFile : {"test_groups.avo", "test_yuv.avo", "1test.avo"}) {
+        std::vector<AVOFrame> reference;
+        AVOMappedArchive mapped;
+        mappedOk = mappedOk && AVOCodec::decodeVideoArchive(archiveFile, reference, archiveHeader) &&
+                   mapped.open(archiveFile) && mapped.getFrameCount() == reference.size();
+        
+        for (uint32_t i = 0; mappedOk && i < mapped.getFrameCount(); i++) {
+            AVOPayloadView payload = mapped.getPayload(i);
+            mappedOk = payload.data != nullptr && payload.size == mapped.getRecords()[i].size;
+        }
+        
+        std::vector<AVOFrame> mappedFrames;
+        mappedOk = mappedOk && mapped.decodeAll([&](uint32_t, const AVOFrame& frame) {
+            mappedFrames.push_back(frame);
+            return true;
+        }) && sameFrames(mappedFrames, reference);
+    }
+    
+    if (mappedOk) {
+        std::cout << "   ✓ decodeAll over the mapped file matches full decoding" << std::endl;
+    } else {
+        std::cout << "   ✗ Memory-mapped reader error!" << std::endl;
+    }
+    
+    std::cout << "15. Testing .avopb bundles..." << std::endl;
+    
+    // 1test_frames - записи старого формата (переводятся с задержкой 33 мс),
+    // 2test_frames - текущего; кадры из пакета совпадают с кадрами из файлов
+    bool bundleOk = true;
+    const std::vector<std::vector<uint8_t>>* bundleSequences[] = {&sequence1, &sequence2};
+    const char* bundleNames[] = {"1test", "2test"};
+    for (int n = 0; n < 2; n++) {
+        std::string name = bundleNames[n];
+        std::string bundleFile = "test_" + name + ".avopb";
+        const std::vector<std::vector<uint8_t>>& sequence = *bundleSequences[n];
+        
+        AVOBundleReader bundle;
+        bundleOk = bundleOk && AVOBundleReader::convertDirectory(name + "_frames", bundleFile, 33) &&
+                   bundle.open(bundleFile) && bundle.getEntries().size() >= sequence.size() - 1;
+        
+        std::vector<uint8_t> record;
+        bundleOk = bundleOk && bundle.readRecord(2, record) &&
+                   !AVOCodec::isLegacyFrameDiffRecord(record.data(), record.size());
+        
+        std::vector<uint8_t> bundleFrame = sequence[0];
+        for (uint32_t i = 1; bundleOk && i < sequence.size(); i++) {
+            std::vector<uint8_t> next;
+            uint32_t delayMs = 0;
+            bundleOk = bundle.decodeFrameDiff(i + 1, bundleFrame, next, seqWidth, seqHeight, delayMs) &&
+                       next == sequence[i] && (n != 0 || delayMs == 33);
+            bundleFrame.swap(next);
+        }
+        std::cout << "   " << bundleFile << ": " << bundle.getEntries().size() << " records, "
+                  << getFileSize(bundleFile) << " bytes" << std::endl;
+    }
+    
+    if (bundleOk) {
+        std::cout << "   ✓ Bundles replay the frame directories, legacy records upgraded" << std::endl;
+    } else {
+        std::cout << "   ✗ Bundle error!" << std::endl;
+    }
+    
+    // Архивы и пакеты проверок после теста не нужны (в отличие от картинок)
+    for (const char* file : {"test_intra.avo", "test_plain.avo", "test_entropy.avo", "test_yuv.avo",
+                             "test_scroll.avo", "test_motion.avo", "test_passing.avo",
+                             "test_background.avo", "test_scenes.avo", "test_mask.avo",
+                             "test_noisy.avo", "test_denoised.avo", "test_groups.avo",
+                             "test_1test.avopb", "test_2test.avopb"}) {
+        std::remove(file);
+    }
 }
 
 void cameraTestMode() {
@@ -1044,6 +1848,19 @@ void recordAVOArchiveMode() {
         filename += ".avo";
     }
     
+    char yuvAnswer = 'n';
+    std::cout << "Store frames as YUV 4:2:0 (half size, lossy color)? (y/n): ";
+    std::cin >> yuvAnswer;
+    
+    // Компенсация движения, фон и энтропийное сжатие (флаги в заголовке архива)
+    AVOEncoderOptions archiveOptions;
+    archiveOptions.flags = AVO_FLAG_ENTROPY | AVO_FLAG_MOTION | AVO_FLAG_BACKGROUND;
+    // Ключевой кадр каждые 250 кадров: отрезки между ними кодируются параллельно
+    archiveOptions.keyFrameInterval = 250;
+    if (yuvAnswer == 'y' || yuvAnswer == 'Y') {
+        archiveOptions.flags |= AVO_FLAG_YUV420;
+    }
+    
     cv::VideoCapture cap(cameraIndex);
     
     if (!cap.isOpened()) {
@@ -1119,21 +1936,27 @@ void recordAVOArchiveMode() {
             } else {
                 // Последующие кадры - только изменения
                 std::vector<PixelChange> changes;
-                AVOCodec::compareFrames(prevFrame, currentFrame, width, height, changes);
+                
+                // Сначала быстрая проверка по выборке; полное сравнение - только при движении
+                if (AVOCodec::hasSampledChanges(prevFrame, currentFrame, width, height,
+                                                AVO_PIXEL_RGB24, frameCount)) {
+                    AVOCodec::compareFrames(prevFrame, currentFrame, width, height, changes);
+                }
                 
                 if (changes.empty()) {
                     // Нет изменений - создаем пустой кадр изменений
+                    // (предыдущий кадр не меняем, чтобы мелкие изменения накапливались)
                     avoFrame.data.clear();
                 } else {
                     // Есть изменения - сжимаем их
                     avoFrame.data = AVOCodec::compressRLE(changes);
+                    
+                    // Обновляем предыдущий кадр
+                    prevFrame = currentFrame;
                 }
                 
                 avoFrame.isFullFrame = false;
                 videoFrames.push_back(avoFrame);
-                
-                // Обновляем предыдущий кадр
-                prevFrame = currentFrame;
             }
             
             frameCount++;
@@ -1215,7 +2038,7 @@ void recordAVOArchiveMode() {
                     std::cout << "Total recording time: " << (totalDelayMs / 1000.0) << " sec" << std::endl;
                     
                     // Передаем 0 как FPS, так как используем реальные задержки
-                    if (AVOCodec::encodeVideoArchive(videoFrames, width, height, 0, filename)) {
+                    if (AVOCodec::encodeVideoArchive(videoFrames, width, height, 0, filename, archiveOptions)) {
                         std::cout << "Archive saved successfully!" << std::endl;
                         std::cout << "Video will playback at the same speed it was recorded" << std::endl;
                     } else {
@@ -1242,7 +2065,7 @@ void recordAVOArchiveMode() {
         std::cout << "Total recording time: " << (totalDelayMs / 1000.0) << " sec" << std::endl;
         
         // Передаем 0 как FPS, так как используем реальные задержки
-        if (AVOCodec::encodeVideoArchive(videoFrames, width, height, 0, filename)) {
+        if (AVOCodec::encodeVideoArchive(videoFrames, width, height, 0, filename, archiveOptions)) {
             std::cout << "Archive saved successfully!" << std::endl;
         }
     }
@@ -1279,40 +2102,44 @@ void playAVOArchiveMode() {
         filename += ".avo";
     }
     
-    // Загружаем архив
-    std::vector<AVOFrame> frames;
-    AVOHeader header;
+    // Загружаем архив (кадры восстанавливаются по запросу)
+    AVOArchive archive;
     
-    if (!AVOCodec::decodeVideoArchive(filename, frames, header)) {
+    if (!archive.open(filename)) {
         std::cerr << "Error loading .avo archive: " << filename << std::endl;
         return;
     }
     
+    const AVOHeader& header = archive.getHeader();
+    size_t frameCount = archive.getFrameCount();
+    
     std::cout << "\nVideo Archive information:" << std::endl;
     std::cout << "  Resolution: " << header.width << "x" << header.height << std::endl;
-    std::cout << "  Total frames in archive: " << frames.size() << std::endl;
+    std::cout << "  Total frames in archive: " << frameCount << std::endl;
     std::cout << "  First frame size: " << header.firstFrameSize << " bytes" << std::endl;
+    std::cout << "  Memory used: " << archive.getMemoryUsage() / 1024 << " KB" << std::endl;
     
     // Рассчитываем общее время и средний FPS
     double totalDelayMs = 0;
-    for (const auto& frame : frames) {
-        totalDelayMs += frame.delayMs;
+    for (uint32_t i = 0; i < frameCount; i++) {
+        totalDelayMs += archive.getDelayMs(i);
     }
     
     double totalTimeSec = totalDelayMs / 1000.0;
-    double avgFps = (frames.size() * 1000.0) / (totalDelayMs > 0 ? totalDelayMs : 1);
+    double avgFps = (frameCount * 1000.0) / (totalDelayMs > 0 ? totalDelayMs : 1);
     
     std::cout << "  Total time: " << std::fixed << std::setprecision(1) << totalTimeSec << " sec" << std::endl;
     std::cout << "  Average FPS: " << std::fixed << std::setprecision(1) << avgFps << std::endl;
     
-    std::cout << "\nPress any key to start playback, ESC to exit\n" << std::endl;
+    std::cout << "\nPress any key to start playback, ESC to exit, A/D - seek -/+ 5 sec\n" << std::endl;
     
     cv::namedWindow("AVO Archive Player", cv::WINDOW_NORMAL);
     cv::resizeWindow("AVO Archive Player", header.width, header.height);
     
     // Показываем первый кадр
-    if (!frames.empty()) {
-        cv::Mat firstFrameMat = rgbVectorToMat(frames[0].data, header.width, header.height);
+    auto firstFrame = archive.getFrame(0);
+    if (firstFrame) {
+        cv::Mat firstFrameMat = rgbVectorToMat(*firstFrame, header.width, header.height);
         cv::putText(firstFrameMat, "Press any key to play", 
                    cv::Point(header.width/2 - 100, header.height/2),
                    cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar(0, 255, 255), 2);
@@ -1325,8 +2152,13 @@ void playAVOArchiveMode() {
     auto nextFrameTime = playbackStartTime;
     int displayedFrames = 0;
     
-    for (size_t i = 0; i < frames.size(); i++) {
-        const AVOFrame& frame = frames[i];
+    for (size_t i = 0; i < frameCount; i++) {
+        auto frameData = archive.getFrame(static_cast<uint32_t>(i));
+        if (!frameData) {
+            std::cerr << "Cannot decode frame " << i << std::endl;
+            break;
+        }
+        uint32_t frameDelayMs = archive.getDelayMs(static_cast<uint32_t>(i));
         
         // Ждем до времени отображения этого кадра
         std::this_thread::sleep_until(nextFrameTime);
@@ -1335,11 +2167,11 @@ void playAVOArchiveMode() {
         auto frameDisplayStart = std::chrono::steady_clock::now();
         
         // Отображение
-        cv::Mat displayFrame = rgbVectorToMat(frame.data, header.width, header.height);
+        cv::Mat displayFrame = rgbVectorToMat(*frameData, header.width, header.height);
         displayedFrames++;
         
         // Информация на кадре
-        cv::putText(displayFrame, "Frame: " + std::to_string(displayedFrames) + "/" + std::to_string(frames.size()), 
+        cv::putText(displayFrame, "Frame: " + std::to_string(i + 1) + "/" + std::to_string(frameCount), 
                    cv::Point(10, 30), cv::FONT_HERSHEY_SIMPLEX, 0.6, 
                    cv::Scalar(0, 255, 255), 2);
         
@@ -1363,10 +2195,10 @@ void playAVOArchiveMode() {
         // Рассчитываем время для следующего кадра
         // nextFrameTime = текущее время начала + задержка этого кадра
         // Но вычитаем время, которое уже потратили на отображение
-        int adjustedDelay = frame.delayMs - displayDuration;
+        int adjustedDelay = frameDelayMs - displayDuration;
         if (adjustedDelay < 1) adjustedDelay = 1; // Минимум 1мс
         
-        nextFrameTime = frameDisplayStart + std::chrono::milliseconds(frame.delayMs);
+        nextFrameTime = frameDisplayStart + std::chrono::milliseconds(frameDelayMs);
         
         // Обработка клавиш с минимальной задержкой
         int key = cv::waitKey(1);
@@ -1379,6 +2211,16 @@ void playAVOArchiveMode() {
             // После паузы корректируем nextFrameTime
             auto pauseEndTime = std::chrono::steady_clock::now();
             nextFrameTime = pauseEndTime;
+        } else if (key == 'a' || key == 'A' || key == 'd' || key == 'D') {
+            // Перемотка на 5 секунд по задержкам кадров
+            bool forward = (key == 'd' || key == 'D');
+            uint32_t skippedMs = 0;
+            while (skippedMs < 5000 && (forward ? i + 1 < frameCount : i > 0)) {
+                i = forward ? i + 1 : i - 1;
+                skippedMs += archive.getDelayMs(static_cast<uint32_t>(i));
+            }
+            i--;    // цикл увеличит номер кадра
+            nextFrameTime = std::chrono::steady_clock::now();
         }
         
         // Статистика каждые 15 кадров
@@ -1388,9 +2230,9 @@ void playAVOArchiveMode() {
                 now - playbackStartTime).count();
             
             double currentFps = (displayedFrames * 1000.0) / (elapsedTotal > 0 ? elapsedTotal : 1);
-            double expectedTime = (totalDelayMs * displayedFrames) / frames.size();
+            double expectedTime = (totalDelayMs * displayedFrames) / frameCount;
             
-            std::cout << "Frame " << displayedFrames << "/" << frames.size() 
+            std::cout << "Frame " << displayedFrames << "/" << frameCount 
                      << " | Real FPS: " << std::fixed << std::setprecision(1) << currentFps
                      << " | Time: " << (elapsedTotal/1000.0) << "s"
                      << " | Expected: " << (expectedTime/1000.0) << "s"
@@ -1426,6 +2268,49 @@ void playAVOArchiveMode() {
     std::cout << "Playback finished." << std::endl;
 }
 
+void convertFramesMode() {
+    std::cout << "\n=== Pack .avop Frames into Bundle ===\n" << std::endl;
+    
+    std::string directory;
+    std::cout << "Enter frames directory (e.g. 1test_frames): ";
+    std::cin >> directory;
+    
+    while (!directory.empty() && directory.back() == '/') {
+        directory.pop_back();
+    }
+    std::string bundleFile = directory + ".avopb";
+    
+    // Старые записи (как в 1test_frames) не хранят задержку - берем ее из
+    // частоты архива рядом (1test.avo), если он есть
+    uint32_t legacyDelayMs = 33;
+    const std::string suffix = "_frames";
+    if (directory.size() > suffix.size() &&
+        directory.compare(directory.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        AVOHeader header;
+        std::vector<uint8_t> firstFrame;
+        std::string archiveFile = directory.substr(0, directory.size() - suffix.size()) + ".avo";
+        if (getFileSize(archiveFile) > 0 &&
+            AVOCodec::decodeFirstFrame(archiveFile, firstFrame, header) && header.fps > 0) {
+            legacyDelayMs = 1000 / header.fps;
+        }
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    if (!AVOBundleReader::convertDirectory(directory, bundleFile, legacyDelayMs)) {
+        std::cerr << "Error converting directory: " << directory << std::endl;
+        return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    
+    AVOBundleReader bundle;
+    if (!bundle.open(bundleFile)) {
+        return;
+    }
+    std::cout << "Packed " << bundle.getEntries().size() << " frames into " << bundleFile
+              << " in " << elapsed << " ms" << std::endl;
+}
+
 // В функции main() добавьте:
 int main() {
     disableAllLogs();
@@ -1442,9 +2327,17 @@ int main() {
     std::cout << "4. Camera test (extended diagnostics)" << std::endl;
     std::cout << "5. Record video to .avo archive (single file)" << std::endl;  // НОВЫЙ
     std::cout << "6. Play .avo video archive" << std::endl;  // НОВЫЙ
+    std::cout << "7. Pack .avop frames directory into bundle" << std::endl;
+    
+    // Трассировка по кадрам: AVO_TRACE=файл.json (Chrome trace / Perfetto)
+    const char* traceFile = std::getenv("AVO_TRACE");
+    if (traceFile && *traceFile) {
+        AVOTrace::start();
+        std::cout << "Frame tracing enabled: " << traceFile << std::endl;
+    }
     
     int mode = 0;
-    std::cout << "\nSelect mode (1-6): ";
+    std::cout << "\nSelect mode (1-7): ";
     std::cin >> mode;
     
     try {
@@ -1467,6 +2360,9 @@ int main() {
             case 6:
                 playAVOArchiveMode();  // НОВЫЙ
                 break;
+            case 7:
+                convertFramesMode();
+                break;
             default:
                 std::cout << "Invalid mode selection!" << std::endl;
                 break;
@@ -1474,9 +2370,19 @@ int main() {
     }
     catch (const std::exception& e) {
         std::cerr << "\nError: " << e.what() << std::endl;
+        if (AVOTrace::isEnabled()) {
+            AVOTrace::writeChromeTrace(traceFile);
+        }
         return 1;
     }
     
+    if (AVOTrace::isEnabled()) {
+        AVOTrace::stop();
+        if (AVOTrace::writeChromeTrace(traceFile)) {
+            std::cout << "Trace saved: " << traceFile << std::endl;
+        }
+    }
+    
     std::cout << "\nProgram finished." << std::endl;
     return 0;
 }
\ No newline at end of file